@@ -0,0 +1,265 @@
+#!/usr/bin/env python
+
+"""Merges the stats outputs of a set of assemblies (the directories made by pipeline.py)
+into one table, with a row per assembly and a column per metric.
+
+For each assembly the columns are named file.attribute for the attributes of the root element
+of each XML file, file.element.attribute for nested elements (file.element[i].attribute for
+the second and later elements with the same name) and coveragePlots.file.category.bin for
+the coverage plots. If a stats binary wrote a metrics row (a file.xml.row file, see
+--metricsRowFile) its metrics are added to those of the XML, replacing the attributes of the
+same name, as the row holds metrics the XML does not but not the nested elements of the XML.
+
+The table is written as CSV, or in a binary columnar format (see writeBinaryTable).
+"""
+
+import os
+import re
+import sys
+import csv
+import struct
+import numbers
+import xml.etree.ElementTree as ET
+from optparse import OptionParser
+
+binaryTableMagic = "ASMTAB01"
+coveragePlotMagic = "ASMCOV01"
+
+def getValue(value):
+    """Converts numeric strings to numbers.
+    """
+    try:
+        return int(value)
+    except ValueError:
+        try:
+            return float(value)
+        except ValueError:
+            return value
+
+class XmlAttributeCollector:
+    """Parser target collecting the attributes of every element, without building a tree.
+    """
+    def __init__(self, prefix, row):
+        self.prefix = prefix
+        self.row = row
+        self.path = [] #Names of the open elements, below the root.
+        self.counts = [ {} ] #For each open element, the number of each of its child elements.
+        self.depth = 0
+
+    def isRootElement(self):
+        #The depth 0 element is the fake root, the first depth 1 element is the file's root element.
+        return self.depth == 1 and len(self.counts[-1]) == 0
+
+    def start(self, tag, attrib):
+        if self.depth >= 1:
+            if self.isRootElement():
+                self.path.append(None)
+            else:
+                count = self.counts[-1].get(tag, 0)
+                self.counts[-1][tag] = count + 1
+                if count > 0:
+                    tag = "%s[%i]" % (tag, count)
+                self.path.append(tag)
+            if self.depth == 1:
+                self.counts[-1][None] = 1
+            name = ".".join([ self.prefix ] + [ i for i in self.path if i != None ])
+            for attribute, value in attrib.items():
+                self.row["%s.%s" % (name, attribute)] = getValue(value)
+        self.counts.append({})
+        self.depth += 1
+
+    def end(self, tag):
+        self.depth -= 1
+        self.counts.pop()
+        if self.depth >= 1:
+            self.path.pop()
+
+    def data(self, data):
+        pass
+
+    def close(self):
+        pass
+
+#The XML declaration at the start of a file, which can not follow the fake root element.
+xmlDeclaration = re.compile(r"^\s*<\?xml[^>]*\?>")
+
+def addXmlFile(xmlFile, prefix, row):
+    """Streams the attributes of an XML file into the row. Some of the stats files have more
+    than one root element, so the file is parsed inside a fake root element.
+    """
+    parser = ET.XMLParser(target=XmlAttributeCollector(prefix, row))
+    parser.feed("<files>")
+    fileHandle = open(xmlFile, 'r')
+    first = True
+    while True:
+        data = fileHandle.read(1 << 20)
+        if not data:
+            break
+        if first:
+            data = xmlDeclaration.sub("", data)
+            first = False
+        parser.feed(data)
+    fileHandle.close()
+    parser.feed("</files>")
+    parser.close()
+
+def addMetricsRowFile(rowFile, prefix, row):
+    """Adds the metrics of a two line CSV file written by a stats binary.
+    """
+    fileHandle = open(rowFile, 'r')
+    lines = list(csv.reader(fileHandle))
+    fileHandle.close()
+    if len(lines) != 2 or len(lines[0]) != len(lines[1]):
+        raise RuntimeError("Malformed metrics row file: %s" % rowFile)
+    for name, value in zip(lines[0], lines[1]):
+        row["%s.%s" % (prefix, name)] = getValue(value)
+
+def addCoveragePlotFile(plotFile, prefix, row):
+    """Adds the cumulative lengths of a coverage plot file (a line of bins, then a line per category).
+    """
+    fileHandle = open(plotFile, 'r')
+    bins = None
+    for line in fileHandle:
+        tokens = line.split()
+        if len(tokens) == 0:
+            continue
+        if bins == None:
+            bins = tokens[1:]
+            continue
+        for bin, value in zip(bins, tokens[1:]):
+            row["%s.%s.%s" % (prefix, tokens[0], bin)] = getValue(value)
+    fileHandle.close()
+
+def addBinaryCoveragePlotFile(plotFile, prefix, row):
+    """As addCoveragePlotFile, for a plot written with --coveragePlotFormat binary (in native byte
+    order, see coveragePlots.c).
+    """
+    fileHandle = open(plotFile, 'rb')
+    if fileHandle.read(8) != coveragePlotMagic:
+        raise RuntimeError("Malformed coverage plot file: %s" % plotFile)
+    categoryNumber, binNumber, standardErrors = struct.unpack("=qqq", fileHandle.read(24))
+    categoryNames = []
+    for i in range(categoryNumber):
+        nameLength = struct.unpack("=q", fileHandle.read(8))[0]
+        categoryNames.append(fileHandle.read((nameLength + 7) / 8 * 8)[:nameLength])
+    bins = struct.unpack("=%iq" % binNumber, fileHandle.read(8 * binNumber))
+    for categoryName in categoryNames:
+        values = struct.unpack("=%i%s" % (binNumber, "d" if standardErrors else "q"), fileHandle.read(8 * binNumber))
+        for bin, value in zip(bins, values):
+            row["%s.%s.%s" % (prefix, categoryName, bin)] = value
+    fileHandle.close()
+
+def getAssemblyRow(assemblyDir):
+    """Gets the metrics of an assembly.
+    """
+    row = {}
+    for fileName in sorted(os.listdir(assemblyDir)):
+        if fileName[-4:] == ".xml":
+            prefix = fileName[:-4]
+            addXmlFile(os.path.join(assemblyDir, fileName), prefix, row)
+            rowFile = os.path.join(assemblyDir, fileName + ".row")
+            if os.path.exists(rowFile):
+                addMetricsRowFile(rowFile, prefix, row)
+    coveragePlotsDir = os.path.join(assemblyDir, "coveragePlots")
+    if os.path.exists(coveragePlotsDir + ".row"):
+        addMetricsRowFile(coveragePlotsDir + ".row", "coveragePlots", row)
+    if os.path.isdir(coveragePlotsDir):
+        for fileName in sorted(os.listdir(coveragePlotsDir)):
+            if fileName[-4:] == ".txt":
+                addCoveragePlotFile(os.path.join(coveragePlotsDir, fileName), "coveragePlots.%s" % fileName[:-4], row)
+            elif fileName[-4:] == ".bin":
+                addBinaryCoveragePlotFile(os.path.join(coveragePlotsDir, fileName), "coveragePlots.%s" % fileName[:-4], row)
+    return row
+
+def getColumns(rows):
+    """The union of the metrics of the rows, in the order they are first seen.
+    """
+    columns = []
+    seen = set()
+    for assembly, row in rows:
+        for column in sorted(row.keys()):
+            if column not in seen:
+                seen.add(column)
+                columns.append(column)
+    return columns
+
+def writeCsvTable(rows, columns, outputFile):
+    fileHandle = open(outputFile, 'w')
+    writer = csv.writer(fileHandle)
+    writer.writerow([ "assembly" ] + columns)
+    for assembly, row in rows:
+        writer.writerow([ assembly ] + [ row.get(column, "") for column in columns ])
+    fileHandle.close()
+
+def writeBinaryTable(rows, columns, outputFile):
+    """Writes the table column by column, all integers little endian int64s:
+    magic (8 bytes), row number, column number, then for the assembly names and then each column:
+    name length, name, type (0 = float64 values, NaN if missing, 1 = strings), then the values,
+    strings as a length (-1 if missing) followed by the string.
+    """
+    fileHandle = open(outputFile, 'wb')
+    fileHandle.write(binaryTableMagic.encode())
+    fileHandle.write(struct.pack("<qq", len(rows), len(columns)))
+    def writeColumn(name, values):
+        fileHandle.write(struct.pack("<q", len(name)) + name.encode())
+        if all([ value == None or isinstance(value, numbers.Number) for value in values ]):
+            fileHandle.write(struct.pack("<q", 0))
+            fileHandle.write(struct.pack("<%id" % len(values), *[ float("nan") if value == None else float(value) for value in values ]))
+        else:
+            fileHandle.write(struct.pack("<q", 1))
+            for value in values:
+                if value == None:
+                    fileHandle.write(struct.pack("<q", -1))
+                else:
+                    value = str(value).encode()
+                    fileHandle.write(struct.pack("<q", len(value)) + value)
+    writeColumn("assembly", [ assembly for assembly, row in rows ])
+    for column in columns:
+        writeColumn(column, [ row.get(column) for assembly, row in rows ])
+    fileHandle.close()
+
+def readBinaryTable(inputFile):
+    """Reads a table written by writeBinaryTable, returning a list of (column name, values) pairs.
+    """
+    fileHandle = open(inputFile, 'rb')
+    if fileHandle.read(8) != binaryTableMagic.encode():
+        raise RuntimeError("Not a binary stats table: %s" % inputFile)
+    rowNumber, columnNumber = struct.unpack("<qq", fileHandle.read(16))
+    def readInt():
+        return struct.unpack("<q", fileHandle.read(8))[0]
+    table = []
+    for i in range(columnNumber + 1):
+        name = fileHandle.read(readInt()).decode()
+        if readInt() == 0:
+            values = list(struct.unpack("<%id" % rowNumber, fileHandle.read(8 * rowNumber)))
+        else:
+            values = []
+            for j in range(rowNumber):
+                length = readInt()
+                values.append(None if length == -1 else fileHandle.read(length).decode())
+        table.append((name, values))
+    fileHandle.close()
+    return table
+
+def main():
+    parser = OptionParser(usage="usage: %prog [options] assemblyDir(s)")
+    parser.add_option("--outputDir", dest="outputDir", default=None,
+                      help="Use every directory in this directory (the output directory of pipeline.py) as an assembly")
+    parser.add_option("--outputFile", dest="outputFile", help="The file to write the table to")
+    parser.add_option("--binary", dest="binary", action="store_true", default=False,
+                      help="Write the table in the binary columnar format instead of CSV")
+    options, args = parser.parse_args()
+    if options.outputFile == None:
+        raise RuntimeError("The output file was not specified")
+    assemblyDirs = args
+    if options.outputDir != None:
+        assemblyDirs += [ os.path.join(options.outputDir, i) for i in sorted(os.listdir(options.outputDir)) if os.path.isdir(os.path.join(options.outputDir, i)) ]
+    rows = [ (os.path.split(os.path.normpath(assemblyDir))[1], getAssemblyRow(assemblyDir)) for assemblyDir in assemblyDirs ]
+    columns = getColumns(rows)
+    if options.binary:
+        writeBinaryTable(rows, columns, options.outputFile)
+    else:
+        writeCsvTable(rows, columns, options.outputFile)
+
+if __name__ == '__main__':
+    main()
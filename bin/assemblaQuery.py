@@ -0,0 +1,74 @@
+#!/usr/bin/env python
+
+"""Asks an assemblaDaemon, which keeps a cactus disk loaded, for the path, substitution or copy
+number stats, writing the XML of each assembly as the script of the metric would.
+
+The metric (pathStats, substitutionStats, copyNumberStats, or shutdown to stop the daemon) is
+followed by any of the options of the script it is to be run with, such as --minimumIdentity,
+--assemblyEventString or --region, which replace the options the daemon was started with for
+this request only. For example:
+
+assemblaQuery.py --socket daemon.sock --outputFile snps.xml substitutionStats --minimumIdentity 90
+"""
+
+import sys
+import socket
+from optparse import OptionParser
+
+def getAssemblyFileName(fileName, assemblyEventString, assemblyNumber):
+    """As getAssemblyFileName of the scripts.
+    """
+    if assemblyNumber == 1:
+        return fileName
+    return "%s.%s" % (fileName, assemblyEventString)
+
+def query(socketPath, request):
+    """Sends the request, returning the list of (assemblyEventString, XML) results.
+    """
+    connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    connection.connect(socketPath)
+    connection.sendall(request + "\n")
+    reply = connection.makefile("rb")
+    results = []
+    while True:
+        line = reply.readline()
+        if line == "":
+            raise RuntimeError("The daemon closed the connection before the end of the reply")
+        tokens = line.rstrip("\n").split("\t")
+        if tokens[0] == "end":
+            break
+        if tokens[0] == "error":
+            raise RuntimeError("The daemon refused the request: %s" % "\t".join(tokens[1:]))
+        if tokens[0] != "result" or len(tokens) != 3:
+            raise RuntimeError("Unexpected reply from the daemon: %s" % line)
+        results.append((tokens[1], reply.read(int(tokens[2]))))
+    reply.close()
+    connection.close()
+    return results
+
+def main():
+    parser = OptionParser(usage="usage: %prog [options] metric [metric options]", description=__doc__)
+    parser.add_option("--socket", dest="socket", help="The socket the daemon is serving on")
+    parser.add_option("--outputFile", dest="outputFile",
+                      help="The file to write the XML in, with the assembly appended if there are several")
+    #The options after the metric are those of the request.
+    parser.disable_interspersed_args()
+    options, args = parser.parse_args()
+    if len(args) == 0:
+        parser.error("Expected a metric")
+    if options.socket is None:
+        parser.error("The socket must be given")
+    if args[0] != "shutdown" and options.outputFile is None:
+        parser.error("The output file must be given")
+    for arg in args:
+        if len(arg.split()) != 1:
+            parser.error("The request can not contain whitespace: %s" % arg)
+
+    results = query(options.socket, " ".join(args))
+    for assemblyEventString, xml in results:
+        fileHandle = open(getAssemblyFileName(options.outputFile, assemblyEventString, len(results)), "w")
+        fileHandle.write(xml)
+        fileHandle.close()
+
+if __name__ == '__main__':
+    main()
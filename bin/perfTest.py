@@ -0,0 +1,227 @@
+#!/usr/bin/env python
+
+"""Runs each of the stats binaries (the programs of src/Makefile) on a small cactus disk and
+checks their outputs against the recorded digests and their wall time and peak resident memory
+against the timings, failing if an output has changed, a binary has become slower or larger by
+more than the tolerance, or a binary has no digest or timings.
+
+Each binary is run --repeats times, the fastest wall time being taken, on a fresh copy of the
+cactus disk each time, so the contig path table and region index files the binaries cache in
+the cactus disk directory are rebuilt by every run and all the runs do the same work.
+
+The digests are a tab separated file, kept in the repository, with a line per binary: the name
+and a SHA1 digest of the outputs. Rewrite it with --updateDigests when an output is meant to change.
+
+The timings are a tab separated file with a line per binary: the name, the wall time in seconds
+and the peak resident memory in kilobytes. The reference timings, measured on the machine named
+in their header, are kept in the repository; as timings only hold for the machine they were
+measured on, tests/perf/Makefile uses timings written on the machine with --updateTimings in
+their place when there are any.
+"""
+
+import os
+import re
+import sys
+import time
+import shlex
+import shutil
+import hashlib
+import subprocess
+from optparse import OptionParser
+
+def getRootPathString():
+    return os.path.split(os.path.split(os.path.abspath(__file__))[0])[0]
+
+#Programs that serve requests until stopped, so are not timed.
+daemonPrograms = set([ "assemblaDaemon" ])
+
+def getPrograms():
+    """The programs listed in src/Makefile, so the test follows the binaries that are built.
+    """
+    for line in open(os.path.join(getRootPathString(), "src", "Makefile")):
+        match = re.match(r"^programs\s*=\s*(.*)$", line)
+        if match:
+            return [ program for program in match.group(1).split() if program not in daemonPrograms ]
+    raise RuntimeError("Could not find the programs in src/Makefile")
+
+def getCactusDiskString(cactusDisk):
+    return "<st_kv_database_conf type=\"tokyo_cabinet\"><tokyo_cabinet database_dir=\"%s\"/></st_kv_database_conf>" % cactusDisk
+
+def getFirstMafSequence(mafFile):
+    """The name of the first sequence of a MAF, to query it with mafRegionQuery.
+    """
+    for line in open(mafFile):
+        if line.startswith("s "):
+            return line.split()[1]
+    raise RuntimeError("The MAF %s has no sequences" % mafFile)
+
+def getDigest(outputFiles):
+    """SHA1 of the names and contents of the output files, or of the files in them if they are
+    directories, ignoring any that do not exist.
+    """
+    digest = hashlib.sha1()
+    for outputFile in outputFiles:
+        fileNames = []
+        if os.path.isdir(outputFile):
+            for dirPath, dirNames, dirFileNames in os.walk(outputFile):
+                dirNames.sort()
+                fileNames += [ os.path.join(dirPath, i) for i in sorted(dirFileNames) ]
+        elif os.path.exists(outputFile):
+            fileNames.append(outputFile)
+        for fileName in fileNames:
+            digest.update("%s\n" % os.path.relpath(fileName, os.path.split(outputFile)[0]))
+            digest.update(open(fileName, 'rb').read())
+    return digest.hexdigest()
+
+def runTimed(command):
+    """Runs the command, returning its wall time in seconds and peak resident memory in kilobytes.
+    """
+    startTime = time.time()
+    #Not run through a shell, so the resource usage is that of the binary.
+    process = subprocess.Popen(shlex.split(command))
+    pid, status, resourceUsage = os.wait4(process.pid, 0)
+    wallTime = time.time() - startTime
+    if status != 0:
+        raise RuntimeError("The command failed with status %i: %s" % (status, command))
+    return wallTime, resourceUsage.ru_maxrss
+
+digestsHeader = """#The SHA1 digests of the outputs of the stats binaries on the perf fixture (see bin/perfTest.py),
+#a line per binary: the name and the digest. Rewrite with make perfDigests when an output is meant to change.
+"""
+
+def readTable(fileName, columnNumber):
+    """The lines of a digests or timings file, by the program name, skipping the comments.
+    """
+    table = {}
+    for line in open(fileName):
+        tokens = line.split()
+        if len(tokens) == columnNumber and not line.startswith("#"):
+            table[tokens[0]] = tokens[1:]
+    return table
+
+class PerfTest:
+    def __init__(self, options):
+        self.options = options
+        self.binPath = os.path.join(getRootPathString(), "bin")
+
+    def getCommand(self, program, cactusDisk, outputFile):
+        """The command line of the program, and the files it writes.
+        """
+        binary = os.path.join(self.binPath, program)
+        if program == "mafRegionQuery":
+            #Queries the annotated MAF written by pathAnnotatedMafGenerator.
+            mafFile = os.path.join(self.options.outputDir, "pathAnnotatedMafGenerator", "output")
+            return "%s --maf %s --region %s --outputFile %s" % (binary, mafFile, getFirstMafSequence(mafFile),
+                                                                outputFile), [ outputFile ]
+        specialOptions = { "pathAnnotatedMafGenerator":"--writeMafIndex",
+                           "linkageStats":"--bucketNumber 2000 --sampleNumber 100000" }.get(program, "")
+        return "%s --cactusDisk '%s' --outputFile %s --metricsRowFile %s.row --assemblyEventString %s \
+--haplotype1EventString %s --haplotype2EventString %s --contaminationEventString %s --minimumNsForScaffoldGap %s %s" % (
+            binary, getCactusDiskString(cactusDisk), outputFile, outputFile, self.options.assemblyEventString,
+            self.options.haplotype1EventString, self.options.haplotype2EventString,
+            self.options.contaminationEventString, self.options.minimumNsForScaffoldGap,
+            specialOptions), [ outputFile, outputFile + ".row", outputFile + ".idx" ]
+
+    def runProgram(self, program):
+        """Returns the fastest wall time, the largest peak resident memory and the digest of the
+        outputs of the repeated runs of the program.
+        """
+        programDir = os.path.join(self.options.outputDir, program)
+        wallTimes, peakMemories = [], []
+        for i in xrange(self.options.repeats):
+            if os.path.exists(programDir):
+                shutil.rmtree(programDir)
+            os.makedirs(programDir)
+            cactusDisk = os.path.join(programDir, "cactusDisk")
+            shutil.copytree(self.options.cactusDisk, cactusDisk)
+            command, outputFiles = self.getCommand(program, cactusDisk, os.path.join(programDir, "output"))
+            wallTime, peakMemory = runTimed(command)
+            wallTimes.append(wallTime)
+            peakMemories.append(peakMemory)
+            digest = getDigest(outputFiles)
+            shutil.rmtree(cactusDisk)
+        return min(wallTimes), max(peakMemories), digest
+
+    def run(self):
+        if not self.options.updateDigests and not os.path.exists(self.options.digests):
+            raise RuntimeError("There are no digests %s, write them with --updateDigests" % self.options.digests)
+        if not self.options.updateTimings and not os.path.exists(self.options.timings):
+            raise RuntimeError("There are no timings %s, write them with --updateTimings" % self.options.timings)
+        results = [ (program,) + self.runProgram(program) for program in getPrograms() ]
+        if self.options.updateDigests or self.options.updateTimings:
+            if self.options.updateDigests:
+                fileHandle = open(self.options.digests, 'w')
+                fileHandle.write(digestsHeader)
+                for program, wallTime, peakMemory, digest in results:
+                    fileHandle.write("%s\t%s\n" % (program, digest))
+                fileHandle.close()
+                sys.stdout.write("Wrote the digests %s\n" % self.options.digests)
+            if self.options.updateTimings:
+                fileHandle = open(self.options.timings, 'w')
+                fileHandle.write("#The wall times and peak memories of the stats binaries on the perf fixture, measured on %s.\n" % (
+                                 " ".join(os.uname())))
+                for program, wallTime, peakMemory, digest in results:
+                    fileHandle.write("%s\t%f\t%i\n" % (program, wallTime, peakMemory))
+                fileHandle.close()
+                sys.stdout.write("Wrote the timings %s\n" % self.options.timings)
+            return 0
+        digests = readTable(self.options.digests, 2)
+        timings = readTable(self.options.timings, 3)
+        failures = 0
+        sys.stdout.write("program\twallTime\tbaselineWallTime\tpeakMemory\tbaselinePeakMemory\toutputs\n")
+        for program, wallTime, peakMemory, digest in results:
+            problems = []
+            baselineWallTime, baselinePeakMemory = "-", "-"
+            if program in timings:
+                baselineWallTime, baselinePeakMemory = timings[program]
+                #The absolute slack keeps the timing noise of short runs from failing the test.
+                if wallTime > float(baselineWallTime) * (1.0 + self.options.timeTolerance) + self.options.timeSlack:
+                    problems.append("slower")
+                if peakMemory > int(baselinePeakMemory) * (1.0 + self.options.memoryTolerance):
+                    problems.append("larger")
+            else:
+                problems.append("not in the timings")
+            if program not in digests:
+                problems.append("no recorded digest")
+            elif digest != digests[program][0]:
+                problems.append("outputs changed")
+            sys.stdout.write("%s\t%f\t%s\t%i\t%s\t%s\n" % (program, wallTime, baselineWallTime, peakMemory,
+                                                            baselinePeakMemory, ", ".join(problems) if problems else "ok"))
+            if problems:
+                failures += 1
+        return 1 if failures > 0 else 0
+
+def main():
+    parser = OptionParser(usage="usage: %prog [options]", description=__doc__)
+    parser.add_option("--cactusDisk", dest="cactusDisk", help="The directory of the cactus disk to run the binaries on")
+    parser.add_option("--digests", dest="digests", help="The file of the digests of the outputs")
+    parser.add_option("--timings", dest="timings", help="The file of the wall times and peak memories")
+    parser.add_option("--outputDir", dest="outputDir", help="The directory to run the binaries in")
+    parser.add_option("--updateDigests", dest="updateDigests", action="store_true", default=False,
+                      help="Write the digests of the outputs, in place of checking them")
+    parser.add_option("--updateTimings", dest="updateTimings", action="store_true", default=False,
+                      help="Write the wall times and peak memories, in place of checking them")
+    parser.add_option("--repeats", dest="repeats", type="int", default=3,
+                      help="The number of times to run each binary, the fastest being taken")
+    parser.add_option("--timeTolerance", dest="timeTolerance", type="float", default=0.2,
+                      help="The fraction by which a wall time can exceed the timings")
+    parser.add_option("--timeSlack", dest="timeSlack", type="float", default=0.1,
+                      help="Seconds by which a wall time can exceed the timings, on top of the tolerance")
+    parser.add_option("--memoryTolerance", dest="memoryTolerance", type="float", default=0.1,
+                      help="The fraction by which a peak resident memory can exceed the timings")
+    parser.add_option("--assemblyEventString", dest="assemblyEventString", default="assembly")
+    parser.add_option("--haplotype1EventString", dest="haplotype1EventString", default="hapA1")
+    parser.add_option("--haplotype2EventString", dest="haplotype2EventString", default="hapA2")
+    parser.add_option("--contaminationEventString", dest="contaminationEventString", default="ecoli")
+    parser.add_option("--minimumNsForScaffoldGap", dest="minimumNsForScaffoldGap", default="15")
+    options, args = parser.parse_args()
+    if len(args) != 0:
+        parser.error("Unrecognised input arguments: %s" % " ".join(args))
+    if options.cactusDisk is None or options.digests is None or options.timings is None or options.outputDir is None:
+        parser.error("The cactus disk, digests, timings and output directory must be given")
+    if not os.path.isdir(options.cactusDisk):
+        raise RuntimeError("The cactus disk %s does not exist, make it with make perfFixture" % options.cactusDisk)
+    sys.exit(PerfTest(options).run())
+
+if __name__ == '__main__':
+    main()
@@ -5,6 +5,8 @@ a set of contamination sequences.
 """
 
 import os
+import time
+import hashlib
 import xml.etree.ElementTree as ET
 import xml
 import sys
@@ -37,6 +39,83 @@ def getRootPathString():
 def getCactusDiskString(alignmentFile):
     return "<st_kv_database_conf type=\"tokyo_cabinet\"><tokyo_cabinet database_dir=\"%s\"/></st_kv_database_conf>" % alignmentFile
 
+#Files written next to the output file by the stats binaries: the index of an annotated MAF and the metrics row.
+outputFileSuffixes = [ ".idx", ".row" ]
+
+def getFileDigest(fileName):
+    """Hash of the contents of a file, e.g. a binary.
+    """
+    digest = hashlib.sha1()
+    fileHandle = open(fileName, 'rb')
+    while True:
+        data = fileHandle.read(1 << 20)
+        if not data:
+            break
+        digest.update(data)
+    fileHandle.close()
+    return digest.hexdigest()
+
+#Prefixes of the caches the stats binaries write in the cactus disk directory (the contig path
+#tables and region indexes), which are derived from the database so are not part of its digest.
+#Kept in step with getCactusDiskIdentifier in src/impl/assemblaCommon.c.
+alignmentCachePrefixes = ( "contigPaths.", "blocks." )
+
+#The bytes hashed at the head and tail of each database file, and the offset of the flags byte of
+#the tokyo cabinet header, as in getCactusDiskIdentifier.
+alignmentSampleSize = 65536
+tokyoCabinetFlagsOffset = 33
+
+def getAlignmentDigest(alignment):
+    """Hash of the names and sizes of the files of a cactus disk and of the bytes at their heads and
+    tails, leaving out the flags byte tokyo cabinet sets whenever the database is opened for writing,
+    which the stats binaries do, so the digest only changes when the alignment does. Hashing the
+    contents of the database would cost more than many of the stats.
+    """
+    digest = hashlib.sha1()
+    for dirPath, dirNames, fileNames in os.walk(alignment):
+        dirNames.sort()
+        for fileName in sorted(fileNames):
+            if fileName.startswith(alignmentCachePrefixes):
+                continue
+            size = os.stat(os.path.join(dirPath, fileName)).st_size
+            digest.update("%s %s\n" % (os.path.relpath(os.path.join(dirPath, fileName), alignment), size))
+            fileHandle = open(os.path.join(dirPath, fileName), 'rb')
+            head = bytearray(fileHandle.read(alignmentSampleSize))
+            if len(head) > tokyoCabinetFlagsOffset:
+                head[tokyoCabinetFlagsOffset] = 0
+            digest.update(str(head))
+            if size > len(head):
+                fileHandle.seek(max(size - alignmentSampleSize, len(head)))
+                digest.update(fileHandle.read())
+            fileHandle.close()
+    return digest.hexdigest()
+
+#Stands for the output file in the arguments of a stats binary, which are hashed for the result
+#cache key before it is replaced, so the key does not depend on where the outputs are written.
+outputFilePlaceholder = "@OUTPUT_FILE@"
+
+def pruneResultCache(resultCacheDir, maximumAge):
+    """Removes the entries of the result cache not used in the last maximumAge days.
+    """
+    if not os.path.isdir(resultCacheDir):
+        return
+    oldestTime = time.time() - maximumAge * 24 * 60 * 60
+    for keyPrefix in os.listdir(resultCacheDir):
+        keyPrefixDir = os.path.join(resultCacheDir, keyPrefix)
+        if not os.path.isdir(keyPrefixDir):
+            continue
+        for key in os.listdir(keyPrefixDir):
+            if os.stat(os.path.join(keyPrefixDir, key)).st_mtime < oldestTime:
+                logger.info("Removing the unused result cache entry %s" % os.path.join(keyPrefixDir, key))
+                system("rm -rf %s" % os.path.join(keyPrefixDir, key))
+
+def getResultCacheKey(alignment, binary, arguments):
+    """Key of the results of running a binary with the given arguments on an alignment.
+    """
+    digest = hashlib.sha1()
+    digest.update("%s\n%s\n%s\n" % (getAlignmentDigest(alignment), getFileDigest(binary), arguments))
+    return digest.hexdigest()
+
 class MakeAlignment(Target):
     """Target runs the alignment.
     """
@@ -96,7 +175,7 @@ class MakeAlignment(Target):
             #system("mv %s %s/" % (cactusAlignmentDir, self.outputDir))
             assert os.path.exists(cactusAlignment)
             #We're done!
-        self.addChildTarget(MakeStats1(self.outputDir, cactusAlignment, self.options))
+        self.addChildTarget(MakeStats1(self.outputDir, cactusAlignment, self.options, memory=1000000000)) #Only adds the stats targets
                 
 class MakeAlignments(Target):
     """Makes alignments using pipeline.
@@ -112,6 +191,7 @@ class MakeAlignments(Target):
         self.options = options
     
     def run(self):
+        self.setFollowOnTarget(MakeStatsTable(self.outputDir))
         for assembly in os.listdir(self.assembliesDir):
             if assembly[-3:] == '.gz' or assembly[-3:] == '.fa':
                 assemblyFile = os.path.join(self.assembliesDir, assembly)
@@ -126,32 +206,134 @@ class MakeAlignments(Target):
                 self.addChildTarget(MakeAlignment(newickTree=self.newickTree, haplotypeSequences=self.haplotypeSequences,
                                                   assemblyFile=assemblyFile, outputDir=outputDirForAssembly, configFile=self.configFile, options=self.options))
 
+class MakeStatsTable(Target):
+    """Merges the stats of all the assemblies into one table, once they are all done.
+    """
+    def __init__(self, outputDir):
+        Target.__init__(self)
+        self.outputDir = outputDir
+    
+    def run(self):
+        system("python %s/aggregateStats.py --outputDir %s --outputFile %s" % (os.path.join(getRootPathString(), "bin"), self.outputDir, os.path.join(self.outputDir, "stats.csv")))
+
 class MakeStats1(Target):
     """Builds basic stats and the maf alignment(s).
+    The stats stages read the alignment, and write nothing in it but the contig path table and
+    region index caches, each through a temporary file renamed into place, so they are added as
+    sibling targets that jobTree can run concurrently. So that they load the contig path table of
+    the default options rather than each building it, it is built first by the pathStats run of
+    MakeCachedPathStats. Each stage loads the cactus disk, hence the memory requests.
     """
-    def __init__(self, outputDir, alignment, options, cpu=4, memory=8000000000):
+    def __init__(self, outputDir, alignment, options, cpu=1, memory=8000000000):
         Target.__init__(self, cpu=cpu, memory=memory)
         self.alignment = alignment
         self.options = options
         self.outputDir = outputDir
         
     def runScript(self, binaryName, outputFile, specialOptions):
-        if not os.path.exists(outputFile):
-            tempOutputFile = getTempFile(rootDir=self.getLocalTempDir())
-            os.remove(tempOutputFile)
-            system("%s --cactusDisk '%s' --outputFile %s --assemblyEventString %s \
+        """Runs the binary, unless its outputs are in the result cache under the key of the
+        alignment, binary and arguments, or outputFile was already made with the same key.
+        """
+        binary = os.path.join(getRootPathString(), "bin", binaryName)
+        arguments = "--cactusDisk '%s' --outputFile %s --metricsRowFile %s.row --assemblyEventString %s \
 --haplotype1EventString %s --haplotype2EventString %s \
---contaminationEventString %s --minimumNsForScaffoldGap %s %s" % 
-            (os.path.join(getRootPathString(), "bin", binaryName),
+--contaminationEventString %s --minimumNsForScaffoldGap %s %s" % (
              getCactusDiskString(self.alignment),
-             tempOutputFile, 
+             outputFilePlaceholder, outputFilePlaceholder,
              self.options.assemblyEventString,
              self.options.haplotype1EventString,
              self.options.haplotype2EventString,
              self.options.contaminationEventString,
-             self.options.minimumNsForScaffoldGap, specialOptions))
-            system("mv %s %s" % (tempOutputFile, outputFile))
+             self.options.minimumNsForScaffoldGap, specialOptions)
+        key = getResultCacheKey(self.alignment, binary, arguments)
+        keyFile = outputFile + ".key"
+        if os.path.exists(outputFile) and os.path.exists(keyFile) and open(keyFile).read().strip() == key:
+            return
+        resultCacheDir = self.options.resultCacheDir
+        if resultCacheDir == None:
+            resultCacheDir = os.path.join(self.outputDir, "resultCache")
+        cachedOutputFile = os.path.join(resultCacheDir, key[:2], key, os.path.split(outputFile)[1])
+        if not os.path.exists(cachedOutputFile):
+            tempOutputFile = getTempFile(rootDir=self.getLocalTempDir())
+            os.remove(tempOutputFile)
+            system("%s %s" % (binary, arguments.replace(outputFilePlaceholder, tempOutputFile)))
+            #Put the outputs in the cache, renaming the directory into place so concurrent targets never see part of it
+            tempCacheDir = getTempDirectory(rootDir=self.getLocalTempDir())
+            for suffix in outputFileSuffixes:
+                if os.path.exists(tempOutputFile + suffix):
+                    system("mv %s%s %s%s" % (tempOutputFile, suffix, os.path.join(tempCacheDir, os.path.split(outputFile)[1]), suffix))
+            system("mv %s %s" % (tempOutputFile, os.path.join(tempCacheDir, os.path.split(outputFile)[1])))
+            if not os.path.exists(os.path.split(os.path.split(cachedOutputFile)[0])[0]):
+                system("mkdir -p %s" % os.path.split(os.path.split(cachedOutputFile)[0])[0])
+            if not os.path.exists(cachedOutputFile):
+                system("mv %s %s" % (tempCacheDir, os.path.split(cachedOutputFile)[0]))
+        #Marks the entry as used, so pruneResultCache keeps it.
+        os.utime(os.path.split(cachedOutputFile)[0], None)
+        system("rm -rf %s" % " ".join([ outputFile ] + [ outputFile + suffix for suffix in outputFileSuffixes ]))
+        system("cp -r %s %s" % (cachedOutputFile, outputFile))
+        for suffix in outputFileSuffixes:
+            if os.path.exists(cachedOutputFile + suffix):
+                system("cp %s%s %s%s" % (cachedOutputFile, suffix, outputFile, suffix))
+        fileHandle = open(keyFile, 'w')
+        fileHandle.write(key + "\n")
+        fileHandle.close()
+
+    def runShardedScript(self, binaryName, outputFile, specialOptions):
+        """As runScript, but if --shardNumber is greater than one adds a target which spreads the
+        evaluation over that many shard targets, then merges the shard files into outputFile.
+        """
+        if self.options.shardNumber <= 1:
+            self.runScript(binaryName, outputFile, specialOptions)
+        else:
+            self.addChildTarget(MakeShardedStats(self.outputDir, self.alignment, self.options,
+                                                 binaryName, outputFile, specialOptions, memory=self.getMemory()))
         
+    def run(self):
+        self.addChildTarget(MakeCachedPathStats(self.outputDir, self.alignment, self.options))
+        self.setFollowOnTarget(MakeStatsStages(self.outputDir, self.alignment, self.options, memory=1000000000))
+
+class MakeStatsStages(MakeStats1):
+    """Adds the stats stages, once the caches are made.
+    """
+    def run(self):
+        self.addChildTarget(MakeTreeStats(self.outputDir, self.alignment, self.options, memory=4000000000))
+        self.addChildTarget(MakeAnnotatedMaf(self.outputDir, self.alignment, self.options, cpu=4))
+        self.addChildTarget(MakeContigPathStats(self.outputDir, self.alignment, self.options))
+        self.addChildTarget(MakeCoveragePlots(self.outputDir, self.alignment, self.options))
+        self.addChildTarget(MakeSubstitutionStats(self.outputDir, self.alignment, self.options))
+        self.addChildTarget(MakeCopyNumberStats(self.outputDir, self.alignment, self.options, memory=4000000000))
+        self.addChildTarget(MakeLinkageStats(self.outputDir, self.alignment, self.options))
+        self.addChildTarget(MakeContigAndScaffoldPathIntervals(self.outputDir, self.alignment, self.options))
+
+class RunStatsScript(MakeStats1):
+    """Runs one stats binary, as runScript.
+    """
+    def __init__(self, outputDir, alignment, options, binaryName, outputFile, specialOptions, cpu=1, memory=8000000000):
+        MakeStats1.__init__(self, outputDir, alignment, options, cpu=cpu, memory=memory)
+        self.binaryName = binaryName
+        self.outputFile = outputFile
+        self.specialOptions = specialOptions
+
+    def run(self):
+        self.runScript(self.binaryName, self.outputFile, self.specialOptions)
+
+class MakeShardedStats(RunStatsScript):
+    """Runs a stats binary in shards of the top level groups of the alignment, as sibling targets
+    that can run on different nodes, then merges the shard files in a follow on target.
+    """
+    def run(self):
+        shardFiles = [ "%s.shard%i" % (self.outputFile, i) for i in xrange(self.options.shardNumber) ]
+        for i in xrange(self.options.shardNumber):
+            self.addChildTarget(RunStatsScript(self.outputDir, self.alignment, self.options, self.binaryName, shardFiles[i],
+                                               "%s --shard %i/%i" % (self.specialOptions, i, self.options.shardNumber),
+                                               memory=self.getMemory()))
+        self.setFollowOnTarget(RunStatsScript(self.outputDir, self.alignment, self.options, self.binaryName, self.outputFile,
+                                              " ".join([ self.specialOptions ] + [ "--mergeShards %s" % i for i in shardFiles ]),
+                                              memory=1000000000))
+
+class MakeTreeStats(MakeStats1):
+    """Makes the cactus tree stats.
+    """
     def run(self):
         outputFile = os.path.join(self.outputDir, "cactusTreeStats.xml")
         if not os.path.exists(outputFile):
@@ -159,39 +341,48 @@ class MakeStats1(Target):
         #outputFile = "%s.maf" % self.alignment
         #if not os.path.exists(outputFile):
         #    system("cactus_MAFGenerator --cactusDisk '%s' --flowerName 0 --outputFile %s --orderByReference" % (getCactusDiskString(self.alignment), outputFile))
+
+class MakeAnnotatedMaf(MakeStats1):
+    """Makes the path annotated maf, using the cpus requested.
+    """
+    def run(self):
         outputFile = os.path.join(self.outputDir, "annotatedPaths.maf")
-        self.runScript("pathAnnotatedMafGenerator", outputFile, "")
-        self.addChildTarget(MakeContigPathStats(self.outputDir, self.alignment, self.options))
+        if self.options.compressMafs:
+            self.runScript("pathAnnotatedMafGenerator", outputFile + ".gz", "--compressOutput --numberOfThreads 4 --writeMafIndex")
+        else:
+            self.runScript("pathAnnotatedMafGenerator", outputFile, "--numberOfThreads 4 --writeMafIndex")
 
-class MakeContigPathStats(MakeStats1):
-    """Makes contig path stats.
+class MakeCachedPathStats(MakeStats1):
+    """Makes the contig path stats of the default options, before the other stats stages, building
+    the contig path table they share. If the stats are in the result cache the table is not built
+    here, and the stages build it themselves.
     """
     def run(self):
         outputFile = os.path.join(self.outputDir, "pathStats.xml")
         self.runScript("pathStats", outputFile, "")
-        self.addChildTarget(MakeCoveragePlots(self.outputDir, self.alignment, self.options))
-        
+
+class MakeContigPathStats(MakeStats1):
+    """Makes the phasing contig path stats, whose options give their own contig path tables.
+    """
+    def run(self):
         outputFile = os.path.join(self.outputDir, "pathStats_hap1Phasing.xml")
         self.runScript("pathStats", outputFile, "--treatHaplotype2AsContamination")
-        self.addChildTarget(MakeCoveragePlots(self.outputDir, self.alignment, self.options))
         
         outputFile = os.path.join(self.outputDir, "pathStats_hap2Phasing.xml")
         self.runScript("pathStats", outputFile, "--treatHaplotype1AsContamination")
-        self.addChildTarget(MakeCoveragePlots(self.outputDir, self.alignment, self.options))
         
 class MakeCoveragePlots(MakeStats1):
     """Makes coverage plots.
     """
     def run(self):
         self.runScript("coveragePlots", os.path.join(self.outputDir, "coveragePlots"), "")
-        self.addChildTarget(MakeSubstitutionStats(self.outputDir, self.alignment, self.options))
         
 class MakeSubstitutionStats(MakeStats1):
     """Makes substitution stats.
     """
     def run(self):
         outputFile = os.path.join(self.outputDir, "substitutionStats_1000_98_5.xml")
-        self.runScript("substitutionStats", outputFile, "--ignoreFirstNBases 5 --minimumBlockLength 1000 --minimumIdentity 98")
+        self.runShardedScript("substitutionStats", outputFile, "--ignoreFirstNBases 5 --minimumBlockLength 1000 --minimumIdentity 98")
         
         outputFile = os.path.join(self.outputDir, "substitutionStats_1000_98_5_indel_positions.xml")
         self.runScript("substitutionStats", outputFile, "--ignoreFirstNBases 5 --minimumBlockLength 1000 --minimumIdentity 98 --printIndelPositions")
@@ -200,21 +391,17 @@ class MakeSubstitutionStats(MakeStats1):
         self.runScript("substitutionStats", outputFile, "--ignoreFirstNBases 5 --minimumBlockLength 1000 --minimumIdentity 98 --printHetPositions")
         
         outputFile = os.path.join(self.outputDir, "substitutionStats_0_0_0.xml")
-        self.runScript("substitutionStats", outputFile, "--ignoreFirstNBases 0 --minimumBlockLength 0")
-        
-        self.addChildTarget(MakeCopyNumberStats(self.outputDir, self.alignment, self.options))
+        self.runShardedScript("substitutionStats", outputFile, "--ignoreFirstNBases 0 --minimumBlockLength 0")
 
 class MakeCopyNumberStats(MakeStats1):
     """Make copy number stats.
     """
     def run(self):
         outputFile = os.path.join(self.outputDir, "copyNumberStats_0.xml")
-        self.runScript("copyNumberStats", outputFile, "")
+        self.runShardedScript("copyNumberStats", outputFile, "--maximumMemory 3000000000")
         
         outputFile = os.path.join(self.outputDir, "copyNumberStats_1000.xml")
-        self.runScript("copyNumberStats", outputFile, "--minimumBlockLength 1000")
-        
-        self.addChildTarget(MakeLinkageStats(self.outputDir, self.alignment, self.options))
+        self.runShardedScript("copyNumberStats", outputFile, "--minimumBlockLength 1000 --maximumMemory 3000000000")
    
 class MakeLinkageStats(MakeStats1):
     """Make linkage stats.
@@ -222,7 +409,6 @@ class MakeLinkageStats(MakeStats1):
     def run(self):
         outputFile = os.path.join(self.outputDir, "linkageStats.xml")
         self.runScript("linkageStats", outputFile, "--bucketNumber 2000 --sampleNumber 1000000")
-        self.addChildTarget(MakeContigAndScaffoldPathIntervals(self.outputDir, self.alignment, self.options))
         
 class MakeContigAndScaffoldPathIntervals(MakeStats1):
     """Make linkage stats.
@@ -258,6 +444,14 @@ def main():
     parser.add_option("--contaminationEventString", dest="contaminationEventString")
     parser.add_option("--featureBedFiles", dest="featureBedFiles")
     parser.add_option("--geneBedFiles", dest="geneBedFiles")
+    parser.add_option("--compressMafs", dest="compressMafs", action="store_true", default=False,
+                      help="Write the annotated MAFs as BGZF compressed files")
+    parser.add_option("--resultCacheDir", dest="resultCacheDir", default=None,
+                      help="Directory in which the outputs of the stats binaries are cached, by a hash of the alignment, binary and arguments (default: resultCache in each assembly's output directory)")
+    parser.add_option("--resultCacheMaxAge", dest="resultCacheMaxAge", type="float", default=30,
+                      help="Remove the result cache entries not used in this many days, before the stats are run (default: 30, 0 to keep them all)")
+    parser.add_option("--shardNumber", dest="shardNumber", type="int", default=1,
+                      help="Spread the substitution and copy number stats of each alignment over this many targets, merging their results")
     
     Stack.addJobTreeOptions(parser)
 
@@ -267,6 +461,14 @@ def main():
     if len(args) != 0:
         raise RuntimeError("Unrecognised input arguments: %s" % " ".join(args))
 
+    #Pruned before any target runs, so no entry is removed while it is being used.
+    if options.resultCacheMaxAge > 0:
+        if options.resultCacheDir != None:
+            pruneResultCache(options.resultCacheDir, options.resultCacheMaxAge)
+        elif os.path.isdir(options.outputDir):
+            for assembly in os.listdir(options.outputDir):
+                pruneResultCache(os.path.join(options.outputDir, assembly, "resultCache"), options.resultCacheMaxAge)
+
     Stack(MakeAlignments(newickTree=options.newickTree, 
                          haplotypeSequences=options.haplotypeSequences.split(), 
                          assembliesDir=options.assembliesDir, 
@@ -0,0 +1,54 @@
+#!/usr/bin/env python
+
+"""Checks the adjacency errors of the window tracks written by windowTracks against the error
+totals of pathStats, run on the same cactus disk with the same options, exiting non zero if they
+differ. Each error cap is counted once over the windows, and an error between two paths is
+counted at the ends of both, so the sum over the windows is the sum of the pathStats totals with
+those of the errors between paths doubled.
+"""
+
+import sys
+import xml.etree.ElementTree as ET
+from optparse import OptionParser
+
+from windowTracks import WindowTracks
+
+#The pathStats totals of the errors between two paths, which are halved by pathStats.
+errorsBetweenPaths = [ "totalErrorsHaplotypeToHaplotypeSameChromosome",
+                       "totalErrorsHaplotypeToHaplotypeDifferentChromosome",
+                       "totalErrorsHaplotypeToInsertion", "totalErrorsHaplotypeToDeletion",
+                       "totalErrorsHaplotypeToInsertionAndDeletion" ]
+#The pathStats totals of the errors at a single path end.
+errorsAtPathEnds = [ "totalErrorsHaplotypeToContamination", "totalErrorsHaplotypeToInsertionToContamination",
+                     "totalErrorsContigEndsWithInsert" ]
+
+def getWindowErrors(windowTracksFile):
+    """The sum of the adjacency errors over the windows, from the single window of the top level
+    of each track.
+    """
+    windowTracks = WindowTracks(windowTracksFile)
+    metricIndex = windowTracks.metricNames.index("adjacencyErrors")
+    total = 0
+    for track in windowTracks.tracks:
+        name, sequenceLength, levelNumber, offset = track
+        for start, end, counts in windowTracks.getWindows(track, levelNumber - 1, 0, sequenceLength):
+            total += counts[metricIndex]
+    return total
+
+def getPathStatsErrors(pathStatsFile):
+    stats = ET.parse(pathStatsFile).getroot()
+    return 2 * sum([ int(stats.attrib[i]) for i in errorsBetweenPaths ]) + \
+        sum([ int(stats.attrib[i]) for i in errorsAtPathEnds ])
+
+def main():
+    parser = OptionParser(usage="usage: %prog windowTracksFile pathStatsFile", description=__doc__)
+    options, args = parser.parse_args()
+    if len(args) != 2:
+        parser.error("The window tracks and pathStats files must be given")
+    windowErrors = getWindowErrors(args[0])
+    pathStatsErrors = getPathStatsErrors(args[1])
+    sys.stdout.write("Adjacency errors in the windows: %i, from pathStats: %i\n" % (windowErrors, pathStatsErrors))
+    sys.exit(0 if windowErrors == pathStatsErrors else 1)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,97 @@
+#!/usr/bin/env python
+
+"""Prints the windows of a window tracks file (written by the windowTracks binary) as a
+tab separated table, with a row per window: sequence, start, end, then a column per metric.
+
+The file holds a pyramid of levels for each haplotype sequence, level 0 with the window size
+given to windowTracks and each further level summing zoomFactor windows of the level below,
+so a zoomed out view of a large range only reads a few windows. Give --level to pick a level,
+or --maximumWindows to pick the finest level with at most that many windows in the range.
+"""
+
+import sys
+import struct
+from optparse import OptionParser
+
+windowTracksMagic = "ASMWIN01"
+
+class WindowTracks:
+    """The header and track directory of a window tracks file, the windows are read as needed.
+    """
+    def __init__(self, fileName):
+        self.fileHandle = open(fileName, "rb")
+        if self.fileHandle.read(8) != windowTracksMagic:
+            raise RuntimeError("The file %s is not a window tracks file" % fileName)
+        self.windowSize, self.zoomFactor, metricNumber, trackNumber = self.readInts(4)
+        self.metricNames = [ self.readString() for i in xrange(metricNumber) ]
+        self.tracks = []
+        for i in xrange(trackNumber):
+            name = self.readString()
+            sequenceLength, levelNumber, offset = self.readInts(3)
+            self.tracks.append((name, sequenceLength, levelNumber, offset))
+
+    def readInts(self, number):
+        return struct.unpack("<%iq" % number, self.fileHandle.read(8 * number))
+
+    def readString(self):
+        length = self.readInts(1)[0]
+        string = self.fileHandle.read(length)
+        self.fileHandle.read((8 - length % 8) % 8)
+        return string
+
+    def getLevelWindowSize(self, level):
+        return self.windowSize * self.zoomFactor ** level
+
+    def getWindowNumber(self, sequenceLength, level):
+        windowSize = self.getLevelWindowSize(level)
+        return max(1, (sequenceLength + windowSize - 1) / windowSize)
+
+    def getWindows(self, track, level, start, end):
+        """Yields (start, end, counts) for the windows of the level overlapping start to end.
+        """
+        name, sequenceLength, levelNumber, offset = track
+        level = min(level, levelNumber - 1)
+        for i in xrange(level):
+            offset += self.getWindowNumber(sequenceLength, i) * len(self.metricNames) * 8
+        windowSize = self.getLevelWindowSize(level)
+        firstWindow = start / windowSize
+        lastWindow = min(self.getWindowNumber(sequenceLength, level), (end + windowSize - 1) / windowSize)
+        self.fileHandle.seek(offset + firstWindow * len(self.metricNames) * 8)
+        for i in xrange(firstWindow, lastWindow):
+            counts = self.readInts(len(self.metricNames))
+            yield i * windowSize, min((i + 1) * windowSize, sequenceLength), counts
+
+def main():
+    parser = OptionParser(usage="usage: %prog [options] windowTracksFile", description=__doc__)
+    parser.add_option("--sequence", dest="sequences", action="append", default=[],
+                      help="Only print the windows of this sequence, may be repeated")
+    parser.add_option("--start", dest="start", type="int", default=0,
+                      help="The start of the range to print (zero based)")
+    parser.add_option("--end", dest="end", type="int", default=sys.maxint,
+                      help="The end of the range to print (exclusive)")
+    parser.add_option("--level", dest="level", type="int", default=0,
+                      help="The level of the pyramid to print, 0 being the finest")
+    parser.add_option("--maximumWindows", dest="maximumWindows", type="int", default=None,
+                      help="Print the finest level with at most this many windows in the range of each sequence")
+    options, args = parser.parse_args()
+    if len(args) != 1:
+        parser.error("Expected one window tracks file")
+
+    windowTracks = WindowTracks(args[0])
+    sys.stdout.write("\t".join([ "sequence", "start", "end" ] + windowTracks.metricNames) + "\n")
+    for track in windowTracks.tracks:
+        name, sequenceLength, levelNumber = track[:3]
+        if len(options.sequences) > 0 and name not in options.sequences:
+            continue
+        end = min(options.end, sequenceLength)
+        level = options.level
+        if options.maximumWindows is not None:
+            level = 0
+            while level < levelNumber - 1 and \
+                    (end - options.start) / windowTracks.getLevelWindowSize(level) >= options.maximumWindows:
+                level += 1
+        for start, windowEnd, counts in windowTracks.getWindows(track, level, options.start, end):
+            sys.stdout.write("\t".join([ name, str(start), str(windowEnd) ] + [ str(i) for i in counts ]) + "\n")
+
+if __name__ == '__main__':
+    main()
@@ -9,13 +9,23 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 #include <time.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 #include "sonLib.h"
 #include "cactus.h"
 #include "adjacencyClassification.h"
+#include "contigPaths.h"
+#include "contigPathTable.h"
+#include "mafWriter.h"
+#include "mafIndex.h"
 #include "assemblaCommon.h"
+#include "counters.h"
 
 /*
  * Global parameters.
@@ -25,8 +35,10 @@ CapCodeParameters *capCodeParameters = NULL;
 char *outputFile = NULL;
 Flower *flower = NULL;
 CactusDisk *cactusDisk = NULL;
+char *cactusDiskDirectory = NULL;
 
 char *assemblyEventString = NULL;
+stList *assemblyEventStrings = NULL;
 char *hap1EventString = NULL;
 char *hap2EventString = NULL;
 char *contaminationEventString = NULL;
@@ -38,6 +50,21 @@ bool treatHaplotype2AsContamination = 0;
  */
 int64_t minimumBlockLength = 0;
 
+/*
+ * For the scripts that traverse the blocks with getMAFsBounded.
+ */
+int64_t maximumMemory = INT64_MAX;
+
+/*
+ * If not NULL, the scripts also write their summary metrics to this file as a MetricsRow.
+ */
+char *metricsRowFile = NULL;
+
+/*
+ * The regions the scripts are restricted to, or NULL.
+ */
+stList *regions = NULL;
+
 /*
  * Parameters for the substitution script.
  */
@@ -52,6 +79,55 @@ bool printHetPositions = 0;
 int64_t bucketNumber = 2000;
 int64_t upperLinkageBound = 200000000;
 int64_t sampleNumber = 1000000;
+double linkagePrecision = 0.0;
+int64_t linkageTimeBudget = 0;
+
+/*
+ * For the annotated MAF script.
+ */
+bool compressOutput = 0;
+int64_t numberOfThreads = 1;
+bool writeMafIndex = 0;
+bool verifyMaf = 0;
+char *annotationTableFormat = NULL;
+
+/*
+ * For the window tracks script.
+ */
+int64_t windowSize = 10000;
+
+/*
+ * For the daemon.
+ */
+char *socketPath = NULL;
+
+/*
+ * For the path stats script.
+ */
+char *capSitesFile = NULL;
+char *contigSummaryFile = NULL;
+
+/*
+ * For the coverage plots script.
+ */
+int64_t coveragePlotMaximumLength = 0;
+int64_t coveragePlotBinsPerDecade = 250;
+bool compressCoveragePlotBins = 0;
+bool coveragePlotIsBinary = 0;
+
+/*
+ * Block sampling.
+ */
+double sampleFraction = 1.0;
+int64_t sampleSeed = 0;
+
+/*
+ * Sharding.
+ */
+bool shardsSupported = 0;
+int64_t shardIndex = 0;
+int64_t shardNumber = 1;
+stList *shardFiles = NULL;
 
 stList *getEventStrings(const char *hapA1EventString,
         const char *hapA2EventString) {
@@ -65,6 +141,1103 @@ stList *getEventStrings(const char *hapA1EventString,
     return eventStrings;
 }
 
+/*
+ * Metrics rows.
+ */
+
+struct _metricsRow {
+    stList *names;
+    stList *values;
+};
+
+MetricsRow *metricsRow_construct(void) {
+    MetricsRow *metricsRow = st_malloc(sizeof(MetricsRow));
+    metricsRow->names = stList_construct3(0, free);
+    metricsRow->values = stList_construct3(0, free);
+    return metricsRow;
+}
+
+void metricsRow_destruct(MetricsRow *metricsRow) {
+    stList_destruct(metricsRow->names);
+    stList_destruct(metricsRow->values);
+    free(metricsRow);
+}
+
+void metricsRow_addInt(MetricsRow *metricsRow, const char *name, int64_t value) {
+    stList_append(metricsRow->names, stString_copy(name));
+    stList_append(metricsRow->values, stString_print("%" PRIi64 "", value));
+}
+
+void metricsRow_addDouble(MetricsRow *metricsRow, const char *name, double value) {
+    stList_append(metricsRow->names, stString_copy(name));
+    stList_append(metricsRow->values, stString_print("%f", value));
+}
+
+void metricsRow_addString(MetricsRow *metricsRow, const char *name, const char *value) {
+    //Quoted, with any quotes doubled, as in CSV.
+    int64_t length = strlen(value);
+    char *quotedValue = st_malloc(2 * length + 3);
+    int64_t j = 0;
+    quotedValue[j++] = '"';
+    for (int64_t i = 0; i < length; i++) {
+        if (value[i] == '"') {
+            quotedValue[j++] = '"';
+        }
+        quotedValue[j++] = value[i];
+    }
+    quotedValue[j++] = '"';
+    quotedValue[j] = '\0';
+    stList_append(metricsRow->names, stString_copy(name));
+    stList_append(metricsRow->values, quotedValue);
+}
+
+void metricsRow_write(MetricsRow *metricsRow, const char *fileName) {
+    FILE *fileHandle = fopen(fileName, "w");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the metrics row file %s for writing", fileName);
+    }
+    for (int64_t i = 0; i < stList_length(metricsRow->names); i++) {
+        fprintf(fileHandle, i == 0 ? "%s" : ",%s", (const char *) stList_get(metricsRow->names, i));
+    }
+    fprintf(fileHandle, "\n");
+    for (int64_t i = 0; i < stList_length(metricsRow->values); i++) {
+        fprintf(fileHandle, i == 0 ? "%s" : ",%s", (const char *) stList_get(metricsRow->values, i));
+    }
+    fprintf(fileHandle, "\n");
+    fclose(fileHandle);
+}
+
+/*
+ * Counters.
+ */
+
+#ifdef ASSEMBLA_COUNTERS
+
+__thread int64_t *assemblaCounters = NULL;
+
+//The counters of all the threads, kept after the threads exit to be summed at exit.
+static stList *allCounters = NULL;
+static pthread_mutex_t allCountersMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void writeCounters(void) {
+    int64_t totals[COUNTER_NUMBER] = { 0 };
+    pthread_mutex_lock(&allCountersMutex);
+    for (int64_t i = 0; i < stList_length(allCounters); i++) {
+        int64_t *counters = stList_get(allCounters, i);
+        for (int64_t j = 0; j < COUNTER_NUMBER; j++) {
+            totals[j] += counters[j];
+        }
+    }
+    pthread_mutex_unlock(&allCountersMutex);
+    const char *fileName = getenv("ASSEMBLA_COUNTERS_FILE");
+    FILE *fileHandle = fileName != NULL ? fopen(fileName, "w") : stderr;
+    if (fileHandle == NULL) {
+        fprintf(stderr, "Could not open the counters file %s\n", fileName);
+        return;
+    }
+    fprintf(fileHandle, "{");
+    const char *separator = "";
+#define ASSEMBLA_COUNTER_WRITE(name, number) \
+    if ((number) == 1) { \
+        fprintf(fileHandle, "%s\"%s\": %" PRIi64 "", separator, #name, totals[COUNTER_##name]); \
+    } else { \
+        fprintf(fileHandle, "%s\"%s\": [", separator, #name); \
+        for (int64_t i = 0; i < (number); i++) { \
+            fprintf(fileHandle, i == 0 ? "%" PRIi64 "" : ", %" PRIi64 "", totals[COUNTER_##name + i]); \
+        } \
+        fprintf(fileHandle, "]"); \
+    } \
+    separator = ", ";
+    ASSEMBLA_COUNTER_LIST(ASSEMBLA_COUNTER_WRITE)
+#undef ASSEMBLA_COUNTER_WRITE
+    fprintf(fileHandle, "}\n");
+    if (fileHandle != stderr) {
+        fclose(fileHandle);
+    }
+}
+
+int64_t *assemblaCounters_construct(void) {
+    assemblaCounters = st_calloc(COUNTER_NUMBER, sizeof(int64_t));
+    pthread_mutex_lock(&allCountersMutex);
+    if (allCounters == NULL) {
+        allCounters = stList_construct();
+        atexit(writeCounters);
+    }
+    stList_append(allCounters, assemblaCounters);
+    pthread_mutex_unlock(&allCountersMutex);
+    return assemblaCounters;
+}
+
+#endif
+
+/*
+ * Arenas.
+ */
+
+#define ARENA_FIRST_CHUNK_SIZE 65536
+#define ARENA_MAXIMUM_CHUNK_SIZE 16777216
+#define ARENA_ALIGNMENT 16
+
+typedef struct _arenaChunk {
+    struct _arenaChunk *next;
+    size_t size;
+    size_t used;
+    char *memory;
+} ArenaChunk;
+
+struct _arena {
+    ArenaChunk *chunks; //The chunk being allocated from, first, then the full chunks.
+    size_t nextChunkSize;
+    int64_t allocationNumber;
+    int64_t bytesAllocated;
+    int64_t bytesReserved;
+    int64_t chunkNumber;
+};
+
+Arena *arena_construct(void) {
+    Arena *arena = st_calloc(1, sizeof(Arena));
+    arena->nextChunkSize = ARENA_FIRST_CHUNK_SIZE;
+    return arena;
+}
+
+void arena_destruct(Arena *arena) {
+    while (arena->chunks != NULL) {
+        ArenaChunk *chunk = arena->chunks;
+        arena->chunks = chunk->next;
+        free(chunk->memory);
+        free(chunk);
+    }
+    free(arena);
+}
+
+void *arena_malloc(Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+    ArenaChunk *chunk = arena->chunks;
+    if (chunk == NULL || chunk->used + size > chunk->size) {
+        chunk = st_malloc(sizeof(ArenaChunk));
+        chunk->used = 0;
+        if (size > arena->nextChunkSize / 4 && arena->chunks != NULL) {
+            //A large allocation gets a chunk of its own, behind the current chunk, which keeps its room.
+            chunk->size = size;
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+        } else {
+            //The chunks double in size, up to the maximum.
+            chunk->size = size > arena->nextChunkSize ? size : arena->nextChunkSize;
+            if (arena->nextChunkSize < ARENA_MAXIMUM_CHUNK_SIZE) {
+                arena->nextChunkSize *= 2;
+            }
+            chunk->next = arena->chunks;
+            arena->chunks = chunk;
+        }
+        chunk->memory = st_malloc(chunk->size);
+        arena->bytesReserved += chunk->size;
+        arena->chunkNumber++;
+    }
+    void *memory = chunk->memory + chunk->used;
+    chunk->used += size;
+    arena->allocationNumber++;
+    arena->bytesAllocated += size;
+    return memory;
+}
+
+char *arena_copyString(Arena *arena, const char *string) {
+    size_t length = strlen(string) + 1;
+    char *copy = arena_malloc(arena, length);
+    memcpy(copy, string, length);
+    return copy;
+}
+
+void arena_report(Arena *arena, MetricsRow *metricsRow) {
+    st_logInfo("The arena made %" PRIi64 " allocations, of %" PRIi64 " bytes, from %" PRIi64 " chunks of %" PRIi64 " bytes\n",
+            arena->allocationNumber, arena->bytesAllocated, arena->chunkNumber, arena->bytesReserved);
+    if (metricsRow != NULL) {
+        metricsRow_addInt(metricsRow, "allocator.allocations", arena->allocationNumber);
+        metricsRow_addInt(metricsRow, "allocator.bytesAllocated", arena->bytesAllocated);
+        metricsRow_addInt(metricsRow, "allocator.chunks", arena->chunkNumber);
+        metricsRow_addInt(metricsRow, "allocator.bytesReserved", arena->bytesReserved);
+    }
+}
+
+/*
+ * The resident memory of the process, or INT64_MAX if it can not be read.
+ */
+static int64_t getResidentMemory(void) {
+    FILE *fileHandle = fopen("/proc/self/statm", "r");
+    if (fileHandle == NULL) {
+        return INT64_MAX;
+    }
+    int64_t size, resident;
+    int64_t i = fscanf(fileHandle, "%" PRIi64 " %" PRIi64 "", &size, &resident);
+    fclose(fileHandle);
+    return i == 2 ? resident * sysconf(_SC_PAGESIZE) : INT64_MAX;
+}
+
+static void unloadFlowers(const BlockTraversal *blockTraversal, stList *processedFlowers) {
+    /*
+     * Unloads the processed flowers if over the memory limit. Checking the memory
+     * is not free, so it is only done every so many flowers.
+     */
+    if (stList_length(processedFlowers) % 64 == 0 && getResidentMemory() > blockTraversal->maximumMemory) {
+        //Nested flowers come before their parents, so no flower is unloaded before its children.
+        for (int64_t i = 0; i < stList_length(processedFlowers); i++) {
+            flower_unload(stList_get(processedFlowers, i));
+        }
+        st_logDebug("Unloaded %" PRIi64 " flowers, resident memory is now %" PRIi64 " bytes\n",
+                stList_length(processedFlowers), getResidentMemory());
+        while (stList_length(processedFlowers) > 0) {
+            stList_pop(processedFlowers);
+        }
+    }
+}
+
+static bool isInShard(const BlockTraversal *blockTraversal, int64_t i) {
+    return i % blockTraversal->shardNumber == blockTraversal->shardIndex;
+}
+
+static void getMAFsBoundedP(const BlockTraversal *blockTraversal, Flower *flower,
+        void(*blockFn)(Block *, void *), void *extraArg, stList *processedFlowers, bool topLevel, bool allBlocks) {
+    //The blocks of the top level flower go to the first shard, its groups are dealt out between the shards.
+    topLevel = topLevel && !allBlocks;
+    if (!topLevel || blockTraversal->shardIndex == 0) {
+        Flower_BlockIterator *blockIt = flower_getBlockIterator(flower);
+        Block *block;
+        while ((block = flower_getNextBlock(blockIt)) != NULL) {
+            if (allBlocks || isBlockInSample(block, blockTraversal->sampleFraction, blockTraversal->sampleSeed)) {
+                blockFn(block, extraArg);
+            }
+        }
+        flower_destructBlockIterator(blockIt);
+    }
+    //Now recurse on the groups, one nested flower subtree at a time.
+    Flower_GroupIterator *groupIt = flower_getGroupIterator(flower);
+    Group *group;
+    int64_t groupIndex = 0;
+    while ((group = flower_getNextGroup(groupIt)) != NULL) {
+        Flower *nestedFlower = group_getNestedFlower(group);
+        if (nestedFlower != NULL && (!topLevel || isInShard(blockTraversal, groupIndex++))) {
+            getMAFsBoundedP(blockTraversal, nestedFlower, blockFn, extraArg, processedFlowers, 0, allBlocks);
+            if (blockTraversal->maximumMemory != INT64_MAX) {
+                stList_append(processedFlowers, nestedFlower);
+                unloadFlowers(blockTraversal, processedFlowers);
+            }
+        }
+    }
+    flower_destructGroupIterator(groupIt);
+}
+
+/*
+ * Sequence views.
+ */
+
+char *sequenceView_read(Segment *segment, SequenceView *sequenceView) {
+    Sequence *sequence = segment_getSequence(segment);
+    if (sequence == NULL) {
+        return NULL;
+    }
+    int64_t start = segment_getStart(segment);
+    if (!segment_getStrand(segment)) { //the leftmost coordinate on the forward strand
+        start -= segment_getLength(segment) - 1;
+    }
+    //Only the bases of the segment are read, not the whole of its sequence.
+    char *string = metaSequence_getString(sequence_getMetaSequence(sequence), start, segment_getLength(segment), 1);
+    sequenceView->string = string;
+    sequenceView->length = segment_getLength(segment);
+    sequenceView->strand = segment_getStrand(segment);
+    return string;
+}
+
+struct _sequenceViewCache {
+    //The strings of the views set since the cache was last cleared.
+    stList *strings;
+};
+
+SequenceViewCache *sequenceViewCache_construct(void) {
+    SequenceViewCache *sequenceViewCache = st_malloc(sizeof(SequenceViewCache));
+    sequenceViewCache->strings = stList_construct3(0, free);
+    return sequenceViewCache;
+}
+
+void sequenceViewCache_destruct(SequenceViewCache *sequenceViewCache) {
+    stList_destruct(sequenceViewCache->strings);
+    free(sequenceViewCache);
+}
+
+void sequenceViewCache_clear(SequenceViewCache *sequenceViewCache) {
+    while (stList_length(sequenceViewCache->strings) > 0) {
+        free(stList_pop(sequenceViewCache->strings));
+    }
+}
+
+bool sequenceViewCache_get(SequenceViewCache *sequenceViewCache, Segment *segment, SequenceView *sequenceView) {
+    char *string = sequenceView_read(segment, sequenceView);
+    if (string == NULL) {
+        return 0;
+    }
+    stList_append(sequenceViewCache->strings, string);
+    return 1;
+}
+
+//The cache of sequenceView_get.
+static SequenceViewCache *sequenceViewCache = NULL;
+
+bool sequenceView_get(Segment *segment, SequenceView *sequenceView) {
+    if (sequenceViewCache == NULL) {
+        sequenceViewCache = sequenceViewCache_construct();
+    }
+    return sequenceViewCache_get(sequenceViewCache, segment, sequenceView);
+}
+
+void sequenceView_clearCache(void) {
+    if (sequenceViewCache != NULL) {
+        sequenceViewCache_clear(sequenceViewCache);
+    }
+}
+
+//The bytes hashed at the head and tail of each database file by getCactusDiskIdentifier.
+#define CACTUS_DISK_SAMPLE_SIZE 65536
+//The offset of the flags byte of the tokyo cabinet header, which is set while a writer has the database open.
+#define TOKYO_CABINET_FLAGS_OFFSET 33
+//The offset basis of the FNV-1a hashes of the cache file names.
+#define FNV_INITIAL_HASH 0xcbf29ce484222325ULL
+
+static uint64_t fnvHash(uint64_t hash, const void *bytes, int64_t length) {
+    for (int64_t i = 0; i < length; i++) {
+        hash = (hash ^ ((const unsigned char *) bytes)[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t fnvHashString(uint64_t hash, const char *string) {
+    return fnvHash(hash, string, strlen(string));
+}
+
+static uint64_t hashFileSample(uint64_t hash, FILE *fileHandle, int64_t offset, int64_t length) {
+    char *bytes = st_malloc(length);
+    if (fseek(fileHandle, offset, SEEK_SET) == 0 && fread(bytes, 1, length, fileHandle) == (size_t) length) {
+        if (offset <= TOKYO_CABINET_FLAGS_OFFSET && TOKYO_CABINET_FLAGS_OFFSET < offset + length) {
+            bytes[TOKYO_CABINET_FLAGS_OFFSET - offset] = 0;
+        }
+        hash = fnvHash(hash, bytes, length);
+    } else {
+        hash = fnvHashString(hash, "unreadable");
+    }
+    free(bytes);
+    return hash;
+}
+
+static bool isCactusDiskCacheFile(const char *fileName) {
+    return strncmp(fileName, "contigPaths.", 12) == 0 || strncmp(fileName, "blocks.", 7) == 0;
+}
+
+static int compareStrings(const char *string1, const char *string2) {
+    return strcmp(string1, string2);
+}
+
+/*
+ * An identifier of the contents of the cactus disk, ignoring contig path tables and region
+ * indexes: a hash of the names and sizes of the database files and of the bytes at their heads,
+ * which hold the tokyo cabinet header with its record counts and the bucket array, and tails,
+ * which hold the last records written. The flags byte of the header is left out, as tokyo cabinet
+ * sets it whenever the database is opened for writing, which the binaries do; the modification
+ * times, which change for the same reason, are not used. Hashing all of the database would cost
+ * more than many of the stats. Computed once per directory in the process.
+ */
+static pthread_mutex_t cactusDiskIdentifierMutex = PTHREAD_MUTEX_INITIALIZER;
+static char *cactusDiskIdentifierDirectory = NULL;
+static uint64_t cactusDiskIdentifier = 0;
+
+static uint64_t getCactusDiskIdentifier(const char *cactusDiskDirectory) {
+    pthread_mutex_lock(&cactusDiskIdentifierMutex);
+    if (cactusDiskIdentifierDirectory == NULL || strcmp(cactusDiskIdentifierDirectory, cactusDiskDirectory) != 0) {
+        uint64_t hash = FNV_INITIAL_HASH;
+        DIR *dir = opendir(cactusDiskDirectory);
+        if (dir != NULL) {
+            //Sorted, as the order of readdir is that of the directory.
+            stList *fileNames = stList_construct3(0, free);
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != NULL) {
+                if (!isCactusDiskCacheFile(entry->d_name)) {
+                    stList_append(fileNames, stString_copy(entry->d_name));
+                }
+            }
+            closedir(dir);
+            stList_sort(fileNames, (int (*)(const void *, const void *)) compareStrings);
+            for (int64_t i = 0; i < stList_length(fileNames); i++) {
+                char *fileName = stString_print("%s/%s", cactusDiskDirectory, (char *) stList_get(fileNames, i));
+                struct stat fileStat;
+                FILE *fileHandle;
+                if (stat(fileName, &fileStat) == 0 && S_ISREG(fileStat.st_mode)
+                        && (fileHandle = fopen(fileName, "rb")) != NULL) {
+                    char *nameAndSize = stString_print("%s %" PRIi64 "\n", (char *) stList_get(fileNames, i),
+                            (int64_t) fileStat.st_size);
+                    hash = fnvHashString(hash, nameAndSize);
+                    free(nameAndSize);
+                    int64_t headLength = fileStat.st_size < CACTUS_DISK_SAMPLE_SIZE ? fileStat.st_size
+                            : CACTUS_DISK_SAMPLE_SIZE;
+                    hash = hashFileSample(hash, fileHandle, 0, headLength);
+                    if (fileStat.st_size > headLength) {
+                        int64_t tailOffset = fileStat.st_size - CACTUS_DISK_SAMPLE_SIZE > headLength
+                                ? fileStat.st_size - CACTUS_DISK_SAMPLE_SIZE : headLength;
+                        hash = hashFileSample(hash, fileHandle, tailOffset, fileStat.st_size - tailOffset);
+                    }
+                    fclose(fileHandle);
+                }
+                free(fileName);
+            }
+            stList_destruct(fileNames);
+        }
+        free(cactusDiskIdentifierDirectory);
+        cactusDiskIdentifierDirectory = stString_copy(cactusDiskDirectory);
+        cactusDiskIdentifier = hash;
+    }
+    uint64_t identifier = cactusDiskIdentifier;
+    pthread_mutex_unlock(&cactusDiskIdentifierMutex);
+    return identifier;
+}
+
+/*
+ * Removes the files of the directory starting with the prefix but not the current prefix, which
+ * are caches of earlier contents of the cactus disk.
+ */
+static void removeSupersededFiles(const char *directory, const char *prefix, const char *currentPrefix) {
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, prefix, strlen(prefix)) == 0
+                && strncmp(entry->d_name, currentPrefix, strlen(currentPrefix)) != 0) {
+            char *fileName = stString_print("%s/%s", directory, entry->d_name);
+            if (unlink(fileName) == 0) {
+                st_logInfo("Removed the superseded cache %s\n", fileName);
+            }
+            free(fileName);
+        }
+    }
+    closedir(dir);
+}
+
+ContigPathTable *getContigPathTable2(Flower *flower, const char *cactusDiskDirectory,
+        CapCodeParameters *capCodeParameters, stList *assemblyEventStrings, stList *haplotypeEventStrings,
+        stList *contaminationEventStrings) {
+    char *tableFile = NULL, *key = NULL, *currentPrefix = NULL;
+    if (cactusDiskDirectory != NULL) {
+        char *assemblies = stString_join2(",", assemblyEventStrings);
+        char *haplotypes = stString_join2(",", haplotypeEventStrings);
+        char *contaminations = stString_join2(",", contaminationEventStrings);
+        uint64_t identifier = getCactusDiskIdentifier(cactusDiskDirectory);
+        key = stString_print("assemblies=%s haplotypes=%s contamination=%s minimumNCount=%" PRIi64
+                " maxInsertionLength=%" PRIi64 " maxDeletionLength=%" PRIi64 " cactusDisk=%016" PRIx64 "",
+                assemblies, haplotypes, contaminations, capCodeParameters->minimumNCount,
+                capCodeParameters->maxInsertionLength, capCodeParameters->maxDeletionLength, identifier);
+        free(assemblies);
+        free(haplotypes);
+        free(contaminations);
+        //Named for the cactus disk contents then the key, so the tables of earlier contents can be found.
+        //The key itself is checked when the table is loaded.
+        currentPrefix = stString_print("contigPaths.%016" PRIx64 ".", identifier);
+        tableFile = stString_print("%s/%s%016" PRIx64 ".bin", cactusDiskDirectory, currentPrefix,
+                fnvHashString(FNV_INITIAL_HASH, key));
+        ContigPathTable *contigPathTable = contigPathTable_load(tableFile, key);
+        if (contigPathTable != NULL) {
+            st_logInfo("Loaded the contig path table %s\n", tableFile);
+            free(tableFile);
+            free(key);
+            free(currentPrefix);
+            return contigPathTable;
+        }
+    }
+    ContigPathTable *contigPathTable = contigPathTable_construct();
+    for (int64_t i = 0; i < stList_length(assemblyEventStrings); i++) {
+        stList *contigPaths = getContigPaths(flower, stList_get(assemblyEventStrings, i), haplotypeEventStrings);
+        contigPathTable_addContigPaths(contigPathTable, contigPaths, haplotypeEventStrings,
+                contaminationEventStrings, capCodeParameters);
+        stList_destruct(contigPaths);
+    }
+    if (tableFile != NULL) {
+        if (contigPathTable_write(contigPathTable, tableFile, key)) {
+            st_logInfo("Wrote the contig path table %s\n", tableFile);
+            removeSupersededFiles(cactusDiskDirectory, "contigPaths.", currentPrefix);
+        } else {
+            st_logInfo("Could not write the contig path table %s\n", tableFile);
+        }
+        free(tableFile);
+        free(key);
+        free(currentPrefix);
+    }
+    return contigPathTable;
+}
+
+ContigPathTable *getContigPathTable(stList *assemblyEventStrings, stList *haplotypeEventStrings,
+        stList *contaminationEventStrings) {
+    return getContigPathTable2(flower, cactusDiskDirectory, capCodeParameters, assemblyEventStrings,
+            haplotypeEventStrings, contaminationEventStrings);
+}
+
+void loadFlowers(Flower *flower) {
+    Flower_GroupIterator *groupIt = flower_getGroupIterator(flower);
+    Group *group;
+    while ((group = flower_getNextGroup(groupIt)) != NULL) {
+        Flower *nestedFlower = group_getNestedFlower(group);
+        if (nestedFlower != NULL) {
+            loadFlowers(nestedFlower);
+        }
+    }
+    flower_destructGroupIterator(groupIt);
+}
+
+/*
+ * Regions.
+ */
+
+static void addRegion(const char *sequenceName, int64_t start, int64_t end) {
+    Region *region = st_malloc(sizeof(Region));
+    region->sequenceName = stString_copy(sequenceName);
+    region->start = start;
+    region->end = end;
+    if (regions == NULL) {
+        regions = stList_construct();
+    }
+    stList_append(regions, region);
+}
+
+static void parseRegion(const char *regionString) {
+    char *sequenceName;
+    int64_t start, end;
+    if (!mafIndex_parseRegion(regionString, &sequenceName, &start, &end)) {
+        st_errAbort("The region %s is not of the form sequence:start-end or sequence", regionString);
+    }
+    addRegion(sequenceName, start, end);
+    free(sequenceName);
+}
+
+static void readRegionBed(const char *fileName) {
+    FILE *fileHandle = fopen(fileName, "r");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the BED file %s", fileName);
+    }
+    char *line;
+    while ((line = stFile_getLineFromFile(fileHandle)) != NULL) {
+        stList *tokens = stString_split(line);
+        if (stList_length(tokens) > 0 && ((char *) stList_get(tokens, 0))[0] != '#'
+                && strcmp(stList_get(tokens, 0), "track") != 0 && strcmp(stList_get(tokens, 0), "browser") != 0) {
+            int64_t start, end;
+            if (stList_length(tokens) < 3 || sscanf(stList_get(tokens, 1), "%" PRIi64 "", &start) != 1
+                    || sscanf(stList_get(tokens, 2), "%" PRIi64 "", &end) != 1 || start < 0 || end < start) {
+                st_errAbort("The line \"%s\" of the BED file %s is not valid", line, fileName);
+            }
+            addRegion(stList_get(tokens, 0), start, end);
+        }
+        stList_destruct(tokens);
+        free(line);
+    }
+    fclose(fileHandle);
+}
+
+struct _regionSet {
+    stList *regions;
+    stHash *sequenceNamesToRegions; //The regions of each sequence name.
+    MafBuffer *sequenceNameBuffer;
+};
+
+RegionSet *regionSet_construct(stList *regions) {
+    RegionSet *regionSet = st_malloc(sizeof(RegionSet));
+    regionSet->regions = regions;
+    regionSet->sequenceNamesToRegions = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL,
+            (void (*)(void *)) stList_destruct);
+    for (int64_t i = 0; i < stList_length(regions); i++) {
+        Region *region = stList_get(regions, i);
+        stList *sequenceRegions = stHash_search(regionSet->sequenceNamesToRegions, region->sequenceName);
+        if (sequenceRegions == NULL) {
+            sequenceRegions = stList_construct();
+            stHash_insert(regionSet->sequenceNamesToRegions, region->sequenceName, sequenceRegions);
+        }
+        stList_append(sequenceRegions, region);
+    }
+    regionSet->sequenceNameBuffer = mafBuffer_construct();
+    return regionSet;
+}
+
+void regionSet_destruct(RegionSet *regionSet) {
+    stHash_destruct(regionSet->sequenceNamesToRegions);
+    mafBuffer_destruct(regionSet->sequenceNameBuffer);
+    free(regionSet);
+}
+
+static stList *getSequenceRegions(RegionSet *regionSet, Sequence *sequence) {
+    mafBuffer_clear(regionSet->sequenceNameBuffer);
+    mafBuffer_appendSequenceName(regionSet->sequenceNameBuffer, sequence);
+    mafBuffer_appendChar(regionSet->sequenceNameBuffer, '\0');
+    return stHash_search(regionSet->sequenceNamesToRegions, regionSet->sequenceNameBuffer->string);
+}
+
+bool regionSet_overlapsBlock(RegionSet *regionSet, Block *block) {
+    bool overlaps = 0;
+    Block_InstanceIterator *instanceIt = block_getInstanceIterator(block);
+    Segment *segment;
+    while (!overlaps && (segment = block_getNext(instanceIt)) != NULL) {
+        Sequence *sequence = segment_getSequence(segment);
+        stList *sequenceRegions = sequence != NULL ? getSequenceRegions(regionSet, sequence) : NULL;
+        if (sequenceRegions == NULL) {
+            continue;
+        }
+        //Positive strand coordinates, as in the MAF index.
+        int64_t start = segment_getStart(segment);
+        if (!segment_getStrand(segment)) {
+            start -= segment_getLength(segment) - 1;
+        }
+        start -= sequence_getStart(sequence);
+        for (int64_t i = 0; i < stList_length(sequenceRegions); i++) {
+            Region *region = stList_get(sequenceRegions, i);
+            if (start < region->end && start + segment_getLength(segment) > region->start) {
+                overlaps = 1;
+                break;
+            }
+        }
+    }
+    block_destructInstanceIterator(instanceIt);
+    return overlaps;
+}
+
+int64_t regionSet_getSequenceLength(RegionSet *regionSet, Sequence *sequence) {
+    stList *sequenceRegions = getSequenceRegions(regionSet, sequence);
+    int64_t length = 0;
+    for (int64_t i = 0; sequenceRegions != NULL && i < stList_length(sequenceRegions); i++) {
+        Region *region = stList_get(sequenceRegions, i);
+        int64_t end = region->end < sequence_getLength(sequence) ? region->end : sequence_getLength(sequence);
+        if (end > region->start) {
+            length += end - region->start;
+        }
+    }
+    return length;
+}
+
+//The region set of the regions given on the command line, built the first time it is needed.
+static RegionSet *regionSet = NULL;
+
+static RegionSet *getRegionSet(void) {
+    assert(regions != NULL);
+    if (regionSet == NULL) {
+        regionSet = regionSet_construct(regions);
+    }
+    return regionSet;
+}
+
+bool blockOverlapsRegions(Block *block) {
+    return regionSet_overlapsBlock(getRegionSet(), block);
+}
+
+int64_t getSequenceRegionLength(Sequence *sequence) {
+    return regionSet_getSequenceLength(getRegionSet(), sequence);
+}
+
+/*
+ * The region index is a MAF index (see mafIndex.h) of the blocks of the cactus disk, in which the
+ * offsets are those of records in a second file. Each record is the name of the flower containing
+ * the block, then the name of the block.
+ */
+typedef struct _regionIndexBuilder {
+    MafIndex *regionIndex;
+    FILE *fileHandle;
+    int64_t recordNumber;
+    bool failed; //Set if a record could not be written.
+} RegionIndexBuilder;
+
+static void addBlockToRegionIndex(Block *block, RegionIndexBuilder *regionIndexBuilder) {
+    Name names[2] = { flower_getName(block_getFlower(block)), block_getName(block) };
+    mafIndex_addBlock(regionIndexBuilder->regionIndex, block, regionIndexBuilder->recordNumber++ * sizeof(names));
+    if (fwrite(names, sizeof(Name), 2, regionIndexBuilder->fileHandle) != 2) {
+        regionIndexBuilder->failed = 1;
+    }
+}
+
+//Numbers the temporary files of the process, which may build indexes in several threads.
+static int64_t temporaryFileNumber = 0;
+
+/*
+ * Sets the directory of the region index and the prefix of its files, and of those of the indexes
+ * of earlier contents of the cactus disk. They are kept in the cactus disk directory if it is
+ * writable, else in the temporary directory, named for the cactus disk directory as well as its
+ * contents, as the indexes of other cactus disks are there too.
+ */
+static void getRegionIndexLocation(const BlockTraversal *blockTraversal, char **directory, char **prefix,
+        char **currentPrefix) {
+    if (access(blockTraversal->cactusDiskDirectory, W_OK) == 0) {
+        *directory = stString_copy(blockTraversal->cactusDiskDirectory);
+        *prefix = stString_copy("blocks.");
+    } else {
+        *directory = stString_copy(getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp");
+        *prefix = stString_print("assemblaBlocks.%016" PRIx64 ".",
+                fnvHashString(FNV_INITIAL_HASH, blockTraversal->cactusDiskDirectory));
+    }
+    *currentPrefix = stString_print("%s%016" PRIx64 ".", *prefix,
+            getCactusDiskIdentifier(blockTraversal->cactusDiskDirectory));
+}
+
+/*
+ * Sets the files of the region index.
+ */
+static void getRegionIndexFiles(const BlockTraversal *blockTraversal, char **indexFile, char **recordsFile) {
+    char *directory, *prefix, *currentPrefix;
+    getRegionIndexLocation(blockTraversal, &directory, &prefix, &currentPrefix);
+    *indexFile = stString_print("%s/%sidx", directory, currentPrefix);
+    *recordsFile = stString_print("%s/%srec", directory, currentPrefix);
+    free(directory);
+    free(prefix);
+    free(currentPrefix);
+}
+
+/*
+ * Removes the region indexes of earlier contents of the cactus disk.
+ */
+static void removeSupersededRegionIndexes(const BlockTraversal *blockTraversal) {
+    char *directory, *prefix, *currentPrefix;
+    getRegionIndexLocation(blockTraversal, &directory, &prefix, &currentPrefix);
+    removeSupersededFiles(directory, prefix, currentPrefix);
+    free(directory);
+    free(prefix);
+    free(currentPrefix);
+}
+
+/*
+ * Builds the region index in the given files, returning zero, having logged why and removed the
+ * files, if they could not be written.
+ */
+static bool writeRegionIndex(const BlockTraversal *blockTraversal, const char *indexFile, const char *recordsFile) {
+    //Written to temporary files then renamed, the records first, so a script running at
+    //the same time never reads part of an index.
+    int64_t i = __sync_fetch_and_add(&temporaryFileNumber, 1);
+    char *tempIndexFile = stString_print("%s.%" PRIi64 ".%" PRIi64 ".tmp", indexFile, (int64_t) getpid(), i);
+    char *tempRecordsFile = stString_print("%s.%" PRIi64 ".%" PRIi64 ".tmp", recordsFile, (int64_t) getpid(), i);
+    RegionIndexBuilder regionIndexBuilder;
+    regionIndexBuilder.fileHandle = fopen(tempRecordsFile, "w");
+    if (regionIndexBuilder.fileHandle == NULL) {
+        st_logInfo("Could not open the region index records %s for writing\n", tempRecordsFile);
+        free(tempIndexFile);
+        free(tempRecordsFile);
+        return 0;
+    }
+    regionIndexBuilder.regionIndex = mafIndex_construct();
+    regionIndexBuilder.recordNumber = 0;
+    regionIndexBuilder.failed = 0;
+    stList *processedFlowers = stList_construct();
+    //The index is shared by all runs, so holds every block, whatever the sample or shard.
+    getMAFsBoundedP(blockTraversal, blockTraversal->flower, (void (*)(Block *, void *)) addBlockToRegionIndex,
+            &regionIndexBuilder, processedFlowers, 1, 1);
+    stList_destruct(processedFlowers);
+    bool written = fclose(regionIndexBuilder.fileHandle) == 0 && !regionIndexBuilder.failed;
+    if (written) {
+        //The records file could be written, so the index file can be opened alongside it.
+        mafIndex_write(regionIndexBuilder.regionIndex, NULL, tempIndexFile);
+        written = rename(tempRecordsFile, recordsFile) == 0 && rename(tempIndexFile, indexFile) == 0;
+    }
+    mafIndex_destruct(regionIndexBuilder.regionIndex);
+    if (written) {
+        st_logInfo("Wrote the region index %s of %" PRIi64 " blocks\n", indexFile, regionIndexBuilder.recordNumber);
+        removeSupersededRegionIndexes(blockTraversal);
+    } else {
+        st_logInfo("Could not write the region index %s\n", indexFile);
+        unlink(tempRecordsFile);
+        unlink(tempIndexFile);
+    }
+    free(tempIndexFile);
+    free(tempRecordsFile);
+    return written;
+}
+
+/*
+ * The region index of the cactus disk, built if there is none, or NULL if it could not be
+ * written, in which case the blocks must be found by checking all of them.
+ */
+static MafIndex *getRegionIndex(const BlockTraversal *blockTraversal, char **recordsFile) {
+    char *indexFile;
+    getRegionIndexFiles(blockTraversal, &indexFile, recordsFile);
+    if ((access(indexFile, R_OK) != 0 || access(*recordsFile, R_OK) != 0)
+            && !writeRegionIndex(blockTraversal, indexFile, *recordsFile)) {
+        free(indexFile);
+        free(*recordsFile);
+        return NULL;
+    }
+    MafIndex *mafIndex = mafIndex_read(indexFile);
+    free(indexFile);
+    return mafIndex;
+}
+
+static void getMAFsInRegionsP(const BlockTraversal *blockTraversal, Flower *flower,
+        void(*blockFn)(Block *, void *), void *extraArg, bool topLevel) {
+    if (!topLevel || blockTraversal->shardIndex == 0) {
+        Flower_BlockIterator *blockIt = flower_getBlockIterator(flower);
+        Block *block;
+        while ((block = flower_getNextBlock(blockIt)) != NULL) {
+            if (regionSet_overlapsBlock(blockTraversal->regionSet, block)
+                    && isBlockInSample(block, blockTraversal->sampleFraction, blockTraversal->sampleSeed)) {
+                blockFn(block, extraArg);
+            }
+        }
+        flower_destructBlockIterator(blockIt);
+    }
+    Flower_GroupIterator *groupIt = flower_getGroupIterator(flower);
+    Group *group;
+    int64_t groupIndex = 0;
+    while ((group = flower_getNextGroup(groupIt)) != NULL) {
+        if (group_getNestedFlower(group) != NULL && (!topLevel || isInShard(blockTraversal, groupIndex++))) {
+            getMAFsInRegionsP(blockTraversal, group_getNestedFlower(group), blockFn, extraArg, 0);
+        }
+    }
+    flower_destructGroupIterator(groupIt);
+}
+
+static void getMAFsInRegionsIndexed(const BlockTraversal *blockTraversal, void(*blockFn)(Block *, void *),
+        void *extraArg) {
+    char *recordsFile;
+    MafIndex *mafIndex = getRegionIndex(blockTraversal, &recordsFile);
+    if (mafIndex == NULL) {
+        st_logInfo("Checking every block for the regions, without an index\n");
+        getMAFsInRegionsP(blockTraversal, blockTraversal->flower, blockFn, extraArg, 1);
+        return;
+    }
+    stSortedSet *offsets = stSortedSet_construct3((int (*)(const void *, const void *)) stIntTuple_cmpFn,
+            (void (*)(void *)) stIntTuple_destruct);
+    stList *regions = blockTraversal->regionSet->regions;
+    for (int64_t i = 0; i < stList_length(regions); i++) {
+        Region *region = stList_get(regions, i);
+        stList *regionOffsets = mafIndex_getOverlappingOffsets(mafIndex, region->sequenceName, region->start,
+                region->end);
+        stList_setDestructor(regionOffsets, NULL);
+        for (int64_t j = 0; j < stList_length(regionOffsets); j++) {
+            stIntTuple *offset = stList_get(regionOffsets, j);
+            if (stSortedSet_search(offsets, offset) == NULL) {
+                stSortedSet_insert(offsets, offset);
+            } else {
+                stIntTuple_destruct(offset);
+            }
+        }
+        stList_destruct(regionOffsets);
+    }
+    mafIndex_destruct(mafIndex);
+
+    //The offsets are in the order the index was built in, which is that of getMAFs. The blocks are
+    //all found before any is visited, so if the records are not readable or do not match the
+    //cactus disk the blocks can be found by checking every block instead.
+    stList *offsetList = stSortedSet_getList(offsets);
+    stList *blocks = stList_construct();
+    FILE *recordsHandle = fopen(recordsFile, "r");
+    bool matched = recordsHandle != NULL;
+    for (int64_t i = 0; i < stList_length(offsetList) && matched; i++) {
+        if (!isInShard(blockTraversal, i)) { //The blocks are dealt out between the shards in index order.
+            continue;
+        }
+        Name names[2];
+        if (fseek(recordsHandle, stIntTuple_get(stList_get(offsetList, i), 0), SEEK_SET) != 0
+                || fread(names, sizeof(Name), 2, recordsHandle) != 2) {
+            matched = 0;
+            break;
+        }
+        Flower *blockFlower = cactusDisk_getFlower(blockTraversal->cactusDisk, names[0]);
+        Block *block = blockFlower != NULL ? flower_getBlock(blockFlower, names[1]) : NULL;
+        if (block == NULL) {
+            matched = 0;
+            break;
+        }
+        stList_append(blocks, block);
+    }
+    if (recordsHandle != NULL) {
+        fclose(recordsHandle);
+    }
+    if (matched) {
+        int64_t visitedBlockNumber = 0;
+        for (int64_t i = 0; i < stList_length(blocks); i++) {
+            Block *block = stList_get(blocks, i);
+            if (isBlockInSample(block, blockTraversal->sampleFraction, blockTraversal->sampleSeed)) {
+                blockFn(block, extraArg);
+                visitedBlockNumber++;
+            }
+        }
+        st_logInfo("Visited %" PRIi64 " of the %" PRIi64 " blocks overlapping the regions, in the shard and sample\n",
+                visitedBlockNumber, stList_length(offsetList));
+    } else {
+        st_logInfo("The region index records %s do not match the cactus disk, checking every block\n",
+                recordsFile);
+        getMAFsInRegionsP(blockTraversal, blockTraversal->flower, blockFn, extraArg, 1);
+    }
+    stList_destruct(blocks);
+    stList_destruct(offsetList);
+    stSortedSet_destruct(offsets);
+    free(recordsFile);
+}
+
+void blockTraversal_run(const BlockTraversal *blockTraversal, void(*blockFn)(Block *, void *), void *extraArg) {
+    if (blockTraversal->regionSet == NULL) {
+        stList *processedFlowers = stList_construct();
+        getMAFsBoundedP(blockTraversal, blockTraversal->flower, blockFn, extraArg, processedFlowers, 1, 0);
+        stList_destruct(processedFlowers);
+    } else if (blockTraversal->cactusDiskDirectory == NULL) {
+        //There is nowhere to keep an index, so every block is checked.
+        getMAFsInRegionsP(blockTraversal, blockTraversal->flower, blockFn, extraArg, 1);
+    } else {
+        getMAFsInRegionsIndexed(blockTraversal, blockFn, extraArg);
+    }
+}
+
+/*
+ * The traversal of getMAFsBounded and getMAFsInRegions, from the command line parameters.
+ */
+static void getBasicBlockTraversal(BlockTraversal *blockTraversal, Flower *flower) {
+    blockTraversal->flower = flower;
+    blockTraversal->cactusDisk = cactusDisk;
+    blockTraversal->cactusDiskDirectory = cactusDiskDirectory;
+    blockTraversal->regionSet = regions != NULL ? getRegionSet() : NULL;
+    blockTraversal->sampleFraction = sampleFraction;
+    blockTraversal->sampleSeed = sampleSeed;
+    blockTraversal->shardIndex = shardIndex;
+    blockTraversal->shardNumber = shardNumber;
+    blockTraversal->maximumMemory = maximumMemory;
+}
+
+/*
+ * A block function of the old form, taking the file handle passed to getMAFsBounded.
+ */
+typedef struct _fileBlockFn {
+    void (*blockFn)(Block *, FILE *);
+    FILE *fileHandle;
+} FileBlockFn;
+
+static void callFileBlockFn(Block *block, FileBlockFn *fileBlockFn) {
+    fileBlockFn->blockFn(block, fileBlockFn->fileHandle);
+}
+
+void getMAFsBounded(Flower *flower, FILE *fileHandle, void(*blockFn)(Block *, FILE *)) {
+    BlockTraversal blockTraversal;
+    getBasicBlockTraversal(&blockTraversal, flower);
+    FileBlockFn fileBlockFn = { blockFn, fileHandle };
+    blockTraversal_run(&blockTraversal, (void (*)(Block *, void *)) callFileBlockFn, &fileBlockFn);
+}
+
+void getMAFsInRegions(FILE *fileHandle, void(*blockFn)(Block *, FILE *)) {
+    assert(regions != NULL);
+    getMAFsBounded(flower, fileHandle, blockFn);
+}
+
+/*
+ * Block sampling.
+ */
+
+bool isBlockInSample(Block *block, double fraction, int64_t seed) {
+    COUNT(blocksVisited);
+    if (fraction >= 1.0) {
+        return 1;
+    }
+    //A hash of the block name and the seed, mapped to [0, 1).
+    uint64_t i = (uint64_t) block_getName(block) ^ ((uint64_t) seed * 0x9e3779b97f4a7c15ULL);
+    i ^= i >> 33;
+    i *= 0xff51afd7ed558ccdULL;
+    i ^= i >> 33;
+    i *= 0xc4ceb9fe1a85ec53ULL;
+    i ^= i >> 33;
+    if ((i >> 11) * (1.0 / 9007199254740992.0) < fraction) {
+        return 1;
+    }
+    COUNT(blocksNotSampled);
+    return 0;
+}
+
+bool isBlockSampled(Block *block) {
+    return isBlockInSample(block, sampleFraction, sampleSeed);
+}
+
+double sampledTotal_getEstimate2(const SampledTotal *sampledTotal, double fraction) {
+    return sampledTotal->sum / fraction;
+}
+
+double sampledTotal_getStandardError2(const SampledTotal *sampledTotal, double fraction) {
+    return sqrt((1.0 - fraction) * sampledTotal->sumOfSquares) / fraction;
+}
+
+double sampledTotal_getEstimate(const SampledTotal *sampledTotal) {
+    return sampledTotal_getEstimate2(sampledTotal, sampleFraction);
+}
+
+double sampledTotal_getStandardError(const SampledTotal *sampledTotal) {
+    return sampledTotal_getStandardError2(sampledTotal, sampleFraction);
+}
+
+/*
+ * Sharding.
+ */
+
+FILE *shardFile_construct(const char *fileName, const char *programName) {
+    FILE *fileHandle = fopen(fileName, "w");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the shard file %s", fileName);
+    }
+    fprintf(fileHandle, "assemblaShard\t%s\t%" PRIi64 "\t%" PRIi64 "\t%.17g\n", programName, shardIndex, shardNumber,
+            sampleFraction);
+    return fileHandle;
+}
+
+void mergeShardFiles(const char *assemblyEventString, const char *programName,
+        void(*readFn)(FILE *fileHandle, const char *fileName, void *extraArg), void *extraArg) {
+    int64_t fileShardNumber = -1;
+    bool *merged = NULL;
+    for (int64_t i = 0; i < stList_length(shardFiles); i++) {
+        char *fileName = getAssemblyFileName(stList_get(shardFiles, i), assemblyEventString);
+        FILE *fileHandle = fopen(fileName, "r");
+        if (fileHandle == NULL) {
+            st_errAbort("Could not open the shard file %s", fileName);
+        }
+        char fileProgramName[100];
+        int64_t fileShardIndex, j;
+        double fileSampleFraction;
+        if (fscanf(fileHandle, "assemblaShard\t%99s\t%" PRIi64 "\t%" PRIi64 "\t%lf\n", fileProgramName, &fileShardIndex,
+                &j, &fileSampleFraction) != 4 || strcmp(fileProgramName, programName) != 0) {
+            st_errAbort("The file %s is not a %s shard file", fileName, programName);
+        }
+        if (merged == NULL) {
+            fileShardNumber = j;
+            merged = st_calloc(fileShardNumber, sizeof(bool));
+        }
+        if (j != fileShardNumber || fileShardIndex < 0 || fileShardIndex >= fileShardNumber) {
+            st_errAbort("The shard file %s is from a split into %" PRIi64 " shards, not %" PRIi64 "", fileName, j,
+                    fileShardNumber);
+        }
+        if (merged[fileShardIndex]) {
+            st_errAbort("The shard %" PRIi64 " is given twice, in %s", fileShardIndex, fileName);
+        }
+        if (fileSampleFraction != sampleFraction) {
+            st_errAbort("The shard file %s was made with a sample fraction of %f, not %f", fileName,
+                    fileSampleFraction, sampleFraction);
+        }
+        merged[fileShardIndex] = 1;
+        readFn(fileHandle, fileName, extraArg);
+        fclose(fileHandle);
+        free(fileName);
+    }
+    for (int64_t i = 0; i < fileShardNumber; i++) {
+        if (!merged[i]) {
+            st_errAbort("The shard %" PRIi64 " of %" PRIi64 " is missing", i, fileShardNumber);
+        }
+    }
+    free(merged);
+}
+
+char *getAssemblyFileName(const char *fileName, const char *assemblyEventString) {
+    if (stList_length(assemblyEventStrings) == 1) {
+        return stString_copy(fileName);
+    }
+    return stString_print("%s.%s", fileName, assemblyEventString);
+}
+
+int64_t getAssemblyIndex(const char *eventString) {
+    for (int64_t i = 0; i < stList_length(assemblyEventStrings); i++) {
+        if (strcmp(eventString, stList_get(assemblyEventStrings, i)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 void basicUsage(const char *programName) {
     fprintf(stderr, "%s\n", programName);
     fprintf(stderr, "-a --logLevel : Set the log level\n");
@@ -78,7 +1251,7 @@ void basicUsage(const char *programName) {
     fprintf(stderr,
             "-o --maximumInsertionLength : Maximum length of insertion\n");
 
-    fprintf(stderr, "-p --assemblyEventString : The assembly event string\n");
+    fprintf(stderr, "-p --assemblyEventString : The assembly event string, may be given more than once to evaluate several assemblies\n");
     fprintf(stderr,
             "-q --haplotype1EventString : The haplotype 1 event string\n");
     fprintf(stderr,
@@ -105,6 +1278,46 @@ void basicUsage(const char *programName) {
             "-B --treatHaplotype2AsContamination : For phasing, treat haplotype 1 like contamination\n");
     fprintf(stderr,
             "-C --printHetPositions : Print out valid heterozygous columns\n");
+    fprintf(stderr,
+            "-D --compressOutput : Write the output as BGZF compressed blocks\n");
+    fprintf(stderr, "-E --numberOfThreads : Number of threads used to format and compress the annotated MAF\n");
+    fprintf(stderr,
+            "-F --writeMafIndex : Write a coordinate index of the MAF, for use with mafRegionQuery\n");
+    fprintf(stderr,
+            "-G --annotationTable : Instead of the MAF write a table (tsv or binary) of the annotation of each assembly segment\n");
+    fprintf(stderr,
+            "-H --maximumMemory : Unload the processed nested flowers once using more than this many bytes\n");
+    fprintf(stderr,
+            "-I --metricsRowFile : Also write the summary metrics as a row for aggregateStats.py\n");
+    fprintf(stderr,
+            "-J --region : Only evaluate the blocks overlapping this region, as sequence:start-end (zero based, half open) or sequence, may be repeated\n");
+    fprintf(stderr,
+            "-K --regionBed : Only evaluate the blocks overlapping the regions in this BED file\n");
+    fprintf(stderr, "-L --windowSize : The size of the windows of the window tracks\n");
+    fprintf(stderr,
+            "-M --sampleFraction : Only evaluate this fraction of the blocks, extrapolating the totals with standard errors\n");
+    fprintf(stderr, "-N --sampleSeed : The seed choosing the sampled blocks\n");
+    fprintf(stderr,
+            "-O --shard : Only evaluate the shard i of n (given as i/n) of the top level groups, writing the partial results to the output file\n");
+    fprintf(stderr,
+            "-P --mergeShards : Merge this shard file into the results in place of reading the cactus disk, may be repeated\n");
+    fprintf(stderr,
+            "-Q --socket : Serve metric requests on this Unix domain socket, in place of writing an output file\n");
+    fprintf(stderr,
+            "-R --capSitesFile : Also write the position of each haplotype switch, gap, contig end and error of the contig paths, as a BED file\n");
+    fprintf(stderr,
+            "-S --contigSummaryFile : Also write a table of the cap sites of each contig\n");
+    fprintf(stderr,
+            "-T --coveragePlotMaximumLength : The length the bins of the coverage plots go up to, by default the longest length plotted\n");
+    fprintf(stderr, "-U --coveragePlotBinsPerDecade : The number of bins of the coverage plots per power of ten\n");
+    fprintf(stderr,
+            "-V --compressCoveragePlotBins : Leave out the bins of the coverage plots with no lengths in them\n");
+    fprintf(stderr, "-W --coveragePlotFormat : Write the coverage plots as tsv (the default) or binary\n");
+    fprintf(stderr,
+            "-X --linkagePrecision : Sample the linkage in rounds until the 95%% interval of each bucket is within this of its ratio, up to the sample number\n");
+    fprintf(stderr, "-Y --linkageTimeBudget : Stop sampling the linkage in rounds after this many seconds\n");
+    fprintf(stderr,
+            "-Z --verifyMaf : Check every MAF block formatted natively against getMAFBlock, failing if one differs\n");
 }
 
 int parseBasicArguments(int argc, char *argv[], const char *programName) {
@@ -116,6 +1329,7 @@ int parseBasicArguments(int argc, char *argv[], const char *programName) {
     int64_t k;
     capCodeParameters = capCodeParameters_construct(25, INT64_MAX, 100000);
     assemblyEventString = NULL;
+    assemblyEventStrings = stList_construct3(0, free);
     hap1EventString = NULL;
     hap2EventString = NULL;
     contaminationEventString = NULL;
@@ -144,13 +1358,36 @@ int parseBasicArguments(int argc, char *argv[], const char *programName) {
                 "sampleNumber", required_argument, 0, 'z' }, {
                 "treatHaplotype1AsContamination", no_argument, 0, 'A' }, {
                 "treatHaplotype2AsContamination", no_argument, 0, 'B' }, {
-                "printHetPositions", no_argument, 0, 'C' },
+                "printHetPositions", no_argument, 0, 'C' }, {
+                "compressOutput", no_argument, 0, 'D' }, {
+                "numberOfThreads", required_argument, 0, 'E' }, {
+                "writeMafIndex", no_argument, 0, 'F' }, {
+                "annotationTable", required_argument, 0, 'G' }, {
+                "maximumMemory", required_argument, 0, 'H' }, {
+                "metricsRowFile", required_argument, 0, 'I' }, {
+                "region", required_argument, 0, 'J' }, {
+                "regionBed", required_argument, 0, 'K' }, {
+                "windowSize", required_argument, 0, 'L' }, {
+                "sampleFraction", required_argument, 0, 'M' }, {
+                "sampleSeed", required_argument, 0, 'N' }, {
+                "shard", required_argument, 0, 'O' }, {
+                "mergeShards", required_argument, 0, 'P' }, {
+                "socket", required_argument, 0, 'Q' }, {
+                "capSitesFile", required_argument, 0, 'R' }, {
+                "contigSummaryFile", required_argument, 0, 'S' }, {
+                "coveragePlotMaximumLength", required_argument, 0, 'T' }, {
+                "coveragePlotBinsPerDecade", required_argument, 0, 'U' }, {
+                "compressCoveragePlotBins", no_argument, 0, 'V' }, {
+                "coveragePlotFormat", required_argument, 0, 'W' }, {
+                "linkagePrecision", required_argument, 0, 'X' }, {
+                "linkageTimeBudget", required_argument, 0, 'Y' }, {
+                "verifyMaf", no_argument, 0, 'Z' },
                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
 
         int key = getopt_long(argc, argv,
-                "a:c:e:hm:n:o:p:q:r:s:t:u:v:wx:y:z:ABCD", long_options,
+                "a:c:e:hm:n:o:p:q:r:s:t:u:v:wx:y:z:ABCDE:FG:H:I:J:K:L:M:N:O:P:Q:R:S:T:U:VW:X:Y:Z", long_options,
                 &option_index);
 
         if (key == -1) {
@@ -185,7 +1422,10 @@ int parseBasicArguments(int argc, char *argv[], const char *programName) {
                 assert(k == 1);
                 break;
             case 'p':
-                assemblyEventString = stString_copy(optarg);
+                stList_append(assemblyEventStrings, stString_copy(optarg));
+                if (assemblyEventString == NULL) {
+                    assemblyEventString = stList_get(assemblyEventStrings, 0);
+                }
                 break;
             case 'q':
                 hap1EventString = stString_copy(optarg);
@@ -252,6 +1492,124 @@ int parseBasicArguments(int argc, char *argv[], const char *programName) {
             case 'C':
                 printHetPositions = 1;
                 break;
+            case 'D':
+                compressOutput = 1;
+                break;
+            case 'E':
+                k = sscanf(optarg, "%" PRIi64 "", &numberOfThreads);
+                assert(k == 1);
+                if (numberOfThreads < 1) {
+                    st_errAbort(
+                            "The number of threads can not be less than 1: %" PRIi64 "",
+                            numberOfThreads);
+                }
+                break;
+            case 'F':
+                writeMafIndex = 1;
+                break;
+            case 'G':
+                annotationTableFormat = stString_copy(optarg);
+                if (strcmp(annotationTableFormat, "tsv") != 0 && strcmp(annotationTableFormat, "binary") != 0) {
+                    st_errAbort("The annotation table format must be tsv or binary: %s", annotationTableFormat);
+                }
+                break;
+            case 'H':
+                k = sscanf(optarg, "%" PRIi64 "", &maximumMemory);
+                assert(k == 1);
+                if (maximumMemory < 0) {
+                    st_errAbort("The maximum memory can not be negative: %" PRIi64 "", maximumMemory);
+                }
+                break;
+            case 'I':
+                metricsRowFile = stString_copy(optarg);
+                break;
+            case 'J':
+                parseRegion(optarg);
+                break;
+            case 'K':
+                readRegionBed(optarg);
+                break;
+            case 'L':
+                k = sscanf(optarg, "%" PRIi64 "", &windowSize);
+                assert(k == 1);
+                if (windowSize < 1) {
+                    st_errAbort("The window size can not be less than 1: %" PRIi64 "", windowSize);
+                }
+                break;
+            case 'M':
+                k = sscanf(optarg, "%lf", &sampleFraction);
+                assert(k == 1);
+                if (sampleFraction <= 0.0 || sampleFraction > 1.0) {
+                    st_errAbort("The sample fraction must be greater than 0 and at most 1: %f", sampleFraction);
+                }
+                break;
+            case 'N':
+                k = sscanf(optarg, "%" PRIi64 "", &sampleSeed);
+                assert(k == 1);
+                break;
+            case 'O':
+                k = sscanf(optarg, "%" PRIi64 "/%" PRIi64 "", &shardIndex, &shardNumber);
+                if (k != 2 || shardNumber < 1 || shardIndex < 0 || shardIndex >= shardNumber) {
+                    st_errAbort("The shard must be given as i/n, with 0 <= i < n: %s", optarg);
+                }
+                break;
+            case 'P':
+                if (shardFiles == NULL) {
+                    shardFiles = stList_construct3(0, free);
+                }
+                stList_append(shardFiles, stString_copy(optarg));
+                break;
+            case 'Q':
+                socketPath = stString_copy(optarg);
+                break;
+            case 'R':
+                capSitesFile = stString_copy(optarg);
+                break;
+            case 'S':
+                contigSummaryFile = stString_copy(optarg);
+                break;
+            case 'T':
+                k = sscanf(optarg, "%" PRIi64 "", &coveragePlotMaximumLength);
+                assert(k == 1);
+                if (coveragePlotMaximumLength < 1) {
+                    st_errAbort("The coverage plot maximum length can not be less than 1: %" PRIi64 "",
+                            coveragePlotMaximumLength);
+                }
+                break;
+            case 'U':
+                k = sscanf(optarg, "%" PRIi64 "", &coveragePlotBinsPerDecade);
+                assert(k == 1);
+                if (coveragePlotBinsPerDecade < 1) {
+                    st_errAbort("The coverage plot bins per decade can not be less than 1: %" PRIi64 "",
+                            coveragePlotBinsPerDecade);
+                }
+                break;
+            case 'V':
+                compressCoveragePlotBins = 1;
+                break;
+            case 'W':
+                if (strcmp(optarg, "tsv") != 0 && strcmp(optarg, "binary") != 0) {
+                    st_errAbort("The coverage plot format must be tsv or binary: %s", optarg);
+                }
+                coveragePlotIsBinary = strcmp(optarg, "binary") == 0;
+                break;
+            case 'X':
+                k = sscanf(optarg, "%lf", &linkagePrecision);
+                assert(k == 1);
+                if (linkagePrecision <= 0.0 || linkagePrecision >= 1.0) {
+                    st_errAbort("The linkage precision must be greater than 0 and less than 1: %f", linkagePrecision);
+                }
+                break;
+            case 'Y':
+                k = sscanf(optarg, "%" PRIi64 "", &linkageTimeBudget);
+                assert(k == 1);
+                if (linkageTimeBudget < 1) {
+                    st_errAbort("The linkage time budget can not be less than 1: %" PRIi64 "", linkageTimeBudget);
+                }
+                break;
+            case 'Z':
+                verifyMaf = 1;
+                break;
             default:
                 st_errAbort("Unrecognised option %s", optarg);
                 break;
@@ -264,9 +1622,20 @@ int parseBasicArguments(int argc, char *argv[], const char *programName) {
 
     st_setLogLevelFromString(logLevelString);
 
-    if (outputFile == NULL) {
+    if (outputFile == NULL && socketPath == NULL) {
         st_errAbort("The output file was not specified");
     }
+    if ((shardNumber > 1 || shardFiles != NULL) && !shardsSupported) {
+        st_errAbort("%s can not be run in shards", programName);
+    }
+    if (shardNumber > 1 && shardFiles != NULL) {
+        st_errAbort("The shards can not be both evaluated and merged in one run");
+    }
+    if (shardFiles != NULL) {
+        //The results come from the shard files, so the cactus disk is not loaded and flower is NULL.
+        free(cactusDiskDatabaseString);
+        return 0;
+    }
     if (cactusDiskDatabaseString == NULL) {
         st_errAbort("The cactus disk string was not specified");
     }
@@ -283,16 +1652,20 @@ int parseBasicArguments(int argc, char *argv[], const char *programName) {
         st_errAbort("The contamination event string was not specified");
     }
 
-    assert(outputFile != NULL);
+    assert(outputFile != NULL || socketPath != NULL);
     assert(cactusDiskDatabaseString != NULL);
 
     //////////////////////////////////////////////
     //Log (some of) the inputs
     //////////////////////////////////////////////
 
-    st_logInfo("Output graph file : %s\n", outputFile);
+    if (outputFile != NULL) {
+        st_logInfo("Output graph file : %s\n", outputFile);
+    }
     st_logInfo("The cactus disk string : %s\n", cactusDiskDatabaseString);
-    st_logInfo("The assembly event string : %s\n", assemblyEventString);
+    for (int64_t i = 0; i < stList_length(assemblyEventStrings); i++) {
+        st_logInfo("The assembly event string : %s\n", stList_get(assemblyEventStrings, i));
+    }
     st_logInfo("The haplotype 1 event string : %s\n", hap1EventString);
     st_logInfo("The haplotype 2 event string : %s\n", hap2EventString);
     st_logInfo("The contamination event string : %s\n",
@@ -305,6 +1678,9 @@ int parseBasicArguments(int argc, char *argv[], const char *programName) {
     stKVDatabaseConf *kvDatabaseConf = stKVDatabaseConf_constructFromString(
             cactusDiskDatabaseString);
     cactusDisk = cactusDisk_construct(kvDatabaseConf, 0);
+    if (stKVDatabaseConf_getDir(kvDatabaseConf) != NULL) {
+        cactusDiskDirectory = stString_copy(stKVDatabaseConf_getDir(kvDatabaseConf));
+    }
     st_logInfo("Set up the cactus disk\n");
 
     //////////////////////////////////////////////
@@ -0,0 +1,446 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten (at) gmail.com) and Dent Earl (dearl (at) soe.ucsc.edu)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * Keeps a cactus disk loaded and serves the path, substitution and copy number stats on a Unix
+ * domain socket, so repeated queries do not each pay for loading the disk and its flowers. The
+ * contig path tables are kept too, by assemblies and parameters. The client is bin/assemblaQuery.py.
+ *
+ * The daemon takes the options of the scripts, with --socket in place of --outputFile; those of
+ * the metrics are the defaults of the requests. A request is one line:
+ *
+ * metric [--option value | --flag]...
+ *
+ * where the metric is pathStats, substitutionStats, copyNumberStats or shutdown, and the options
+ * are those of the scripts listed in parseRequest. The reply is, for each assembly,
+ *
+ * result <tab> assemblyEventString <tab> byteNumber <newline> the XML of the script
+ *
+ * then a line "end", or else a line "error <tab> message". The connection is then closed.
+ *
+ * A client has REQUEST_TIMEOUT seconds to send its request, and each write of the reply times out
+ * after as long, so a stalled client can not hold up the daemon. Requests for assemblies or
+ * sequences not in the alignment are refused before they are run.
+ */
+
+//For the sockets, and S_ISSOCK.
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "cactus.h"
+#include "sonLib.h"
+#include "adjacencyClassification.h"
+#include "mafWriter.h"
+#include "mafIndex.h"
+#include "assemblaCommon.h"
+#include "assemblaMetrics.h"
+
+//The longest request line read.
+#define MAXIMUM_REQUEST_LENGTH 1000000
+
+//The seconds a client has to send its request, and that each write of a reply can block for.
+#define REQUEST_TIMEOUT 30
+
+//The contig path tables kept between the requests, the least recently used being freed first.
+#define MAXIMUM_CONTIG_PATH_TABLES 4
+
+//The names of the sequences of the alignment, as in the regions of the requests.
+static stSet *sequenceNames;
+
+typedef struct _request {
+    const char *metric;
+    AssemblaParameters parameters;
+    CapCodeParameters capCodeParameters;
+    stList *assemblyEventStrings; //The strings are those of the tokens.
+    stList *regions;
+    stList *tokens;
+} Request;
+
+static void request_destruct(Request *request) {
+    stList_destruct(request->assemblyEventStrings);
+    if (request->regions != NULL) {
+        for (int64_t i = 0; i < stList_length(request->regions); i++) {
+            Region *region = stList_get(request->regions, i);
+            free(region->sequenceName);
+            free(region);
+        }
+        stList_destruct(request->regions);
+    }
+    stList_destruct(request->tokens);
+}
+
+static bool parseInt(const char *string, int64_t *i) {
+    int n;
+    return sscanf(string, "%" PRIi64 "%n", i, &n) == 1 && string[n] == '\0';
+}
+
+static char *parseRequest(char *line, const AssemblaParameters *defaults, Request *request) {
+    /*
+     * Parses the request line, returning NULL or else an error message, which the caller frees.
+     */
+    request->tokens = stString_split(line);
+    request->assemblyEventStrings = stList_construct();
+    request->regions = NULL;
+    request->parameters = *defaults;
+    request->capCodeParameters = *defaults->capCodeParameters;
+    request->parameters.capCodeParameters = &request->capCodeParameters;
+    //Each request is one run, of every block of the disk.
+    request->parameters.keepErrorPositions = 0;
+    request->parameters.shardIndex = 0;
+    request->parameters.shardNumber = 1;
+    if (stList_length(request->tokens) == 0) {
+        return stString_copy("The request is empty");
+    }
+    request->metric = stList_get(request->tokens, 0);
+    for (int64_t i = 1; i < stList_length(request->tokens); i++) {
+        const char *option = stList_get(request->tokens, i);
+        if (strcmp(option, "--treatHaplotype1AsContamination") == 0) {
+            request->parameters.treatHaplotype1AsContamination = 1;
+            continue;
+        }
+        if (strcmp(option, "--treatHaplotype2AsContamination") == 0) {
+            request->parameters.treatHaplotype2AsContamination = 1;
+            continue;
+        }
+        if (i + 1 == stList_length(request->tokens)) {
+            return stString_print("The option %s has no value", option);
+        }
+        const char *value = stList_get(request->tokens, ++i);
+        bool valid = 1;
+        if (strcmp(option, "--assemblyEventString") == 0) {
+            stList_append(request->assemblyEventStrings, (void *) value);
+        } else if (strcmp(option, "--minimumBlockLength") == 0) {
+            valid = parseInt(value, &request->parameters.minimumBlockLength);
+        } else if (strcmp(option, "--ignoreFirstNBasesOfBlock") == 0) {
+            valid = parseInt(value, &request->parameters.ignoreFirstNBasesOfBlock);
+        } else if (strcmp(option, "--minimumIdentity") == 0) {
+            valid = parseInt(value, &request->parameters.minimumIdentity) && request->parameters.minimumIdentity >= 0
+                    && request->parameters.minimumIdentity <= 100;
+        } else if (strcmp(option, "--minimumNsForScaffoldGap") == 0) {
+            valid = parseInt(value, &request->capCodeParameters.minimumNCount);
+        } else if (strcmp(option, "--maximumDeletionLength") == 0) {
+            valid = parseInt(value, &request->capCodeParameters.maxDeletionLength);
+        } else if (strcmp(option, "--maximumInsertionLength") == 0) {
+            valid = parseInt(value, &request->capCodeParameters.maxInsertionLength);
+        } else if (strcmp(option, "--sampleFraction") == 0) {
+            int n;
+            valid = sscanf(value, "%lf%n", &request->parameters.sampleFraction, &n) == 1 && value[n] == '\0'
+                    && request->parameters.sampleFraction > 0.0 && request->parameters.sampleFraction <= 1.0;
+        } else if (strcmp(option, "--sampleSeed") == 0) {
+            valid = parseInt(value, &request->parameters.sampleSeed);
+        } else if (strcmp(option, "--region") == 0) {
+            Region *region = st_malloc(sizeof(Region));
+            if (!mafIndex_parseRegion(value, &region->sequenceName, &region->start, &region->end)) {
+                free(region);
+                return stString_print("The region %s is not of the form sequence:start-end or sequence", value);
+            }
+            if (request->regions == NULL) {
+                request->regions = stList_construct();
+            }
+            stList_append(request->regions, region);
+        } else {
+            return stString_print("Unrecognised option %s", option);
+        }
+        if (!valid) {
+            return stString_print("The value %s of the option %s is not valid", value, option);
+        }
+    }
+    if (request->parameters.treatHaplotype1AsContamination && request->parameters.treatHaplotype2AsContamination) {
+        return stString_copy("Only one haplotype can be treated as contamination");
+    }
+    if (stList_length(request->assemblyEventStrings) == 0) {
+        for (int64_t i = 0; i < stList_length(assemblyEventStrings); i++) {
+            stList_append(request->assemblyEventStrings, stList_get(assemblyEventStrings, i));
+        }
+    }
+    //Checked before the run, so that a request for what is not in the alignment is refused.
+    for (int64_t i = 0; i < stList_length(request->assemblyEventStrings); i++) {
+        const char *eventString = stList_get(request->assemblyEventStrings, i);
+        if (eventTree_getEventByHeader(flower_getEventTree(flower), eventString) == NULL) {
+            return stString_print("The assembly %s is not in the alignment", eventString);
+        }
+    }
+    //Regions replace those given to the daemon.
+    if (request->regions != NULL) {
+        for (int64_t i = 0; i < stList_length(request->regions); i++) {
+            Region *region = stList_get(request->regions, i);
+            if (stSet_search(sequenceNames, region->sequenceName) == NULL) {
+                return stString_print("The sequence %s of a region is not in the alignment", region->sequenceName);
+            }
+        }
+        request->parameters.regions = request->regions;
+    }
+    return NULL;
+}
+
+static stSet *getSequenceNames(Flower *flower) {
+    stSet *sequenceNames = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, free);
+    MafBuffer *sequenceName = mafBuffer_construct();
+    Flower_SequenceIterator *sequenceIt = flower_getSequenceIterator(flower);
+    Sequence *sequence;
+    while ((sequence = flower_getNextSequence(sequenceIt)) != NULL) {
+        mafBuffer_clear(sequenceName);
+        mafBuffer_appendSequenceName(sequenceName, sequence);
+        mafBuffer_appendChar(sequenceName, '\0');
+        stSet_insert(sequenceNames, stString_copy(sequenceName->string));
+    }
+    flower_destructSequenceIterator(sequenceIt);
+    mafBuffer_destruct(sequenceName);
+    return sequenceNames;
+}
+
+static bool writeBytes(int fd, const char *bytes, int64_t length) {
+    while (length > 0) {
+        ssize_t i = write(fd, bytes, length);
+        if (i < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        bytes += i;
+        length -= i;
+    }
+    return 1;
+}
+
+static bool writeString(int fd, const char *string) {
+    return writeBytes(fd, string, strlen(string));
+}
+
+static char *readRequestLine(int fd) {
+    /*
+     * Reads the request, up to the first newline, or NULL if the connection fails or the client
+     * does not send it within REQUEST_TIMEOUT seconds. Anything after the newline is ignored.
+     */
+    int64_t deadline = time(NULL) + REQUEST_TIMEOUT;
+    int64_t length = 0, maximumLength = 4096;
+    char *line = st_malloc(maximumLength + 1);
+    while (1) {
+        int64_t remaining = deadline - time(NULL);
+        struct pollfd pollFd = { fd, POLLIN, 0 };
+        int i = remaining > 0 ? poll(&pollFd, 1, remaining * 1000) : 0;
+        if (i < 0 && errno == EINTR) {
+            continue;
+        }
+        if (i <= 0) {
+            if (i == 0) {
+                st_logInfo("Timed out reading a request\n");
+            }
+            free(line);
+            return NULL;
+        }
+        ssize_t j = read(fd, line + length, maximumLength - length);
+        if (j < 0 && errno == EINTR) {
+            continue;
+        }
+        if (j <= 0) {
+            if (length > 0) {
+                break; //The client closed its side without a newline.
+            }
+            free(line);
+            return NULL;
+        }
+        char *newline = memchr(line + length, '\n', j);
+        length += j;
+        if (newline != NULL) {
+            length = newline - line;
+            break;
+        }
+        if (length == maximumLength) {
+            if (maximumLength >= MAXIMUM_REQUEST_LENGTH) {
+                free(line);
+                return NULL;
+            }
+            maximumLength *= 2;
+            line = realloc(line, maximumLength + 1);
+            if (line == NULL) {
+                st_errAbort("Failed to grow the request line");
+            }
+        }
+    }
+    line[length] = '\0';
+    return line;
+}
+
+static bool writeResult(int fd, const char *assemblyEventString, FILE *fileHandle) {
+    /*
+     * Writes the XML written to the temporary file as a result.
+     */
+    int64_t length = ftell(fileHandle);
+    rewind(fileHandle);
+    char *header = stString_print("result\t%s\t%" PRIi64 "\n", assemblyEventString, length);
+    bool written = writeString(fd, header);
+    free(header);
+    char buffer[65536];
+    while (written && length > 0) {
+        size_t i = fread(buffer, 1, length < (int64_t) sizeof(buffer) ? length : (int64_t) sizeof(buffer), fileHandle);
+        written = i > 0 && writeBytes(fd, buffer, i);
+        length -= i;
+    }
+    fclose(fileHandle);
+    return written;
+}
+
+static bool serveRequest(AssemblaContext *context, const AssemblaParameters *defaults, int fd) {
+    /*
+     * Serves the request of the connection, returning zero if the daemon is to shut down.
+     */
+    char *line = readRequestLine(fd);
+    if (line == NULL) {
+        st_logInfo("Dropped a connection without a request\n");
+        return 1;
+    }
+    int64_t startTime = time(NULL);
+    Request request;
+    char *error = parseRequest(line, defaults, &request);
+    bool running = 1, written = 1;
+    if (error != NULL) {
+        //Reported below.
+    } else if (strcmp(request.metric, "shutdown") == 0) {
+        running = 0;
+    } else if (strcmp(request.metric, "pathStats") == 0) {
+        for (int64_t i = 0; i < stList_length(request.assemblyEventStrings) && written; i++) {
+            const char *eventString = stList_get(request.assemblyEventStrings, i);
+            PathStats *pathStats = assemblaMetrics_getPathStats(context, &request.parameters, eventString);
+            FILE *fileHandle = tmpfile();
+            if (fileHandle == NULL) {
+                error = stString_copy("Could not open a temporary file for a result");
+                pathStats_destruct(pathStats);
+                break;
+            }
+            pathStats_writeXML(pathStats, fileHandle);
+            written = writeResult(fd, eventString, fileHandle);
+            pathStats_destruct(pathStats);
+        }
+    } else if (strcmp(request.metric, "substitutionStats") == 0) {
+        stList *substitutionStats = assemblaMetrics_getSubstitutionStats(context, &request.parameters,
+                request.assemblyEventStrings);
+        for (int64_t i = 0; i < stList_length(substitutionStats) && written; i++) {
+            SubstitutionStats *counts = stList_get(substitutionStats, i);
+            substitutionStats_extrapolate(counts);
+            FILE *fileHandle = tmpfile();
+            if (fileHandle == NULL) {
+                error = stString_copy("Could not open a temporary file for a result");
+                break;
+            }
+            substitutionStats_writeXML(counts, fileHandle);
+            written = writeResult(fd, stList_get(request.assemblyEventStrings, i), fileHandle);
+        }
+        stList_destruct(substitutionStats);
+    } else if (strcmp(request.metric, "copyNumberStats") == 0) {
+        stList *copyNumberStats = assemblaMetrics_getCopyNumberStats(context, &request.parameters,
+                request.assemblyEventStrings);
+        for (int64_t i = 0; i < stList_length(copyNumberStats) && written; i++) {
+            FILE *fileHandle = tmpfile();
+            if (fileHandle == NULL) {
+                error = stString_copy("Could not open a temporary file for a result");
+                break;
+            }
+            copyNumberStats_writeXML(stList_get(copyNumberStats, i), request.parameters.minimumBlockLength,
+                    fileHandle);
+            written = writeResult(fd, stList_get(request.assemblyEventStrings, i), fileHandle);
+        }
+        stList_destruct(copyNumberStats);
+    } else {
+        error = stString_print("Unrecognised metric %s", request.metric);
+    }
+    if (error != NULL) {
+        st_logInfo("Refused the request %s: %s\n", line, error);
+        char *reply = stString_print("error\t%s\n", error);
+        writeString(fd, reply);
+        free(reply);
+        free(error);
+    } else if (written) {
+        writeString(fd, "end\n");
+        st_logInfo("Served the request %s in %" PRIi64 " seconds\n", line, time(NULL) - startTime);
+    } else {
+        st_logInfo("The client of the request %s went away\n", line);
+    }
+    request_destruct(&request);
+    free(line);
+    return running;
+}
+
+int main(int argc, char *argv[]) {
+    //////////////////////////////////////////////
+    //Parse the inputs
+    //////////////////////////////////////////////
+
+    parseBasicArguments(argc, argv, "assemblaDaemon");
+    if (socketPath == NULL) {
+        st_errAbort("The socket was not specified");
+    }
+
+    AssemblaParameters defaults;
+    assemblaParameters_setFromArguments(&defaults);
+    defaults.maximumMemory = INT64_MAX; //The flowers are kept loaded, between the requests.
+    AssemblaContext *context = assemblaContext_constructFromArguments();
+    assemblaContext_setMaximumContigPathTables(context, MAXIMUM_CONTIG_PATH_TABLES);
+    sequenceNames = getSequenceNames(flower);
+
+    //////////////////////////////////////////////
+    //Listen on the socket
+    //////////////////////////////////////////////
+
+    //A client going away mid reply is not to kill the daemon, the write fails instead.
+    signal(SIGPIPE, SIG_IGN);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        st_errAbort("The socket path %s is too long", socketPath);
+    }
+    strcpy(address.sun_path, socketPath);
+    struct stat fileStat;
+    if (stat(socketPath, &fileStat) == 0) {
+        if (!S_ISSOCK(fileStat.st_mode)) {
+            st_errAbort("The socket path %s exists and is not a socket", socketPath);
+        }
+        unlink(socketPath); //Left by an earlier daemon.
+    }
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0 || bind(listenFd, (struct sockaddr *) &address, sizeof(address)) != 0
+            || listen(listenFd, 16) != 0) {
+        st_errAbort("Could not listen on the socket %s", socketPath);
+    }
+    st_logInfo("Serving requests on %s\n", socketPath);
+
+    //The requests are served one at a time, as the runs of a context are serialised anyway.
+    bool running = 1;
+    while (running) {
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            st_errAbort("Could not accept a connection on the socket %s", socketPath);
+        }
+        //Bounds the writes of the reply, the reads of the request are bounded by readRequestLine.
+        struct timeval timeout = { REQUEST_TIMEOUT, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        running = serveRequest(context, &defaults, fd);
+        close(fd);
+    }
+
+    close(listenFd);
+    unlink(socketPath);
+    stSet_destruct(sequenceNames);
+    assemblaContext_destruct(context);
+    st_logInfo("Shut down\n");
+
+    return 0;
+}
@@ -0,0 +1,1320 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten (at) gmail.com) and Dent Earl (dearl (at) soe.ucsc.edu)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "sonLib.h"
+#include "cactus.h"
+#include "substitutions.h"
+#include "adjacencyClassification.h"
+#include "assemblaCommon.h"
+#include "assemblaMetrics.h"
+#include "counters.h"
+
+/*
+ * Parameters.
+ */
+
+void assemblaParameters_setFromArguments(AssemblaParameters *parameters) {
+    parameters->capCodeParameters = capCodeParameters;
+    parameters->hap1EventString = hap1EventString;
+    parameters->hap2EventString = hap2EventString;
+    parameters->contaminationEventString = contaminationEventString;
+    parameters->treatHaplotype1AsContamination = treatHaplotype1AsContamination;
+    parameters->treatHaplotype2AsContamination = treatHaplotype2AsContamination;
+    parameters->minimumBlockLength = minimumBlockLength;
+    parameters->capSiteFn = NULL;
+    parameters->capSiteExtraArg = NULL;
+    parameters->ignoreFirstNBasesOfBlock = ignoreFirstNBasesOfBlock;
+    parameters->minimumIdentity = minimumIndentity;
+    parameters->keepErrorPositions = printIndelPositions || printHetPositions;
+    parameters->regions = regions;
+    parameters->sampleFraction = sampleFraction;
+    parameters->sampleSeed = sampleSeed;
+    parameters->shardIndex = shardIndex;
+    parameters->shardNumber = shardNumber;
+    parameters->maximumMemory = maximumMemory;
+}
+
+static stList *getHaplotypeEventStrings(const AssemblaParameters *parameters) {
+    assert(!(parameters->treatHaplotype1AsContamination && parameters->treatHaplotype2AsContamination));
+    return getEventStrings(parameters->treatHaplotype1AsContamination ? NULL : parameters->hap1EventString,
+            parameters->treatHaplotype2AsContamination ? NULL : parameters->hap2EventString);
+}
+
+static stList *getContaminationEventStrings(const AssemblaParameters *parameters) {
+    return getEventStrings(parameters->contaminationEventString,
+            parameters->treatHaplotype1AsContamination ? parameters->hap1EventString :
+                    (parameters->treatHaplotype2AsContamination ? parameters->hap2EventString : NULL));
+}
+
+static int64_t getEventIndex(stList *eventStrings, const char *eventString) {
+    for (int64_t i = 0; i < stList_length(eventStrings); i++) {
+        if (strcmp(eventString, stList_get(eventStrings, i)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Contexts.
+ */
+
+struct _assemblaContext {
+    CactusDisk *cactusDisk;
+    Flower *flower;
+    char *cactusDiskDirectory;
+    bool ownsCactusDisk;
+    SequenceViewCache *sequenceViewCache;
+    //If not NULL, the contig path tables kept for reuse, by a key of their assemblies and parameters,
+    //with the keys in the order the tables were last used, the least recently used first.
+    stHash *contigPathTables;
+    stList *contigPathTableKeys;
+    int64_t maximumContigPathTables;
+    pthread_mutex_t mutex; //Held by the running run.
+};
+
+static AssemblaContext *assemblaContext_construct2(CactusDisk *cactusDisk, const char *cactusDiskDirectory,
+        bool ownsCactusDisk) {
+    AssemblaContext *context = st_malloc(sizeof(AssemblaContext));
+    context->cactusDisk = cactusDisk;
+    context->flower = cactusDisk_getFlower(cactusDisk, 0);
+    assert(context->flower != NULL);
+    context->cactusDiskDirectory = cactusDiskDirectory != NULL ? stString_copy(cactusDiskDirectory) : NULL;
+    context->ownsCactusDisk = ownsCactusDisk;
+    context->sequenceViewCache = sequenceViewCache_construct();
+    context->contigPathTables = NULL;
+    context->contigPathTableKeys = NULL;
+    context->maximumContigPathTables = 0;
+    pthread_mutex_init(&context->mutex, NULL);
+    return context;
+}
+
+AssemblaContext *assemblaContext_construct(const char *cactusDiskDatabaseString) {
+    stKVDatabaseConf *kvDatabaseConf = stKVDatabaseConf_constructFromString(cactusDiskDatabaseString);
+    CactusDisk *cactusDisk = cactusDisk_construct(kvDatabaseConf, 0);
+    AssemblaContext *context = assemblaContext_construct2(cactusDisk, stKVDatabaseConf_getDir(kvDatabaseConf), 1);
+    stKVDatabaseConf_destruct(kvDatabaseConf);
+    return context;
+}
+
+AssemblaContext *assemblaContext_constructFromArguments(void) {
+    if (cactusDisk == NULL) {
+        st_errAbort("The cactus disk has not been loaded");
+    }
+    return assemblaContext_construct2(cactusDisk, cactusDiskDirectory, 0);
+}
+
+void assemblaContext_destruct(AssemblaContext *context) {
+    sequenceViewCache_destruct(context->sequenceViewCache);
+    if (context->contigPathTables != NULL) {
+        stHash_destruct(context->contigPathTables);
+        stList_destruct(context->contigPathTableKeys);
+    }
+    if (context->ownsCactusDisk) {
+        cactusDisk_destruct(context->cactusDisk);
+    }
+    free(context->cactusDiskDirectory);
+    pthread_mutex_destroy(&context->mutex);
+    free(context);
+}
+
+static void removeLeastRecentlyUsedContigPathTable(AssemblaContext *context) {
+    char *key = stList_remove(context->contigPathTableKeys, 0);
+    contigPathTable_destruct(stHash_remove(context->contigPathTables, key));
+    free(key);
+}
+
+void assemblaContext_setMaximumContigPathTables(AssemblaContext *context, int64_t maximumContigPathTables) {
+    pthread_mutex_lock(&context->mutex);
+    if (maximumContigPathTables > 0 && context->contigPathTables == NULL) {
+        context->contigPathTables = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free,
+                (void (*)(void *)) contigPathTable_destruct);
+        context->contigPathTableKeys = stList_construct();
+    } else if (maximumContigPathTables <= 0 && context->contigPathTables != NULL) {
+        stHash_destruct(context->contigPathTables);
+        stList_destruct(context->contigPathTableKeys);
+        context->contigPathTables = NULL;
+        context->contigPathTableKeys = NULL;
+    }
+    context->maximumContigPathTables = maximumContigPathTables;
+    while (context->contigPathTables != NULL && stHash_size(context->contigPathTables) > maximumContigPathTables) {
+        removeLeastRecentlyUsedContigPathTable(context);
+    }
+    pthread_mutex_unlock(&context->mutex);
+}
+
+static ContigPathTable *getContextContigPathTable(AssemblaContext *context, CapCodeParameters *capCodeParameters,
+        stList *assemblyEventStrings, stList *haplotypeEventStrings, stList *contaminationEventStrings) {
+    /*
+     * The contig path table, from the context if it is kept there. Must be released with
+     * releaseContextContigPathTable.
+     */
+    char *key = NULL;
+    if (context->contigPathTables != NULL) {
+        char *assemblies = stString_join2(",", assemblyEventStrings);
+        char *haplotypes = stString_join2(",", haplotypeEventStrings);
+        char *contaminations = stString_join2(",", contaminationEventStrings);
+        key = stString_print("assemblies=%s haplotypes=%s contamination=%s minimumNCount=%" PRIi64
+                " maxInsertionLength=%" PRIi64 " maxDeletionLength=%" PRIi64 "", assemblies, haplotypes,
+                contaminations, capCodeParameters->minimumNCount, capCodeParameters->maxInsertionLength,
+                capCodeParameters->maxDeletionLength);
+        free(assemblies);
+        free(haplotypes);
+        free(contaminations);
+        ContigPathTable *contigPathTable = stHash_search(context->contigPathTables, key);
+        if (contigPathTable != NULL) {
+            //Now the most recently used.
+            for (int64_t i = 0; i < stList_length(context->contigPathTableKeys); i++) {
+                if (strcmp(stList_get(context->contigPathTableKeys, i), key) == 0) {
+                    stList_append(context->contigPathTableKeys, stList_remove(context->contigPathTableKeys, i));
+                    break;
+                }
+            }
+            free(key);
+            return contigPathTable;
+        }
+    }
+    ContigPathTable *contigPathTable = getContigPathTable2(context->flower, context->cactusDiskDirectory,
+            capCodeParameters, assemblyEventStrings, haplotypeEventStrings, contaminationEventStrings);
+    if (key != NULL) {
+        //Only one table is used by a run, and the runs are serialised, so none of those kept is in use.
+        while (stHash_size(context->contigPathTables) >= context->maximumContigPathTables) {
+            removeLeastRecentlyUsedContigPathTable(context);
+        }
+        stHash_insert(context->contigPathTables, key, contigPathTable);
+        stList_append(context->contigPathTableKeys, key);
+    }
+    return contigPathTable;
+}
+
+static void releaseContextContigPathTable(AssemblaContext *context, ContigPathTable *contigPathTable) {
+    if (context->contigPathTables == NULL) {
+        contigPathTable_destruct(contigPathTable);
+    }
+}
+
+static void getBlockTraversal(AssemblaContext *context, const AssemblaParameters *parameters, RegionSet *regionSet,
+        BlockTraversal *blockTraversal) {
+    blockTraversal->flower = context->flower;
+    blockTraversal->cactusDisk = context->cactusDisk;
+    blockTraversal->cactusDiskDirectory = context->cactusDiskDirectory;
+    blockTraversal->regionSet = regionSet;
+    blockTraversal->sampleFraction = parameters->sampleFraction;
+    blockTraversal->sampleSeed = parameters->sampleSeed;
+    blockTraversal->shardIndex = parameters->shardIndex;
+    blockTraversal->shardNumber = parameters->shardNumber;
+    blockTraversal->maximumMemory = parameters->maximumMemory;
+}
+
+/*
+ * Path stats.
+ */
+
+typedef struct _pathStatsRun {
+    const AssemblaParameters *parameters;
+    const char *assemblyEventString;
+    stList *haplotypeEventStrings;
+    PathStats *pathStats; //The error totals are counted at both ends of the paths, until they are halved.
+    stList *insertionDistribution;
+    stList *deletionDistribution;
+    stSortedSet *contigsSet;
+    stSortedSet *haplotypesSet;
+    stList *blockList;
+    //If sampling, the totals of the path lengths and numbers of the sampled blocks.
+    SampledTotal sampledPathLength;
+    SampledTotal sampledBlockNumber;
+    //In region mode, the segments of the contig path table in blocks overlapping the regions.
+    ContigPathTable *contigPathTable;
+    bool *segmentsInRegions;
+} PathStatsRun;
+
+static int64_t *copyLength(Arena *arena, int64_t length) {
+    int64_t *i = arena_malloc(arena, sizeof(int64_t));
+    *i = length;
+    return i;
+}
+
+static void addCapCode(PathStatsRun *run, enum CapCode capCode, int64_t insertLength, int64_t deleteLength) {
+    PathStats *pathStats = run->pathStats;
+    switch (capCode) {
+        case HAP_SWITCH:
+            pathStats->totalHaplotypeSwitches++;
+            return;
+        case HAP_NOTHING:
+            return;
+        case CONTIG_END:
+            pathStats->totalContigEnds++;
+            return;
+        case CONTIG_END_WITH_SCAFFOLD_GAP:
+        case CONTIG_END_WITH_AMBIGUITY_GAP:
+            pathStats->totalContigEndsWithNs++;
+            return;
+        case SCAFFOLD_GAP:
+            pathStats->totalScaffoldGaps++;
+            return;
+        case AMBIGUITY_GAP:
+            pathStats->totalAmbiguityGaps++;
+            return;
+        case ERROR_HAP_TO_HAP_SAME_CHROMOSOME:
+            pathStats->totalErrorsHaplotypeToHaplotypeSameChromosome++;
+            return;
+        case ERROR_HAP_TO_HAP_DIFFERENT_CHROMOSOMES:
+            pathStats->totalErrorsHaplotypeToHaplotypeDifferentChromosome++;
+            return;
+        case ERROR_HAP_TO_CONTAMINATION:
+            pathStats->totalErrorsHaplotypeToContamination++;
+            return;
+        case ERROR_HAP_TO_INSERT_TO_CONTAMINATION:
+            pathStats->totalErrorsHaplotypeToInsertionToContamination++;
+            return;
+        case ERROR_HAP_TO_INSERT:
+            assert(insertLength > 0);
+            stList_append(run->insertionDistribution, copyLength(pathStats->arena, insertLength));
+            pathStats->totalErrorsHaplotypeToInsertion++;
+            return;
+        case ERROR_HAP_TO_DELETION:
+            assert(deleteLength > 0);
+            stList_append(run->deletionDistribution, copyLength(pathStats->arena, deleteLength));
+            pathStats->totalErrorsHaplotypeToDeletion++;
+            return;
+        case ERROR_HAP_TO_INSERT_AND_DELETION:
+            assert(insertLength > 0);
+            assert(deleteLength > 0);
+            stList_append(run->insertionDistribution, copyLength(pathStats->arena, insertLength));
+            stList_append(run->deletionDistribution, copyLength(pathStats->arena, deleteLength));
+            pathStats->totalErrorsHaplotypeToInsertionAndDeletion++;
+            return;
+        case ERROR_CONTIG_END_WITH_INSERT:
+            pathStats->totalErrorsContigEndsWithInsert++;
+            return;
+    }
+}
+
+static int compareSequences(const void *a, const void *b) {
+    return cactusMisc_nameCompare(sequence_getName((Sequence *) a), sequence_getName((Sequence *) b));
+}
+
+static int compareSequencesByLength(const void *a, const void *b) {
+    return sequence_getLength((Sequence *) b) - sequence_getLength((Sequence *) a);
+}
+
+static int compareBlocksByLength(const void *a, const void *b) {
+    return block_getLength((Block *) b) - block_getLength((Block *) a);
+}
+
+static int compareLengths(const void *a, const void *b) {
+    int64_t i = *(const int64_t *) a, j = *(const int64_t *) b;
+    return i > j ? -1 : (i < j ? 1 : 0);
+}
+
+static int compareLengthsAscending(const void *a, const void *b) {
+    return compareLengths(b, a);
+}
+
+/*
+ * The positive strand coordinate, from the start of its sequence, of a column of the segment.
+ */
+static int64_t getSegmentPosition(Segment *segment, int64_t column) {
+    int64_t i = segment_getStrand(segment) ? segment_getStart(segment) + column : segment_getStart(segment) - column;
+    return i - sequence_getStart(segment_getSequence(segment));
+}
+
+static Segment *getHaplotypeSegment(Block *block, PathStatsRun *run) {
+    Segment *segment;
+    Block_InstanceIterator *instanceIt = block_getInstanceIterator(block);
+    while ((segment = block_getNext(instanceIt)) != NULL) {
+        if (segment_getSequence(segment) != NULL
+                && getEventIndex(run->haplotypeEventStrings, event_getHeader(segment_getEvent(segment))) != -1) {
+            break;
+        }
+    }
+    block_destructInstanceIterator(instanceIt);
+    return segment;
+}
+
+static void reportCapSites(PathStatsRun *run, Block *block, Segment *segment, int64_t segmentOrdinal) {
+    /*
+     * Calls the cap site function for the ends of the assembly segment, using the cap codes of the
+     * table so the sites are those counted in the totals. The segment and haplotype segment are in
+     * the orientation of the block, so share its columns.
+     */
+    Segment *haplotypeSegment = getHaplotypeSegment(block, run);
+    bool pathOrientation = contigPathTable_hasPathOrientation(run->contigPathTable, segment);
+    for (int64_t i = 0; i < 2; i++) {
+        CapSite capSite;
+        capSite._5End = i == 0;
+        capSite.capCode = contigPathTable_getPathCapCode(run->contigPathTable, segmentOrdinal, capSite._5End,
+                &capSite.insertLength, &capSite.deleteLength);
+        if (capSite.capCode == HAP_NOTHING) {
+            continue;
+        }
+        int64_t column = capSite._5End == pathOrientation ? 0 : block_getLength(block) - 1;
+        capSite.sequence = segment_getSequence(segment);
+        capSite.position = getSegmentPosition(segment, column);
+        capSite.strand = segment_getStrand(segment) == pathOrientation;
+        capSite.path = contigPathTable_getSegmentPath(run->contigPathTable, segmentOrdinal);
+        capSite.haplotypeSequence = haplotypeSegment != NULL ? segment_getSequence(haplotypeSegment) : NULL;
+        capSite.haplotypePosition = haplotypeSegment != NULL ? getSegmentPosition(haplotypeSegment, column) : -1;
+        run->parameters->capSiteFn(&capSite, run->parameters->capSiteExtraArg);
+    }
+}
+
+static void accumulateBlock(Block *block, PathStatsRun *run) {
+    if (hasCapInEvents(block_get5End(block), run->haplotypeEventStrings)) {
+        if (hasCapInEvent(block_get5End(block), run->assemblyEventString)
+                && isBlockInSample(block, run->parameters->sampleFraction, run->parameters->sampleSeed)) {
+            //Only the block level totals are sampled, the contigs and haplotypes are all visited.
+            stList_append(run->blockList, block);
+            run->pathStats->totalPathLength += block_getLength(block);
+            sampledTotal_add(&run->sampledPathLength, block_getLength(block));
+            sampledTotal_add(&run->sampledBlockNumber, 1);
+        }
+    }
+    Segment *segment;
+    Block_InstanceIterator *instanceIt = block_getInstanceIterator(block);
+    while ((segment = block_getNext(instanceIt)) != NULL) {
+        Sequence *sequence = segment_getSequence(segment);
+        assert(sequence != NULL);
+        if (strcmp(event_getHeader(segment_getEvent(segment)), run->assemblyEventString) == 0) {
+            stSortedSet_insert(run->contigsSet, sequence);
+            if (run->segmentsInRegions != NULL || run->parameters->capSiteFn != NULL) {
+                int64_t segmentOrdinal = contigPathTable_getSegmentOrdinal(run->contigPathTable, segment);
+                if (segmentOrdinal != -1) {
+                    if (run->segmentsInRegions != NULL) {
+                        run->segmentsInRegions[segmentOrdinal] = 1;
+                    }
+                    if (run->parameters->capSiteFn != NULL) {
+                        reportCapSites(run, block, segment, segmentOrdinal);
+                    }
+                }
+            }
+        }
+        if (getEventIndex(run->haplotypeEventStrings, event_getHeader(segment_getEvent(segment))) != -1) {
+            stSortedSet_insert(run->haplotypesSet, sequence);
+        }
+    }
+    block_destructInstanceIterator(instanceIt);
+}
+
+static void traverseBlocks(Flower *flower, PathStatsRun *run) {
+    Flower_GroupIterator *groupIt = flower_getGroupIterator(flower);
+    Group *group;
+    while ((group = flower_getNextGroup(groupIt)) != NULL) {
+        if (group_getNestedFlower(group) != NULL) {
+            traverseBlocks(group_getNestedFlower(group), run);
+        }
+    }
+    flower_destructGroupIterator(groupIt);
+
+    Flower_BlockIterator *blockIt = flower_getBlockIterator(flower);
+    Block *block;
+    while ((block = flower_getNextBlock(blockIt)) != NULL) {
+        accumulateBlock(block, run);
+    }
+    flower_destructBlockIterator(blockIt);
+}
+
+static int64_t getN50(int64_t genomeLength, stList *objects, int64_t(*lengthFn)(const void *)) {
+    int64_t totalLength = 0;
+    int64_t pJ = INT64_MAX;
+    for (int64_t i = 0; i < stList_length(objects); i++) {
+        int64_t j = lengthFn(stList_get(objects, i));
+        assert(j <= pJ);
+        pJ = j;
+        totalLength += j;
+        if (totalLength >= genomeLength / 2) {
+            return j;
+        }
+    }
+    return -1; //this should not happen!
+}
+
+static int64_t getN50FromLengths(int64_t genomeLength, int64_t *lengths, int64_t lengthNumber) {
+    /*
+     * As getN50, but for an array of lengths, which is sorted from longest to shortest.
+     */
+    qsort(lengths, lengthNumber, sizeof(int64_t), compareLengths);
+    int64_t totalLength = 0;
+    for (int64_t i = 0; i < lengthNumber; i++) {
+        totalLength += lengths[i];
+        if (totalLength >= genomeLength / 2) {
+            return lengths[i];
+        }
+    }
+    return -1; //this should not happen!
+}
+
+static int64_t *getErrorSizes(stList *distribution, Arena *arena, int64_t *errorSizeNumber) {
+    /*
+     * The sizes of the errors, in ascending order. Each error is seen from both ends of its path,
+     * so its size is in the distribution twice.
+     */
+    stList_sort(distribution, compareLengthsAscending);
+    assert(stList_length(distribution) % 2 == 0);
+    *errorSizeNumber = stList_length(distribution) / 2;
+    int64_t *errorSizes = arena_malloc(arena, sizeof(int64_t) * (*errorSizeNumber + 1));
+    for (int64_t i = 0; i < stList_length(distribution); i += 2) {
+        assert(*(int64_t *) stList_get(distribution, i) == *(int64_t *) stList_get(distribution, i+1));
+        errorSizes[i / 2] = *(int64_t *) stList_get(distribution, i);
+    }
+    return errorSizes;
+}
+
+static void getPathStats(AssemblaContext *context, PathStatsRun *run) {
+    const AssemblaParameters *parameters = run->parameters;
+    PathStats *pathStats = run->pathStats;
+    stList *contaminationEventStrings = getContaminationEventStrings(parameters);
+    stList *eventStrings = stList_construct();
+    stList_append(eventStrings, (void *) run->assemblyEventString);
+    run->contigPathTable = getContextContigPathTable(context, parameters->capCodeParameters, eventStrings,
+            run->haplotypeEventStrings, contaminationEventStrings);
+    stList_destruct(eventStrings);
+    stList_destruct(contaminationEventStrings);
+    int64_t segmentNumber = contigPathTable_getSegmentNumber(run->contigPathTable);
+    int64_t pathNumber = contigPathTable_getPathNumber(run->contigPathTable);
+    int64_t scaffoldNumber = contigPathTable_getScaffoldNumber(run->contigPathTable);
+
+    RegionSet *regionSet = NULL;
+    if (parameters->regions != NULL) {
+        regionSet = regionSet_construct(parameters->regions);
+        run->segmentsInRegions = st_calloc(segmentNumber + 1, sizeof(bool));
+        BlockTraversal blockTraversal;
+        getBlockTraversal(context, parameters, regionSet, &blockTraversal);
+        blockTraversal_run(&blockTraversal, (void (*)(Block *, void *)) accumulateBlock, run);
+    } else {
+        traverseBlocks(context->flower, run);
+    }
+
+    //The cap codes of the segments of the paths, as stored in the table. In region mode only the
+    //segments in blocks overlapping the regions, and the paths and scaffold paths containing
+    //them, are counted.
+    bool *pathsInRegions = st_calloc(pathNumber + 1, sizeof(bool));
+    bool *scaffoldsInRegions = st_calloc(scaffoldNumber + 1, sizeof(bool));
+    for (int64_t i = 0; i < segmentNumber; i++) {
+        if (run->segmentsInRegions == NULL || run->segmentsInRegions[i]) {
+            int64_t insertLength, deleteLength;
+            enum CapCode capCode = contigPathTable_getPathCapCode(run->contigPathTable, i, 1, &insertLength,
+                    &deleteLength);
+            addCapCode(run, capCode, insertLength, deleteLength);
+            capCode = contigPathTable_getPathCapCode(run->contigPathTable, i, 0, &insertLength, &deleteLength);
+            addCapCode(run, capCode, insertLength, deleteLength);
+            pathsInRegions[contigPathTable_getSegmentPath(run->contigPathTable, i)] = 1;
+        }
+    }
+
+    //The lengths of the paths and of the scaffold paths, copied as they are sorted for the N50s
+    //and the table may be mapped read only.
+    int64_t *pathLengths = st_malloc(sizeof(int64_t) * (pathNumber + 1));
+    int64_t *scaffoldPathLengths = st_malloc(sizeof(int64_t) * (scaffoldNumber + 1));
+    const int64_t *allPathLengths = contigPathTable_getPathLengths(run->contigPathTable);
+    const int64_t *allScaffoldPathLengths = contigPathTable_getScaffoldLengths(run->contigPathTable);
+    int64_t totalHaplotypeLength = 0;
+    for (int64_t i = 0; i < pathNumber; i++) {
+        if (pathsInRegions[i]) {
+            pathLengths[pathStats->totalHaplotypePaths++] = allPathLengths[i];
+            totalHaplotypeLength += allPathLengths[i];
+            scaffoldsInRegions[contigPathTable_getScaffold(run->contigPathTable, i)] = 1;
+        }
+    }
+    for (int64_t i = 0; i < scaffoldNumber; i++) {
+        if (scaffoldsInRegions[i]) {
+            scaffoldPathLengths[pathStats->totalScaffoldPaths++] = allScaffoldPathLengths[i];
+        }
+    }
+    free(pathsInRegions);
+    free(scaffoldsInRegions);
+    free(run->segmentsInRegions);
+    releaseContextContigPathTable(context, run->contigPathTable);
+
+    stList *sequences = stSortedSet_getList(run->contigsSet);
+    stList *haplotypes = stSortedSet_getList(run->haplotypesSet);
+    stList_sort(run->blockList, compareBlocksByLength);
+    stList_sort(sequences, compareSequencesByLength);
+
+    for (int64_t i = 0; i < stList_length(sequences); i++) {
+        pathStats->totalContigsLength += sequence_getLength(stList_get(sequences, i));
+    }
+
+    //The average length of the two haplotypes, or of their regions.
+    for (int64_t i = 0; i < stList_length(haplotypes); i++) {
+        pathStats->genotypeLength += regionSet != NULL ? regionSet_getSequenceLength(regionSet, stList_get(haplotypes, i)) :
+                sequence_getLength(stList_get(haplotypes, i));
+    }
+    pathStats->genotypeLength /= stList_length(run->haplotypeEventStrings);
+    int64_t averageHaplotypeLength = pathStats->genotypeLength;
+
+    pathStats->totalBlockNumber = stList_length(run->blockList);
+    if (parameters->sampleFraction < 1.0) {
+        //Extrapolate the block totals, the sampled blocks covering the sample fraction of the genotype.
+        pathStats->totalPathLength = llround(sampledTotal_getEstimate2(&run->sampledPathLength, parameters->sampleFraction));
+        pathStats->totalBlockNumber = llround(sampledTotal_getEstimate2(&run->sampledBlockNumber,
+                parameters->sampleFraction));
+        pathStats->blockNG50 = getN50(averageHaplotypeLength * parameters->sampleFraction, run->blockList,
+                (int64_t(*)(const void *)) block_getLength);
+        pathStats->totalPathLengthStandardError = sampledTotal_getStandardError2(&run->sampledPathLength,
+                parameters->sampleFraction);
+        pathStats->totalBlockNumberStandardError = sampledTotal_getStandardError2(&run->sampledBlockNumber,
+                parameters->sampleFraction);
+        pathStats->coverageStandardError = pathStats->totalPathLengthStandardError / averageHaplotypeLength;
+    } else {
+        pathStats->blockNG50 = getN50(averageHaplotypeLength, run->blockList, (int64_t(*)(const void *)) block_getLength);
+    }
+    pathStats->contigN50 = getN50(pathStats->totalContigsLength, sequences, (int64_t(*)(const void *)) sequence_getLength); //length of contig which appears in order (from longest to shortest) at 50% coverage.
+    pathStats->contigNG50 = getN50(averageHaplotypeLength, sequences, (int64_t(*)(const void *)) sequence_getLength);
+    pathStats->contigPathNG50 = getN50FromLengths(averageHaplotypeLength, pathLengths, pathStats->totalHaplotypePaths); //length of maximal haplotype path which appears in order (from longest to shortest) at 50% coverage.
+    pathStats->scaffoldPathNG50 = getN50FromLengths(averageHaplotypeLength, scaffoldPathLengths, pathStats->totalScaffoldPaths);
+
+    pathStats->totalContigNumber = stSortedSet_size(run->contigsSet);
+
+    assert(pathStats->totalErrorsHaplotypeToHaplotypeSameChromosome % 2 == 0);
+    assert(pathStats->totalErrorsHaplotypeToHaplotypeDifferentChromosome % 2 == 0);
+    assert(pathStats->totalErrorsHaplotypeToInsertion % 2 == 0);
+    assert(pathStats->totalErrorsHaplotypeToDeletion % 2 == 0);
+    assert(pathStats->totalErrorsHaplotypeToInsertionAndDeletion % 2 == 0);
+    assert(pathStats->totalScaffoldGaps % 2 == 0);
+    assert(pathStats->totalAmbiguityGaps % 2 == 0);
+
+    //The totals counted at both ends of the paths.
+    pathStats->totalHaplotypeSwitches /= 2;
+    pathStats->totalScaffoldGaps /= 2;
+    pathStats->totalAmbiguityGaps /= 2;
+    pathStats->totalErrorsHaplotypeToHaplotypeSameChromosome /= 2;
+    pathStats->totalErrorsHaplotypeToHaplotypeDifferentChromosome /= 2;
+    pathStats->totalErrorsHaplotypeToInsertion /= 2;
+    pathStats->totalErrorsHaplotypeToDeletion /= 2;
+    pathStats->totalErrorsHaplotypeToInsertionAndDeletion /= 2;
+
+    pathStats->totalErrors = pathStats->totalErrorsHaplotypeToHaplotypeSameChromosome
+            + pathStats->totalErrorsHaplotypeToHaplotypeDifferentChromosome
+            + pathStats->totalErrorsHaplotypeToContamination + pathStats->totalErrorsHaplotypeToInsertionToContamination
+            + pathStats->totalErrorsHaplotypeToInsertion + pathStats->totalErrorsHaplotypeToDeletion
+            + pathStats->totalErrorsHaplotypeToInsertionAndDeletion + pathStats->totalErrorsContigEndsWithInsert;
+    pathStats->errorsPerContig = ((double) pathStats->totalErrors) / pathStats->totalContigNumber;
+    pathStats->errorsPerMappedBase = ((double) pathStats->totalErrors) / pathStats->totalPathLength;
+    pathStats->coverage = ((double) pathStats->totalPathLength) / averageHaplotypeLength;
+
+    pathStats->insertionErrorSizes = getErrorSizes(run->insertionDistribution, pathStats->arena,
+            &pathStats->insertionErrorSizeNumber);
+    pathStats->deletionErrorSizes = getErrorSizes(run->deletionDistribution, pathStats->arena,
+            &pathStats->deletionErrorSizeNumber);
+
+    if (regionSet != NULL) {
+        regionSet_destruct(regionSet);
+    }
+    stList_destruct(sequences);
+    stList_destruct(haplotypes);
+    free(pathLengths);
+    free(scaffoldPathLengths);
+}
+
+PathStats *assemblaMetrics_getPathStats(AssemblaContext *context, const AssemblaParameters *parameters,
+        const char *assemblyEventString) {
+    if (parameters->shardNumber > 1) {
+        st_errAbort("The path stats can not be run in shards");
+    }
+    PathStats *pathStats = st_calloc(1, sizeof(PathStats));
+    pathStats->sampleFraction = parameters->sampleFraction;
+    pathStats->arena = arena_construct();
+
+    PathStatsRun run;
+    memset(&run, 0, sizeof(PathStatsRun));
+    run.parameters = parameters;
+    run.assemblyEventString = assemblyEventString;
+    run.haplotypeEventStrings = getHaplotypeEventStrings(parameters);
+    run.pathStats = pathStats;
+    run.insertionDistribution = stList_construct();
+    run.deletionDistribution = stList_construct();
+    run.contigsSet = stSortedSet_construct3(compareSequences, NULL);
+    run.haplotypesSet = stSortedSet_construct3(compareSequences, NULL);
+    run.blockList = stList_construct();
+
+    pthread_mutex_lock(&context->mutex);
+    getPathStats(context, &run);
+    pthread_mutex_unlock(&context->mutex);
+
+    stList_destruct(run.haplotypeEventStrings);
+    stList_destruct(run.insertionDistribution);
+    stList_destruct(run.deletionDistribution);
+    stSortedSet_destruct(run.contigsSet);
+    stSortedSet_destruct(run.haplotypesSet);
+    stList_destruct(run.blockList);
+    return pathStats;
+}
+
+void pathStats_destruct(PathStats *pathStats) {
+    arena_destruct(pathStats->arena);
+    free(pathStats);
+}
+
+char *pathStats_getErrorSizeDistribution(const int64_t *errorSizes, int64_t errorSizeNumber) {
+    char **cAA = st_malloc(sizeof(char *) * (errorSizeNumber + 1));
+    for (int64_t i = 0; i < errorSizeNumber; i++) {
+        cAA[i] = stString_print("%" PRIi64 "", errorSizes[i]);
+    }
+    char *cA = stString_join(" ", (const char **)cAA, errorSizeNumber);
+    for (int64_t i = 0; i < errorSizeNumber; i++) {
+        free(cAA[i]);
+    }
+    free(cAA);
+    return cA;
+}
+
+void pathStats_writeXML(PathStats *pathStats, FILE *fileHandle) {
+    char *insertionDistributionString = pathStats_getErrorSizeDistribution(pathStats->insertionErrorSizes,
+            pathStats->insertionErrorSizeNumber);
+    char *deletionDistributionString = pathStats_getErrorSizeDistribution(pathStats->deletionErrorSizes,
+            pathStats->deletionErrorSizeNumber);
+
+    fprintf(fileHandle, "<stats totalHaplotypeSwitches=\"%" PRIi64 "\" "
+        "totalScaffoldGaps=\"%" PRIi64 "\" "
+        "totalAmbiguityGaps=\"%" PRIi64 "\" "
+        "totalContigEnds=\"%" PRIi64 "\" "
+        "totalContigEndsWithNs=\"%" PRIi64 "\" "
+        "totalErrorsHaplotypeToHaplotypeSameChromosome=\"%" PRIi64 "\" "
+        "totalErrorsHaplotypeToHaplotypeDifferentChromosome=\"%" PRIi64 "\" "
+        "totalErrorsHaplotypeToContamination=\"%" PRIi64 "\" "
+        "totalErrorsHaplotypeToInsertionToContamination=\"%" PRIi64 "\" "
+        "totalErrorsHaplotypeToInsertion=\"%" PRIi64 "\" "
+        "totalErrorsHaplotypeToDeletion=\"%" PRIi64 "\" "
+        "totalErrorsHaplotypeToInsertionAndDeletion=\"%" PRIi64 "\" "
+        "totalErrorsContigEndsWithInsert=\"%" PRIi64 "\" "
+        "totalErrors=\"%" PRIi64 "\" totalPathLength=\"%" PRIi64 "\" genotypeLength=\"%" PRIi64 "\" "
+        "totalContigsLength=\"%" PRIi64 "\" coverage=\"%f\" blockNG50=\"%" PRIi64 "\" contigN50=\"%" PRIi64 "\" "
+        "contigNG50=\"%" PRIi64 "\" contigPathNG50=\"%" PRIi64 "\" scaffoldPathNG50=\"%" PRIi64 "\" totalBlockNumber=\"%" PRIi64 "\" "
+        "totalContigNumber=\"%" PRIi64 "\" totalHaplotypePaths=\"%" PRIi64 "\" totalScaffoldPaths=\"%" PRIi64 "\" "
+        "errorsPerContig=\"%f\" errorsPerMappedBase=\"%f\" "
+        "insertionErrorSizeDistribution=\"%s\" "
+        "deletionErrorSizeDistribution=\"%s\"", pathStats->totalHaplotypeSwitches,
+            pathStats->totalScaffoldGaps, pathStats->totalAmbiguityGaps, pathStats->totalContigEnds,
+            pathStats->totalContigEndsWithNs, pathStats->totalErrorsHaplotypeToHaplotypeSameChromosome,
+            pathStats->totalErrorsHaplotypeToHaplotypeDifferentChromosome, pathStats->totalErrorsHaplotypeToContamination,
+            pathStats->totalErrorsHaplotypeToInsertionToContamination, pathStats->totalErrorsHaplotypeToInsertion,
+            pathStats->totalErrorsHaplotypeToDeletion, pathStats->totalErrorsHaplotypeToInsertionAndDeletion,
+            pathStats->totalErrorsContigEndsWithInsert, pathStats->totalErrors, pathStats->totalPathLength,
+            pathStats->genotypeLength, pathStats->totalContigsLength, pathStats->coverage, pathStats->blockNG50,
+            pathStats->contigN50, pathStats->contigNG50, pathStats->contigPathNG50, pathStats->scaffoldPathNG50,
+            pathStats->totalBlockNumber, pathStats->totalContigNumber, pathStats->totalHaplotypePaths,
+            pathStats->totalScaffoldPaths, pathStats->errorsPerContig, pathStats->errorsPerMappedBase,
+            insertionDistributionString, deletionDistributionString);
+    if (pathStats->sampleFraction < 1.0) {
+        fprintf(fileHandle, " sampleFraction=\"%f\" totalPathLengthStandardError=\"%f\" "
+            "totalBlockNumberStandardError=\"%f\" coverageStandardError=\"%f\"", pathStats->sampleFraction,
+                pathStats->totalPathLengthStandardError, pathStats->totalBlockNumberStandardError,
+                pathStats->coverageStandardError);
+    }
+    fprintf(fileHandle, "/>");
+    free(insertionDistributionString);
+    free(deletionDistributionString);
+}
+
+/*
+ * Substitution stats.
+ */
+
+const char *substitutionTotalNames[SUBSTITUTION_TOTAL_NUMBER] = { "totalHomozygous",
+        "totalCorrectInHomozygous", "totalErrorsInHomozygous", "totalCallsInHomozygous", "totalHeterozygous",
+        "totalCorrectInHeterozygous", "totalErrorsInHeterozygous", "totalCallsInHeterozygous",
+        "totalCorrectHap1InHeterozygous", "totalCorrectHap2InHeterozygous", "totalInOneHaplotypeOnly",
+        "totalCorrectInOneHaplotypeOnly", "totalErrorsInOneHaplotypeOnly", "totalCallsInOneHaplotypeOnly" };
+
+SubstitutionStats *substitutionStats_construct(double sampleFraction) {
+    SubstitutionStats *substitutionStats = st_calloc(1, sizeof(SubstitutionStats));
+    substitutionStats->indelPositions = stList_construct();
+    substitutionStats->hetPositions = stList_construct();
+    substitutionStats->sampleFraction = sampleFraction;
+    if (sampleFraction < 1.0) {
+        substitutionStats->sampledTotals = st_calloc(SUBSTITUTION_TOTAL_NUMBER, sizeof(SampledTotal));
+    }
+    substitutionStats->arena = arena_construct();
+    return substitutionStats;
+}
+
+void substitutionStats_destruct(SubstitutionStats *substitutionStats) {
+    stList_destruct(substitutionStats->indelPositions);
+    stList_destruct(substitutionStats->hetPositions);
+    free(substitutionStats->sampledTotals);
+    arena_destruct(substitutionStats->arena);
+    free(substitutionStats);
+}
+
+void substitutionStats_getTotals(const SubstitutionStats *counts, double *totals) {
+    totals[0] = counts->totalSites;
+    totals[1] = counts->totalCorrect;
+    totals[2] = counts->totalErrors;
+    totals[3] = counts->totalCalls;
+    totals[4] = counts->totalHeterozygous;
+    totals[5] = counts->totalCorrectInHeterozygous;
+    totals[6] = counts->totalErrorsInHeterozygous;
+    totals[7] = counts->totalCallsInHeterozygous;
+    totals[8] = counts->totalCorrectHap1InHeterozygous;
+    totals[9] = counts->totalCorrectHap2InHeterozygous;
+    totals[10] = counts->totalInOneHaplotypeOnly;
+    totals[11] = counts->totalCorrectInOneHaplotype;
+    totals[12] = counts->totalErrorsInOneHaplotype;
+    totals[13] = counts->totalCallsInOneHaplotype;
+}
+
+void substitutionStats_setTotals(SubstitutionStats *counts, const double *totals) {
+    counts->totalSites = llround(totals[0]);
+    counts->totalCorrect = totals[1];
+    counts->totalErrors = llround(totals[2]);
+    counts->totalCalls = llround(totals[3]);
+    counts->totalHeterozygous = llround(totals[4]);
+    counts->totalCorrectInHeterozygous = totals[5];
+    counts->totalErrorsInHeterozygous = llround(totals[6]);
+    counts->totalCallsInHeterozygous = llround(totals[7]);
+    counts->totalCorrectHap1InHeterozygous = llround(totals[8]);
+    counts->totalCorrectHap2InHeterozygous = llround(totals[9]);
+    counts->totalInOneHaplotypeOnly = llround(totals[10]);
+    counts->totalCorrectInOneHaplotype = totals[11];
+    counts->totalErrorsInOneHaplotype = llround(totals[12]);
+    counts->totalCallsInOneHaplotype = llround(totals[13]);
+}
+
+void substitutionStats_extrapolate(SubstitutionStats *counts) {
+    if (counts->sampledTotals == NULL) {
+        return;
+    }
+    double totals[SUBSTITUTION_TOTAL_NUMBER];
+    for (int64_t i = 0; i < SUBSTITUTION_TOTAL_NUMBER; i++) {
+        totals[i] = sampledTotal_getEstimate2(&counts->sampledTotals[i], counts->sampleFraction);
+    }
+    substitutionStats_setTotals(counts, totals);
+}
+
+void substitutionStats_writeXML(SubstitutionStats *counts, FILE *fileHandle) {
+    fprintf(fileHandle, "<substitutionStats ");
+    fprintf(fileHandle, "totalHomozygous=\"%" PRIi64 "\" "
+        "totalCorrectInHomozygous=\"%f\" "
+        "totalErrorsInHomozygous=\"%" PRIi64 "\" "
+        "totalCallsInHomozygous=\"%" PRIi64 "\" "
+        "totalHeterozygous=\"%" PRIi64 "\" "
+        "totalCorrectInHeterozygous=\"%f\" "
+        "totalErrorsInHeterozygous=\"%" PRIi64 "\" "
+        "totalCallsInHeterozygous=\"%" PRIi64 "\" "
+        "totalCorrectHap1InHeterozygous=\"%" PRIi64 "\" "
+        "totalCorrectHap2InHeterozygous=\"%" PRIi64 "\" "
+        "totalInOneHaplotypeOnly=\"%" PRIi64 "\" "
+        "totalCorrectInOneHaplotypeOnly=\"%f\" "
+        "totalErrorsInOneHaplotypeOnly=\"%" PRIi64 "\" "
+        "totalCallsInOneHaplotypeOnly=\"%" PRIi64 "\"", counts->totalSites, counts->totalCorrect, counts->totalErrors,
+            counts->totalCalls, counts->totalHeterozygous, counts->totalCorrectInHeterozygous,
+            counts->totalErrorsInHeterozygous, counts->totalCallsInHeterozygous,
+            counts->totalCorrectHap1InHeterozygous, counts->totalCorrectHap2InHeterozygous, counts->totalInOneHaplotypeOnly,
+            counts->totalCorrectInOneHaplotype, counts->totalErrorsInOneHaplotype, counts->totalCallsInOneHaplotype);
+    if (counts->sampledTotals != NULL) {
+        //The totals are extrapolated from the sampled blocks, give their standard errors.
+        fprintf(fileHandle, " sampleFraction=\"%f\"", counts->sampleFraction);
+        for (int64_t j = 0; j < SUBSTITUTION_TOTAL_NUMBER; j++) {
+            fprintf(fileHandle, " %sStandardError=\"%f\"", substitutionTotalNames[j],
+                    sampledTotal_getStandardError2(&counts->sampledTotals[j], counts->sampleFraction));
+        }
+    }
+    fprintf(fileHandle, " />");
+}
+
+typedef struct _substitutionRun {
+    const AssemblaParameters *parameters;
+    stList *assemblyEventStrings;
+    stList *substitutionStats;
+    SequenceViewCache *sequenceViewCache;
+} SubstitutionRun;
+
+static SegmentHolder *segmentHolder_construct(Arena *arena, Segment *segment, int64_t offset, char base1, char base2,
+        char base3) {
+    SegmentHolder *segmentHolder = arena_malloc(arena, sizeof(SegmentHolder));
+    segmentHolder->segment = segment;
+    segmentHolder->offset = offset;
+    segmentHolder->base1 = base1;
+    segmentHolder->base2 = base2;
+    segmentHolder->base3 = base3;
+    return segmentHolder;
+}
+
+static void addErrorPosition(SubstitutionStats *counts, const AssemblaParameters *parameters, stList *positions,
+        Segment *segment, int64_t offset, char base1, char base2, char base3) {
+    if (parameters->keepErrorPositions) {
+        stList_append(positions, segmentHolder_construct(counts->arena, segment, offset, base1, base2, base3));
+    }
+}
+
+static void addSnpStats(Block *block, SubstitutionStats *counts, const AssemblaParameters *parameters,
+        const SequenceView *hap1Seq, const SequenceView *hap2Seq, const SequenceView *assemblySeq,
+        Segment *hap1Segment, Segment *hap2Segment) {
+    int64_t ignoreFirstNBasesOfBlock = parameters->ignoreFirstNBasesOfBlock;
+    assert(parameters->minimumIdentity >= 0);
+    assert(parameters->minimumIdentity <= 100);
+    if (hap1Seq != NULL || hap2Seq != NULL) {
+        if (hap1Seq != NULL) {
+            assert(hap1Seq->length == block_getLength(block));
+        }
+        if (hap2Seq != NULL) {
+            assert(hap2Seq->length == block_getLength(block));
+        }
+        if (assemblySeq != NULL) {
+            assert(assemblySeq->length == block_getLength(block));
+        }
+        double homoMatches = 0;
+        double matches = 0;
+        for (int64_t i = ignoreFirstNBasesOfBlock; i < block_getLength(block) - ignoreFirstNBasesOfBlock; i++) {
+            char hap1Base = hap1Seq != NULL ? sequenceView_getBase(hap1Seq, i) : 'N';
+            char hap2Base = hap2Seq != NULL ? sequenceView_getBase(hap2Seq, i) : 'N';
+            char assemblyBase = assemblySeq != NULL ? sequenceView_getBase(assemblySeq, i) : 'N';
+            if (hap1Seq != NULL && hap2Seq != NULL) {
+                if (toupper(hap1Base) == toupper(hap2Base)) {
+                    homoMatches++;
+                }
+            } else {
+                homoMatches = INT64_MAX;
+            }
+            if (assemblySeq != NULL) {
+                if (hap1Seq != NULL) {
+                    if (hap2Seq != NULL) {
+                        if (toupper(hap1Base) == toupper(hap2Base) && toupper(hap1Base) == toupper(
+                                assemblyBase)) {
+                            matches++;
+                        }
+                    } else {
+                        if (toupper(hap1Base) == toupper(assemblyBase)) {
+                            matches++;
+                        }
+                    }
+                } else {
+                    assert(hap2Seq != NULL);
+                    if (toupper(hap2Base) == toupper(assemblyBase)) {
+                        matches++;
+                    }
+                }
+            } else {
+                matches = INT64_MAX;
+            }
+        }
+        double homoIdentity = 100.0 * homoMatches / (block_getLength(block) - 2.0 * ignoreFirstNBasesOfBlock);
+        double identity = 100.0 * matches / (block_getLength(block) - 2.0 * ignoreFirstNBasesOfBlock);
+
+        if (homoIdentity >= parameters->minimumIdentity && identity >= parameters->minimumIdentity) {
+            //We're in gravy.
+            for (int64_t i = ignoreFirstNBasesOfBlock; i < block_getLength(block) - ignoreFirstNBasesOfBlock; i++) {
+                char hap1Base = hap1Seq != NULL ? sequenceView_getBase(hap1Seq, i) : 'N';
+                char hap2Base = hap2Seq != NULL ? sequenceView_getBase(hap2Seq, i) : 'N';
+                char assemblyBase = assemblySeq != NULL ? sequenceView_getBase(assemblySeq, i) : 'N';
+                if (hap1Seq != NULL) {
+                    if (hap2Seq != NULL) {
+                        if (toupper(hap1Base) == toupper(hap2Base)) {
+                            counts->totalSites++;
+                            if (assemblySeq != NULL) {
+                                counts->totalCorrect += bitsScoreFn(assemblyBase, hap1Base);
+                                counts->totalErrors += correctFn(assemblyBase, hap1Base) ? 0 : 1;
+                                counts->totalCalls++;
+                            }
+                        } else {
+                            counts->totalHeterozygous++;
+                            if (assemblySeq != NULL) {
+                                assert(toupper(hap1Base) != toupper(hap2Base));
+                                counts->totalCorrectInHeterozygous += bitsScoreFn(assemblyBase, hap1Base);
+                                counts->totalCorrectHap1InHeterozygous += bitsScoreFn(assemblyBase, hap1Base);
+                                counts->totalCorrectInHeterozygous += bitsScoreFn(assemblyBase, hap2Base);
+                                counts->totalCorrectHap2InHeterozygous += bitsScoreFn(assemblyBase, hap2Base);
+                                counts->totalErrorsInHeterozygous += (correctFn(assemblyBase, hap1Base) || correctFn(
+                                        assemblyBase, hap2Base)) ? 0 : 1;
+                                counts->totalCallsInHeterozygous++;
+                                if (!(correctFn(assemblyBase, hap1Base)
+                                        || correctFn(assemblyBase, hap2Base))) {
+                                    addErrorPosition(counts, parameters, counts->hetPositions, hap1Segment, i,
+                                            assemblyBase, hap1Base, hap2Base);
+                                }
+                            }
+                        }
+                    } else {
+                        counts->totalInOneHaplotypeOnly++;
+                        if (assemblySeq != NULL) {
+                            counts->totalCorrectInOneHaplotype += bitsScoreFn(assemblyBase, hap1Base);
+                            counts->totalErrorsInOneHaplotype += correctFn(assemblyBase, hap1Base) ? 0 : 1;
+                            counts->totalCallsInOneHaplotype++;
+                            if (!correctFn(assemblyBase, hap1Base)) {
+                                addErrorPosition(counts, parameters, counts->indelPositions, hap1Segment, i,
+                                        assemblyBase, hap1Base, 'N');
+                            }
+                        }
+                    }
+                } else {
+                    if (hap2Seq != NULL) {
+                        counts->totalInOneHaplotypeOnly++;
+                        if (assemblySeq != NULL) {
+                            counts->totalCorrectInOneHaplotype += bitsScoreFn(assemblyBase, hap2Base);
+                            counts->totalErrorsInOneHaplotype += correctFn(assemblyBase, hap2Base) ? 0 : 1;
+                            counts->totalCallsInOneHaplotype++;
+                            if (!correctFn(assemblyBase, hap2Base)) {
+                                addErrorPosition(counts, parameters, counts->indelPositions, hap2Segment, i,
+                                        assemblyBase, 'N', hap2Base);
+                            }
+                        }
+                    }
+                }
+            }
+        } else {
+            COUNT(substitutionBlocksBelowMinimumIdentity);
+        }
+    }
+}
+
+static void getSnpStats(Block *block, SubstitutionRun *run) {
+    COUNT(substitutionBlocks);
+    const AssemblaParameters *parameters = run->parameters;
+    if (block_getLength(block) >= parameters->minimumBlockLength) {
+        //Now get the column, the haplotype strings are shared by all the assemblies
+        Block_InstanceIterator *instanceIterator = block_getInstanceIterator(block);
+        Segment *segment;
+        SequenceView hap1View, hap2View;
+        SequenceView *hap1Seq = NULL;
+        SequenceView *hap2Seq = NULL;
+        int64_t assemblyNumber = stList_length(run->assemblyEventStrings);
+        SequenceView *assemblyViews = st_malloc(assemblyNumber * sizeof(SequenceView));
+        bool *hasAssemblySeqs = st_calloc(assemblyNumber, sizeof(bool));
+        bool *duplicateAssemblySeqs = st_calloc(assemblyNumber, sizeof(bool));
+        Segment *hap1Segment = NULL;
+        Segment *hap2Segment = NULL;
+        while ((segment = block_getNext(instanceIterator)) != NULL) {
+            const char *segmentEvent = event_getHeader(segment_getEvent(segment));
+            if (strcmp(segmentEvent, parameters->hap1EventString) == 0) {
+                if (hap1Seq != NULL) {
+                    COUNT(substitutionBlocksWithDuplicateHaplotypes);
+                    goto end;
+                }
+                hap1Seq = sequenceViewCache_get(run->sequenceViewCache, segment, &hap1View) ? &hap1View : NULL;
+                hap1Segment = segment;
+            }
+            if (strcmp(segmentEvent, parameters->hap2EventString) == 0) {
+                if (hap2Seq != NULL) {
+                    COUNT(substitutionBlocksWithDuplicateHaplotypes);
+                    goto end;
+                }
+                hap2Seq = sequenceViewCache_get(run->sequenceViewCache, segment, &hap2View) ? &hap2View : NULL;
+                hap2Segment = segment;
+            }
+            int64_t assemblyIndex = getEventIndex(run->assemblyEventStrings, segmentEvent);
+            if (assemblyIndex != -1) {
+                if (hasAssemblySeqs[assemblyIndex]) {
+                    //The block is skipped for this assembly only
+                    COUNT(substitutionDuplicateAssemblySegments);
+                    duplicateAssemblySeqs[assemblyIndex] = 1;
+                } else {
+                    hasAssemblySeqs[assemblyIndex] = sequenceViewCache_get(run->sequenceViewCache, segment,
+                            &assemblyViews[assemblyIndex]);
+                }
+            }
+        }
+
+        for (int64_t i = 0; i < assemblyNumber; i++) {
+            if (!duplicateAssemblySeqs[i]) {
+                SubstitutionStats *counts = stList_get(run->substitutionStats, i);
+                double totalsBefore[SUBSTITUTION_TOTAL_NUMBER], totalsAfter[SUBSTITUTION_TOTAL_NUMBER];
+                if (counts->sampledTotals != NULL) {
+                    substitutionStats_getTotals(counts, totalsBefore);
+                }
+                addSnpStats(block, counts, parameters, hap1Seq, hap2Seq, hasAssemblySeqs[i] ? &assemblyViews[i] : NULL,
+                        hap1Segment, hap2Segment);
+                if (counts->sampledTotals != NULL) {
+                    //The contribution of the block to each total.
+                    substitutionStats_getTotals(counts, totalsAfter);
+                    for (int64_t j = 0; j < SUBSTITUTION_TOTAL_NUMBER; j++) {
+                        sampledTotal_add(&counts->sampledTotals[j], totalsAfter[j] - totalsBefore[j]);
+                    }
+                }
+            }
+        }
+
+        end:
+        //cleanup, the strings of the views are freed with the cache
+        sequenceViewCache_clear(run->sequenceViewCache);
+        free(assemblyViews);
+        free(hasAssemblySeqs);
+        free(duplicateAssemblySeqs);
+        block_destructInstanceIterator(instanceIterator);
+    } else {
+        COUNT(substitutionBlocksBelowMinimumLength);
+    }
+}
+
+stList *assemblaMetrics_getSubstitutionStats(AssemblaContext *context, const AssemblaParameters *parameters,
+        stList *assemblyEventStrings) {
+    SubstitutionRun run;
+    run.parameters = parameters;
+    run.assemblyEventStrings = assemblyEventStrings;
+    run.substitutionStats = stList_construct3(0, (void (*)(void *)) substitutionStats_destruct);
+    run.sequenceViewCache = context->sequenceViewCache;
+    for (int64_t i = 0; i < stList_length(assemblyEventStrings); i++) {
+        stList_append(run.substitutionStats, substitutionStats_construct(parameters->sampleFraction));
+    }
+    RegionSet *regionSet = parameters->regions != NULL ? regionSet_construct(parameters->regions) : NULL;
+    BlockTraversal blockTraversal;
+    getBlockTraversal(context, parameters, regionSet, &blockTraversal);
+    if (parameters->keepErrorPositions && blockTraversal.maximumMemory != INT64_MAX) {
+        //The positions keep pointers to segments.
+        st_logInfo("Not unloading flowers, as the positions are to be kept\n");
+        blockTraversal.maximumMemory = INT64_MAX;
+    }
+
+    //One pass over the blocks, for all the assemblies.
+    pthread_mutex_lock(&context->mutex);
+    blockTraversal_run(&blockTraversal, (void (*)(Block *, void *)) getSnpStats, &run);
+    pthread_mutex_unlock(&context->mutex);
+
+    if (regionSet != NULL) {
+        regionSet_destruct(regionSet);
+    }
+    return run.substitutionStats;
+}
+
+/*
+ * Copy number stats.
+ */
+
+const char *copyNumberTotalNames[COPY_NUMBER_TOTAL_NUMBER] = { "totalColumnCount", "totalBaseCount",
+        "deficientCopyNumberCounts.totalColumns", "deficientCopyNumberCounts.totalBases",
+        "deficientCopyNumberCountsGreaterThanZero.totalColumns", "deficientCopyNumberCountsGreaterThanZero.totalBases",
+        "excessCopyNumberCounts.totalColumns", "excessCopyNumberCounts.totalBases" };
+
+static uint64_t copyNumberCategory_hashKey(const CopyNumberCategory *category) {
+    return (uint64_t) category->maxHapNumber * 1000003 + (uint64_t) category->minHapNumber * 10007
+            + (uint64_t) category->assemblyNumber;
+}
+
+static int copyNumberCategory_equalsFn(const CopyNumberCategory *category1, const CopyNumberCategory *category2) {
+    return category1->maxHapNumber == category2->maxHapNumber && category1->minHapNumber == category2->minHapNumber
+            && category1->assemblyNumber == category2->assemblyNumber;
+}
+
+static int copyNumberCategory_cmpFn(const CopyNumberCategory *category1, const CopyNumberCategory *category2) {
+    if (category1->maxHapNumber != category2->maxHapNumber) {
+        return category1->maxHapNumber < category2->maxHapNumber ? -1 : 1;
+    }
+    if (category1->minHapNumber != category2->minHapNumber) {
+        return category1->minHapNumber < category2->minHapNumber ? -1 : 1;
+    }
+    if (category1->assemblyNumber != category2->assemblyNumber) {
+        return category1->assemblyNumber < category2->assemblyNumber ? -1 : 1;
+    }
+    return 0;
+}
+
+CopyNumberStats *copyNumberStats_construct(double sampleFraction) {
+    CopyNumberStats *copyNumberStats = st_calloc(1, sizeof(CopyNumberStats));
+    copyNumberStats->categories = stHash_construct3((uint64_t(*)(const void *)) copyNumberCategory_hashKey,
+            (int(*)(const void *, const void *)) copyNumberCategory_equalsFn, NULL, NULL);
+    copyNumberStats->sampleFraction = sampleFraction;
+    copyNumberStats->arena = arena_construct();
+    return copyNumberStats;
+}
+
+void copyNumberStats_destruct(CopyNumberStats *copyNumberStats) {
+    stHash_destruct(copyNumberStats->categories);
+    arena_destruct(copyNumberStats->arena);
+    free(copyNumberStats);
+}
+
+static void addCopyNumberTotals(int64_t *totals, int64_t maxHapNumber, int64_t minHapNumber, int64_t assemblyNumber,
+        int64_t columnCount) {
+    /*
+     * Adds the columns of a copy number category to the totals.
+     */
+    totals[TOTAL_COLUMNS] += columnCount;
+    totals[TOTAL_BASES] += assemblyNumber * columnCount;
+    if (assemblyNumber < minHapNumber) {
+        totals[DEFICIENT_COLUMNS] += columnCount;
+        totals[DEFICIENT_BASES] += columnCount * (minHapNumber - assemblyNumber);
+        if (assemblyNumber > 0) {
+            totals[DEFICIENT_COLUMNS_GREATER_THAN_ZERO] += columnCount;
+            totals[DEFICIENT_BASES_GREATER_THAN_ZERO] += columnCount * (minHapNumber - assemblyNumber);
+        }
+    } else if (assemblyNumber > maxHapNumber) {
+        totals[EXCESS_COLUMNS] += columnCount;
+        totals[EXCESS_BASES] += columnCount * (assemblyNumber - maxHapNumber);
+    }
+}
+
+void copyNumberStats_addColumnCount(CopyNumberStats *copyNumberStats, int64_t maxHapNumber, int64_t minHapNumber,
+        int64_t assemblyNumber, int64_t columnCount) {
+    //Only allocates the category if it is new.
+    CopyNumberCategory key = { maxHapNumber, minHapNumber, assemblyNumber, 0 };
+    CopyNumberCategory *category = stHash_search(copyNumberStats->categories, &key);
+    if (category == NULL) {
+        COUNT(copyNumberCategories);
+        category = arena_malloc(copyNumberStats->arena, sizeof(CopyNumberCategory));
+        *category = key;
+        stHash_insert(copyNumberStats->categories, category, category);
+    }
+    category->columnCount += columnCount;
+}
+
+stList *copyNumberStats_getCategories(CopyNumberStats *copyNumberStats) {
+    stList *categories = stHash_getKeys(copyNumberStats->categories);
+    stList_sort(categories, (int(*)(const void *, const void *)) copyNumberCategory_cmpFn);
+    return categories;
+}
+
+void copyNumberStats_getTotals(CopyNumberStats *copyNumberStats, int64_t *totals) {
+    for (int64_t i = 0; i < COPY_NUMBER_TOTAL_NUMBER; i++) {
+        totals[i] = 0;
+    }
+    if (copyNumberStats->sampleFraction < 1.0) {
+        for (int64_t i = 0; i < COPY_NUMBER_TOTAL_NUMBER; i++) {
+            totals[i] = llround(sampledTotal_getEstimate2(&copyNumberStats->sampledTotals[i],
+                    copyNumberStats->sampleFraction));
+        }
+        return;
+    }
+    stHashIterator *it = stHash_getIterator(copyNumberStats->categories);
+    CopyNumberCategory *category;
+    while ((category = stHash_getNext(it)) != NULL) {
+        addCopyNumberTotals(totals, category->maxHapNumber, category->minHapNumber, category->assemblyNumber,
+                category->columnCount);
+    }
+    stHash_destructIterator(it);
+}
+
+int64_t copyNumberStats_getColumnCount(CopyNumberStats *copyNumberStats, CopyNumberCategory *category) {
+    return llround(category->columnCount / copyNumberStats->sampleFraction);
+}
+
+void copyNumberStats_writeXML(CopyNumberStats *copyNumberStats, int64_t minimumBlockLength, FILE *fileHandle) {
+    stList *copyNumbers = copyNumberStats_getCategories(copyNumberStats);
+    int64_t totals[COPY_NUMBER_TOTAL_NUMBER];
+    copyNumberStats_getTotals(copyNumberStats, totals);
+    int64_t totalColumnCount = totals[TOTAL_COLUMNS];
+    int64_t totalBaseCount = totals[TOTAL_BASES];
+    int64_t totalCopyNumberDeficientColumns = totals[DEFICIENT_COLUMNS];
+    int64_t totalCopyNumberDeficientBases = totals[DEFICIENT_BASES];
+    int64_t totalCopyNumberDeficientColumnsGreaterThanZero = totals[DEFICIENT_COLUMNS_GREATER_THAN_ZERO];
+    int64_t totalCopyNumberDeficientBasesGreaterThanZero = totals[DEFICIENT_BASES_GREATER_THAN_ZERO];
+    int64_t totalCopyNumberExcessColumns = totals[EXCESS_COLUMNS];
+    int64_t totalCopyNumberExcessBases = totals[EXCESS_BASES];
+    fprintf(fileHandle, "<copy_number_stats minimumBlockLength=\"%" PRIi64 "\" totalColumnCount=\"%" PRIi64 "\" totalBaseCount=\"%" PRIi64 "\"", minimumBlockLength, totalColumnCount, totalBaseCount);
+    if (copyNumberStats->sampleFraction < 1.0) {
+        //The totals are extrapolated from the sampled blocks, give their standard errors.
+        fprintf(fileHandle, " sampleFraction=\"%f\"", copyNumberStats->sampleFraction);
+        for (int64_t i = 0; i < COPY_NUMBER_TOTAL_NUMBER; i++) {
+            fprintf(fileHandle, " %sStandardError=\"%f\"", copyNumberTotalNames[i],
+                    sampledTotal_getStandardError2(&copyNumberStats->sampledTotals[i],
+                            copyNumberStats->sampleFraction));
+        }
+    }
+    fprintf(fileHandle, ">\n");
+    for (int64_t i = 0; i < stList_length(copyNumbers); i++) {
+        CopyNumberCategory *copyNumber = stList_get(copyNumbers, i);
+        int64_t *columnCount = &copyNumber->columnCount;
+        int64_t maxHapNumber = copyNumber->maxHapNumber;
+        int64_t minHapNumber = copyNumber->minHapNumber;
+        assert(minHapNumber >= 0);
+        assert(maxHapNumber >= minHapNumber);
+        int64_t assemblyNumber = copyNumber->assemblyNumber;
+        assert(assemblyNumber >= 0);
+        assert(columnCount != NULL);
+        assert(columnCount[0] >= 1);
+        fprintf(
+                fileHandle,
+                "<copy_number_category maximumHaplotypeCopyNumber=\"%" PRIi64 "\" minimumHaplotypeCopyNumber=\"%" PRIi64 "\" assemblyCopyNumber=\"%" PRIi64 "\" columnCount=\"%" PRIi64 "\"/>\n",
+                maxHapNumber, minHapNumber, assemblyNumber, copyNumberStats_getColumnCount(copyNumberStats, copyNumber));
+    }
+    fprintf(fileHandle, "<deficientCopyNumberCounts totalColumns=\"%" PRIi64 "\" totalBases=\"%" PRIi64 "\" totalProportionOfColumns=\"%f\" totalProportionOfBases=\"%f\"/>",
+            totalCopyNumberDeficientColumns, totalCopyNumberDeficientBases,
+            ((float)totalCopyNumberDeficientColumns)/totalColumnCount, ((float)totalCopyNumberDeficientBases)/totalBaseCount);
+    fprintf(fileHandle, "<deficientCopyNumberCountsGreaterThanZero totalColumns=\"%" PRIi64 "\" totalBases=\"%" PRIi64 "\" totalProportionOfColumns=\"%f\" totalProportionOfBases=\"%f\"/>",
+                totalCopyNumberDeficientColumnsGreaterThanZero, totalCopyNumberDeficientBasesGreaterThanZero,
+                ((float)totalCopyNumberDeficientColumnsGreaterThanZero)/totalColumnCount, ((float)totalCopyNumberDeficientBasesGreaterThanZero)/totalBaseCount);
+    fprintf(fileHandle, "<excessCopyNumberCounts totalColumns=\"%" PRIi64 "\" totalBases=\"%" PRIi64 "\" totalProportionOfColumns=\"%f\" totalProportionOfBases=\"%f\"/>",
+            totalCopyNumberExcessColumns, totalCopyNumberExcessBases,
+            ((float)totalCopyNumberExcessColumns)/totalColumnCount, ((float)totalCopyNumberExcessBases)/totalBaseCount);
+    fprintf(fileHandle, "</copy_number_stats>\n");
+    stList_destruct(copyNumbers);
+}
+
+typedef struct _copyNumberRun {
+    const AssemblaParameters *parameters;
+    stList *assemblyEventStrings;
+    stList *copyNumberStats;
+    int64_t *assemblyNumbers;
+} CopyNumberRun;
+
+static void getCopyNumbers(Block *block, CopyNumberRun *run) {
+    /*
+     * Counts the copy numbers of the block, for every assembly at once.
+     */
+    COUNT(copyNumberBlocks);
+    const AssemblaParameters *parameters = run->parameters;
+    if (block_getLength(block) >= parameters->minimumBlockLength) {
+        Segment *segment;
+        Block_InstanceIterator *instanceIt = block_getInstanceIterator(block);
+        int64_t hapA1Number = 0, hapA2Number = 0;
+        for (int64_t i = 0; i < stList_length(run->assemblyEventStrings); i++) {
+            run->assemblyNumbers[i] = 0;
+        }
+        while ((segment = block_getNext(instanceIt)) != NULL) {
+            const char *segmentEvent = event_getHeader(segment_getEvent(segment));
+            int64_t assemblyIndex = getEventIndex(run->assemblyEventStrings, segmentEvent);
+            if (assemblyIndex != -1) { //Establish if we need a line..
+                run->assemblyNumbers[assemblyIndex]++;
+            } else if (strcmp(segmentEvent, parameters->hap1EventString) == 0) {
+                hapA1Number++;
+            } else if (strcmp(segmentEvent, parameters->hap2EventString) == 0) {
+                hapA2Number++;
+            }
+        }
+        block_destructInstanceIterator(instanceIt);
+        for (int64_t i = 0; i < stList_length(run->assemblyEventStrings); i++) {
+            CopyNumberStats *copyNumberStats = stList_get(run->copyNumberStats, i);
+            int64_t assemblyNumber = run->assemblyNumbers[i];
+            if (assemblyNumber > 0 || hapA1Number > 0 || hapA2Number > 0) {
+                int64_t maxHapNumber = hapA1Number > hapA2Number ? hapA1Number : hapA2Number;
+                int64_t minHapNumber = hapA1Number < hapA2Number ? hapA1Number : hapA2Number;
+                if (parameters->sampleFraction < 1.0) {
+                    int64_t totals[COPY_NUMBER_TOTAL_NUMBER] = { 0 };
+                    addCopyNumberTotals(totals, maxHapNumber, minHapNumber, assemblyNumber, block_getLength(block));
+                    for (int64_t j = 0; j < COPY_NUMBER_TOTAL_NUMBER; j++) {
+                        sampledTotal_add(&copyNumberStats->sampledTotals[j], totals[j]);
+                    }
+                }
+                copyNumberStats_addColumnCount(copyNumberStats, maxHapNumber, minHapNumber, assemblyNumber,
+                        block_getLength(block));
+            }
+        }
+    } else {
+        COUNT(copyNumberBlocksBelowMinimumLength);
+    }
+}
+
+stList *assemblaMetrics_getCopyNumberStats(AssemblaContext *context, const AssemblaParameters *parameters,
+        stList *assemblyEventStrings) {
+    CopyNumberRun run;
+    run.parameters = parameters;
+    run.assemblyEventStrings = assemblyEventStrings;
+    run.copyNumberStats = stList_construct3(0, (void (*)(void *)) copyNumberStats_destruct);
+    run.assemblyNumbers = st_malloc(sizeof(int64_t) * (stList_length(assemblyEventStrings) + 1));
+    for (int64_t i = 0; i < stList_length(assemblyEventStrings); i++) {
+        stList_append(run.copyNumberStats, copyNumberStats_construct(parameters->sampleFraction));
+    }
+    RegionSet *regionSet = parameters->regions != NULL ? regionSet_construct(parameters->regions) : NULL;
+    BlockTraversal blockTraversal;
+    getBlockTraversal(context, parameters, regionSet, &blockTraversal);
+
+    //Pass over the blocks, once for all the assemblies.
+    pthread_mutex_lock(&context->mutex);
+    blockTraversal_run(&blockTraversal, (void (*)(Block *, void *)) getCopyNumbers, &run);
+    pthread_mutex_unlock(&context->mutex);
+
+    if (regionSet != NULL) {
+        regionSet_destruct(regionSet);
+    }
+    free(run.assemblyNumbers);
+    return run.copyNumberStats;
+}
@@ -0,0 +1,530 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten (at) gmail.com) and Dent Earl (dearl (at) soe.ucsc.edu)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sonLib.h"
+#include "cactus.h"
+#include "contigPaths.h"
+#include "contigPathTable.h"
+#include "counters.h"
+
+/*
+ * File layout, all integers are int64_t unless stated:
+ *
+ * magic (8 bytes), key length, key padded to 8 bytes,
+ * table size, segment number, path number, scaffold number,
+ * segment names (table size), segment ordinals (table size),
+ * segment paths (segment number), cap lengths (segment number * 4),
+ * path lengths, scaffold path lengths, path scaffolds (path number each), scaffold lengths (scaffold number),
+ * cap codes (int8_t, segment number * 4), segment orientations (int8_t, segment number),
+ * both padded to 8 bytes.
+ */
+
+static const char *contigPathTableMagic = "ASMCPT02";
+
+struct _contigPathTable {
+    //Open addressing table (linear probing) from segment names to segment ordinals,
+    //empty slots have the name NULL_NAME.
+    Name *segmentNames;
+    int64_t *segmentOrdinals;
+    int64_t tableSize;
+    //Indexed by segment ordinal.
+    int64_t *segmentPaths;
+    int8_t *segmentOrientations; //segment_getOrientation of the segment as it is in its path
+    int64_t segmentNumber;
+    int64_t maxSegmentNumber;
+    //Indexed by segment ordinal * 4: the codes of the 5' and 3' caps of the segment as it is in
+    //its path, then of the 5' and 3' caps of its reverse.
+    int8_t *capCodes;
+    //Indexed by segment ordinal * 4: the insert and delete lengths of the 5' cap of the segment as
+    //it is in its path, then those of its 3' cap.
+    int64_t *capLengths;
+    //Indexed by path ordinal.
+    int64_t *pathLengths;
+    int64_t *scaffoldPathLengths;
+    int64_t *pathScaffolds;
+    int64_t pathNumber;
+    int64_t maxPathNumber;
+    //Indexed by scaffold ordinal.
+    int64_t *scaffoldLengths;
+    int64_t scaffoldNumber;
+    int64_t maxScaffoldNumber;
+    //If the table was loaded from a file the arrays point into this mapping.
+    void *mapping;
+    int64_t mappingLength;
+};
+
+static uint64_t hashName(Name name) {
+    uint64_t i = (uint64_t) name;
+    i ^= i >> 33;
+    i *= 0xff51afd7ed558ccdULL;
+    i ^= i >> 33;
+    i *= 0xc4ceb9fe1a85ec53ULL;
+    i ^= i >> 33;
+    return i;
+}
+
+static int64_t *getSlot(ContigPathTable *contigPathTable, Name name, bool insert) {
+    uint64_t mask = contigPathTable->tableSize - 1;
+    COUNT(contigPathTableLookups);
+    for (uint64_t i = hashName(name) & mask;; i = (i + 1) & mask) {
+        COUNT(contigPathTableProbes);
+        if (contigPathTable->segmentNames[i] == name) {
+            return &contigPathTable->segmentOrdinals[i];
+        }
+        if (contigPathTable->segmentNames[i] == NULL_NAME) {
+            if (!insert) {
+                return NULL;
+            }
+            contigPathTable->segmentNames[i] = name;
+            return &contigPathTable->segmentOrdinals[i];
+        }
+    }
+}
+
+static void resizeTable(ContigPathTable *contigPathTable, int64_t tableSize) {
+    Name *segmentNames = contigPathTable->segmentNames;
+    int64_t *segmentOrdinals = contigPathTable->segmentOrdinals;
+    int64_t oldTableSize = contigPathTable->tableSize;
+    contigPathTable->tableSize = tableSize;
+    contigPathTable->segmentNames = st_malloc(sizeof(Name) * tableSize);
+    contigPathTable->segmentOrdinals = st_malloc(sizeof(int64_t) * tableSize);
+    for (int64_t i = 0; i < tableSize; i++) {
+        contigPathTable->segmentNames[i] = NULL_NAME;
+    }
+    for (int64_t i = 0; i < oldTableSize; i++) {
+        if (segmentNames[i] != NULL_NAME) {
+            *getSlot(contigPathTable, segmentNames[i], 1) = segmentOrdinals[i];
+        }
+    }
+    free(segmentNames);
+    free(segmentOrdinals);
+}
+
+static void *resizeArray(void *array, int64_t length, size_t elementSize) {
+    array = realloc(array, length * elementSize);
+    if (array == NULL) {
+        st_errAbort("Failed to grow a contig path table to %" PRIi64 " entries", length);
+    }
+    return array;
+}
+
+static int64_t getNewLength(int64_t maxLength, int64_t length) {
+    while (length > maxLength) {
+        maxLength = maxLength * 2 + 16;
+    }
+    return maxLength;
+}
+
+static void reserveSegments(ContigPathTable *contigPathTable, int64_t segmentNumber) {
+    if (segmentNumber > contigPathTable->maxSegmentNumber) {
+        int64_t i = getNewLength(contigPathTable->maxSegmentNumber, segmentNumber);
+        contigPathTable->segmentPaths = resizeArray(contigPathTable->segmentPaths, i, sizeof(int64_t));
+        contigPathTable->segmentOrientations = resizeArray(contigPathTable->segmentOrientations, i, sizeof(int8_t));
+        contigPathTable->capCodes = resizeArray(contigPathTable->capCodes, i * 4, sizeof(int8_t));
+        contigPathTable->capLengths = resizeArray(contigPathTable->capLengths, i * 4, sizeof(int64_t));
+        contigPathTable->maxSegmentNumber = i;
+    }
+}
+
+static void reservePaths(ContigPathTable *contigPathTable, int64_t pathNumber) {
+    if (pathNumber > contigPathTable->maxPathNumber) {
+        int64_t i = getNewLength(contigPathTable->maxPathNumber, pathNumber);
+        contigPathTable->pathLengths = resizeArray(contigPathTable->pathLengths, i, sizeof(int64_t));
+        contigPathTable->scaffoldPathLengths = resizeArray(contigPathTable->scaffoldPathLengths, i, sizeof(int64_t));
+        contigPathTable->pathScaffolds = resizeArray(contigPathTable->pathScaffolds, i, sizeof(int64_t));
+        contigPathTable->maxPathNumber = i;
+    }
+}
+
+static void reserveScaffolds(ContigPathTable *contigPathTable, int64_t scaffoldNumber) {
+    if (scaffoldNumber > contigPathTable->maxScaffoldNumber) {
+        int64_t i = getNewLength(contigPathTable->maxScaffoldNumber, scaffoldNumber);
+        contigPathTable->scaffoldLengths = resizeArray(contigPathTable->scaffoldLengths, i, sizeof(int64_t));
+        contigPathTable->maxScaffoldNumber = i;
+    }
+}
+
+ContigPathTable *contigPathTable_construct(void) {
+    ContigPathTable *contigPathTable = st_calloc(1, sizeof(ContigPathTable));
+    resizeTable(contigPathTable, 16);
+    return contigPathTable;
+}
+
+void contigPathTable_destruct(ContigPathTable *contigPathTable) {
+    if (contigPathTable->mapping != NULL) {
+        munmap(contigPathTable->mapping, contigPathTable->mappingLength);
+    } else {
+        free(contigPathTable->segmentNames);
+        free(contigPathTable->segmentOrdinals);
+        free(contigPathTable->segmentPaths);
+        free(contigPathTable->segmentOrientations);
+        free(contigPathTable->capCodes);
+        free(contigPathTable->capLengths);
+        free(contigPathTable->pathLengths);
+        free(contigPathTable->scaffoldPathLengths);
+        free(contigPathTable->pathScaffolds);
+        free(contigPathTable->scaffoldLengths);
+    }
+    free(contigPathTable);
+}
+
+static int8_t getCapCodeAndLengths(Cap *cap, stList *haplotypeEventStrings, stList *contaminationEventStrings,
+        CapCodeParameters *capCodeParameters, int64_t *capLengths, Cap **otherCap) {
+    Cap *otherCap2;
+    int64_t insertLength = 0, deleteLength = 0;
+    enum CapCode capCode = getCapCode(cap, otherCap != NULL ? otherCap : &otherCap2, haplotypeEventStrings,
+            contaminationEventStrings, &insertLength, &deleteLength, capCodeParameters);
+    COUNT_INDEX(capCodes, capCode);
+    if (capLengths != NULL) {
+        capLengths[0] = insertLength;
+        capLengths[1] = deleteLength;
+    }
+    return capCode;
+}
+
+static void addSegment(ContigPathTable *contigPathTable, Segment *segment, int64_t path,
+        stList *haplotypeEventStrings, stList *contaminationEventStrings, CapCodeParameters *capCodeParameters) {
+    if ((contigPathTable->segmentNumber + 1) * 2 > contigPathTable->tableSize) { //keep the load below a half
+        resizeTable(contigPathTable, contigPathTable->tableSize * 2);
+    }
+    if (getSlot(contigPathTable, segment_getName(segment), 0) != NULL) {
+        //A segment is in at most one contig path.
+        assert(contigPathTable_getPath(contigPathTable, segment) == path);
+        return;
+    }
+    reserveSegments(contigPathTable, contigPathTable->segmentNumber + 1);
+    int64_t segmentOrdinal = contigPathTable->segmentNumber++;
+    *getSlot(contigPathTable, segment_getName(segment), 1) = segmentOrdinal;
+    contigPathTable->segmentPaths[segmentOrdinal] = path;
+    contigPathTable->segmentOrientations[segmentOrdinal] = segment_getOrientation(segment);
+    int8_t *capCodes = &contigPathTable->capCodes[segmentOrdinal * 4];
+    int64_t *capLengths = &contigPathTable->capLengths[segmentOrdinal * 4];
+    capCodes[0] = getCapCodeAndLengths(segment_get5Cap(segment), haplotypeEventStrings, contaminationEventStrings,
+            capCodeParameters, capLengths, NULL);
+    capCodes[1] = getCapCodeAndLengths(segment_get3Cap(segment), haplotypeEventStrings, contaminationEventStrings,
+            capCodeParameters, capLengths + 2, NULL);
+    capCodes[2] = getCapCodeAndLengths(segment_get5Cap(segment_getReverse(segment)), haplotypeEventStrings,
+            contaminationEventStrings, capCodeParameters, NULL, NULL);
+    capCodes[3] = getCapCodeAndLengths(segment_get3Cap(segment_getReverse(segment)), haplotypeEventStrings,
+            contaminationEventStrings, capCodeParameters, NULL, NULL);
+}
+
+/*
+ * Union-find over the paths of a call to contigPathTable_addContigPaths, indexed by path
+ * ordinal less the first path ordinal of the call.
+ */
+static int64_t findScaffold(int64_t *parents, int64_t i) {
+    int64_t root = i;
+    while (parents[root] != root) {
+        root = parents[root];
+    }
+    while (parents[i] != root) { //path compression
+        int64_t j = parents[i];
+        parents[i] = root;
+        i = j;
+    }
+    return root;
+}
+
+static void joinScaffolds(int64_t *parents, int64_t *sizes, int64_t i, int64_t j) {
+    i = findScaffold(parents, i);
+    j = findScaffold(parents, j);
+    if (i != j) { //union by size
+        if (sizes[i] < sizes[j]) {
+            int64_t k = i;
+            i = j;
+            j = k;
+        }
+        parents[j] = i;
+        sizes[i] += sizes[j];
+    }
+}
+
+static void joinScaffoldEnd(ContigPathTable *contigPathTable, int64_t *parents, int64_t *sizes, int64_t firstPath,
+        int64_t path, Cap *cap, stList *haplotypeEventStrings, stList *contaminationEventStrings,
+        CapCodeParameters *capCodeParameters) {
+    /*
+     * Joins the scaffold of the path to the scaffold of the path across the gap at the given end cap, if any.
+     */
+    Cap *otherCap = NULL;
+    enum CapCode capCode = getCapCodeAndLengths(cap, haplotypeEventStrings, contaminationEventStrings,
+            capCodeParameters, NULL, &otherCap);
+    if ((capCode == SCAFFOLD_GAP || capCode == AMBIGUITY_GAP) && otherCap != NULL
+            && cap_getSegment(otherCap) != NULL) {
+        int64_t otherPath = contigPathTable_getPath(contigPathTable, cap_getSegment(otherCap));
+        if (otherPath >= firstPath) {
+            joinScaffolds(parents, sizes, path - firstPath, otherPath - firstPath);
+        }
+    }
+}
+
+void contigPathTable_addContigPaths(ContigPathTable *contigPathTable, stList *contigPaths,
+        stList *haplotypeEventStrings, stList *contaminationEventStrings, CapCodeParameters *capCodeParameters) {
+    assert(contigPathTable->mapping == NULL);
+    int64_t firstPath = contigPathTable->pathNumber;
+    int64_t pathNumber = stList_length(contigPaths);
+    reservePaths(contigPathTable, firstPath + pathNumber);
+    for (int64_t i = 0; i < pathNumber; i++) {
+        stList *contigPath = stList_get(contigPaths, i);
+        int64_t path = contigPathTable->pathNumber++;
+        contigPathTable->pathLengths[path] = contigPathLength(contigPath);
+        for (int64_t j = 0; j < stList_length(contigPath); j++) {
+            addSegment(contigPathTable, stList_get(contigPath, j), path, haplotypeEventStrings,
+                    contaminationEventStrings, capCodeParameters);
+        }
+    }
+
+    //The scaffold paths, as in getScaffoldPaths: paths are joined across the scaffold and
+    //ambiguity gaps at their ends.
+    int64_t *parents = st_malloc(sizeof(int64_t) * (pathNumber + 1));
+    int64_t *sizes = st_malloc(sizeof(int64_t) * (pathNumber + 1));
+    for (int64_t i = 0; i < pathNumber; i++) {
+        parents[i] = i;
+        sizes[i] = 1;
+    }
+    for (int64_t i = 0; i < pathNumber; i++) {
+        stList *contigPath = stList_get(contigPaths, i);
+        assert(stList_length(contigPath) > 0);
+        joinScaffoldEnd(contigPathTable, parents, sizes, firstPath, firstPath + i,
+                segment_get5Cap(stList_get(contigPath, 0)), haplotypeEventStrings, contaminationEventStrings,
+                capCodeParameters);
+        joinScaffoldEnd(contigPathTable, parents, sizes, firstPath, firstPath + i,
+                segment_get3Cap(stList_get(contigPath, stList_length(contigPath) - 1)), haplotypeEventStrings,
+                contaminationEventStrings, capCodeParameters);
+    }
+
+    //Number the scaffolds in the order their first paths were added and sum their lengths. The
+    //sizes array is reused to hold the scaffold ordinal of each representative.
+    for (int64_t i = 0; i < pathNumber; i++) {
+        sizes[i] = -1;
+    }
+    for (int64_t i = 0; i < pathNumber; i++) {
+        int64_t root = findScaffold(parents, i);
+        if (sizes[root] == -1) {
+            reserveScaffolds(contigPathTable, contigPathTable->scaffoldNumber + 1);
+            sizes[root] = contigPathTable->scaffoldNumber++;
+            contigPathTable->scaffoldLengths[sizes[root]] = 0;
+        }
+        contigPathTable->pathScaffolds[firstPath + i] = sizes[root];
+        contigPathTable->scaffoldLengths[sizes[root]] += contigPathTable->pathLengths[firstPath + i];
+    }
+    for (int64_t i = firstPath; i < contigPathTable->pathNumber; i++) {
+        contigPathTable->scaffoldPathLengths[i] = contigPathTable->scaffoldLengths[contigPathTable->pathScaffolds[i]];
+        assert(contigPathTable->scaffoldPathLengths[i] >= contigPathTable->pathLengths[i]);
+    }
+    free(parents);
+    free(sizes);
+}
+
+int64_t contigPathTable_getSegmentNumber(ContigPathTable *contigPathTable) {
+    return contigPathTable->segmentNumber;
+}
+
+int64_t contigPathTable_getPathNumber(ContigPathTable *contigPathTable) {
+    return contigPathTable->pathNumber;
+}
+
+int64_t contigPathTable_getScaffoldNumber(ContigPathTable *contigPathTable) {
+    return contigPathTable->scaffoldNumber;
+}
+
+int64_t contigPathTable_getSegmentOrdinal(ContigPathTable *contigPathTable, Segment *segment) {
+    int64_t *segmentOrdinal = getSlot(contigPathTable, segment_getName(segment), 0);
+    return segmentOrdinal != NULL ? *segmentOrdinal : -1;
+}
+
+int64_t contigPathTable_getPath(ContigPathTable *contigPathTable, Segment *segment) {
+    int64_t segmentOrdinal = contigPathTable_getSegmentOrdinal(contigPathTable, segment);
+    return segmentOrdinal != -1 ? contigPathTable->segmentPaths[segmentOrdinal] : -1;
+}
+
+int64_t contigPathTable_getSegmentPath(ContigPathTable *contigPathTable, int64_t segmentOrdinal) {
+    assert(segmentOrdinal >= 0 && segmentOrdinal < contigPathTable->segmentNumber);
+    return contigPathTable->segmentPaths[segmentOrdinal];
+}
+
+int64_t contigPathTable_getPathLength(ContigPathTable *contigPathTable, int64_t path) {
+    assert(path >= 0 && path < contigPathTable->pathNumber);
+    return contigPathTable->pathLengths[path];
+}
+
+int64_t contigPathTable_getScaffoldPathLength(ContigPathTable *contigPathTable, int64_t path) {
+    assert(path >= 0 && path < contigPathTable->pathNumber);
+    return contigPathTable->scaffoldPathLengths[path];
+}
+
+int64_t contigPathTable_getScaffold(ContigPathTable *contigPathTable, int64_t path) {
+    assert(path >= 0 && path < contigPathTable->pathNumber);
+    return contigPathTable->pathScaffolds[path];
+}
+
+const int64_t *contigPathTable_getPathLengths(ContigPathTable *contigPathTable) {
+    return contigPathTable->pathLengths;
+}
+
+const int64_t *contigPathTable_getScaffoldLengths(ContigPathTable *contigPathTable) {
+    return contigPathTable->scaffoldLengths;
+}
+
+bool contigPathTable_getCapCodes(ContigPathTable *contigPathTable, Segment *segment, enum CapCode *_5CapCode,
+        enum CapCode *_3CapCode) {
+    int64_t segmentOrdinal = contigPathTable_getSegmentOrdinal(contigPathTable, segment);
+    if (segmentOrdinal == -1) {
+        return 0;
+    }
+    int8_t *capCodes = &contigPathTable->capCodes[segmentOrdinal * 4];
+    if (segment_getOrientation(segment) != contigPathTable->segmentOrientations[segmentOrdinal]) {
+        capCodes += 2;
+    }
+    *_5CapCode = capCodes[0];
+    *_3CapCode = capCodes[1];
+    return 1;
+}
+
+bool contigPathTable_hasPathOrientation(ContigPathTable *contigPathTable, Segment *segment) {
+    int64_t segmentOrdinal = contigPathTable_getSegmentOrdinal(contigPathTable, segment);
+    assert(segmentOrdinal != -1);
+    return segment_getOrientation(segment) == contigPathTable->segmentOrientations[segmentOrdinal];
+}
+
+enum CapCode contigPathTable_getPathCapCode(ContigPathTable *contigPathTable, int64_t segmentOrdinal, bool _5End,
+        int64_t *insertLength, int64_t *deleteLength) {
+    assert(segmentOrdinal >= 0 && segmentOrdinal < contigPathTable->segmentNumber);
+    int64_t *capLengths = &contigPathTable->capLengths[segmentOrdinal * 4 + (_5End ? 0 : 2)];
+    *insertLength = capLengths[0];
+    *deleteLength = capLengths[1];
+    return contigPathTable->capCodes[segmentOrdinal * 4 + (_5End ? 0 : 1)];
+}
+
+/*
+ * Reading and writing.
+ */
+
+static int64_t getPaddedLength(int64_t length) {
+    return (length + 7) / 8 * 8;
+}
+
+static bool writeArray(FILE *fileHandle, const void *array, int64_t length) {
+    static const char padding[8] = { 0 };
+    int64_t paddingLength = getPaddedLength(length) - length;
+    return fwrite(array, 1, length, fileHandle) == length
+            && fwrite(padding, 1, paddingLength, fileHandle) == paddingLength;
+}
+
+static bool writeInt(FILE *fileHandle, int64_t i) {
+    return writeArray(fileHandle, &i, sizeof(int64_t));
+}
+
+//Numbers the temporary files of the process, which may write tables in several threads.
+static int64_t temporaryFileNumber = 0;
+
+bool contigPathTable_write(ContigPathTable *contigPathTable, const char *fileName, const char *key) {
+    //Written to a temporary file then renamed, so scripts running at the same time never see part of a table.
+    char *tempFileName = stString_print("%s.%" PRIi64 ".%" PRIi64 ".tmp", fileName, (int64_t) getpid(),
+            __sync_fetch_and_add(&temporaryFileNumber, 1));
+    FILE *fileHandle = fopen(tempFileName, "w");
+    if (fileHandle == NULL) {
+        free(tempFileName);
+        return 0;
+    }
+    int64_t segmentNumber = contigPathTable->segmentNumber;
+    int64_t pathNumber = contigPathTable->pathNumber;
+    int64_t scaffoldNumber = contigPathTable->scaffoldNumber;
+    bool written = writeArray(fileHandle, contigPathTableMagic, 8)
+            && writeInt(fileHandle, strlen(key))
+            && writeArray(fileHandle, key, strlen(key))
+            && writeInt(fileHandle, contigPathTable->tableSize)
+            && writeInt(fileHandle, segmentNumber)
+            && writeInt(fileHandle, pathNumber)
+            && writeInt(fileHandle, scaffoldNumber)
+            && writeArray(fileHandle, contigPathTable->segmentNames, sizeof(Name) * contigPathTable->tableSize)
+            && writeArray(fileHandle, contigPathTable->segmentOrdinals, sizeof(int64_t) * contigPathTable->tableSize)
+            && writeArray(fileHandle, contigPathTable->segmentPaths, sizeof(int64_t) * segmentNumber)
+            && writeArray(fileHandle, contigPathTable->capLengths, sizeof(int64_t) * segmentNumber * 4)
+            && writeArray(fileHandle, contigPathTable->pathLengths, sizeof(int64_t) * pathNumber)
+            && writeArray(fileHandle, contigPathTable->scaffoldPathLengths, sizeof(int64_t) * pathNumber)
+            && writeArray(fileHandle, contigPathTable->pathScaffolds, sizeof(int64_t) * pathNumber)
+            && writeArray(fileHandle, contigPathTable->scaffoldLengths, sizeof(int64_t) * scaffoldNumber)
+            && writeArray(fileHandle, contigPathTable->capCodes, sizeof(int8_t) * segmentNumber * 4)
+            && writeArray(fileHandle, contigPathTable->segmentOrientations, sizeof(int8_t) * segmentNumber);
+    written = fclose(fileHandle) == 0 && written && rename(tempFileName, fileName) == 0;
+    if (!written) {
+        unlink(tempFileName);
+    }
+    free(tempFileName);
+    return written;
+}
+
+ContigPathTable *contigPathTable_load(const char *fileName, const char *key) {
+    int fileDescriptor = open(fileName, O_RDONLY);
+    if (fileDescriptor == -1) {
+        return NULL;
+    }
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size < 16) {
+        close(fileDescriptor);
+        return NULL;
+    }
+    int64_t mappingLength = fileStat.st_size;
+    char *mapping = mmap(NULL, mappingLength, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+    close(fileDescriptor);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    int64_t keyLength = ((int64_t *) mapping)[1];
+    int64_t offset = 16 + getPaddedLength(keyLength);
+    if (memcmp(mapping, contigPathTableMagic, 8) != 0 || keyLength != strlen(key) || offset + 32 > mappingLength
+            || memcmp(mapping + 16, key, keyLength) != 0) {
+        munmap(mapping, mappingLength);
+        return NULL;
+    }
+    int64_t *header = (int64_t *) (mapping + offset);
+    offset += 32;
+    int64_t tableSize = header[0], segmentNumber = header[1], pathNumber = header[2], scaffoldNumber = header[3];
+    if (offset + 8 * (tableSize * 2 + segmentNumber * 5 + pathNumber * 3 + scaffoldNumber)
+            + getPaddedLength(segmentNumber * 4)
+            + getPaddedLength(segmentNumber) != mappingLength) {
+        st_logInfo("The contig path table %s is malformed, ignoring it\n", fileName);
+        munmap(mapping, mappingLength);
+        return NULL;
+    }
+    ContigPathTable *contigPathTable = st_calloc(1, sizeof(ContigPathTable));
+    contigPathTable->mapping = mapping;
+    contigPathTable->mappingLength = mappingLength;
+    contigPathTable->tableSize = tableSize;
+    contigPathTable->segmentNumber = segmentNumber;
+    contigPathTable->pathNumber = pathNumber;
+    contigPathTable->scaffoldNumber = scaffoldNumber;
+    contigPathTable->segmentNames = (Name *) (mapping + offset);
+    offset += 8 * tableSize;
+    contigPathTable->segmentOrdinals = (int64_t *) (mapping + offset);
+    offset += 8 * tableSize;
+    contigPathTable->segmentPaths = (int64_t *) (mapping + offset);
+    offset += 8 * segmentNumber;
+    contigPathTable->capLengths = (int64_t *) (mapping + offset);
+    offset += 8 * segmentNumber * 4;
+    contigPathTable->pathLengths = (int64_t *) (mapping + offset);
+    offset += 8 * pathNumber;
+    contigPathTable->scaffoldPathLengths = (int64_t *) (mapping + offset);
+    offset += 8 * pathNumber;
+    contigPathTable->pathScaffolds = (int64_t *) (mapping + offset);
+    offset += 8 * pathNumber;
+    contigPathTable->scaffoldLengths = (int64_t *) (mapping + offset);
+    offset += 8 * scaffoldNumber;
+    contigPathTable->capCodes = (int8_t *) (mapping + offset);
+    offset += getPaddedLength(segmentNumber * 4);
+    contigPathTable->segmentOrientations = (int8_t *) (mapping + offset);
+    return contigPathTable;
+}
@@ -4,6 +4,8 @@
  * Released under the MIT license, see LICENSE.txt
  */
 
+#include <math.h>
+
 #include "cactus.h"
 #include "cactusMafs.h"
 #include "contigPaths.h"
@@ -11,40 +13,99 @@
 #include "adjacencyClassification.h"
 #include "scaffoldPaths.h"
 #include "assemblaCommon.h"
+#include "assemblaMetrics.h"
 
-static stHash *setOfPairs;
+static void reportCopyNumberStats(CopyNumberStats *copyNumberStats, const char *fileName, const char *rowFileName) {
+    FILE *fileHandle = fopen(fileName, "w");
 
-static void getMAFBlock2(Block *block, FILE *fileHandle) {
-    /*
-     * Prints out the comment lines, then the maf blocks.
-     */
-    if (block_getLength(block) >= minimumBlockLength) {
-        Segment *segment;
-        Block_InstanceIterator *instanceIt = block_getInstanceIterator(block);
-        int64_t assemblyNumber = 0, hapA1Number = 0, hapA2Number = 0;
-        while ((segment = block_getNext(instanceIt)) != NULL) {
-            const char *segmentEvent = event_getHeader(segment_getEvent(segment));
-            if (strcmp(segmentEvent, assemblyEventString) == 0) { //Establish if we need a line..
-                assemblyNumber++;
-            } else if (strcmp(segmentEvent, hap1EventString) == 0) {
-                hapA1Number++;
-            } else if (strcmp(segmentEvent, hap2EventString) == 0) {
-                hapA2Number++;
+    copyNumberStats_writeXML(copyNumberStats, minimumBlockLength, fileHandle);
+    fclose(fileHandle);
+
+    int64_t totals[COPY_NUMBER_TOTAL_NUMBER];
+    copyNumberStats_getTotals(copyNumberStats, totals);
+    SampledTotal *sampledTotals = copyNumberStats->sampledTotals;
+    int64_t totalColumnCount = totals[TOTAL_COLUMNS];
+    int64_t totalBaseCount = totals[TOTAL_BASES];
+    int64_t totalCopyNumberDeficientColumns = totals[DEFICIENT_COLUMNS];
+    int64_t totalCopyNumberDeficientBases = totals[DEFICIENT_BASES];
+    int64_t totalCopyNumberDeficientColumnsGreaterThanZero = totals[DEFICIENT_COLUMNS_GREATER_THAN_ZERO];
+    int64_t totalCopyNumberDeficientBasesGreaterThanZero = totals[DEFICIENT_BASES_GREATER_THAN_ZERO];
+    int64_t totalCopyNumberExcessColumns = totals[EXCESS_COLUMNS];
+    int64_t totalCopyNumberExcessBases = totals[EXCESS_BASES];
+
+    if (rowFileName != NULL) {
+        MetricsRow *metricsRow = metricsRow_construct();
+        metricsRow_addInt(metricsRow, "minimumBlockLength", minimumBlockLength);
+        metricsRow_addInt(metricsRow, "totalColumnCount", totalColumnCount);
+        metricsRow_addInt(metricsRow, "totalBaseCount", totalBaseCount);
+        metricsRow_addInt(metricsRow, "deficientCopyNumberCounts.totalColumns", totalCopyNumberDeficientColumns);
+        metricsRow_addInt(metricsRow, "deficientCopyNumberCounts.totalBases", totalCopyNumberDeficientBases);
+        metricsRow_addDouble(metricsRow, "deficientCopyNumberCounts.totalProportionOfColumns",
+                ((float)totalCopyNumberDeficientColumns)/totalColumnCount);
+        metricsRow_addDouble(metricsRow, "deficientCopyNumberCounts.totalProportionOfBases",
+                ((float)totalCopyNumberDeficientBases)/totalBaseCount);
+        metricsRow_addInt(metricsRow, "deficientCopyNumberCountsGreaterThanZero.totalColumns", totalCopyNumberDeficientColumnsGreaterThanZero);
+        metricsRow_addInt(metricsRow, "deficientCopyNumberCountsGreaterThanZero.totalBases", totalCopyNumberDeficientBasesGreaterThanZero);
+        metricsRow_addDouble(metricsRow, "deficientCopyNumberCountsGreaterThanZero.totalProportionOfColumns",
+                ((float)totalCopyNumberDeficientColumnsGreaterThanZero)/totalColumnCount);
+        metricsRow_addDouble(metricsRow, "deficientCopyNumberCountsGreaterThanZero.totalProportionOfBases",
+                ((float)totalCopyNumberDeficientBasesGreaterThanZero)/totalBaseCount);
+        metricsRow_addInt(metricsRow, "excessCopyNumberCounts.totalColumns", totalCopyNumberExcessColumns);
+        metricsRow_addInt(metricsRow, "excessCopyNumberCounts.totalBases", totalCopyNumberExcessBases);
+        metricsRow_addDouble(metricsRow, "excessCopyNumberCounts.totalProportionOfColumns",
+                ((float)totalCopyNumberExcessColumns)/totalColumnCount);
+        metricsRow_addDouble(metricsRow, "excessCopyNumberCounts.totalProportionOfBases",
+                ((float)totalCopyNumberExcessBases)/totalBaseCount);
+        if (sampleFraction < 1.0) {
+            metricsRow_addDouble(metricsRow, "sampleFraction", sampleFraction);
+            for (int64_t i = 0; i < COPY_NUMBER_TOTAL_NUMBER; i++) {
+                char *name = stString_print("%s.standardError", copyNumberTotalNames[i]);
+                metricsRow_addDouble(metricsRow, name, sampledTotal_getStandardError(&sampledTotals[i]));
+                free(name);
             }
         }
-        block_destructInstanceIterator(instanceIt);
-        if (assemblyNumber > 0 || hapA1Number > 0 || hapA2Number > 0) {
-            stIntTuple *key = stIntTuple_construct3( hapA1Number > hapA2Number ? hapA1Number : hapA2Number,
-                    hapA1Number < hapA2Number ? hapA1Number : hapA2Number, assemblyNumber);
-            int64_t *value;
-            if ((value = stHash_search(setOfPairs, key)) == NULL) {
-                value = st_malloc(sizeof(int64_t));
-                value[0] = 0;
-                stHash_insert(setOfPairs, key, value);
-            } else {
-                stIntTuple_destruct(key);
-            }
-            value[0] += block_getLength(block);
+        arena_report(copyNumberStats->arena, metricsRow);
+        metricsRow_write(metricsRow, rowFileName);
+        metricsRow_destruct(metricsRow);
+    }
+}
+
+static void writeCopyNumberShard(CopyNumberStats *copyNumberStats, const char *fileName) {
+    /*
+     * Writes the column counts of the categories and the sampled totals of the shard.
+     */
+    FILE *fileHandle = shardFile_construct(fileName, "copyNumberStats");
+    stHashIterator *it = stHash_getIterator(copyNumberStats->categories);
+    CopyNumberCategory *copyNumber;
+    while ((copyNumber = stHash_getNext(it)) != NULL) {
+        fprintf(fileHandle, "category\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\n", copyNumber->maxHapNumber,
+                copyNumber->minHapNumber, copyNumber->assemblyNumber, copyNumber->columnCount);
+    }
+    stHash_destructIterator(it);
+    for (int64_t i = 0; i < COPY_NUMBER_TOTAL_NUMBER; i++) {
+        fprintf(fileHandle, "sampledTotal\t%" PRIi64 "\t%.17g\t%.17g\n", i, copyNumberStats->sampledTotals[i].sum,
+                copyNumberStats->sampledTotals[i].sumOfSquares);
+    }
+    fclose(fileHandle);
+}
+
+static void readCopyNumberShard(FILE *fileHandle, const char *fileName, CopyNumberStats *copyNumberStats) {
+    /*
+     * Adds the counts of a shard file to those of the assembly.
+     */
+    char type[20];
+    while (fscanf(fileHandle, "%19s", type) == 1) {
+        int64_t i, j, k, l;
+        double sum, sumOfSquares;
+        if (strcmp(type, "category") == 0 && fscanf(fileHandle, "%" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 "",
+                &i, &j, &k, &l) == 4) {
+            copyNumberStats_addColumnCount(copyNumberStats, i, j, k, l);
+        } else if (strcmp(type, "sampledTotal") == 0 && fscanf(fileHandle, "%" PRIi64 " %lf %lf", &i, &sum,
+                &sumOfSquares) == 3 && i >= 0 && i < COPY_NUMBER_TOTAL_NUMBER) {
+            copyNumberStats->sampledTotals[i].sum += sum;
+            copyNumberStats->sampledTotals[i].sumOfSquares += sumOfSquares;
+        } else {
+            st_errAbort("The shard file %s is malformed", fileName);
         }
     }
 }
@@ -54,6 +115,7 @@ int main(int argc, char *argv[]) {
     //Parse the inputs
     //////////////////////////////////////////////
 
+    shardsSupported = 1;
     parseBasicArguments(argc, argv, "copyNumberStats");
 
     ///////////////////////////////////////////////////////////////////////////
@@ -61,69 +123,53 @@ int main(int argc, char *argv[]) {
     ///////////////////////////////////////////////////////////////////////////
 
     int64_t startTime = time(NULL);
-    FILE *fileHandle = fopen(outputFile, "w");
 
-    //The pairs to represent the mafs.
-    setOfPairs = stHash_construct3((uint64_t(*)(const void *)) stIntTuple_hashKey,
-            (int(*)(const void *, const void *)) stIntTuple_equalsFn, (void(*)(void *)) stIntTuple_destruct, free);
-    //Pass over the blocks.
-    getMAFs(flower, fileHandle, getMAFBlock2);
-    //Now calculate the linkage stats
-    stList *copyNumbers = stHash_getKeys(setOfPairs);
-    stList_sort(copyNumbers, (int(*)(const void *, const void *)) stIntTuple_cmpFn);
-    int64_t totalCopyNumberDeficientColumns = 0;
-    int64_t totalCopyNumberDeficientBases = 0;
-    int64_t totalCopyNumberDeficientColumnsGreaterThanZero = 0;
-    int64_t totalCopyNumberDeficientBasesGreaterThanZero = 0;
-    int64_t totalCopyNumberExcessColumns = 0;
-    int64_t totalCopyNumberExcessBases = 0;
-    int64_t totalColumnCount = 0;
-    int64_t totalBaseCount = 0;
-    for (int64_t i = 0; i < stList_length(copyNumbers); i++) {
-        stIntTuple *copyNumber = stList_get(copyNumbers, i);
-        int64_t *columnCount = stHash_search(setOfPairs, copyNumber);
-        totalColumnCount += columnCount[0];
-        totalBaseCount += stIntTuple_get(copyNumber, 2) * columnCount[0];
+    //The categories of the columns, for each assembly.
+    AssemblaParameters parameters;
+    assemblaParameters_setFromArguments(&parameters);
+    int64_t assemblyNumber = stList_length(assemblyEventStrings);
+    stList *copyNumberStats;
+    if (shardFiles != NULL) {
+        //Merge the counts of the shards.
+        copyNumberStats = stList_construct3(0, (void (*)(void *)) copyNumberStats_destruct);
+        for (int64_t i = 0; i < assemblyNumber; i++) {
+            CopyNumberStats *assemblyCopyNumberStats = copyNumberStats_construct(sampleFraction);
+            mergeShardFiles(stList_get(assemblyEventStrings, i), "copyNumberStats",
+                    (void (*)(FILE *, const char *, void *)) readCopyNumberShard, assemblyCopyNumberStats);
+            stList_append(copyNumberStats, assemblyCopyNumberStats);
+        }
+    } else {
+        //Pass over the blocks, once for all the assemblies.
+        //The context is only made here, as the cactus disk is not loaded when shards are merged.
+        AssemblaContext *context = assemblaContext_constructFromArguments();
+        copyNumberStats = assemblaMetrics_getCopyNumberStats(context, &parameters, assemblyEventStrings);
+        assemblaContext_destruct(context);
     }
-    fprintf(fileHandle, "<copy_number_stats minimumBlockLength=\"%" PRIi64 "\" totalColumnCount=\"%" PRIi64 "\" totalBaseCount=\"%" PRIi64 "\">\n", minimumBlockLength, totalColumnCount, totalBaseCount);
-    for (int64_t i = 0; i < stList_length(copyNumbers); i++) {
-        stIntTuple *copyNumber = stList_get(copyNumbers, i);
-        int64_t *columnCount = stHash_search(setOfPairs, copyNumber);
-        int64_t maxHapNumber = stIntTuple_get(copyNumber, 0);
-        int64_t minHapNumber = stIntTuple_get(copyNumber, 1);
-        assert(minHapNumber >= 0);
-        assert(maxHapNumber >= minHapNumber);
-        int64_t assemblyNumber = stIntTuple_get(copyNumber, 2);
-        assert(assemblyNumber >= 0);
-        assert(columnCount != NULL);
-        assert(columnCount[0] >= 1);
-        fprintf(
-                fileHandle,
-                "<copy_number_category maximumHaplotypeCopyNumber=\"%" PRIi64 "\" minimumHaplotypeCopyNumber=\"%" PRIi64 "\" assemblyCopyNumber=\"%" PRIi64 "\" columnCount=\"%" PRIi64 "\"/>\n",
-                maxHapNumber, minHapNumber, assemblyNumber, columnCount[0]);
-        if (assemblyNumber < minHapNumber) {
-            totalCopyNumberDeficientColumns += columnCount[0];
-            totalCopyNumberDeficientBases += columnCount[0] * (minHapNumber - assemblyNumber);
-            if(assemblyNumber > 0) {
-                totalCopyNumberDeficientColumnsGreaterThanZero += columnCount[0];
-                totalCopyNumberDeficientBasesGreaterThanZero += columnCount[0] * (minHapNumber - assemblyNumber);
+    for (int64_t i = 0; i < assemblyNumber; i++) {
+        CopyNumberStats *assemblyCopyNumberStats = stList_get(copyNumberStats, i);
+        const char *eventString = stList_get(assemblyEventStrings, i);
+        char *assemblyOutputFile = getAssemblyFileName(outputFile, eventString);
+        char *assemblyMetricsRowFile = metricsRowFile != NULL ? getAssemblyFileName(metricsRowFile, eventString) : NULL;
+        if (shardNumber > 1) {
+            //The raw counts of the shard, to be merged.
+            writeCopyNumberShard(assemblyCopyNumberStats, assemblyOutputFile);
+            if (assemblyMetricsRowFile != NULL) {
+                //The counts go in the row of the merged run, so the shard's row has just its allocator.
+                MetricsRow *metricsRow = metricsRow_construct();
+                arena_report(assemblyCopyNumberStats->arena, metricsRow);
+                metricsRow_write(metricsRow, assemblyMetricsRowFile);
+                metricsRow_destruct(metricsRow);
             }
-         } else if (assemblyNumber > maxHapNumber) {
-            totalCopyNumberExcessColumns += columnCount[0];
-            totalCopyNumberExcessBases += columnCount[0] * (assemblyNumber - maxHapNumber);
+        } else {
+            reportCopyNumberStats(assemblyCopyNumberStats, assemblyOutputFile, assemblyMetricsRowFile);
         }
+        if (metricsRowFile == NULL) {
+            arena_report(assemblyCopyNumberStats->arena, NULL);
+        }
+        free(assemblyOutputFile);
+        free(assemblyMetricsRowFile);
     }
-    fprintf(fileHandle, "<deficientCopyNumberCounts totalColumns=\"%" PRIi64 "\" totalBases=\"%" PRIi64 "\" totalProportionOfColumns=\"%f\" totalProportionOfBases=\"%f\"/>",
-            totalCopyNumberDeficientColumns, totalCopyNumberDeficientBases,
-            ((float)totalCopyNumberDeficientColumns)/totalColumnCount, ((float)totalCopyNumberDeficientBases)/totalBaseCount);
-    fprintf(fileHandle, "<deficientCopyNumberCountsGreaterThanZero totalColumns=\"%" PRIi64 "\" totalBases=\"%" PRIi64 "\" totalProportionOfColumns=\"%f\" totalProportionOfBases=\"%f\"/>",
-                totalCopyNumberDeficientColumnsGreaterThanZero, totalCopyNumberDeficientBasesGreaterThanZero,
-                ((float)totalCopyNumberDeficientColumnsGreaterThanZero)/totalColumnCount, ((float)totalCopyNumberDeficientBasesGreaterThanZero)/totalBaseCount);
-    fprintf(fileHandle, "<excessCopyNumberCounts totalColumns=\"%" PRIi64 "\" totalBases=\"%" PRIi64 "\" totalProportionOfColumns=\"%f\" totalProportionOfBases=\"%f\"/>",
-            totalCopyNumberExcessColumns, totalCopyNumberExcessBases,
-            ((float)totalCopyNumberExcessColumns)/totalColumnCount, ((float)totalCopyNumberExcessBases)/totalBaseCount);
-    fprintf(fileHandle, "</copy_number_stats>\n");
-    fclose(fileHandle);
+    stList_destruct(copyNumberStats);
 
     st_logInfo("Got the copy number counts in %" PRIi64 " seconds/\n", time(NULL) - startTime);
 
@@ -16,6 +16,9 @@
 #include "adjacencyClassification.h"
 #include "scaffoldPaths.h"
 #include "assemblaCommon.h"
+#include "contigPathTable.h"
+#include "counters.h"
+#include "mafWriter.h"
 
 /*
  * For a range of block, contig and contig-path length values reports
@@ -59,29 +62,18 @@ typedef struct _blockHolder {
     int64_t haplotypeToContaminationCategory;
 } BlockHolder;
 
-stHash *segmentsToMaximalHaplotypePaths;
-stHash *maximalHaplotypePathLengths;
-stHash *maximalScaffoldPathLengths;
+ContigPathTable *contigPathTable;
 
 int64_t getMaximalHaplotypePathLengthP(Block *block,
-        stHash *segmentToHaplotypePath, stHash *haplotypePathLengths) {
+        int64_t (*pathLengthFn)(ContigPathTable *, int64_t)) {
     Segment *segment;
     Block_InstanceIterator *instanceIt = block_getInstanceIterator(block);
     int64_t maxLength = 0;
     while ((segment = block_getNext(instanceIt)) != NULL) {
         if (strcmp(event_getHeader(segment_getEvent(segment)), assemblyEventString) == 0) { //Establish if we need a line..
-            stList *maximalHaplotypePath = stHash_search(
-                    segmentToHaplotypePath, segment);
-            if (maximalHaplotypePath == NULL) {
-                maximalHaplotypePath = stHash_search(segmentToHaplotypePath,
-                        segment_getReverse(segment));
-            }
-            if (maximalHaplotypePath != NULL) {
-                assert(
-                        stHash_search(haplotypePathLengths,
-                                maximalHaplotypePath) != NULL);
-                int64_t i = stIntTuple_get(stHash_search(
-                        haplotypePathLengths, maximalHaplotypePath), 0);
+            int64_t maximalHaplotypePath = contigPathTable_getPath(contigPathTable, segment);
+            if (maximalHaplotypePath != -1) {
+                int64_t i = pathLengthFn(contigPathTable, maximalHaplotypePath);
                 if (i > maxLength) {
                     maxLength = i;
                 }
@@ -94,13 +86,11 @@ int64_t getMaximalHaplotypePathLengthP(Block *block,
 }
 
 int64_t getMaximalHaplotypePathLength(Block *block) {
-    return getMaximalHaplotypePathLengthP(block,
-            segmentsToMaximalHaplotypePaths, maximalHaplotypePathLengths);
+    return getMaximalHaplotypePathLengthP(block, contigPathTable_getPathLength);
 }
 
 int64_t getMaximalScaffoldPathLength(Block *block) {
-    return getMaximalHaplotypePathLengthP(block,
-            segmentsToMaximalHaplotypePaths, maximalScaffoldPathLengths);
+    return getMaximalHaplotypePathLengthP(block, contigPathTable_getScaffoldPathLength);
 }
 
 int64_t getMaximalContigLength(Block *block) {
@@ -122,8 +112,9 @@ int64_t getMaximalContigLength(Block *block) {
 }
 
 stSortedSet *getSpecies(Block *block) {
+    //The event names are those of the events, which outlive the set.
     stSortedSet *species = stSortedSet_construct3((int(*)(const void *,
-            const void *)) strcmp, free);
+            const void *)) strcmp, NULL);
     Segment *segment;
     Block_InstanceIterator *segmentIterator = block_getInstanceIterator(block);
     while ((segment = block_getNext(segmentIterator)) != NULL) {
@@ -131,8 +122,9 @@ stSortedSet *getSpecies(Block *block) {
         Event *event = segment_getEvent(segment);
         assert(event != NULL);
         const char *eventHeader = event_getHeader(event);
+        COUNT(coveragePlotSpeciesLookups);
         if (stSortedSet_search(species, (void *) eventHeader) == NULL) {
-            stSortedSet_insert(species, stString_copy(eventHeader));
+            stSortedSet_insert(species, (void *) eventHeader);
         }
     }
     block_destructInstanceIterator(segmentIterator);
@@ -159,8 +151,12 @@ int64_t getHaplotypeContaminationCategory(stSortedSet *species) {
     return i + j;
 }
 
+//The block holders of an assembly are allocated from its arena, and freed with it.
+static Arena *arena;
+
 static BlockHolder *blockHolder_construct(Block *block) {
-    BlockHolder *blockHolder = st_malloc(sizeof(BlockHolder));
+    COUNT(coveragePlotBlocks);
+    BlockHolder *blockHolder = arena_malloc(arena, sizeof(BlockHolder));
 
     blockHolder->block = block;
 
@@ -202,29 +198,29 @@ static BlockHolder *blockHolder_construct(Block *block) {
     return blockHolder;
 }
 
-static void blockHolder_destruct(BlockHolder *blockHolder) {
-    free(blockHolder);
+static int compareLengths(int64_t length1, int64_t length2) {
+    //Not a difference, which would overflow an int for genome scale lengths.
+    return length1 < length2 ? -1 : (length1 > length2 ? 1 : 0);
 }
 
 static int blockHolder_compareByBlockLength(const BlockHolder *blockHolder1,
         const BlockHolder *blockHolder2) {
-    return blockHolder1->blockLength - blockHolder2->blockLength;
+    return compareLengths(blockHolder1->blockLength, blockHolder2->blockLength);
 }
 
 static int blockHolder_compareByHaplotypePathLength(
         const BlockHolder *blockHolder1, const BlockHolder *blockHolder2) {
-    return blockHolder1->haplotypePathLength
-            - blockHolder2->haplotypePathLength;
+    return compareLengths(blockHolder1->haplotypePathLength, blockHolder2->haplotypePathLength);
 }
 
 static int blockHolder_compareByScaffoldPathLength(
         const BlockHolder *blockHolder1, const BlockHolder *blockHolder2) {
-    return blockHolder1->scaffoldPathLength - blockHolder2->scaffoldPathLength;
+    return compareLengths(blockHolder1->scaffoldPathLength, blockHolder2->scaffoldPathLength);
 }
 
 static int blockHolder_compareByContigLength(const BlockHolder *blockHolder1,
         const BlockHolder *blockHolder2) {
-    return blockHolder1->contigLength - blockHolder2->contigLength;
+    return compareLengths(blockHolder1->contigLength, blockHolder2->contigLength);
 }
 
 static int64_t blockHolder_getBlockLength(const BlockHolder *blockHolder) {
@@ -257,17 +253,17 @@ static int64_t blockHolder_getHaplotypeContaminationCategory(
     return blockHolder->haplotypeToContaminationCategory;
 }
 
-static void printCumulativeLengthPlots(stList *blockHolders, int(*cmpFn)(
-        const BlockHolder *, const BlockHolder *), int64_t(*getCategory)(
-        const BlockHolder *), int64_t(*getLength)(const BlockHolder *),
-        int64_t categoryNumber, const char **categoryNames,
-        const char *outputFile) {
-    FILE *fileHandle = fopen(outputFile, "w");
-
-    stList_sort(blockHolders, (int(*)(const void *, const void *)) cmpFn);
+static int64_t blockHolder_getSquaredBlockLength(const BlockHolder *blockHolder) {
+    return blockHolder->blockLength * blockHolder->blockLength;
+}
 
-    int64_t binNumber = 2000;
-    double binSize = 8.0 / binNumber; //We go up to 100,000,000
+static int64_t *getCumulativeLengths(stList *blockHolders, int64_t(*getCategory)(
+        const BlockHolder *), int64_t(*getLength)(const BlockHolder *), int64_t(*getWeight)(const BlockHolder *),
+        int64_t categoryNumber, int64_t binNumber, double binSize) {
+    /*
+     * Sums the weights (the block lengths, or their squares for the standard errors of a sample)
+     * of the blocks, sorted by length, in each category and bin.
+     */
     int64_t *cumulativeLengths = st_malloc(sizeof(int64_t) * categoryNumber
             * (binNumber + 1));
     for (int64_t i = 0; i < categoryNumber; i++) {
@@ -276,7 +272,7 @@ static void printCumulativeLengthPlots(stList *blockHolders, int(*cmpFn)(
     for (int64_t i = 0; i < stList_length(blockHolders); i++) { //Get the start values
         BlockHolder *blockHolder = stList_get(blockHolders, i);
         cumulativeLengths[getCategory(blockHolder)]
-                += blockHolder_getBlockLength(blockHolder);
+                += getWeight(blockHolder);
     }
 
     int64_t j = 0; //index of bin
@@ -300,41 +296,187 @@ static void printCumulativeLengthPlots(stList *blockHolders, int(*cmpFn)(
             if (getCategory(blockHolder) % 2 == 0) {
                 cumulativeLengths[i * categoryNumber
                         + getCategory(blockHolder)]
-                        -= blockHolder_getBlockLength(blockHolder);
+                        -= getWeight(blockHolder);
                 if (getCategory(blockHolder) < categoryNumber) {
                     //This shifts the numbers into the other column
                     cumulativeLengths[i * categoryNumber + getCategory(
-                            blockHolder) + 1] += blockHolder_getBlockLength(
-                            blockHolder);
+                            blockHolder) + 1] += getWeight(blockHolder);
                 }
             }
         }
     }
+    return cumulativeLengths;
+}
+
+/*
+ * The plots are written as tsv, a line of the bins (the minimum length of each), then a line per
+ * category, or in a binary format, all integers int64_t in native byte order:
+ *
+ * magic (8 bytes), category number, bin number, value type (0 for the cumulative lengths as
+ * integers, 1 for their standard errors as doubles), for each category: name length, name padded
+ * to 8 bytes, then the bins, then for each category the value of each bin.
+ *
+ * If the bins are compressed a bin is only written if it is the first or last, or its values differ
+ * from those of the bin before, so the value at a length is that of the last bin at or below it.
+ */
+
+static const char *coveragePlotMagic = "ASMCOV01";
 
-    //Now print the final values..
-    fprintf(fileHandle, "category\t");
+static int64_t getBinNumber(int64_t maximumLength) {
+    /*
+     * Bins of the given number per power of ten, up to the maximum length.
+     */
+    return maximumLength > 1 ? (int64_t) ceil(log10((double) maximumLength) * coveragePlotBinsPerDecade) : 1;
+}
+
+static bool *getWrittenBins(int64_t *cumulativeLengths, int64_t categoryNumber, int64_t binNumber) {
+    bool *writtenBins = st_malloc(sizeof(bool) * (binNumber + 1));
     for (int64_t i = 0; i <= binNumber; i++) {
-        fprintf(fileHandle, "%" PRIi64 "\t", (int64_t) pow(10, i * binSize));
+        writtenBins[i] = !compressCoveragePlotBins || i == 0 || i == binNumber
+                || memcmp(&cumulativeLengths[(i - 1) * categoryNumber], &cumulativeLengths[i * categoryNumber],
+                        sizeof(int64_t) * categoryNumber) != 0;
+    }
+    return writtenBins;
+}
+
+static void appendBinaryInt(MafBuffer *mafBuffer, int64_t i) {
+    mafBuffer_append(mafBuffer, (const char *) &i, sizeof(int64_t));
+}
+
+static void appendCumulativeLength(MafBuffer *mafBuffer, int64_t cumulativeLength, bool standardErrors) {
+    /*
+     * Appends the cumulative length, extrapolated from the sampled blocks if sampling, or, given the
+     * sum of the squared lengths, its standard error.
+     */
+    if (standardErrors) {
+        SampledTotal sampledTotal = { 0.0, cumulativeLength };
+        double standardError = sampledTotal_getStandardError(&sampledTotal);
+        if (coveragePlotIsBinary) {
+            mafBuffer_append(mafBuffer, (const char *) &standardError, sizeof(double));
+        } else {
+            char string[64];
+            snprintf(string, sizeof(string), "%f", standardError);
+            mafBuffer_appendString(mafBuffer, string);
+        }
+    } else {
+        cumulativeLength = sampleFraction < 1.0 ? llround(cumulativeLength / sampleFraction) : cumulativeLength;
+        if (coveragePlotIsBinary) {
+            appendBinaryInt(mafBuffer, cumulativeLength);
+        } else {
+            mafBuffer_appendInt(mafBuffer, cumulativeLength);
+        }
+    }
+}
+
+static void printCumulativeLengths(int64_t *cumulativeLengths, bool standardErrors, int64_t categoryNumber,
+        const char **categoryNames, int64_t binNumber, double binSize, const char *outputFile) {
+    /*
+     * Prints the cumulative lengths, or their standard errors, each line formatted in a buffer and
+     * written at once.
+     */
+    FILE *fileHandle = fopen(outputFile, "w");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the coverage plot file %s", outputFile);
     }
-    fprintf(fileHandle, "\n");
-    for (j = 0; j < categoryNumber; j++) {
-        fprintf(fileHandle, "%s\t", categoryNames[j]);
+    bool *writtenBins = getWrittenBins(cumulativeLengths, categoryNumber, binNumber);
+    int64_t writtenBinNumber = 0;
+    for (int64_t i = 0; i <= binNumber; i++) {
+        writtenBinNumber += writtenBins[i];
+    }
+    MafBuffer *mafBuffer = mafBuffer_construct();
+    if (coveragePlotIsBinary) {
+        mafBuffer_append(mafBuffer, coveragePlotMagic, 8);
+        appendBinaryInt(mafBuffer, categoryNumber);
+        appendBinaryInt(mafBuffer, writtenBinNumber);
+        appendBinaryInt(mafBuffer, standardErrors);
+        for (int64_t j = 0; j < categoryNumber; j++) {
+            int64_t nameLength = strlen(categoryNames[j]);
+            appendBinaryInt(mafBuffer, nameLength);
+            mafBuffer_append(mafBuffer, categoryNames[j], nameLength);
+            while (nameLength++ % 8 != 0) {
+                mafBuffer_appendChar(mafBuffer, '\0');
+            }
+        }
+    } else {
+        mafBuffer_appendString(mafBuffer, "category\t");
+    }
+    for (int64_t i = 0; i <= binNumber; i++) {
+        if (writtenBins[i]) {
+            if (coveragePlotIsBinary) {
+                appendBinaryInt(mafBuffer, (int64_t) pow(10, i * binSize));
+            } else {
+                mafBuffer_appendInt(mafBuffer, (int64_t) pow(10, i * binSize));
+                mafBuffer_appendChar(mafBuffer, '\t');
+            }
+        }
+    }
+    if (!coveragePlotIsBinary) {
+        mafBuffer_appendChar(mafBuffer, '\n');
+    }
+    for (int64_t j = 0; j < categoryNumber; j++) {
+        fwrite(mafBuffer->string, sizeof(char), mafBuffer->length, fileHandle);
+        mafBuffer_clear(mafBuffer);
+        if (!coveragePlotIsBinary) {
+            mafBuffer_appendString(mafBuffer, categoryNames[j]);
+            mafBuffer_appendChar(mafBuffer, '\t');
+        }
         for (int64_t i = 0; i <= binNumber; i++) {
-            fprintf(fileHandle, "%lli\t", (long long int) cumulativeLengths[i
-                    * categoryNumber + j]);
+            if (writtenBins[i]) {
+                appendCumulativeLength(mafBuffer, cumulativeLengths[i * categoryNumber + j], standardErrors);
+                if (!coveragePlotIsBinary) {
+                    mafBuffer_appendChar(mafBuffer, '\t');
+                }
+            }
+        }
+        if (!coveragePlotIsBinary) {
+            mafBuffer_appendChar(mafBuffer, '\n');
         }
-        fprintf(fileHandle, "\n");
     }
+    fwrite(mafBuffer->string, sizeof(char), mafBuffer->length, fileHandle);
+    mafBuffer_destruct(mafBuffer);
+    free(writtenBins);
+    fclose(fileHandle);
+}
+
+static void printCumulativeLengthPlots(stList *blockHolders, int(*cmpFn)(
+        const BlockHolder *, const BlockHolder *), int64_t(*getCategory)(
+        const BlockHolder *), int64_t(*getLength)(const BlockHolder *),
+        int64_t categoryNumber, const char **categoryNames,
+        const char *outputDir, const char *plotName) {
+    stList_sort(blockHolders, (int(*)(const void *, const void *)) cmpFn);
+
+    //The bins go up to the maximum length, or past the longest length plotted.
+    int64_t maximumLength = coveragePlotMaximumLength;
+    if (maximumLength == 0) {
+        maximumLength = stList_length(blockHolders) > 0 ? getLength(stList_peek(blockHolders)) + 1 : 1;
+    }
+    int64_t binNumber = getBinNumber(maximumLength);
+    double binSize = 1.0 / coveragePlotBinsPerDecade;
+    const char *suffix = coveragePlotIsBinary ? "bin" : "txt";
+    int64_t *cumulativeLengths = getCumulativeLengths(blockHolders, getCategory, getLength,
+            blockHolder_getBlockLength, categoryNumber, binNumber, binSize);
+    char *plotFile = stString_print("%s/%s.%s", outputDir, plotName, suffix);
+    printCumulativeLengths(cumulativeLengths, 0, categoryNumber, categoryNames, binNumber, binSize, plotFile);
+    free(plotFile);
     free(cumulativeLengths);
 
-    fclose(fileHandle);
+    if (sampleFraction < 1.0) {
+        //The standard errors of the extrapolated lengths go in a second file, alongside.
+        int64_t *squaredLengths = getCumulativeLengths(blockHolders, getCategory, getLength,
+                blockHolder_getSquaredBlockLength, categoryNumber, binNumber, binSize);
+        char *standardErrorFile = stString_print("%s/%sStandardErrors.%s", outputDir, plotName, suffix);
+        printCumulativeLengths(squaredLengths, 1, categoryNumber, categoryNames, binNumber, binSize,
+                standardErrorFile);
+        free(standardErrorFile);
+        free(squaredLengths);
+    }
 }
 
 void getBlocks(Flower *flower, stList *blockHolders) {
     Flower_BlockIterator *blockIt = flower_getBlockIterator(flower);
     Block *block;
     while ((block = flower_getNextBlock(blockIt)) != NULL) {
-        if (block_getInstanceNumber(block) > 0) {
+        if (block_getInstanceNumber(block) > 0 && isBlockSampled(block)) {
             stList_append(blockHolders, blockHolder_construct(block));
         }
     }
@@ -350,6 +492,14 @@ void getBlocks(Flower *flower, stList *blockHolders) {
     flower_destructGroupIterator(groupIt);
 }
 
+static stList *regionBlockHolders;
+
+static void getRegionBlock(Block *block, FILE *fileHandle) {
+    if (block_getInstanceNumber(block) > 0) {
+        stList_append(regionBlockHolders, blockHolder_construct(block));
+    }
+}
+
 int main(int argc, char *argv[]) {
     //////////////////////////////////////////////
     //Parse the inputs
@@ -364,72 +514,89 @@ int main(int argc, char *argv[]) {
     stList *haplotypeEventStrings = getEventStrings(hap1EventString, hap2EventString);
     stList *contaminationEventStrings = getEventStrings(contaminationEventString, NULL);
 
-    stList *maximalHaplotypePaths = getContigPaths(flower, assemblyEventString, haplotypeEventStrings);
-    segmentsToMaximalHaplotypePaths = buildSegmentToContigPathHash(
-            maximalHaplotypePaths);
-    maximalHaplotypePathLengths
-            = buildContigPathToContigPathLengthHash(
-                    maximalHaplotypePaths);
-    maximalScaffoldPathLengths = getContigPathToScaffoldPathLengthsHash(
-            maximalHaplotypePaths, haplotypeEventStrings, contaminationEventStrings, capCodeParameters);
-
-    ///////////////////////////////////////////////////////////////////////////
-    // Calculate blocks
-    ///////////////////////////////////////////////////////////////////////////
+    //The flowers are loaded once, and the plots of each assembly are then calculated in turn.
+    for (int64_t i = 0; i < stList_length(assemblyEventStrings); i++) {
+        assemblyEventString = stList_get(assemblyEventStrings, i);
+        char *outputDir = getAssemblyFileName(outputFile, assemblyEventString);
+
+        stList *eventStrings = stList_construct();
+        stList_append(eventStrings, assemblyEventString);
+        contigPathTable = getContigPathTable(eventStrings, haplotypeEventStrings, contaminationEventStrings);
+        stList_destruct(eventStrings);
+
+        ///////////////////////////////////////////////////////////////////////////
+        // Calculate blocks
+        ///////////////////////////////////////////////////////////////////////////
+
+        arena = arena_construct();
+        stList *blockHolders = stList_construct();
+        if (regions != NULL) {
+            regionBlockHolders = blockHolders;
+            getMAFsInRegions(NULL, getRegionBlock);
+        } else {
+            getBlocks(flower, blockHolders);
+        }
 
-    stList *blockHolders = stList_construct3(0,
-            (void(*)(void *)) blockHolder_destruct);
-    getBlocks(flower, blockHolders);
-
-    const char *haplotypeCategoryNames[8] = { "hap1/hap2/assembly",
-            "hap1/hap2/!assembly", "hap1/!hap2/assembly",
-            "hap1/!hap2/!assembly", "!hap1/hap2/assembly",
-            "!hap1/hap2/!assembly", "!hap1/!hap2/assembly", "all" };
-
-    st_system("mkdir %s", outputFile);
-
-    printCumulativeLengthPlots(blockHolders, blockHolder_compareByBlockLength,
-            blockHolder_getHaplotypeCategory, blockHolder_getBlockLength, 8,
-            haplotypeCategoryNames, stString_print(
-                    "%s/blockLengthsVsCoverageOfAssemblyAndHaplotypes.txt", outputFile));
-    printCumulativeLengthPlots(blockHolders,
-            blockHolder_compareByHaplotypePathLength,
-            blockHolder_getHaplotypeCategory,
-            blockHolder_getHaplotypePathLength, 8, haplotypeCategoryNames,
-            stString_print("%s/contigPathLengthsVsCoverageOfAssemblyAndHaplotypes.txt", outputFile));
-    printCumulativeLengthPlots(blockHolders,
-            blockHolder_compareByScaffoldPathLength,
-            blockHolder_getHaplotypeCategory,
-            blockHolder_getScaffoldPathLength, 8, haplotypeCategoryNames,
-            stString_print("%s/scaffoldPathLengthsVsCoverageOfAssemblyAndHaplotypes.txt", outputFile));
-    printCumulativeLengthPlots(blockHolders, blockHolder_compareByContigLength,
-            blockHolder_getHaplotypeCategory, blockHolder_getContigLength, 8,
-            haplotypeCategoryNames, stString_print(
-                    "%s/contigLengthsVsCoverageOfAssemblyAndHaplotypes.txt", outputFile));
-
-    const char *contaminationCategoryNames[4] = { "contamination/assembly", "contamination/!assembly",
-            "!contamination/assembly", "all" };
-
-    printCumulativeLengthPlots(blockHolders, blockHolder_compareByBlockLength,
-            blockHolder_getContaminationCategory, blockHolder_getBlockLength, 4,
-            contaminationCategoryNames, stString_print(
-                    "%s/blockLengthsVsCoverageOfAssemblyAndContamination.txt", outputFile));
-    printCumulativeLengthPlots(blockHolders, blockHolder_compareByContigLength,
-            blockHolder_getContaminationCategory, blockHolder_getContigLength, 4,
-            contaminationCategoryNames, stString_print(
-                    "%s/contigLengthsVsCoverageOfAssemblyAndContamination.txt", outputFile));
-
-    const char *contaminationHaplotypeCategoryNames[4] = { "hap/contamination", "hap/!contamination",
-            "!hap/contamination", "all" };
-
-    printCumulativeLengthPlots(blockHolders, blockHolder_compareByBlockLength,
-            blockHolder_getHaplotypeContaminationCategory, blockHolder_getBlockLength,
-            4, contaminationHaplotypeCategoryNames, stString_print(
-                    "%s/blockLengthsVsCoverageOfHaplotypesAndContamination.txt", outputFile));
-    printCumulativeLengthPlots(blockHolders, blockHolder_compareByContigLength,
-            blockHolder_getHaplotypeContaminationCategory, blockHolder_getContigLength,
-            4, contaminationHaplotypeCategoryNames, stString_print(
-                    "%s/contigLengthsVsCoverageOfHaplotypesAndContamination.txt", outputFile));
+        const char *haplotypeCategoryNames[8] = { "hap1/hap2/assembly",
+                "hap1/hap2/!assembly", "hap1/!hap2/assembly",
+                "hap1/!hap2/!assembly", "!hap1/hap2/assembly",
+                "!hap1/hap2/!assembly", "!hap1/!hap2/assembly", "all" };
+
+        st_system("mkdir %s", outputDir);
+
+        printCumulativeLengthPlots(blockHolders, blockHolder_compareByBlockLength,
+                blockHolder_getHaplotypeCategory, blockHolder_getBlockLength, 8,
+                haplotypeCategoryNames, outputDir, "blockLengthsVsCoverageOfAssemblyAndHaplotypes");
+        printCumulativeLengthPlots(blockHolders,
+                blockHolder_compareByHaplotypePathLength,
+                blockHolder_getHaplotypeCategory,
+                blockHolder_getHaplotypePathLength, 8, haplotypeCategoryNames,
+                outputDir, "contigPathLengthsVsCoverageOfAssemblyAndHaplotypes");
+        printCumulativeLengthPlots(blockHolders,
+                blockHolder_compareByScaffoldPathLength,
+                blockHolder_getHaplotypeCategory,
+                blockHolder_getScaffoldPathLength, 8, haplotypeCategoryNames,
+                outputDir, "scaffoldPathLengthsVsCoverageOfAssemblyAndHaplotypes");
+        printCumulativeLengthPlots(blockHolders, blockHolder_compareByContigLength,
+                blockHolder_getHaplotypeCategory, blockHolder_getContigLength, 8,
+                haplotypeCategoryNames, outputDir, "contigLengthsVsCoverageOfAssemblyAndHaplotypes");
+
+        const char *contaminationCategoryNames[4] = { "contamination/assembly", "contamination/!assembly",
+                "!contamination/assembly", "all" };
+
+        printCumulativeLengthPlots(blockHolders, blockHolder_compareByBlockLength,
+                blockHolder_getContaminationCategory, blockHolder_getBlockLength, 4,
+                contaminationCategoryNames, outputDir, "blockLengthsVsCoverageOfAssemblyAndContamination");
+        printCumulativeLengthPlots(blockHolders, blockHolder_compareByContigLength,
+                blockHolder_getContaminationCategory, blockHolder_getContigLength, 4,
+                contaminationCategoryNames, outputDir, "contigLengthsVsCoverageOfAssemblyAndContamination");
+
+        const char *contaminationHaplotypeCategoryNames[4] = { "hap/contamination", "hap/!contamination",
+                "!hap/contamination", "all" };
+
+        printCumulativeLengthPlots(blockHolders, blockHolder_compareByBlockLength,
+                blockHolder_getHaplotypeContaminationCategory, blockHolder_getBlockLength,
+                4, contaminationHaplotypeCategoryNames, outputDir, "blockLengthsVsCoverageOfHaplotypesAndContamination");
+        printCumulativeLengthPlots(blockHolders, blockHolder_compareByContigLength,
+                blockHolder_getHaplotypeContaminationCategory, blockHolder_getContigLength,
+                4, contaminationHaplotypeCategoryNames, outputDir, "contigLengthsVsCoverageOfHaplotypesAndContamination");
+
+        stList_destruct(blockHolders);
+        if (metricsRowFile != NULL) {
+            //The plots are not metrics, so the row has just the allocator statistics.
+            MetricsRow *metricsRow = metricsRow_construct();
+            arena_report(arena, metricsRow);
+            char *assemblyMetricsRowFile = getAssemblyFileName(metricsRowFile, assemblyEventString);
+            metricsRow_write(metricsRow, assemblyMetricsRowFile);
+            free(assemblyMetricsRowFile);
+            metricsRow_destruct(metricsRow);
+        } else {
+            arena_report(arena, NULL);
+        }
+        arena_destruct(arena);
+        contigPathTable_destruct(contigPathTable);
+        free(outputDir);
+    }
 
     return 0;
 }
@@ -4,6 +4,11 @@
  * Released under the MIT license, see LICENSE.txt
  */
 
+//For clock_gettime.
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+
 #include "sonLib.h"
 #include "cactus.h"
 #include "cactusMafs.h"
@@ -11,6 +16,102 @@
 #include "assemblaCommon.h"
 #include "linkage.h"
 
+/*
+ * In adaptive mode (see linkagePrecision) the points are sampled in rounds, each taking a number
+ * of samples from every meta-sequence. samplePoints picks the distances itself, so the samples
+ * can not be aimed at a bucket; instead each round is sized for the unconverged bucket that needs
+ * the most samples, at most doubling the samples taken so far. A bucket without samples, among
+ * those up to the longest distance sampled, has not converged, unless it holds no whole distance
+ * (as do some of the narrow buckets of the shortest distances) so can never be sampled.
+ */
+
+static const double linkageZ = 1.96; //For 95% intervals.
+static const int64_t initialLinkageRoundSize = 10000;
+
+static void getWilsonInterval(int64_t correct, int64_t samples, double *lower, double *upper) {
+    /*
+     * The Wilson score interval of the ratio of correct samples, which unlike the normal interval
+     * is sound for ratios near 0 or 1 and small numbers of samples.
+     */
+    double n = samples, p = correct / n, z2 = linkageZ * linkageZ;
+    double centre = (p + z2 / (2 * n)) / (1 + z2 / n);
+    double halfWidth = linkageZ * sqrt(p * (1 - p) / n + z2 / (4 * n * n)) / (1 + z2 / n);
+    *lower = centre - halfWidth > 0.0 ? centre - halfWidth : 0.0;
+    *upper = centre + halfWidth < 1.0 ? centre + halfWidth : 1.0;
+}
+
+static bool isBucketSampleable(int64_t i, double bucketSize) {
+    /*
+     * Whether the bucket holds any whole distance, the distances of bucket i being from
+     * 10^(i/bucketSize) up to 10^((i+1)/bucketSize).
+     */
+    return ceil(pow(10, i / bucketSize)) < pow(10, (i + 1) / bucketSize);
+}
+
+static int64_t getEmptyBucketNumber(int64_t *samples, double bucketSize) {
+    /*
+     * The sampleable buckets without samples, up to the last bucket with samples.
+     */
+    int64_t lastBucket = bucketNumber - 1;
+    while (lastBucket >= 0 && samples[lastBucket] == 0) {
+        lastBucket--;
+    }
+    int64_t emptyBucketNumber = 0;
+    for (int64_t i = 0; i < lastBucket; i++) {
+        emptyBucketNumber += samples[i] == 0 && isBucketSampleable(i, bucketSize);
+    }
+    return emptyBucketNumber;
+}
+
+static double getRequiredSampleFactor(int64_t *correct, int64_t *samples, double bucketSize) {
+    /*
+     * The factor the samples of the unconverged bucket needing the most must be multiplied by to
+     * reach the precision, by the normal approximation, or 0 if all the buckets have converged.
+     * Empty buckets need more samples than can be known, so ask for the most a round can take.
+     */
+    double factor = getEmptyBucketNumber(samples, bucketSize) > 0 ? 2.0 : 0.0;
+    for (int64_t i = 0; i < bucketNumber; i++) {
+        if (samples[i] > 0) {
+            double lower, upper;
+            getWilsonInterval(correct[i], samples[i], &lower, &upper);
+            if ((upper - lower) / 2 > linkagePrecision) {
+                double p = (lower + upper) / 2;
+                double requiredSamples = linkageZ * linkageZ * p * (1 - p) / (linkagePrecision * linkagePrecision);
+                double j = requiredSamples / samples[i];
+                factor = j > factor ? j : factor;
+                factor = factor > 1.0 ? factor : 1.0;
+            }
+        }
+    }
+    return factor;
+}
+
+static double getSeconds(void) {
+    /*
+     * Seconds from a fixed point, for timing the rounds to better than the second of time().
+     */
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+static int64_t getNextRoundSize(int64_t *correct, int64_t *samples, double bucketSize, int64_t samplesPerMetaSequence) {
+    /*
+     * The samples to take from each meta-sequence in the next round, or 0 if done.
+     */
+    int64_t roundSize = samplesPerMetaSequence;
+    if (linkagePrecision > 0.0) {
+        double factor = getRequiredSampleFactor(correct, samples, bucketSize);
+        if (factor == 0.0) {
+            return 0;
+        }
+        double i = samplesPerMetaSequence * (factor - 1.0);
+        roundSize = i < samplesPerMetaSequence ? (int64_t) ceil(i) : samplesPerMetaSequence;
+        roundSize = roundSize > initialLinkageRoundSize ? roundSize : initialLinkageRoundSize;
+    }
+    return roundSize < sampleNumber - samplesPerMetaSequence ? roundSize : sampleNumber - samplesPerMetaSequence;
+}
+
 int main(int argc, char *argv[]) {
     //////////////////////////////////////////////
     //Parse the inputs
@@ -34,15 +135,37 @@ int main(int argc, char *argv[]) {
 
     stList *eventStrings = getEventStrings(hap1EventString, hap2EventString);
     stSortedSet *sequences = getMetaSequencesForEvents(flower, eventStrings);
-    stSortedSetIterator *it = stSortedSet_getIterator(sequences);
     stSortedSet *sortedSegments = getOrderedSegments(flower);
-    MetaSequence *metaSequence;
-    while ((metaSequence = stSortedSet_getNext(it)) != NULL) {
-        samplePoints(flower, metaSequence, assemblyEventString,
-                sampleNumber, correct, aligned, samples,
-                bucketNumber, bucketSize, sortedSegments, 1, 1.0);
+    bool adaptive = linkagePrecision > 0.0 || linkageTimeBudget > 0;
+    int64_t roundSize = adaptive && initialLinkageRoundSize < sampleNumber ? initialLinkageRoundSize : sampleNumber;
+    int64_t samplesPerMetaSequence = 0, rounds = 0;
+    double startTime = getSeconds();
+    while (roundSize > 0) {
+        double roundStartTime = getSeconds();
+        stSortedSetIterator *it = stSortedSet_getIterator(sequences);
+        MetaSequence *metaSequence;
+        while ((metaSequence = stSortedSet_getNext(it)) != NULL) {
+            samplePoints(flower, metaSequence, assemblyEventString,
+                    roundSize, correct, aligned, samples,
+                    bucketNumber, bucketSize, sortedSegments, 1, 1.0);
+        }
+        stSortedSet_destructIterator(it);
+        samplesPerMetaSequence += roundSize;
+        rounds++;
+        if (!adaptive) {
+            break;
+        }
+        //Rounds are not cut short, so the meta-sequences are sampled equally; a round is only
+        //started if it should end within the time budget, at the rate of the last.
+        double secondsPerSample = (getSeconds() - roundStartTime) / roundSize;
+        roundSize = getNextRoundSize(correct, samples, bucketSize, samplesPerMetaSequence);
+        if (linkageTimeBudget > 0 && getSeconds() - startTime + secondsPerSample * roundSize > linkageTimeBudget) {
+            break;
+        }
     }
-    stSortedSet_destructIterator(it);
+    bool converged = linkagePrecision > 0.0 && getRequiredSampleFactor(correct, samples, bucketSize) == 0.0;
+    int64_t emptyBucketNumber = getEmptyBucketNumber(samples, bucketSize);
+    st_logInfo("Took %" PRIi64 " samples per meta-sequence in %" PRIi64 " rounds\n", samplesPerMetaSequence, rounds);
     stSortedSet_destruct(sequences);
     stSortedSet_destruct(sortedSegments);
 
@@ -51,7 +174,12 @@ int main(int argc, char *argv[]) {
     ///////////////////////////////////////////////////////////////////////////
 
     FILE *fileHandle = fopen(outputFile, "w");
-    fprintf(fileHandle, "<linkage_stats>\n");
+    if (adaptive) {
+        fprintf(fileHandle, "<linkage_stats samples_per_meta_sequence=\"%" PRIi64 "\" rounds=\"%" PRIi64 "\" converged=\"%i\" empty_buckets=\"%" PRIi64 "\">\n",
+                samplesPerMetaSequence, rounds, converged, emptyBucketNumber);
+    } else {
+        fprintf(fileHandle, "<linkage_stats>\n");
+    }
     int64_t pMaxSize = 1;
     int64_t cumulativeCorrect = 0;
     int64_t cumulativeSamples = 0;
@@ -63,8 +191,10 @@ int main(int argc, char *argv[]) {
                     /bucketSize);
             cumulativeCorrect += correct[i];
             cumulativeSamples += samples[i];
-            fprintf(fileHandle, "\t<bucket from=\"%" PRIi64 "\" to=\"%" PRIi64 "\" correct=\"%" PRIi64 "\" samples=\"%" PRIi64 "\" correct_to_samples_ratio=\"%f\" cumulative_correct=\"%" PRIi64 "\" cumulative_samples=\"%" PRIi64 "\" cummulate_correct_to_samples_ratio=\"%f\"/>\n",
-                    pMaxSize, maxSize, correct[i], samples[i], ((float) correct[i])/samples[i], cumulativeCorrect, cumulativeSamples, ((float) cumulativeCorrect)/cumulativeSamples);
+            double lower, upper; //The 95% interval of the ratio.
+            getWilsonInterval(correct[i], samples[i], &lower, &upper);
+            fprintf(fileHandle, "\t<bucket from=\"%" PRIi64 "\" to=\"%" PRIi64 "\" correct=\"%" PRIi64 "\" samples=\"%" PRIi64 "\" correct_to_samples_ratio=\"%f\" correct_to_samples_ratio_lower=\"%f\" correct_to_samples_ratio_upper=\"%f\" cumulative_correct=\"%" PRIi64 "\" cumulative_samples=\"%" PRIi64 "\" cummulate_correct_to_samples_ratio=\"%f\"/>\n",
+                    pMaxSize, maxSize, correct[i], samples[i], ((float) correct[i])/samples[i], lower, upper, cumulativeCorrect, cumulativeSamples, ((float) cumulativeCorrect)/cumulativeSamples);
             pMaxSize = maxSize + 1;
         }
     }
@@ -0,0 +1,446 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten (at) gmail.com) and Dent Earl (dearl (at) soe.ucsc.edu)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "sonLib.h"
+#include "cactus.h"
+#include "mafWriter.h"
+#include "mafIndex.h"
+
+/*
+ * File layout, all integers are int64_t:
+ *
+ * magic (8 bytes), compressed, sequence number, entry number,
+ * for each sequence: first entry, entry number, maximum entry length, name length, name padded to 8 bytes,
+ * entries: start, end, offset (sorted by sequence then start).
+ */
+
+static const char *mafIndexMagic = "MAFIDX01";
+
+typedef struct _mafIndexEntry {
+    int64_t start;
+    int64_t end;
+    int64_t offset;
+} MafIndexEntry;
+
+typedef struct _mafIndexSequence {
+    int64_t firstEntry;
+    int64_t entryNumber;
+    int64_t maximumLength;
+} MafIndexSequence;
+
+typedef struct _mafIndexBuildEntry {
+    int64_t sequence;
+    MafIndexEntry entry;
+} MafIndexBuildEntry;
+
+struct _mafIndex {
+    //Building
+    stHash *sequenceNamesToIndices;
+    stList *sequenceNames;
+    MafIndexBuildEntry *buildEntries;
+    int64_t buildEntryNumber;
+    int64_t maxBuildEntryNumber;
+    MafBuffer *scratch;
+    //Querying
+    bool compressed;
+    stHash *sequences;
+    const MafIndexEntry *entries;
+    void *map;
+    int64_t mapLength;
+};
+
+MafIndex *mafIndex_construct(void) {
+    MafIndex *mafIndex = st_malloc(sizeof(MafIndex));
+    mafIndex->sequenceNamesToIndices = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL,
+            (void (*)(void *)) stIntTuple_destruct);
+    mafIndex->sequenceNames = stList_construct3(0, free);
+    mafIndex->buildEntries = NULL;
+    mafIndex->buildEntryNumber = 0;
+    mafIndex->maxBuildEntryNumber = 0;
+    mafIndex->scratch = mafBuffer_construct();
+    mafIndex->compressed = 0;
+    mafIndex->sequences = NULL;
+    mafIndex->entries = NULL;
+    mafIndex->map = NULL;
+    mafIndex->mapLength = 0;
+    return mafIndex;
+}
+
+void mafIndex_destruct(MafIndex *mafIndex) {
+    if (mafIndex->sequenceNamesToIndices != NULL) {
+        stHash_destruct(mafIndex->sequenceNamesToIndices);
+        stList_destruct(mafIndex->sequenceNames);
+        free(mafIndex->buildEntries);
+        mafBuffer_destruct(mafIndex->scratch);
+    }
+    if (mafIndex->sequences != NULL) {
+        stHash_destruct(mafIndex->sequences);
+    }
+    if (mafIndex->map != NULL) {
+        munmap(mafIndex->map, mafIndex->mapLength);
+    }
+    free(mafIndex);
+}
+
+static int64_t getSequenceIndex(MafIndex *mafIndex, Sequence *sequence) {
+    mafBuffer_clear(mafIndex->scratch);
+    mafBuffer_appendSequenceName(mafIndex->scratch, sequence);
+    mafBuffer_appendChar(mafIndex->scratch, '\0');
+    stIntTuple *i = stHash_search(mafIndex->sequenceNamesToIndices, mafIndex->scratch->string);
+    if (i == NULL) {
+        char *sequenceName = stString_copy(mafIndex->scratch->string);
+        i = stIntTuple_construct1(stList_length(mafIndex->sequenceNames));
+        stList_append(mafIndex->sequenceNames, sequenceName);
+        stHash_insert(mafIndex->sequenceNamesToIndices, sequenceName, i);
+    }
+    return stIntTuple_get(i, 0);
+}
+
+void mafIndex_addBlock(MafIndex *mafIndex, Block *block, int64_t offset) {
+    Block_InstanceIterator *instanceIt = block_getInstanceIterator(block);
+    Segment *segment;
+    while ((segment = block_getNext(instanceIt)) != NULL) {
+        Sequence *sequence = segment_getSequence(segment);
+        if (sequence == NULL) {
+            continue;
+        }
+        if (mafIndex->buildEntryNumber == mafIndex->maxBuildEntryNumber) {
+            mafIndex->maxBuildEntryNumber = mafIndex->maxBuildEntryNumber * 2 + 1024;
+            mafIndex->buildEntries = realloc(mafIndex->buildEntries,
+                    sizeof(MafIndexBuildEntry) * mafIndex->maxBuildEntryNumber);
+            if (mafIndex->buildEntries == NULL) {
+                st_errAbort("Failed to grow the MAF index");
+            }
+        }
+        MafIndexBuildEntry *buildEntry = &mafIndex->buildEntries[mafIndex->buildEntryNumber++];
+        buildEntry->sequence = getSequenceIndex(mafIndex, sequence);
+        int64_t start = segment_getStart(segment);
+        if (!segment_getStrand(segment)) {
+            start -= segment_getLength(segment) - 1;
+        }
+        buildEntry->entry.start = start - sequence_getStart(sequence);
+        buildEntry->entry.end = buildEntry->entry.start + segment_getLength(segment);
+        buildEntry->entry.offset = offset;
+    }
+    block_destructInstanceIterator(instanceIt);
+}
+
+static int compareBuildEntries(const void *a, const void *b) {
+    const MafIndexBuildEntry *entry1 = a;
+    const MafIndexBuildEntry *entry2 = b;
+    if (entry1->sequence != entry2->sequence) {
+        return entry1->sequence < entry2->sequence ? -1 : 1;
+    }
+    if (entry1->entry.start != entry2->entry.start) {
+        return entry1->entry.start < entry2->entry.start ? -1 : 1;
+    }
+    return entry1->entry.offset < entry2->entry.offset ? -1 : (entry1->entry.offset > entry2->entry.offset ? 1 : 0);
+}
+
+static void writeInt(FILE *fileHandle, int64_t i) {
+    if (fwrite(&i, sizeof(int64_t), 1, fileHandle) != 1) {
+        st_errAbort("Failed to write the MAF index");
+    }
+}
+
+void mafIndex_write(MafIndex *mafIndex, MafWriter *mafWriter, const char *fileName) {
+    qsort(mafIndex->buildEntries, mafIndex->buildEntryNumber, sizeof(MafIndexBuildEntry), compareBuildEntries);
+    int64_t sequenceNumber = stList_length(mafIndex->sequenceNames);
+    MafIndexSequence *sequences = st_calloc(sequenceNumber > 0 ? sequenceNumber : 1, sizeof(MafIndexSequence));
+    for (int64_t i = 0; i < mafIndex->buildEntryNumber; i++) {
+        MafIndexBuildEntry *buildEntry = &mafIndex->buildEntries[i];
+        MafIndexSequence *sequence = &sequences[buildEntry->sequence];
+        if (sequence->entryNumber++ == 0) {
+            sequence->firstEntry = i;
+        }
+        if (buildEntry->entry.end - buildEntry->entry.start > sequence->maximumLength) {
+            sequence->maximumLength = buildEntry->entry.end - buildEntry->entry.start;
+        }
+    }
+
+    FILE *fileHandle = fopen(fileName, "w");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the MAF index %s for writing", fileName);
+    }
+    fwrite(mafIndexMagic, 1, 8, fileHandle);
+    writeInt(fileHandle, mafWriter != NULL && mafWriter_isCompressed(mafWriter));
+    writeInt(fileHandle, sequenceNumber);
+    writeInt(fileHandle, mafIndex->buildEntryNumber);
+    for (int64_t i = 0; i < sequenceNumber; i++) {
+        const char *sequenceName = stList_get(mafIndex->sequenceNames, i);
+        int64_t nameLength = strlen(sequenceName);
+        writeInt(fileHandle, sequences[i].firstEntry);
+        writeInt(fileHandle, sequences[i].entryNumber);
+        writeInt(fileHandle, sequences[i].maximumLength);
+        writeInt(fileHandle, nameLength);
+        char padding[8] = { 0 };
+        fwrite(sequenceName, 1, nameLength, fileHandle);
+        fwrite(padding, 1, (8 - nameLength % 8) % 8, fileHandle);
+    }
+    for (int64_t i = 0; i < mafIndex->buildEntryNumber; i++) {
+        MafIndexEntry *entry = &mafIndex->buildEntries[i].entry;
+        writeInt(fileHandle, entry->start);
+        writeInt(fileHandle, entry->end);
+        writeInt(fileHandle, mafWriter != NULL ? mafWriter_getVirtualOffset(mafWriter, entry->offset) : entry->offset);
+    }
+    if (fclose(fileHandle) != 0) {
+        st_errAbort("Failed to close the MAF index %s", fileName);
+    }
+    free(sequences);
+}
+
+MafIndex *mafIndex_read(const char *fileName) {
+    int fileDescriptor = open(fileName, O_RDONLY);
+    if (fileDescriptor < 0) {
+        st_errAbort("Could not open the MAF index %s", fileName);
+    }
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size < 32) {
+        st_errAbort("The MAF index %s is not valid", fileName);
+    }
+    MafIndex *mafIndex = st_malloc(sizeof(MafIndex));
+    mafIndex->sequenceNamesToIndices = NULL;
+    mafIndex->mapLength = fileStat.st_size;
+    mafIndex->map = mmap(NULL, mafIndex->mapLength, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    close(fileDescriptor);
+    if (mafIndex->map == MAP_FAILED) {
+        st_errAbort("Could not map the MAF index %s", fileName);
+    }
+    const char *bytes = mafIndex->map;
+    if (memcmp(bytes, mafIndexMagic, 8) != 0) {
+        st_errAbort("The file %s is not a MAF index", fileName);
+    }
+    //The counts and offsets of the header are checked against the size of the file before they
+    //are used, so a corrupt index aborts rather than reading outside of the map. The entries
+    //themselves are not checked, which would read all of the map.
+    const int64_t *header = (const int64_t *) (bytes + 8);
+    mafIndex->compressed = header[0];
+    int64_t sequenceNumber = header[1];
+    int64_t entryNumber = header[2];
+    if ((header[0] != 0 && header[0] != 1) || sequenceNumber < 0 || sequenceNumber > (mafIndex->mapLength - 32) / 32
+            || entryNumber < 0 || entryNumber > (mafIndex->mapLength - 32) / (int64_t) sizeof(MafIndexEntry)) {
+        st_errAbort("The MAF index %s has an invalid header", fileName);
+    }
+    mafIndex->sequences = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, free);
+    int64_t i = 32;
+    for (int64_t j = 0; j < sequenceNumber; j++) {
+        if (i > mafIndex->mapLength - 32) {
+            st_errAbort("The MAF index %s is truncated", fileName);
+        }
+        const int64_t *sequenceHeader = (const int64_t *) (bytes + i);
+        int64_t nameLength = sequenceHeader[3];
+        if (sequenceHeader[0] < 0 || sequenceHeader[0] > entryNumber || sequenceHeader[1] < 0
+                || sequenceHeader[1] > entryNumber - sequenceHeader[0] || sequenceHeader[2] < 0 || nameLength < 0
+                || nameLength > mafIndex->mapLength - i - 32) {
+            st_errAbort("The MAF index %s has an invalid sequence %" PRIi64 "", fileName, j);
+        }
+        MafIndexSequence *sequence = st_malloc(sizeof(MafIndexSequence));
+        sequence->firstEntry = sequenceHeader[0];
+        sequence->entryNumber = sequenceHeader[1];
+        sequence->maximumLength = sequenceHeader[2];
+        char *sequenceName = st_malloc(nameLength + 1);
+        memcpy(sequenceName, bytes + i + 32, nameLength);
+        sequenceName[nameLength] = '\0';
+        if (stHash_search(mafIndex->sequences, sequenceName) != NULL) {
+            st_errAbort("The MAF index %s has the sequence %s more than once", fileName, sequenceName);
+        }
+        stHash_insert(mafIndex->sequences, sequenceName, sequence);
+        i += 32 + nameLength + (8 - nameLength % 8) % 8;
+    }
+    if (i > mafIndex->mapLength || (mafIndex->mapLength - i) / (int64_t) sizeof(MafIndexEntry) != entryNumber
+            || (mafIndex->mapLength - i) % (int64_t) sizeof(MafIndexEntry) != 0) {
+        st_errAbort("The MAF index %s is truncated", fileName);
+    }
+    mafIndex->entries = (const MafIndexEntry *) (bytes + i);
+    return mafIndex;
+}
+
+bool mafIndex_isCompressed(MafIndex *mafIndex) {
+    return mafIndex->compressed;
+}
+
+stList *mafIndex_getOverlappingOffsets(MafIndex *mafIndex, const char *sequenceName, int64_t start, int64_t end) {
+    stSortedSet *offsets = stSortedSet_construct3((int (*)(const void *, const void *)) stIntTuple_cmpFn, NULL);
+    MafIndexSequence *sequence = stHash_search(mafIndex->sequences, (void *) sequenceName);
+    if (sequence != NULL) {
+        const MafIndexEntry *entries = mafIndex->entries + sequence->firstEntry;
+        //Binary search for the first entry that could overlap, then scan.
+        int64_t minimumStart = start - sequence->maximumLength;
+        int64_t i = 0, j = sequence->entryNumber;
+        while (i < j) {
+            int64_t k = i + (j - i) / 2;
+            if (entries[k].start <= minimumStart) {
+                i = k + 1;
+            } else {
+                j = k;
+            }
+        }
+        for (; i < sequence->entryNumber && entries[i].start < end; i++) {
+            if (entries[i].end > start) {
+                stIntTuple *offset = stIntTuple_construct1(entries[i].offset);
+                if (stSortedSet_search(offsets, offset) == NULL) {
+                    stSortedSet_insert(offsets, offset);
+                } else {
+                    stIntTuple_destruct(offset);
+                }
+            }
+        }
+    }
+    stList *offsetList = stSortedSet_getList(offsets);
+    stList_setDestructor(offsetList, (void (*)(void *)) stIntTuple_destruct);
+    stSortedSet_destruct(offsets);
+    return offsetList;
+}
+
+bool mafIndex_parseRegion(const char *region, char **sequenceName, int64_t *start, int64_t *end) {
+    const char *colon = strrchr(region, ':');
+    if (colon == NULL) {
+        *sequenceName = stString_copy(region);
+        *start = 0;
+        *end = INT64_MAX;
+        return strlen(region) > 0;
+    }
+    if (sscanf(colon + 1, "%" PRIi64 "-%" PRIi64 "", start, end) != 2 || *start < 0 || *end < *start
+            || colon == region) {
+        return 0;
+    }
+    *sequenceName = st_malloc(colon - region + 1);
+    memcpy(*sequenceName, region, colon - region);
+    (*sequenceName)[colon - region] = '\0';
+    return 1;
+}
+
+/*
+ * Reader.
+ */
+
+struct _mafReader {
+    FILE *fileHandle;
+    bool compressed;
+    unsigned char *compressedBlock;
+    char *data;
+    int64_t dataLength;
+    int64_t dataOffset;
+};
+
+MafReader *mafReader_construct(const char *fileName, bool compressed) {
+    MafReader *mafReader = st_malloc(sizeof(MafReader));
+    mafReader->fileHandle = fopen(fileName, "r");
+    if (mafReader->fileHandle == NULL) {
+        st_errAbort("Could not open the MAF file %s", fileName);
+    }
+    mafReader->compressed = compressed;
+    mafReader->compressedBlock = st_malloc(BGZF_MAX_BLOCK_SIZE);
+    mafReader->data = st_malloc(BGZF_MAX_BLOCK_SIZE);
+    mafReader->dataLength = 0;
+    mafReader->dataOffset = 0;
+    return mafReader;
+}
+
+void mafReader_destruct(MafReader *mafReader) {
+    fclose(mafReader->fileHandle);
+    free(mafReader->compressedBlock);
+    free(mafReader->data);
+    free(mafReader);
+}
+
+/*
+ * Reads the next chunk of data (the next BGZF block if compressed), returns zero at the end of the file.
+ */
+static bool mafReader_fill(MafReader *mafReader) {
+    mafReader->dataOffset = 0;
+    mafReader->dataLength = 0;
+    if (!mafReader->compressed) {
+        mafReader->dataLength = fread(mafReader->data, 1, BGZF_MAX_BLOCK_SIZE, mafReader->fileHandle);
+        return mafReader->dataLength > 0;
+    }
+    unsigned char *block = mafReader->compressedBlock;
+    do { //Skip empty blocks, including the end of file marker.
+        size_t i = fread(block, 1, BGZF_HEADER_SIZE, mafReader->fileHandle);
+        if (i == 0) {
+            return 0;
+        }
+        if (i != BGZF_HEADER_SIZE || block[0] != 0x1f || block[1] != 0x8b || block[12] != 'B' || block[13] != 'C') {
+            st_errAbort("The MAF is not a valid BGZF file");
+        }
+        int64_t blockSize = (block[16] | (block[17] << 8)) + 1;
+        if (blockSize < BGZF_HEADER_SIZE + BGZF_FOOTER_SIZE || fread(block + BGZF_HEADER_SIZE, 1, blockSize
+                - BGZF_HEADER_SIZE, mafReader->fileHandle) != blockSize - BGZF_HEADER_SIZE) {
+            st_errAbort("The MAF contains a truncated BGZF block");
+        }
+        z_stream zStream;
+        memset(&zStream, 0, sizeof(z_stream));
+        if (inflateInit2(&zStream, -15) != Z_OK) {
+            st_errAbort("Failed to initialise zlib");
+        }
+        zStream.next_in = block + BGZF_HEADER_SIZE;
+        zStream.avail_in = blockSize - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+        zStream.next_out = (Bytef *) mafReader->data;
+        zStream.avail_out = BGZF_MAX_BLOCK_SIZE;
+        if (inflate(&zStream, Z_FINISH) != Z_STREAM_END) {
+            st_errAbort("Failed to decompress a BGZF block");
+        }
+        mafReader->dataLength = zStream.total_out;
+        inflateEnd(&zStream);
+    } while (mafReader->dataLength == 0);
+    return 1;
+}
+
+void mafReader_seek(MafReader *mafReader, int64_t offset) {
+    int64_t fileOffset = mafReader->compressed ? offset >> 16 : offset;
+    if (fseek(mafReader->fileHandle, fileOffset, SEEK_SET) != 0) {
+        st_errAbort("Failed to seek to %" PRIi64 " in the MAF", fileOffset);
+    }
+    mafReader_fill(mafReader);
+    if (mafReader->compressed) {
+        mafReader->dataOffset = offset & 0xffff;
+    }
+}
+
+bool mafReader_getLine(MafReader *mafReader, MafBuffer *line) {
+    bool gotCharacters = 0;
+    while (1) {
+        if (mafReader->dataOffset >= mafReader->dataLength && !mafReader_fill(mafReader)) {
+            return gotCharacters;
+        }
+        char *start = mafReader->data + mafReader->dataOffset;
+        char *newLine = memchr(start, '\n', mafReader->dataLength - mafReader->dataOffset);
+        int64_t length = newLine != NULL ? newLine - start + 1 : mafReader->dataLength - mafReader->dataOffset;
+        mafBuffer_append(line, start, length);
+        mafReader->dataOffset += length;
+        gotCharacters = 1;
+        if (newLine != NULL) {
+            return 1;
+        }
+    }
+}
+
+void mafReader_getRecord(MafReader *mafReader, int64_t offset, MafBuffer *record) {
+    mafReader_seek(mafReader, offset);
+    bool inBlock = 0;
+    while (1) {
+        int64_t lineStart = record->length;
+        if (!mafReader_getLine(mafReader, record)) {
+            return;
+        }
+        char c = record->string[lineStart];
+        if (c == 'a') {
+            inBlock = 1;
+        } else if (inBlock && (c == '\n' || record->length == lineStart)) {
+            return;
+        }
+    }
+}
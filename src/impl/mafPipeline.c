@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten (at) gmail.com) and Dent Earl (dearl (at) soe.ucsc.edu)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "sonLib.h"
+#include "cactus.h"
+#include "mafWriter.h"
+#include "mafIndex.h"
+#include "mafPipeline.h"
+
+typedef struct _blockJob {
+    Block *block;
+    //The instance views, or NULL if the block was formatted by getMAFBlock into blockText.
+    SequenceView *instanceViews;
+    MafBuffer *blockText;
+    MafBuffer *record;
+    bool done;
+} BlockJob;
+
+struct _mafPipeline {
+    MafWriter *mafWriter;
+    MafIndex *mafIndex;
+    void (*annotateBlock)(Block *block, MafBuffer *mafBuffer);
+    //Ring of jobs, indexed by their sequence number modulo jobNumber.
+    BlockJob *jobs;
+    int64_t jobNumber;
+    int64_t jobsSubmitted;
+    int64_t jobsStarted;
+    int64_t jobsWritten;
+    bool finished;
+    int64_t threadNumber;
+    pthread_t *threads;
+    pthread_t writerThread;
+    pthread_mutex_t mutex;
+    pthread_cond_t jobSubmitted;
+    pthread_cond_t jobDone;
+    pthread_cond_t jobWritten;
+};
+
+static void formatRecord(MafPipeline *mafPipeline, BlockJob *job) {
+    mafBuffer_clear(job->record);
+    mafPipeline->annotateBlock(job->block, job->record);
+    if (job->instanceViews != NULL) {
+        mafBuffer_appendBlockWithViews(job->record, job->block, job->instanceViews);
+        free(job->instanceViews);
+        job->instanceViews = NULL;
+    } else {
+        mafBuffer_append(job->record, job->blockText->string, job->blockText->length);
+    }
+}
+
+static void writeRecord(MafPipeline *mafPipeline, Block *block, MafBuffer *record) {
+    if (mafPipeline->mafIndex != NULL) {
+        mafIndex_addBlock(mafPipeline->mafIndex, block, mafWriter_getOffset(mafPipeline->mafWriter));
+    }
+    MafBuffer *mafBuffer = mafWriter_getBuffer(mafPipeline->mafWriter);
+    mafBuffer_append(mafBuffer, record->string, record->length);
+    mafWriter_endRecord(mafPipeline->mafWriter);
+}
+
+static void *formattingWorker(void *arg) {
+    MafPipeline *mafPipeline = arg;
+    pthread_mutex_lock(&mafPipeline->mutex);
+    while (1) {
+        while (mafPipeline->jobsStarted == mafPipeline->jobsSubmitted && !mafPipeline->finished) {
+            pthread_cond_wait(&mafPipeline->jobSubmitted, &mafPipeline->mutex);
+        }
+        if (mafPipeline->jobsStarted == mafPipeline->jobsSubmitted) {
+            break;
+        }
+        BlockJob *job = &mafPipeline->jobs[mafPipeline->jobsStarted++ % mafPipeline->jobNumber];
+        pthread_mutex_unlock(&mafPipeline->mutex);
+        formatRecord(mafPipeline, job);
+        pthread_mutex_lock(&mafPipeline->mutex);
+        job->done = 1;
+        pthread_cond_broadcast(&mafPipeline->jobDone);
+    }
+    pthread_mutex_unlock(&mafPipeline->mutex);
+    return NULL;
+}
+
+static void *writingWorker(void *arg) {
+    MafPipeline *mafPipeline = arg;
+    pthread_mutex_lock(&mafPipeline->mutex);
+    while (1) {
+        while (mafPipeline->jobsWritten < mafPipeline->jobsSubmitted ? !mafPipeline->jobs[mafPipeline->jobsWritten
+                % mafPipeline->jobNumber].done : !mafPipeline->finished) {
+            pthread_cond_wait(&mafPipeline->jobDone, &mafPipeline->mutex);
+        }
+        if (mafPipeline->jobsWritten == mafPipeline->jobsSubmitted) {
+            break;
+        }
+        //The slot can not be reused until jobsWritten is incremented, so write without the lock.
+        BlockJob *job = &mafPipeline->jobs[mafPipeline->jobsWritten % mafPipeline->jobNumber];
+        pthread_mutex_unlock(&mafPipeline->mutex);
+        writeRecord(mafPipeline, job->block, job->record);
+        pthread_mutex_lock(&mafPipeline->mutex);
+        mafPipeline->jobsWritten++;
+        pthread_cond_signal(&mafPipeline->jobWritten);
+    }
+    pthread_mutex_unlock(&mafPipeline->mutex);
+    return NULL;
+}
+
+MafPipeline *mafPipeline_construct(MafWriter *mafWriter, MafIndex *mafIndex, int64_t threadNumber,
+        void (*annotateBlock)(Block *block, MafBuffer *mafBuffer)) {
+    MafPipeline *mafPipeline = st_malloc(sizeof(MafPipeline));
+    mafPipeline->mafWriter = mafWriter;
+    mafPipeline->mafIndex = mafIndex;
+    mafPipeline->annotateBlock = annotateBlock;
+    mafPipeline->threadNumber = threadNumber > 1 ? threadNumber : 0;
+    mafPipeline->jobNumber = mafPipeline->threadNumber > 0 ? 64 * mafPipeline->threadNumber : 1;
+    mafPipeline->jobs = st_malloc(sizeof(BlockJob) * mafPipeline->jobNumber);
+    for (int64_t i = 0; i < mafPipeline->jobNumber; i++) {
+        mafPipeline->jobs[i].instanceViews = NULL;
+        mafPipeline->jobs[i].blockText = mafBuffer_construct();
+        mafPipeline->jobs[i].record = mafBuffer_construct();
+        mafPipeline->jobs[i].done = 0;
+    }
+    mafPipeline->jobsSubmitted = 0;
+    mafPipeline->jobsStarted = 0;
+    mafPipeline->jobsWritten = 0;
+    mafPipeline->finished = 0;
+    mafPipeline->threads = NULL;
+    if (mafPipeline->threadNumber > 0) {
+        pthread_mutex_init(&mafPipeline->mutex, NULL);
+        pthread_cond_init(&mafPipeline->jobSubmitted, NULL);
+        pthread_cond_init(&mafPipeline->jobDone, NULL);
+        pthread_cond_init(&mafPipeline->jobWritten, NULL);
+        mafPipeline->threads = st_malloc(sizeof(pthread_t) * mafPipeline->threadNumber);
+        for (int64_t i = 0; i < mafPipeline->threadNumber; i++) {
+            if (pthread_create(&mafPipeline->threads[i], NULL, formattingWorker, mafPipeline) != 0) {
+                st_errAbort("Failed to start a MAF formatting thread");
+            }
+        }
+        if (pthread_create(&mafPipeline->writerThread, NULL, writingWorker, mafPipeline) != 0) {
+            st_errAbort("Failed to start the MAF writing thread");
+        }
+    }
+    return mafPipeline;
+}
+
+void mafPipeline_addBlock(MafPipeline *mafPipeline, Block *block) {
+    //Everything that reads the cactus disk is done here, in the calling thread.
+    SequenceView *instanceViews = NULL;
+    MafBuffer *blockText = NULL;
+    if (mafBuffer_canFormatBlock(block)) {
+        instanceViews = mafBuffer_getInstanceViews(block);
+    } else {
+        blockText = mafBuffer_construct();
+        mafBuffer_appendBlockUsingGetMAFBlock(blockText, block);
+    }
+    if (mafPipeline->threadNumber == 0) {
+        BlockJob *job = &mafPipeline->jobs[0];
+        job->block = block;
+        job->instanceViews = instanceViews;
+        mafBuffer_clear(job->blockText);
+        if (blockText != NULL) {
+            mafBuffer_append(job->blockText, blockText->string, blockText->length);
+        }
+        formatRecord(mafPipeline, job);
+        writeRecord(mafPipeline, block, job->record);
+    } else {
+        pthread_mutex_lock(&mafPipeline->mutex);
+        while (mafPipeline->jobsSubmitted - mafPipeline->jobsWritten == mafPipeline->jobNumber) {
+            pthread_cond_wait(&mafPipeline->jobWritten, &mafPipeline->mutex);
+        }
+        pthread_mutex_unlock(&mafPipeline->mutex);
+        //The slot is not touched by the workers until jobsSubmitted is incremented.
+        BlockJob *job = &mafPipeline->jobs[mafPipeline->jobsSubmitted % mafPipeline->jobNumber];
+        job->block = block;
+        job->instanceViews = instanceViews;
+        mafBuffer_clear(job->blockText);
+        if (blockText != NULL) {
+            mafBuffer_append(job->blockText, blockText->string, blockText->length);
+        }
+        job->done = 0;
+        pthread_mutex_lock(&mafPipeline->mutex);
+        mafPipeline->jobsSubmitted++;
+        pthread_cond_signal(&mafPipeline->jobSubmitted);
+        pthread_mutex_unlock(&mafPipeline->mutex);
+    }
+    if (blockText != NULL) {
+        mafBuffer_destruct(blockText);
+    }
+}
+
+void mafPipeline_destruct(MafPipeline *mafPipeline) {
+    if (mafPipeline->threadNumber > 0) {
+        pthread_mutex_lock(&mafPipeline->mutex);
+        mafPipeline->finished = 1;
+        pthread_cond_broadcast(&mafPipeline->jobSubmitted);
+        pthread_cond_broadcast(&mafPipeline->jobDone);
+        pthread_mutex_unlock(&mafPipeline->mutex);
+        for (int64_t i = 0; i < mafPipeline->threadNumber; i++) {
+            pthread_join(mafPipeline->threads[i], NULL);
+        }
+        pthread_join(mafPipeline->writerThread, NULL);
+        pthread_mutex_destroy(&mafPipeline->mutex);
+        pthread_cond_destroy(&mafPipeline->jobSubmitted);
+        pthread_cond_destroy(&mafPipeline->jobDone);
+        pthread_cond_destroy(&mafPipeline->jobWritten);
+        free(mafPipeline->threads);
+    }
+    for (int64_t i = 0; i < mafPipeline->jobNumber; i++) {
+        assert(mafPipeline->jobs[i].instanceViews == NULL);
+        mafBuffer_destruct(mafPipeline->jobs[i].blockText);
+        mafBuffer_destruct(mafPipeline->jobs[i].record);
+    }
+    free(mafPipeline->jobs);
+    free(mafPipeline);
+}
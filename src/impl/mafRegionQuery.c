@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten (at) gmail.com) and Dent Earl (dearl (at) soe.ucsc.edu)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <getopt.h>
+
+#include "sonLib.h"
+#include "mafWriter.h"
+#include "mafIndex.h"
+
+/*
+ * Pulls the records (annotation lines and MAF blocks) overlapping one or more regions
+ * out of a MAF written by pathAnnotatedMafGenerator, using its index, writing them after a
+ * MAF header.
+ */
+
+static void usage() {
+    fprintf(stderr, "mafRegionQuery\n");
+    fprintf(stderr, "-a --logLevel : Set the log level\n");
+    fprintf(stderr, "-b --maf : The MAF file (uncompressed or BGZF)\n");
+    fprintf(stderr, "-c --index : The index of the MAF file, defaults to the MAF file name with .idx appended\n");
+    fprintf(stderr,
+            "-d --region : A region to extract, as sequence:start-end (zero based, half open) or sequence, may be repeated\n");
+    fprintf(stderr, "-e --outputFile : The file to write the records in, defaults to standard out\n");
+    fprintf(stderr, "-h --help : Print this help screen\n");
+}
+
+int main(int argc, char *argv[]) {
+    char *logLevelString = NULL;
+    char *mafFile = NULL;
+    char *indexFile = NULL;
+    char *queryOutputFile = NULL;
+    stList *regions = stList_construct();
+
+    while (1) {
+        static struct option long_options[] = { { "logLevel", required_argument, 0, 'a' }, { "maf",
+                required_argument, 0, 'b' }, { "index", required_argument, 0, 'c' }, { "region", required_argument,
+                0, 'd' }, { "outputFile", required_argument, 0, 'e' }, { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+
+        int key = getopt_long(argc, argv, "a:b:c:d:e:h", long_options, &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+            case 'a':
+                logLevelString = optarg;
+                break;
+            case 'b':
+                mafFile = optarg;
+                break;
+            case 'c':
+                indexFile = optarg;
+                break;
+            case 'd':
+                stList_append(regions, optarg);
+                break;
+            case 'e':
+                queryOutputFile = optarg;
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    st_setLogLevelFromString(logLevelString);
+
+    if (mafFile == NULL) {
+        st_errAbort("The MAF file was not specified");
+    }
+    if (stList_length(regions) == 0) {
+        st_errAbort("No regions were specified");
+    }
+    char *indexFileName = indexFile != NULL ? stString_copy(indexFile) : stString_print("%s.idx", mafFile);
+
+    int64_t startTime = time(NULL);
+    MafIndex *mafIndex = mafIndex_read(indexFileName);
+
+    //Gather the offsets of all the records, in file order.
+    stSortedSet *offsets = stSortedSet_construct3((int (*)(const void *, const void *)) stIntTuple_cmpFn,
+            (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < stList_length(regions); i++) {
+        char *sequenceName;
+        int64_t start, end;
+        if (!mafIndex_parseRegion(stList_get(regions, i), &sequenceName, &start, &end)) {
+            st_errAbort("The region %s is not valid", (char *) stList_get(regions, i));
+        }
+        stList *regionOffsets = mafIndex_getOverlappingOffsets(mafIndex, sequenceName, start, end);
+        st_logInfo("Got %" PRIi64 " records for the region %s\n", stList_length(regionOffsets),
+                (char *) stList_get(regions, i));
+        for (int64_t j = 0; j < stList_length(regionOffsets); j++) {
+            stIntTuple *offset = stList_get(regionOffsets, j);
+            if (stSortedSet_search(offsets, offset) == NULL) {
+                stSortedSet_insert(offsets, stIntTuple_construct1(stIntTuple_get(offset, 0)));
+            }
+        }
+        stList_destruct(regionOffsets);
+        free(sequenceName);
+    }
+
+    //Now write out the records.
+    FILE *fileHandle = queryOutputFile != NULL ? fopen(queryOutputFile, "w") : stdout;
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the output file %s", queryOutputFile);
+    }
+    //The header, as written by makeMAFHeader, so the output is a MAF in its own right.
+    fprintf(fileHandle, "##maf version=1 scoring=N/A\n\n");
+    MafReader *mafReader = mafReader_construct(mafFile, mafIndex_isCompressed(mafIndex));
+    MafBuffer *record = mafBuffer_construct();
+    stSortedSetIterator *it = stSortedSet_getIterator(offsets);
+    stIntTuple *offset;
+    while ((offset = stSortedSet_getNext(it)) != NULL) {
+        mafBuffer_clear(record);
+        mafReader_getRecord(mafReader, stIntTuple_get(offset, 0), record);
+        fwrite(record->string, 1, record->length, fileHandle);
+    }
+    stSortedSet_destructIterator(it);
+    if (fileHandle != stdout) {
+        fclose(fileHandle);
+    }
+    st_logInfo("Got %" PRIi64 " records in %" PRIi64 " seconds\n", stSortedSet_size(offsets), time(NULL) - startTime);
+
+    mafBuffer_destruct(record);
+    mafReader_destruct(mafReader);
+    stSortedSet_destruct(offsets);
+    mafIndex_destruct(mafIndex);
+    stList_destruct(regions);
+    free(indexFileName);
+
+    return 0;
+}
@@ -0,0 +1,556 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten (at) gmail.com) and Dent Earl (dearl (at) soe.ucsc.edu)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "sonLib.h"
+#include "cactus.h"
+#include "cactusMafs.h"
+#include "assemblaCommon.h"
+#include "mafWriter.h"
+
+/*
+ * Buffer functions.
+ */
+
+MafBuffer *mafBuffer_construct(void) {
+    MafBuffer *mafBuffer = st_malloc(sizeof(MafBuffer));
+    mafBuffer->length = 0;
+    mafBuffer->maxLength = 1024;
+    mafBuffer->string = st_malloc(mafBuffer->maxLength);
+    return mafBuffer;
+}
+
+void mafBuffer_destruct(MafBuffer *mafBuffer) {
+    free(mafBuffer->string);
+    free(mafBuffer);
+}
+
+void mafBuffer_clear(MafBuffer *mafBuffer) {
+    mafBuffer->length = 0;
+}
+
+static void mafBuffer_ensureCapacity(MafBuffer *mafBuffer, int64_t length) {
+    if (mafBuffer->length + length > mafBuffer->maxLength) {
+        while (mafBuffer->length + length > mafBuffer->maxLength) {
+            mafBuffer->maxLength *= 2;
+        }
+        mafBuffer->string = realloc(mafBuffer->string, mafBuffer->maxLength);
+        if (mafBuffer->string == NULL) {
+            st_errAbort("Failed to grow a MAF buffer to %" PRIi64 " bytes", mafBuffer->maxLength);
+        }
+    }
+}
+
+void mafBuffer_append(MafBuffer *mafBuffer, const char *string, int64_t length) {
+    mafBuffer_ensureCapacity(mafBuffer, length);
+    memcpy(mafBuffer->string + mafBuffer->length, string, length);
+    mafBuffer->length += length;
+}
+
+void mafBuffer_appendString(MafBuffer *mafBuffer, const char *string) {
+    mafBuffer_append(mafBuffer, string, strlen(string));
+}
+
+void mafBuffer_appendChar(MafBuffer *mafBuffer, char c) {
+    mafBuffer_ensureCapacity(mafBuffer, 1);
+    mafBuffer->string[mafBuffer->length++] = c;
+}
+
+void mafBuffer_appendSequenceView(MafBuffer *mafBuffer, const SequenceView *sequenceView) {
+    if (sequenceView->strand) {
+        mafBuffer_append(mafBuffer, sequenceView->string, sequenceView->length);
+        return;
+    }
+    mafBuffer_ensureCapacity(mafBuffer, sequenceView->length);
+    char *cA = mafBuffer->string + mafBuffer->length;
+    for (int64_t i = 0; i < sequenceView->length; i++) {
+        cA[i] = sequenceView_getBase(sequenceView, i);
+    }
+    mafBuffer->length += sequenceView->length;
+}
+
+void mafBuffer_appendInt(MafBuffer *mafBuffer, int64_t i) {
+    char digits[21];
+    int64_t j = 21;
+    uint64_t k = i < 0 ? -((uint64_t) i) : (uint64_t) i;
+    do {
+        digits[--j] = '0' + k % 10;
+        k /= 10;
+    } while (k > 0);
+    if (i < 0) {
+        digits[--j] = '-';
+    }
+    mafBuffer_append(mafBuffer, digits + j, 21 - j);
+}
+
+void mafBuffer_appendFile(MafBuffer *mafBuffer, FILE *fileHandle) {
+    rewind(fileHandle);
+    char chunk[65536];
+    size_t i;
+    while ((i = fread(chunk, 1, sizeof(chunk), fileHandle)) > 0) {
+        mafBuffer_append(mafBuffer, chunk, i);
+    }
+}
+
+/*
+ * Block formatting, follows getMAFBlock in cactusMafs.
+ */
+
+void mafBuffer_appendSequenceName(MafBuffer *mafBuffer, Sequence *sequence) {
+    const char *sequenceHeader = sequence_getHeader(sequence);
+    int64_t i = 0;
+    while (sequenceHeader[i] == ' ' || sequenceHeader[i] == '\t' || sequenceHeader[i] == '\n') {
+        i++;
+    }
+    int64_t j = i;
+    while (sequenceHeader[j] != '\0' && sequenceHeader[j] != ' ' && sequenceHeader[j] != '\t' && sequenceHeader[j] != '\n') {
+        j++;
+    }
+    if (j > i) {
+        mafBuffer_append(mafBuffer, sequenceHeader + i, j - i);
+    } else {
+        char *cA = cactusMisc_nameToString(sequence_getName(sequence));
+        mafBuffer_appendString(mafBuffer, cA);
+        free(cA);
+    }
+}
+
+static void mafBuffer_appendSegment(MafBuffer *mafBuffer, Segment *segment, const SequenceView *instanceView) {
+    Sequence *sequence = segment_getSequence(segment);
+    int64_t start;
+    if (segment_getStrand(segment)) {
+        start = segment_getStart(segment) - sequence_getStart(sequence);
+    } else { //start with respect to the start of the reverse complement sequence
+        start = (sequence_getStart(sequence) + sequence_getLength(sequence) - 1) - segment_getStart(segment);
+    }
+    mafBuffer_append(mafBuffer, "s\t", 2);
+    mafBuffer_appendSequenceName(mafBuffer, sequence);
+    mafBuffer_appendChar(mafBuffer, '\t');
+    mafBuffer_appendInt(mafBuffer, start);
+    mafBuffer_appendChar(mafBuffer, '\t');
+    mafBuffer_appendInt(mafBuffer, segment_getLength(segment));
+    mafBuffer_append(mafBuffer, segment_getStrand(segment) ? "\t+\t" : "\t-\t", 3);
+    mafBuffer_appendInt(mafBuffer, sequence_getLength(sequence));
+    mafBuffer_appendChar(mafBuffer, '\t');
+    mafBuffer_appendSequenceView(mafBuffer, instanceView);
+    mafBuffer_appendChar(mafBuffer, '\n');
+}
+
+SequenceView *mafBuffer_getInstanceViews(Block *block) {
+    //The bases go after the views, in the same allocation, so the views are freed with them.
+    int64_t instanceNumber = block_getInstanceNumber(block);
+    int64_t basesLength = 0;
+    Block_InstanceIterator *instanceIt = block_getInstanceIterator(block);
+    Segment *segment;
+    while ((segment = block_getNext(instanceIt)) != NULL) {
+        basesLength += segment_getSequence(segment) != NULL ? segment_getLength(segment) : 0;
+    }
+    block_destructInstanceIterator(instanceIt);
+    SequenceView *instanceViews = st_malloc(sizeof(SequenceView) * (instanceNumber + 1) + basesLength);
+    char *bases = (char *) (instanceViews + instanceNumber + 1);
+    instanceIt = block_getInstanceIterator(block);
+    int64_t i = 0;
+    while ((segment = block_getNext(instanceIt)) != NULL) {
+        char *string = sequenceView_read(segment, &instanceViews[i]);
+        if (string != NULL) {
+            memcpy(bases, string, instanceViews[i].length);
+            instanceViews[i].string = bases;
+            bases += instanceViews[i].length;
+            free(string);
+        } else {
+            instanceViews[i].string = NULL;
+        }
+        i++;
+    }
+    block_destructInstanceIterator(instanceIt);
+    assert(i == instanceNumber);
+    return instanceViews;
+}
+
+void mafBuffer_appendBlockWithViews(MafBuffer *mafBuffer, Block *block, const SequenceView *instanceViews) {
+    if (block_getInstanceNumber(block) > 0) {
+        mafBuffer_append(mafBuffer, "a score=", 8);
+        mafBuffer_appendInt(mafBuffer, block_getLength(block) * block_getInstanceNumber(block));
+        mafBuffer_appendChar(mafBuffer, '\n');
+        Block_InstanceIterator *instanceIt = block_getInstanceIterator(block);
+        Segment *segment;
+        int64_t i = 0;
+        while ((segment = block_getNext(instanceIt)) != NULL) {
+            if (instanceViews[i].string != NULL) {
+                mafBuffer_appendSegment(mafBuffer, segment, &instanceViews[i]);
+            }
+            i++;
+        }
+        block_destructInstanceIterator(instanceIt);
+        mafBuffer_appendChar(mafBuffer, '\n');
+    }
+}
+
+void mafBuffer_appendBlockUsingGetMAFBlock(MafBuffer *mafBuffer, Block *block) {
+    FILE *fileHandle = tmpfile();
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open a temporary file to format a MAF block");
+    }
+    getMAFBlock(block, fileHandle);
+    mafBuffer_appendFile(mafBuffer, fileHandle);
+    fclose(fileHandle);
+}
+
+/*
+ * 0 = not yet checked, 1 = format natively, 2 = use getMAFBlock.
+ */
+static int64_t blockFormatterState = 0;
+
+static bool formatsLikeGetMAFBlock(Block *block) {
+    MafBuffer *formatted = mafBuffer_construct();
+    SequenceView *instanceViews = mafBuffer_getInstanceViews(block);
+    mafBuffer_appendBlockWithViews(formatted, block, instanceViews);
+    free(instanceViews);
+    MafBuffer *expected = mafBuffer_construct();
+    mafBuffer_appendBlockUsingGetMAFBlock(expected, block);
+    bool matches = expected->length == formatted->length && memcmp(expected->string, formatted->string,
+            expected->length) == 0;
+    mafBuffer_destruct(formatted);
+    mafBuffer_destruct(expected);
+    return matches;
+}
+
+bool mafBuffer_canFormatBlock(Block *block) {
+    if (block_getRootInstance(block) != NULL) {
+        //Blocks with trees have a different header line, leave those to cactusMafs.
+        return 0;
+    }
+    if (block_getInstanceNumber(block) > 0 && (blockFormatterState == 0 || (verifyMaf && blockFormatterState == 1))) {
+        if (formatsLikeGetMAFBlock(block)) {
+            blockFormatterState = 1;
+        } else if (verifyMaf) {
+            char *blockName = cactusMisc_nameToString(block_getName(block));
+            st_errAbort("The MAF block formatter does not match getMAFBlock for the block %s", blockName);
+        } else {
+            st_logInfo("The MAF block formatter does not match getMAFBlock, falling back to getMAFBlock\n");
+            blockFormatterState = 2;
+        }
+    }
+    return blockFormatterState != 2;
+}
+
+void mafBuffer_appendBlock(MafBuffer *mafBuffer, Block *block) {
+    if (mafBuffer_canFormatBlock(block)) {
+        SequenceView *instanceViews = mafBuffer_getInstanceViews(block);
+        mafBuffer_appendBlockWithViews(mafBuffer, block, instanceViews);
+        free(instanceViews);
+    } else {
+        mafBuffer_appendBlockUsingGetMAFBlock(mafBuffer, block);
+    }
+}
+
+/*
+ * BGZF blocks, see the SAM specification.
+ */
+
+static const unsigned char bgzfEmptyBlock[28] = { 0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00,
+        0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+typedef struct _compressionJob {
+    char *uncompressed;
+    int64_t uncompressedLength;
+    unsigned char *compressed;
+    int64_t compressedLength;
+    bool done;
+} CompressionJob;
+
+static void putLittleEndian(unsigned char *bytes, uint64_t value, int64_t byteNumber) {
+    for (int64_t i = 0; i < byteNumber; i++) {
+        bytes[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+static bool deflateBlock(CompressionJob *job, int level) {
+    z_stream zStream;
+    memset(&zStream, 0, sizeof(z_stream));
+    if (deflateInit2(&zStream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        st_errAbort("Failed to initialise zlib");
+    }
+    zStream.next_in = (Bytef *) job->uncompressed;
+    zStream.avail_in = job->uncompressedLength;
+    zStream.next_out = job->compressed + BGZF_HEADER_SIZE;
+    zStream.avail_out = BGZF_MAX_BLOCK_SIZE - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+    int i = deflate(&zStream, Z_FINISH);
+    job->compressedLength = BGZF_HEADER_SIZE + zStream.total_out + BGZF_FOOTER_SIZE;
+    deflateEnd(&zStream);
+    return i == Z_STREAM_END;
+}
+
+static void compressBlock(CompressionJob *job) {
+    assert(job->uncompressedLength <= BGZF_BLOCK_SIZE);
+    if (!deflateBlock(job, Z_DEFAULT_COMPRESSION)) {
+        //Incompressible data, store it instead (this always fits).
+        if (!deflateBlock(job, Z_NO_COMPRESSION)) {
+            st_errAbort("Failed to compress a BGZF block");
+        }
+    }
+    unsigned char *header = job->compressed;
+    memcpy(header, bgzfEmptyBlock, 16);
+    putLittleEndian(header + 16, job->compressedLength - 1, 2);
+    unsigned char *footer = job->compressed + job->compressedLength - BGZF_FOOTER_SIZE;
+    uLong crc = crc32(crc32(0L, Z_NULL, 0), (Bytef *) job->uncompressed, job->uncompressedLength);
+    putLittleEndian(footer, crc, 4);
+    putLittleEndian(footer + 4, job->uncompressedLength, 4);
+}
+
+/*
+ * The writer.
+ */
+
+struct _mafWriter {
+    FILE *fileHandle;
+    MafBuffer *buffer;
+    int64_t flushThreshold;
+    bool compress;
+    //Ring of compression jobs, indexed by their sequence number modulo jobNumber.
+    CompressionJob *jobs;
+    int64_t jobNumber;
+    int64_t jobsSubmitted;
+    int64_t jobsStarted;
+    int64_t jobsWritten;
+    bool finished;
+    //Worker threads, absent if compressing in the calling thread.
+    int64_t threadNumber;
+    pthread_t *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t jobSubmitted;
+    pthread_cond_t jobDone;
+    //Offsets, to support indexing.
+    int64_t flushedLength;
+    int64_t writtenLength;
+    int64_t *blockOffsets;
+    int64_t blockNumber;
+    int64_t maxBlockNumber;
+    bool closed;
+};
+
+static void *compressionWorker(void *arg) {
+    MafWriter *mafWriter = arg;
+    pthread_mutex_lock(&mafWriter->mutex);
+    while (1) {
+        while (mafWriter->jobsStarted == mafWriter->jobsSubmitted && !mafWriter->finished) {
+            pthread_cond_wait(&mafWriter->jobSubmitted, &mafWriter->mutex);
+        }
+        if (mafWriter->jobsStarted == mafWriter->jobsSubmitted) {
+            break;
+        }
+        CompressionJob *job = &mafWriter->jobs[mafWriter->jobsStarted++ % mafWriter->jobNumber];
+        pthread_mutex_unlock(&mafWriter->mutex);
+        compressBlock(job);
+        pthread_mutex_lock(&mafWriter->mutex);
+        job->done = 1;
+        pthread_cond_broadcast(&mafWriter->jobDone);
+    }
+    pthread_mutex_unlock(&mafWriter->mutex);
+    return NULL;
+}
+
+static void writeBytes(MafWriter *mafWriter, const void *bytes, int64_t length) {
+    if (fwrite(bytes, 1, length, mafWriter->fileHandle) != length) {
+        st_errAbort("Failed to write to the MAF file");
+    }
+}
+
+static void writeJob(MafWriter *mafWriter, CompressionJob *job) {
+    if (mafWriter->blockNumber == mafWriter->maxBlockNumber) {
+        mafWriter->maxBlockNumber = mafWriter->maxBlockNumber * 2 + 1024;
+        mafWriter->blockOffsets = realloc(mafWriter->blockOffsets, sizeof(int64_t) * mafWriter->maxBlockNumber);
+        if (mafWriter->blockOffsets == NULL) {
+            st_errAbort("Failed to grow the BGZF block offsets");
+        }
+    }
+    mafWriter->blockOffsets[mafWriter->blockNumber++] = mafWriter->writtenLength;
+    writeBytes(mafWriter, job->compressed, job->compressedLength);
+    mafWriter->writtenLength += job->compressedLength;
+}
+
+/*
+ * Writes out completed jobs in order, waiting on unfinished jobs while more than
+ * maxOutstanding jobs remain unwritten. Called holding the mutex.
+ */
+static void writeCompletedJobs(MafWriter *mafWriter, int64_t maxOutstanding) {
+    while (mafWriter->jobsWritten < mafWriter->jobsSubmitted) {
+        CompressionJob *job = &mafWriter->jobs[mafWriter->jobsWritten % mafWriter->jobNumber];
+        if (!job->done) {
+            if (mafWriter->jobsSubmitted - mafWriter->jobsWritten <= maxOutstanding) {
+                return;
+            }
+            pthread_cond_wait(&mafWriter->jobDone, &mafWriter->mutex);
+            continue;
+        }
+        //The slot can not be reused until jobsWritten is incremented, so write without the lock.
+        pthread_mutex_unlock(&mafWriter->mutex);
+        writeJob(mafWriter, job);
+        pthread_mutex_lock(&mafWriter->mutex);
+        mafWriter->jobsWritten++;
+    }
+}
+
+static void submitBlock(MafWriter *mafWriter, const char *string, int64_t length) {
+    assert(length <= BGZF_BLOCK_SIZE);
+    if (mafWriter->threadNumber == 0) {
+        CompressionJob *job = &mafWriter->jobs[0];
+        memcpy(job->uncompressed, string, length);
+        job->uncompressedLength = length;
+        compressBlock(job);
+        writeJob(mafWriter, job);
+        return;
+    }
+    pthread_mutex_lock(&mafWriter->mutex);
+    writeCompletedJobs(mafWriter, mafWriter->jobNumber - 1);
+    CompressionJob *job = &mafWriter->jobs[mafWriter->jobsSubmitted % mafWriter->jobNumber];
+    memcpy(job->uncompressed, string, length);
+    job->uncompressedLength = length;
+    job->done = 0;
+    mafWriter->jobsSubmitted++;
+    pthread_cond_signal(&mafWriter->jobSubmitted);
+    pthread_mutex_unlock(&mafWriter->mutex);
+}
+
+static void mafWriter_flush(MafWriter *mafWriter, bool final) {
+    MafBuffer *buffer = mafWriter->buffer;
+    if (!mafWriter->compress) {
+        writeBytes(mafWriter, buffer->string, buffer->length);
+        mafWriter->flushedLength += buffer->length;
+        mafBuffer_clear(buffer);
+        return;
+    }
+    //Only write whole BGZF blocks until the end, so blocks stay a constant size.
+    int64_t i = 0;
+    while (buffer->length - i >= BGZF_BLOCK_SIZE || (final && buffer->length > i)) {
+        int64_t j = buffer->length - i < BGZF_BLOCK_SIZE ? buffer->length - i : BGZF_BLOCK_SIZE;
+        submitBlock(mafWriter, buffer->string + i, j);
+        i += j;
+    }
+    mafWriter->flushedLength += i;
+    memmove(buffer->string, buffer->string + i, buffer->length - i);
+    buffer->length -= i;
+}
+
+MafWriter *mafWriter_construct(const char *fileName, bool compress, int64_t threadNumber) {
+    MafWriter *mafWriter = st_malloc(sizeof(MafWriter));
+    mafWriter->fileHandle = fopen(fileName, "w");
+    if (mafWriter->fileHandle == NULL) {
+        st_errAbort("Could not open the MAF file %s for writing", fileName);
+    }
+    mafWriter->buffer = mafBuffer_construct();
+    mafWriter->flushThreshold = 1 << 22;
+    mafWriter->compress = compress;
+    mafWriter->threadNumber = compress && threadNumber > 1 ? threadNumber : 0;
+    mafWriter->jobNumber = mafWriter->threadNumber > 0 ? 4 * mafWriter->threadNumber : 1;
+    mafWriter->jobsSubmitted = 0;
+    mafWriter->jobsStarted = 0;
+    mafWriter->jobsWritten = 0;
+    mafWriter->finished = 0;
+    mafWriter->jobs = NULL;
+    mafWriter->threads = NULL;
+    mafWriter->flushedLength = 0;
+    mafWriter->writtenLength = 0;
+    mafWriter->blockOffsets = NULL;
+    mafWriter->blockNumber = 0;
+    mafWriter->maxBlockNumber = 0;
+    mafWriter->closed = 0;
+    if (compress) {
+        mafWriter->jobs = st_malloc(sizeof(CompressionJob) * mafWriter->jobNumber);
+        for (int64_t i = 0; i < mafWriter->jobNumber; i++) {
+            mafWriter->jobs[i].uncompressed = st_malloc(BGZF_BLOCK_SIZE);
+            mafWriter->jobs[i].compressed = st_malloc(BGZF_MAX_BLOCK_SIZE);
+            mafWriter->jobs[i].done = 0;
+        }
+    }
+    if (mafWriter->threadNumber > 0) {
+        pthread_mutex_init(&mafWriter->mutex, NULL);
+        pthread_cond_init(&mafWriter->jobSubmitted, NULL);
+        pthread_cond_init(&mafWriter->jobDone, NULL);
+        mafWriter->threads = st_malloc(sizeof(pthread_t) * mafWriter->threadNumber);
+        for (int64_t i = 0; i < mafWriter->threadNumber; i++) {
+            if (pthread_create(&mafWriter->threads[i], NULL, compressionWorker, mafWriter) != 0) {
+                st_errAbort("Failed to start a compression thread");
+            }
+        }
+    }
+    return mafWriter;
+}
+
+void mafWriter_close(MafWriter *mafWriter) {
+    if (mafWriter->closed) {
+        return;
+    }
+    mafWriter->closed = 1;
+    mafWriter_flush(mafWriter, 1);
+    if (mafWriter->threadNumber > 0) {
+        pthread_mutex_lock(&mafWriter->mutex);
+        writeCompletedJobs(mafWriter, 0);
+        mafWriter->finished = 1;
+        pthread_cond_broadcast(&mafWriter->jobSubmitted);
+        pthread_mutex_unlock(&mafWriter->mutex);
+        for (int64_t i = 0; i < mafWriter->threadNumber; i++) {
+            pthread_join(mafWriter->threads[i], NULL);
+        }
+        pthread_mutex_destroy(&mafWriter->mutex);
+        pthread_cond_destroy(&mafWriter->jobSubmitted);
+        pthread_cond_destroy(&mafWriter->jobDone);
+        free(mafWriter->threads);
+    }
+    if (mafWriter->compress) {
+        writeBytes(mafWriter, bgzfEmptyBlock, sizeof(bgzfEmptyBlock));
+        for (int64_t i = 0; i < mafWriter->jobNumber; i++) {
+            free(mafWriter->jobs[i].uncompressed);
+            free(mafWriter->jobs[i].compressed);
+        }
+        free(mafWriter->jobs);
+    }
+    if (fclose(mafWriter->fileHandle) != 0) {
+        st_errAbort("Failed to close the MAF file");
+    }
+}
+
+void mafWriter_destruct(MafWriter *mafWriter) {
+    mafWriter_close(mafWriter);
+    mafBuffer_destruct(mafWriter->buffer);
+    free(mafWriter->blockOffsets);
+    free(mafWriter);
+}
+
+MafBuffer *mafWriter_getBuffer(MafWriter *mafWriter) {
+    return mafWriter->buffer;
+}
+
+int64_t mafWriter_getOffset(MafWriter *mafWriter) {
+    return mafWriter->flushedLength + mafWriter->buffer->length;
+}
+
+bool mafWriter_isCompressed(MafWriter *mafWriter) {
+    return mafWriter->compress;
+}
+
+int64_t mafWriter_getVirtualOffset(MafWriter *mafWriter, int64_t offset) {
+    assert(mafWriter->closed);
+    if (!mafWriter->compress) {
+        return offset;
+    }
+    //All but the last BGZF block hold exactly BGZF_BLOCK_SIZE bytes.
+    int64_t i = offset / BGZF_BLOCK_SIZE;
+    assert(i < mafWriter->blockNumber);
+    return (mafWriter->blockOffsets[i] << 16) | (offset % BGZF_BLOCK_SIZE);
+}
+
+void mafWriter_endRecord(MafWriter *mafWriter) {
+    if (mafWriter->buffer->length >= mafWriter->flushThreshold) {
+        mafWriter_flush(mafWriter, 0);
+    }
+}
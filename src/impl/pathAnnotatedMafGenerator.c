@@ -11,10 +11,13 @@
 #include "adjacencyClassification.h"
 #include "scaffoldPaths.h"
 #include "assemblaCommon.h"
+#include "mafWriter.h"
+#include "mafIndex.h"
+#include "mafPipeline.h"
+#include "contigPathTable.h"
 
-stHash *segmentsToMaximalHaplotypePaths;
-stHash *maximalHaplotypePathLengths;
-stHash *maximalScaffoldPathsLengths;
+MafPipeline *mafPipeline;
+ContigPathTable *contigPathTable;
 stList *haplotypeEventStrings;
 stList *contaminationEventStrings;
 
@@ -61,66 +64,208 @@ int getSimpleCode(enum CapCode code) {
     return 2;
 }
 
-void getMAFBlock2(Block *block, FILE *fileHandle) {
+typedef struct _segmentAnnotation {
+    int64_t length;
+    int64_t scaffoldPathLength;
+    enum CapCode _5EndStatusNerd;
+    enum CapCode _3EndStatusNerd;
+} SegmentAnnotation;
+
+static bool getSegmentAnnotation(Segment *segment, SegmentAnnotation *annotation) {
+    /*
+     * Gets the annotation of an assembly segment in a contig path, returning zero
+     * if the segment is not such a segment.
+     */
+    if (getAssemblyIndex(event_getHeader(segment_getEvent(segment))) == -1) { //Establish if we need a line..
+        return 0;
+    }
+    int64_t maximalHaplotypePath = contigPathTable_getPath(contigPathTable, segment);
+    if (maximalHaplotypePath == -1) {
+        return 0;
+    }
+    annotation->length = contigPathTable_getPathLength(contigPathTable, maximalHaplotypePath);
+    annotation->scaffoldPathLength = contigPathTable_getScaffoldPathLength(contigPathTable, maximalHaplotypePath);
+    assert(annotation->scaffoldPathLength >= annotation->length);
+    //The cap codes were computed with the table.
+    return contigPathTable_getCapCodes(contigPathTable, segment, &annotation->_5EndStatusNerd,
+            &annotation->_3EndStatusNerd);
+}
+
+void annotateBlock(Block *block, MafBuffer *mafBuffer) {
+    /*
+     * Prints out the comment lines for the block. Called from the pipeline's worker threads,
+     * so only reads the flowers, which are all loaded before the pipeline starts, and the
+     * contig path table.
+     */
+    /*
+     * Codes:
+     * 0 = contig ends.
+     * 1 = correct adjacency.
+     * 2 = error adjacency.
+     * 3 = scaffold gap
+     */
+    Segment *segment;
+    SegmentAnnotation annotation;
+    Block_InstanceIterator *instanceIt = block_getInstanceIterator(block);
+    while ((segment = block_getNext(instanceIt)) != NULL) {
+        if (getSegmentAnnotation(segment, &annotation)) {
+            mafBuffer_append(mafBuffer, "#HPL=", 5);
+            mafBuffer_appendInt(mafBuffer, annotation.length);
+            mafBuffer_append(mafBuffer, " 5=", 3);
+            mafBuffer_appendInt(mafBuffer, getSimpleCode(annotation._5EndStatusNerd));
+            mafBuffer_append(mafBuffer, " 3=", 3);
+            mafBuffer_appendInt(mafBuffer, getSimpleCode(annotation._3EndStatusNerd));
+            mafBuffer_append(mafBuffer, " SPL=", 5);
+            mafBuffer_appendInt(mafBuffer, annotation.scaffoldPathLength);
+            mafBuffer_append(mafBuffer, " 5NERD=", 7);
+            mafBuffer_appendInt(mafBuffer, (int64_t)annotation._5EndStatusNerd);
+            mafBuffer_append(mafBuffer, " 3NERD=", 7);
+            mafBuffer_appendInt(mafBuffer, (int64_t)annotation._3EndStatusNerd);
+            mafBuffer_appendChar(mafBuffer, '\n');
+        }
+    }
+    block_destructInstanceIterator(instanceIt);
+}
+
+/*
+ * The annotation table, written instead of the MAF if --annotationTable is given. It
+ * has one row per annotated assembly segment, in the same order as the #HPL lines of the MAF.
+ *
+ * The tsv format has a header line, then the columns: sequence, start, end (zero based,
+ * half open and on the positive strand), strand, HPL, SPL, 5, 3, 5NERD, 3NERD.
+ *
+ * The binary format, all integers int64_t in native byte order:
+ * magic (8 bytes), then for each row the same columns, with the sequence as an index
+ * into the sequence names and the strand as 1 (+) or 0 (-), then for each sequence the
+ * name length and the name padded to 8 bytes, then the number of sequences and the number of rows.
+ */
+
+static const char *annotationTableMagic = "HPLTAB01";
+
+MafWriter *annotationTableWriter;
+bool annotationTableIsBinary;
+stHash *annotationTableSequencesToIndices;
+stList *annotationTableSequenceNames;
+int64_t annotationTableRowNumber = 0;
+
+static int64_t getAnnotationTableSequenceIndex(Sequence *sequence) {
+    stIntTuple *i = stHash_search(annotationTableSequencesToIndices, sequence);
+    if (i == NULL) {
+        MafBuffer *sequenceName = mafBuffer_construct();
+        mafBuffer_appendSequenceName(sequenceName, sequence);
+        mafBuffer_appendChar(sequenceName, '\0');
+        i = stIntTuple_construct1(stList_length(annotationTableSequenceNames));
+        stList_append(annotationTableSequenceNames, stString_copy(sequenceName->string));
+        stHash_insert(annotationTableSequencesToIndices, sequence, i);
+        mafBuffer_destruct(sequenceName);
+    }
+    return stIntTuple_get(i, 0);
+}
+
+static void appendBinaryInt(MafBuffer *mafBuffer, int64_t i) {
+    mafBuffer_append(mafBuffer, (const char *) &i, sizeof(int64_t));
+}
+
+void writeAnnotationTableRows(Block *block, FILE *fileHandle) {
     /*
-     * Prints out the comment lines, then the maf blocks.
+     * Writes a table row for each annotated segment in the block, without getting the block's strings.
      */
     if (getNumberOnPositiveStrand(block) == 0) {
         block = block_getReverse(block);
     }
+    MafBuffer *mafBuffer = mafWriter_getBuffer(annotationTableWriter);
     Segment *segment;
+    SegmentAnnotation annotation;
     Block_InstanceIterator *instanceIt = block_getInstanceIterator(block);
     while ((segment = block_getNext(instanceIt)) != NULL) {
-        if (strcmp(event_getHeader(segment_getEvent(segment)), assemblyEventString) == 0) { //Establish if we need a line..
-            stList *maximalHaplotypePath = stHash_search(
-                    segmentsToMaximalHaplotypePaths, segment);
-            if (maximalHaplotypePath == NULL) {
-                maximalHaplotypePath = stHash_search(
-                        segmentsToMaximalHaplotypePaths, segment_getReverse(
-                                segment));
-            }
-            if (maximalHaplotypePath != NULL) {
-                assert(stHash_search(maximalHaplotypePathLengths,
-                        maximalHaplotypePath) != NULL);
-                int64_t length = stIntTuple_get(stHash_search(
-                        maximalHaplotypePathLengths, maximalHaplotypePath), 0);
-                assert(stHash_search(maximalScaffoldPathsLengths,
-                        maximalHaplotypePath) != NULL);
-                int64_t scaffoldPathLength = stIntTuple_get(
-                        stHash_search(maximalScaffoldPathsLengths,
-                                maximalHaplotypePath), 0);
-                assert(scaffoldPathLength >= length);
-                /*
-                 * Codes:
-                 * 0 = contig ends.
-                 * 1 = correct adjacency.
-                 * 2 = error adjacency.
-                 * 3 = scaffold gap
-                 */
-
-                int64_t insertLength;
-                int64_t deleteLength;
-                Cap *otherCap;
-                enum CapCode _5EndStatusNerd = getCapCode(segment_get5Cap(
-                        segment), &otherCap, haplotypeEventStrings, contaminationEventStrings, &insertLength, &deleteLength, capCodeParameters);
-                enum CapCode _3EndStatusNerd = getCapCode(segment_get3Cap(
-                        segment), &otherCap, haplotypeEventStrings, contaminationEventStrings, &insertLength, &deleteLength, capCodeParameters);
-
-                int64_t _5EndStatus = getSimpleCode(_5EndStatusNerd);
-                int64_t _3EndStatus = getSimpleCode(_3EndStatusNerd);
-
-                fprintf(
-                        fileHandle,
-                        "#HPL=%" PRIi64 " 5=%" PRIi64 " 3=%" PRIi64 " SPL=%" PRIi64 " 5NERD=%" PRIi64 " 3NERD=%" PRIi64 "\n",
-                        length, _5EndStatus, _3EndStatus,
-                        scaffoldPathLength,
-                        (int64_t)_5EndStatusNerd, (int64_t)_3EndStatusNerd);
-            }
+        Sequence *sequence = segment_getSequence(segment);
+        if (sequence == NULL || !getSegmentAnnotation(segment, &annotation)) {
+            continue;
+        }
+        int64_t start = segment_getStart(segment);
+        if (!segment_getStrand(segment)) {
+            start -= segment_getLength(segment) - 1;
+        }
+        start -= sequence_getStart(sequence);
+        if (annotationTableIsBinary) {
+            appendBinaryInt(mafBuffer, getAnnotationTableSequenceIndex(sequence));
+            appendBinaryInt(mafBuffer, start);
+            appendBinaryInt(mafBuffer, start + segment_getLength(segment));
+            appendBinaryInt(mafBuffer, segment_getStrand(segment));
+            appendBinaryInt(mafBuffer, annotation.length);
+            appendBinaryInt(mafBuffer, annotation.scaffoldPathLength);
+            appendBinaryInt(mafBuffer, getSimpleCode(annotation._5EndStatusNerd));
+            appendBinaryInt(mafBuffer, getSimpleCode(annotation._3EndStatusNerd));
+            appendBinaryInt(mafBuffer, annotation._5EndStatusNerd);
+            appendBinaryInt(mafBuffer, annotation._3EndStatusNerd);
+        } else {
+            mafBuffer_appendSequenceName(mafBuffer, sequence);
+            mafBuffer_appendChar(mafBuffer, '\t');
+            mafBuffer_appendInt(mafBuffer, start);
+            mafBuffer_appendChar(mafBuffer, '\t');
+            mafBuffer_appendInt(mafBuffer, start + segment_getLength(segment));
+            mafBuffer_appendChar(mafBuffer, '\t');
+            mafBuffer_appendChar(mafBuffer, segment_getStrand(segment) ? '+' : '-');
+            mafBuffer_appendChar(mafBuffer, '\t');
+            mafBuffer_appendInt(mafBuffer, annotation.length);
+            mafBuffer_appendChar(mafBuffer, '\t');
+            mafBuffer_appendInt(mafBuffer, annotation.scaffoldPathLength);
+            mafBuffer_appendChar(mafBuffer, '\t');
+            mafBuffer_appendInt(mafBuffer, getSimpleCode(annotation._5EndStatusNerd));
+            mafBuffer_appendChar(mafBuffer, '\t');
+            mafBuffer_appendInt(mafBuffer, getSimpleCode(annotation._3EndStatusNerd));
+            mafBuffer_appendChar(mafBuffer, '\t');
+            mafBuffer_appendInt(mafBuffer, annotation._5EndStatusNerd);
+            mafBuffer_appendChar(mafBuffer, '\t');
+            mafBuffer_appendInt(mafBuffer, annotation._3EndStatusNerd);
+            mafBuffer_appendChar(mafBuffer, '\n');
         }
+        annotationTableRowNumber++;
     }
     block_destructInstanceIterator(instanceIt);
+    mafWriter_endRecord(annotationTableWriter);
+}
+
+static void writeAnnotationTable(void) {
+    annotationTableWriter = mafWriter_construct(outputFile, compressOutput, numberOfThreads);
+    annotationTableIsBinary = strcmp(annotationTableFormat, "binary") == 0;
+    annotationTableSequencesToIndices = stHash_construct2(NULL, (void (*)(void *)) stIntTuple_destruct);
+    annotationTableSequenceNames = stList_construct3(0, free);
+    MafBuffer *mafBuffer = mafWriter_getBuffer(annotationTableWriter);
+    if (annotationTableIsBinary) {
+        mafBuffer_append(mafBuffer, annotationTableMagic, 8);
+    } else {
+        mafBuffer_appendString(mafBuffer, "#sequence\tstart\tend\tstrand\tHPL\tSPL\t5\t3\t5NERD\t3NERD\n");
+    }
+    getMAFsReferenceOrdered(flower, NULL, writeAnnotationTableRows);
+    if (annotationTableIsBinary) {
+        mafBuffer = mafWriter_getBuffer(annotationTableWriter);
+        for (int64_t i = 0; i < stList_length(annotationTableSequenceNames); i++) {
+            const char *sequenceName = stList_get(annotationTableSequenceNames, i);
+            int64_t nameLength = strlen(sequenceName);
+            appendBinaryInt(mafBuffer, nameLength);
+            mafBuffer_append(mafBuffer, sequenceName, nameLength);
+            while (nameLength++ % 8 != 0) {
+                mafBuffer_appendChar(mafBuffer, '\0');
+            }
+        }
+        appendBinaryInt(mafBuffer, stList_length(annotationTableSequenceNames));
+        appendBinaryInt(mafBuffer, annotationTableRowNumber);
+    }
+    mafWriter_close(annotationTableWriter);
+    mafWriter_destruct(annotationTableWriter);
+    stHash_destruct(annotationTableSequencesToIndices);
+    stList_destruct(annotationTableSequenceNames);
+}
 
-    getMAFBlock(block, fileHandle);
+void getMAFBlock2(Block *block, FILE *fileHandle) {
+    /*
+     * Passes the block to the pipeline, which prints out the comment lines, then the maf block.
+     */
+    if (getNumberOnPositiveStrand(block) == 0) {
+        block = block_getReverse(block);
+    }
+    mafPipeline_addBlock(mafPipeline, block);
 }
 
 int main(int argc, char *argv[]) {
@@ -136,25 +281,45 @@ int main(int argc, char *argv[]) {
 
     haplotypeEventStrings = getEventStrings(hap1EventString, hap2EventString);
     contaminationEventStrings = getEventStrings(contaminationEventString, NULL);
-    stList *maximalHaplotypePaths = getContigPaths(flower, assemblyEventString, haplotypeEventStrings);
-    segmentsToMaximalHaplotypePaths = buildSegmentToContigPathHash(
-            maximalHaplotypePaths);
-    maximalHaplotypePathLengths
-            = buildContigPathToContigPathLengthHash(
-                    maximalHaplotypePaths);
-    maximalScaffoldPathsLengths = getContigPathToScaffoldPathLengthsHash(
-            maximalHaplotypePaths, haplotypeEventStrings, contaminationEventStrings, capCodeParameters);
+    //The paths of all the assemblies are put in the same table, so that one MAF is annotated for all of them.
+    contigPathTable = getContigPathTable(assemblyEventStrings, haplotypeEventStrings, contaminationEventStrings);
 
     ///////////////////////////////////////////////////////////////////////////
     // Now print the MAFs
     ///////////////////////////////////////////////////////////////////////////
 
     int64_t startTime = time(NULL);
-    FILE *fileHandle = fopen(outputFile, "w");
-    makeMAFHeader(flower, fileHandle);
-    getMAFsReferenceOrdered(flower, fileHandle, getMAFBlock2);
+    if (annotationTableFormat != NULL) {
+        writeAnnotationTable();
+        st_logInfo("Got the annotation table in %" PRIi64 " seconds/\n", time(NULL) - startTime);
+        return 0;
+    }
+    MafWriter *mafWriter = mafWriter_construct(outputFile, compressOutput, numberOfThreads);
+    MafIndex *mafIndex = NULL;
+    if (writeMafIndex) {
+        mafIndex = mafIndex_construct();
+    }
+    FILE *headerFileHandle = tmpfile();
+    makeMAFHeader(flower, headerFileHandle);
+    mafBuffer_appendFile(mafWriter_getBuffer(mafWriter), headerFileHandle);
+    fclose(headerFileHandle);
+    //The annotation only reads the contig path table and the segments of the loaded flowers, so it can
+    //be computed by the pipeline's worker threads. All the flowers are loaded first, as the table may
+    //have been mapped from its file without loading them, so the traversal does not load flowers
+    //while the workers read. The blocks are written through the pipeline, not the file handle.
+    loadFlowers(flower);
+    mafPipeline = mafPipeline_construct(mafWriter, mafIndex, numberOfThreads, annotateBlock);
+    getMAFsReferenceOrdered(flower, NULL, getMAFBlock2);
+    mafPipeline_destruct(mafPipeline);
 
-    fclose(fileHandle);
+    mafWriter_close(mafWriter);
+    if (mafIndex != NULL) {
+        char *indexFile = stString_print("%s.idx", outputFile);
+        mafIndex_write(mafIndex, mafWriter, indexFile);
+        free(indexFile);
+        mafIndex_destruct(mafIndex);
+    }
+    mafWriter_destruct(mafWriter);
     st_logInfo("Got the mafs in %" PRIi64 " seconds/\n", time(NULL) - startTime);
 
     return 0;
@@ -4,6 +4,8 @@
  * Released under the MIT license, see LICENSE.txt
  */
 
+#include <math.h>
+
 #include "cactus.h"
 #include "cactusMafs.h"
 #include "contigPaths.h"
@@ -11,333 +13,204 @@
 #include "adjacencyClassification.h"
 #include "scaffoldPaths.h"
 #include "assemblaCommon.h"
+#include "assemblaMetrics.h"
+#include "mafWriter.h"
 
-int64_t totalHapSwitches = 0;
-
-int64_t totalCleanEnds = 0;
-int64_t totalHangingEndWithsNs = 0;
-
-int64_t totalScaffoldGaps = 0;
-int64_t totalAmbiguityGaps = 0;
-
-int64_t totalHaplotypeLength = 0;
-
-int64_t totalErrorsHapToHapSameChromosome = 0;
-int64_t totalErrorsInterJoin = 0;
-int64_t totalErrorsHapToContamination = 0;
-int64_t totalErrorsHapToInsertToContamination = 0;
-int64_t totalErrorsInsertion = 0;
-int64_t totalErrorsDeleteion = 0;
-int64_t totalErrorsInsertionAndDeletion = 0;
-int64_t totalErrorsHangingInsertion = 0;
-stList *insertionDistribution = NULL;
-stList *deletionDistribution = NULL;
-
-void reportHaplotypePathStatsP(Cap *cap, stList *haplotypeEventStrings, stList *contaminationEventStrings, CapCodeParameters *capCodeParameters) {
-    int64_t insertLength, deleteLength;
-    Cap *otherCap;
-    switch (getCapCode(cap, &otherCap, haplotypeEventStrings, contaminationEventStrings, &insertLength, &deleteLength, capCodeParameters)) {
-        case HAP_SWITCH:
-            totalHapSwitches++;
-            return;
-        case HAP_NOTHING:
-            return;
-        case CONTIG_END:
-            totalCleanEnds++;
-            return;
-        case CONTIG_END_WITH_SCAFFOLD_GAP:
-        case CONTIG_END_WITH_AMBIGUITY_GAP:
-            totalHangingEndWithsNs++;
-            return;
-        case SCAFFOLD_GAP:
-            totalScaffoldGaps++;
-            return;
-        case AMBIGUITY_GAP:
-            totalAmbiguityGaps++;
-            return;
-        case ERROR_HAP_TO_HAP_SAME_CHROMOSOME:
-            totalErrorsHapToHapSameChromosome++;
-            return;
-        case ERROR_HAP_TO_HAP_DIFFERENT_CHROMOSOMES:
-            totalErrorsInterJoin++;
-            return;
-        case ERROR_HAP_TO_CONTAMINATION:
-            totalErrorsHapToContamination++;
-            return;
-        case ERROR_HAP_TO_INSERT_TO_CONTAMINATION:
-            totalErrorsHapToInsertToContamination++;
-            return;
-        case ERROR_HAP_TO_INSERT:
-            assert(insertLength > 0);
-            stList_append(insertionDistribution, stIntTuple_construct1( insertLength));
-            totalErrorsInsertion++;
-            return;
-        case ERROR_HAP_TO_DELETION:
-            assert(deleteLength > 0);
-            stList_append(deletionDistribution, stIntTuple_construct1( deleteLength));
-            totalErrorsDeleteion++;
-            return;
-        case ERROR_HAP_TO_INSERT_AND_DELETION:
-            assert(insertLength > 0);
-            assert(deleteLength > 0);
-            stList_append(insertionDistribution, stIntTuple_construct1( insertLength));
-            stList_append(deletionDistribution, stIntTuple_construct1( deleteLength));
-            totalErrorsInsertionAndDeletion++;
-            return;
-        case ERROR_CONTIG_END_WITH_INSERT:
-            totalErrorsHangingInsertion++;
-            return;
-    }
-}
-
-static int64_t totalPathLength = 0; //sum of all blocks containing haplotype and assembly.
-static stSortedSet *contigsSet;
-static stSortedSet *haplotypesSet;
-static stList *blockList;
-
-int compareSequences(const void *a, const void *b) {
-    return cactusMisc_nameCompare(sequence_getName((Sequence *) a), sequence_getName((Sequence *) b));
-}
-
-static int compareSequencesByLength(const void *a, const void *b) {
-    return sequence_getLength((Sequence *) b) - sequence_getLength((Sequence *) a);
-}
-
-static int compareBlocksByLength(const void *a, const void *b) {
-    return block_getLength((Block *) b) - block_getLength((Block *) a);
-}
-
-static stHash *maximalHaplotypePathToLength;
-
-static int64_t getHaplotypePathLength(const void *a) {
-    return stIntTuple_get(stHash_search(maximalHaplotypePathToLength, (void *) a), 0);
-}
-
-static int compareMaximalHaplotypePaths(const void *a, const void *b) {
-    return getHaplotypePathLength(b) - getHaplotypePathLength(a);
-}
-
-static stHash *maximalScaffoldPathToLength;
+/*
+ * The cap sites, written as they are found, and their counts for each contig.
+ *
+ * The cap sites file is a BED file with a header line, one line per site, in the order the blocks
+ * are visited, with the columns: contig, start, end (the base at the end of the segment), cap code,
+ * score (0), strand of the contig path, end of the segment in the path (5 or 3), insert length,
+ * delete length, haplotype sequence and position (. and -1 if the block has no haplotype).
+ *
+ * The contig summary is a tsv with a header line and, for each contig with sites in the order
+ * of their names: contig, length, the number of sites of each cap code, and the number of errors.
+ * Sites are counted at each path end, so an adjacency between two paths is counted twice.
+ */
 
-static int64_t getScaffoldPathLength(const void *a) {
-    return stIntTuple_get(stHash_search(maximalScaffoldPathToLength, (void *) a), 0);
+#define CAP_SITE_CODE_NUMBER 14
+
+static const enum CapCode capSiteCodes[CAP_SITE_CODE_NUMBER] = { HAP_SWITCH, SCAFFOLD_GAP, AMBIGUITY_GAP,
+        CONTIG_END, CONTIG_END_WITH_SCAFFOLD_GAP, CONTIG_END_WITH_AMBIGUITY_GAP, ERROR_HAP_TO_HAP_SAME_CHROMOSOME,
+        ERROR_HAP_TO_HAP_DIFFERENT_CHROMOSOMES, ERROR_HAP_TO_CONTAMINATION, ERROR_HAP_TO_INSERT_TO_CONTAMINATION,
+        ERROR_HAP_TO_INSERT, ERROR_HAP_TO_DELETION, ERROR_HAP_TO_INSERT_AND_DELETION, ERROR_CONTIG_END_WITH_INSERT };
+
+static const char *capSiteCodeNames[CAP_SITE_CODE_NUMBER] = { "HAP_SWITCH", "SCAFFOLD_GAP", "AMBIGUITY_GAP",
+        "CONTIG_END", "CONTIG_END_WITH_SCAFFOLD_GAP", "CONTIG_END_WITH_AMBIGUITY_GAP",
+        "ERROR_HAP_TO_HAP_SAME_CHROMOSOME", "ERROR_HAP_TO_HAP_DIFFERENT_CHROMOSOMES", "ERROR_HAP_TO_CONTAMINATION",
+        "ERROR_HAP_TO_INSERT_TO_CONTAMINATION", "ERROR_HAP_TO_INSERT", "ERROR_HAP_TO_DELETION",
+        "ERROR_HAP_TO_INSERT_AND_DELETION", "ERROR_CONTIG_END_WITH_INSERT" };
+
+//The first of the codes that are errors.
+static const int64_t firstErrorCapSiteCode = 6;
+
+typedef struct _contigSummary {
+    char *contigName;
+    int64_t contigLength;
+    int64_t counts[CAP_SITE_CODE_NUMBER];
+} ContigSummary;
+
+typedef struct _capSiteWriter {
+    FILE *fileHandle; //NULL if the sites are not written.
+    MafBuffer *line;
+    //From the contig names, NULL if the summary is not written. Keyed by name as each flower has its
+    //own Sequence objects for a contig.
+    stHash *contigSummaries;
+} CapSiteWriter;
+
+static void contigSummary_destruct(ContigSummary *contigSummary) {
+    free(contigSummary->contigName);
+    free(contigSummary);
 }
 
-static int compareScaffoldPaths(const void *a, const void *b) {
-    return getScaffoldPathLength(b) - getScaffoldPathLength(a);
+static int contigSummary_cmpFn(const void *a, const void *b) {
+    return strcmp(((const ContigSummary *) a)->contigName, ((const ContigSummary *) b)->contigName);
 }
 
-void accumulateBlock(Block *block, const char *assemblyEventString, stList *eventStrings) {
-    if (hasCapInEvents(block_get5End(block), eventStrings)) {
-        //genotypeLength += block_getLength(block);
-        if (hasCapInEvent(block_get5End(block), assemblyEventString)) {
-            stList_append(blockList, block);
-            totalPathLength += block_getLength(block);
+static int64_t getCapSiteCodeIndex(enum CapCode capCode) {
+    for (int64_t i = 0; i < CAP_SITE_CODE_NUMBER; i++) {
+        if (capSiteCodes[i] == capCode) {
+            return i;
         }
     }
-    Segment *segment;
-    Block_InstanceIterator *instanceIt = block_getInstanceIterator(block);
-    while ((segment = block_getNext(instanceIt)) != NULL) {
-        Sequence *sequence = segment_getSequence(segment);
-        assert(sequence != NULL);
-        if (strcmp(event_getHeader(segment_getEvent(segment)), assemblyEventString) == 0) {
-            stSortedSet_insert(contigsSet, sequence);
-        }
-        for(int64_t i=0; i<stList_length(eventStrings); i++) {
-            if(strcmp(event_getHeader(segment_getEvent(segment)), stList_get(eventStrings, i)) == 0) {
-                stSortedSet_insert(haplotypesSet, sequence);
-                break;
-            }
-        }
-        //assert(stList_length(eventStrings) == 2);
-        //if (strcmp(event_getHeader(segment_getEvent(segment)), stList_get(eventStrings, 0)) == 0 ||
-        //        strcmp(event_getHeader(segment_getEvent(segment)), stList_get(eventStrings, 1)) == 0) {
-        //    stSortedSet_insert(haplotypesSet, sequence);
-        //}
-    }
-    block_destructInstanceIterator(instanceIt);
+    st_errAbort("Unexpected cap code: %i", (int) capCode);
+    return -1;
 }
 
-void traverseBlocks(Flower *flower, const char *assemblyEventString, stList *eventStrings) {
-    Flower_GroupIterator *groupIt = flower_getGroupIterator(flower);
-    Group *group;
-    while ((group = flower_getNextGroup(groupIt)) != NULL) {
-        if (group_getNestedFlower(group) != NULL) {
-            traverseBlocks(group_getNestedFlower(group), assemblyEventString, eventStrings);
+static void writeCapSite(const CapSite *capSite, CapSiteWriter *capSiteWriter) {
+    int64_t i = getCapSiteCodeIndex(capSite->capCode);
+    MafBuffer *line = capSiteWriter->line;
+    if (capSiteWriter->fileHandle != NULL) {
+        mafBuffer_clear(line);
+        mafBuffer_appendSequenceName(line, capSite->sequence);
+        mafBuffer_appendChar(line, '\t');
+        mafBuffer_appendInt(line, capSite->position);
+        mafBuffer_appendChar(line, '\t');
+        mafBuffer_appendInt(line, capSite->position + 1);
+        mafBuffer_appendChar(line, '\t');
+        mafBuffer_appendString(line, capSiteCodeNames[i]);
+        mafBuffer_append(line, capSite->strand ? "\t0\t+\t" : "\t0\t-\t", 5);
+        mafBuffer_appendChar(line, capSite->_5End ? '5' : '3');
+        mafBuffer_appendChar(line, '\t');
+        mafBuffer_appendInt(line, capSite->insertLength);
+        mafBuffer_appendChar(line, '\t');
+        mafBuffer_appendInt(line, capSite->deleteLength);
+        mafBuffer_appendChar(line, '\t');
+        if (capSite->haplotypeSequence != NULL) {
+            mafBuffer_appendSequenceName(line, capSite->haplotypeSequence);
+        } else {
+            mafBuffer_appendChar(line, '.');
         }
+        mafBuffer_appendChar(line, '\t');
+        mafBuffer_appendInt(line, capSite->haplotypePosition);
+        mafBuffer_appendChar(line, '\n');
+        fwrite(line->string, sizeof(char), line->length, capSiteWriter->fileHandle);
     }
-    flower_destructGroupIterator(groupIt);
-
-    Flower_BlockIterator *blockIt = flower_getBlockIterator(flower);
-    Block *block;
-    while ((block = flower_getNextBlock(blockIt)) != NULL) {
-        accumulateBlock(block, assemblyEventString, eventStrings);
-    }
-    flower_destructBlockIterator(blockIt);
-}
-
-int64_t getN50(int64_t genomeLength, stList *objects, int64_t(*lengthFn)(const void *)) {
-    int64_t totalLength = 0;
-    int64_t pJ = INT64_MAX;
-    for (int64_t i = 0; i < stList_length(objects); i++) {
-        int64_t j = lengthFn(stList_get(objects, i));
-        assert(j <= pJ);
-        pJ = j;
-        totalLength += j;
-        if (totalLength >= genomeLength / 2) {
-            return j;
+    if (capSiteWriter->contigSummaries != NULL) {
+        mafBuffer_clear(line);
+        mafBuffer_appendSequenceName(line, capSite->sequence);
+        mafBuffer_appendChar(line, '\0');
+        ContigSummary *contigSummary = stHash_search(capSiteWriter->contigSummaries, line->string);
+        if (contigSummary == NULL) {
+            contigSummary = st_calloc(1, sizeof(ContigSummary));
+            contigSummary->contigName = stString_copy(line->string);
+            contigSummary->contigLength = sequence_getLength(capSite->sequence);
+            stHash_insert(capSiteWriter->contigSummaries, contigSummary->contigName, contigSummary);
         }
+        contigSummary->counts[i]++;
     }
-    return -1; //this should not happen!
 }
 
-stList *getScaffoldPathsList(stList *maximalHaplotypePaths, stList *haplotypeEventStrings, stList *contaminationEventStrings,CapCodeParameters *capCodeParameters) {
-    stHash *scaffoldPaths = getScaffoldPaths(maximalHaplotypePaths, haplotypeEventStrings, contaminationEventStrings,capCodeParameters);
-    stSortedSet *bucketSet = stSortedSet_construct();
-    stList *scaffoldPaths2 = stList_construct();
-    stHashIterator *hashIt = stHash_getIterator(scaffoldPaths);
-    stList *haplotypePath;
-    while ((haplotypePath = stHash_getNext(hashIt)) != NULL) {
-        assert(stList_length(haplotypePath) > 0);
-        stSortedSet *bucket = stHash_search(scaffoldPaths, haplotypePath);
-        assert(bucket != NULL);
-        if (stSortedSet_search(bucketSet, bucket) == NULL) {
-            stSortedSet_insert(bucketSet, bucket);
-            stList_append(scaffoldPaths2, haplotypePath);
-        }
+static void writeContigSummary(stHash *contigSummaries, const char *fileName) {
+    FILE *fileHandle = fopen(fileName, "w");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the contig summary file %s", fileName);
     }
-    stHash_destructIterator(hashIt);
-    stSortedSet_destruct(bucketSet);
-    return scaffoldPaths2;
-}
-
-char *concatenateList(stList *list) {
-    char **cAA = st_malloc(sizeof(char *) * (stList_length(list)/2));
-    stList_sort(list, (int (*)(const void *, const void *))stIntTuple_cmpFn);
-    assert(stList_length(list) % 2 == 0);
-    for (int64_t i = 0; i < stList_length(list); i+=2) {
-        assert(stIntTuple_get(stList_get(list, i), 0) == stIntTuple_get(stList_get(list, i+1), 0));
-        cAA[i/2] = stString_print("%" PRIi64 "", stIntTuple_get(stList_get(list, i), 0));
+    fprintf(fileHandle, "#contig\tlength");
+    for (int64_t i = 0; i < CAP_SITE_CODE_NUMBER; i++) {
+        fprintf(fileHandle, "\t%s", capSiteCodeNames[i]);
     }
-    char *cA = stString_join(" ", (const char **)cAA, stList_length(list)/2);
-    for (int64_t i = 0; i < stList_length(list)/2; i++) {
-        free(cAA[i]);
+    fprintf(fileHandle, "\terrors\n");
+    stList *contigSummaryList = stHash_getValues(contigSummaries);
+    stList_sort(contigSummaryList, contigSummary_cmpFn);
+    for (int64_t i = 0; i < stList_length(contigSummaryList); i++) {
+        ContigSummary *contigSummary = stList_get(contigSummaryList, i);
+        fprintf(fileHandle, "%s\t%" PRIi64 "", contigSummary->contigName, contigSummary->contigLength);
+        int64_t errors = 0;
+        for (int64_t j = 0; j < CAP_SITE_CODE_NUMBER; j++) {
+            fprintf(fileHandle, "\t%" PRIi64 "", contigSummary->counts[j]);
+            errors += j >= firstErrorCapSiteCode ? contigSummary->counts[j] : 0;
+        }
+        fprintf(fileHandle, "\t%" PRIi64 "\n", errors);
     }
-    free(cAA);
-    return cA;
+    stList_destruct(contigSummaryList);
+    fclose(fileHandle);
 }
 
-void reportSamplePathStats(Flower *flower, FILE *fileHandle,
-        const char *assemblyEventString,
-        stList *haplotypeEventStrings, stList *contaminationEventStrings, CapCodeParameters *capCodeParameters) {
+void reportSamplePathStats(PathStats *pathStats, FILE *fileHandle, const char *rowFileName) {
     /*
-     * Gets stats on the maximal haplotype paths.
+     * Prints the stats on the maximal haplotype paths.
      */
-
-    stList *maximalHaplotypePaths = getContigPaths(flower, assemblyEventString, haplotypeEventStrings);
-    maximalHaplotypePathToLength = buildContigPathToContigPathLengthHash(maximalHaplotypePaths);
-    maximalScaffoldPathToLength = getContigPathToScaffoldPathLengthsHash(maximalHaplotypePaths, haplotypeEventStrings, contaminationEventStrings, capCodeParameters);
-
-    //initialise the global arrays
-    insertionDistribution = stList_construct3(0, (void(*)(void *)) stIntTuple_destruct);
-    deletionDistribution = stList_construct3(0, (void(*)(void *)) stIntTuple_destruct);
-
-    for (int64_t i = 0; i < stList_length(maximalHaplotypePaths); i++) {
-        stList *maximalHaplotypePath = stList_get(maximalHaplotypePaths, i);
-        totalHaplotypeLength += contigPathLength(maximalHaplotypePath);
-        for (int64_t j = 0; j < stList_length(maximalHaplotypePath); j++) {
-            Segment *segment = stList_get(maximalHaplotypePath, j);
-            reportHaplotypePathStatsP(segment_get5Cap(segment), haplotypeEventStrings, contaminationEventStrings, capCodeParameters);
-            reportHaplotypePathStatsP(segment_get3Cap(segment), haplotypeEventStrings, contaminationEventStrings, capCodeParameters);
+    pathStats_writeXML(pathStats, fileHandle);
+
+    if (rowFileName != NULL) {
+        MetricsRow *metricsRow = metricsRow_construct();
+        metricsRow_addInt(metricsRow, "totalHaplotypeSwitches", pathStats->totalHaplotypeSwitches);
+        metricsRow_addInt(metricsRow, "totalScaffoldGaps", pathStats->totalScaffoldGaps);
+        metricsRow_addInt(metricsRow, "totalAmbiguityGaps", pathStats->totalAmbiguityGaps);
+        metricsRow_addInt(metricsRow, "totalContigEnds", pathStats->totalContigEnds);
+        metricsRow_addInt(metricsRow, "totalContigEndsWithNs", pathStats->totalContigEndsWithNs);
+        metricsRow_addInt(metricsRow, "totalErrorsHaplotypeToHaplotypeSameChromosome",
+                pathStats->totalErrorsHaplotypeToHaplotypeSameChromosome);
+        metricsRow_addInt(metricsRow, "totalErrorsHaplotypeToHaplotypeDifferentChromosome",
+                pathStats->totalErrorsHaplotypeToHaplotypeDifferentChromosome);
+        metricsRow_addInt(metricsRow, "totalErrorsHaplotypeToContamination", pathStats->totalErrorsHaplotypeToContamination);
+        metricsRow_addInt(metricsRow, "totalErrorsHaplotypeToInsertionToContamination",
+                pathStats->totalErrorsHaplotypeToInsertionToContamination);
+        metricsRow_addInt(metricsRow, "totalErrorsHaplotypeToInsertion", pathStats->totalErrorsHaplotypeToInsertion);
+        metricsRow_addInt(metricsRow, "totalErrorsHaplotypeToDeletion", pathStats->totalErrorsHaplotypeToDeletion);
+        metricsRow_addInt(metricsRow, "totalErrorsHaplotypeToInsertionAndDeletion",
+                pathStats->totalErrorsHaplotypeToInsertionAndDeletion);
+        metricsRow_addInt(metricsRow, "totalErrorsContigEndsWithInsert", pathStats->totalErrorsContigEndsWithInsert);
+        metricsRow_addInt(metricsRow, "totalErrors", pathStats->totalErrors);
+        metricsRow_addInt(metricsRow, "totalPathLength", pathStats->totalPathLength);
+        metricsRow_addInt(metricsRow, "genotypeLength", pathStats->genotypeLength);
+        metricsRow_addInt(metricsRow, "totalContigsLength", pathStats->totalContigsLength);
+        metricsRow_addDouble(metricsRow, "coverage", pathStats->coverage);
+        metricsRow_addInt(metricsRow, "blockNG50", pathStats->blockNG50);
+        metricsRow_addInt(metricsRow, "contigN50", pathStats->contigN50);
+        metricsRow_addInt(metricsRow, "contigNG50", pathStats->contigNG50);
+        metricsRow_addInt(metricsRow, "contigPathNG50", pathStats->contigPathNG50);
+        metricsRow_addInt(metricsRow, "scaffoldPathNG50", pathStats->scaffoldPathNG50);
+        metricsRow_addInt(metricsRow, "totalBlockNumber", pathStats->totalBlockNumber);
+        metricsRow_addInt(metricsRow, "totalContigNumber", pathStats->totalContigNumber);
+        metricsRow_addInt(metricsRow, "totalHaplotypePaths", pathStats->totalHaplotypePaths);
+        metricsRow_addInt(metricsRow, "totalScaffoldPaths", pathStats->totalScaffoldPaths);
+        metricsRow_addDouble(metricsRow, "errorsPerContig", pathStats->errorsPerContig);
+        metricsRow_addDouble(metricsRow, "errorsPerMappedBase", pathStats->errorsPerMappedBase);
+        char *insertionDistributionString = pathStats_getErrorSizeDistribution(pathStats->insertionErrorSizes,
+                pathStats->insertionErrorSizeNumber);
+        char *deletionDistributionString = pathStats_getErrorSizeDistribution(pathStats->deletionErrorSizes,
+                pathStats->deletionErrorSizeNumber);
+        metricsRow_addString(metricsRow, "insertionErrorSizeDistribution", insertionDistributionString);
+        metricsRow_addString(metricsRow, "deletionErrorSizeDistribution", deletionDistributionString);
+        free(insertionDistributionString);
+        free(deletionDistributionString);
+        arena_report(pathStats->arena, metricsRow);
+        if (pathStats->sampleFraction < 1.0) {
+            metricsRow_addDouble(metricsRow, "sampleFraction", pathStats->sampleFraction);
+            metricsRow_addDouble(metricsRow, "totalPathLength.standardError", pathStats->totalPathLengthStandardError);
+            metricsRow_addDouble(metricsRow, "totalBlockNumber.standardError", pathStats->totalBlockNumberStandardError);
+            metricsRow_addDouble(metricsRow, "coverage.standardError", pathStats->coverageStandardError);
         }
+        metricsRow_write(metricsRow, rowFileName);
+        metricsRow_destruct(metricsRow);
     }
 
-    blockList = stList_construct();
-    contigsSet = stSortedSet_construct3(compareSequences, NULL);
-    haplotypesSet = stSortedSet_construct3(compareSequences, NULL);
-
-    traverseBlocks(flower, assemblyEventString, haplotypeEventStrings);
-
-    stList *sequences = stSortedSet_getList(contigsSet);
-    stList *haplotypes = stSortedSet_getList(haplotypesSet);
-    stList_sort(blockList, compareBlocksByLength);
-    stList_sort(sequences, compareSequencesByLength);
-    stList_sort(maximalHaplotypePaths, compareMaximalHaplotypePaths);
-    stList *scaffoldPaths = getScaffoldPathsList(maximalHaplotypePaths, haplotypeEventStrings, contaminationEventStrings, capCodeParameters);
-    stList_sort(scaffoldPaths, compareScaffoldPaths);
-
-    int64_t totalSequencesLength = 0;
-    for (int64_t i = 0; i < stList_length(sequences); i++) {
-        totalSequencesLength += sequence_getLength(stList_get(sequences, i));
-    }
-
-    int64_t averageHaplotypeLength = 0; //average length of the two haplotypes.
-    for (int64_t i = 0; i < stList_length(haplotypes); i++) {
-        averageHaplotypeLength += sequence_getLength(stList_get(haplotypes, i));
+    if (rowFileName == NULL) {
+        arena_report(pathStats->arena, NULL);
     }
-    averageHaplotypeLength /= stList_length(haplotypeEventStrings);
-
-    int64_t totalBlockNumber = stList_length(blockList);
-    int64_t blockNG50 = getN50(averageHaplotypeLength, blockList, (int64_t(*)(const void *)) block_getLength);
-    int64_t contigN50 = getN50(totalSequencesLength, sequences, (int64_t(*)(const void *)) sequence_getLength); //length of contig which appears in order (from longest to shortest) at 50% coverage.
-    int64_t contigNG50 = getN50(averageHaplotypeLength, sequences, (int64_t(*)(const void *)) sequence_getLength); //length of contig which appears in order (from longest to shortest) at 50% coverage.
-    int64_t haplotypePathNG50 = getN50(averageHaplotypeLength, maximalHaplotypePaths, getHaplotypePathLength); //length of maximal haplotype path which appears in order (from longest to shortest) at 50% coverage.
-    int64_t scaffoldPathNG50 = getN50(averageHaplotypeLength, scaffoldPaths, getScaffoldPathLength); //length of maximal scaffold path which appears in order (from longest to shortest) at 50% coverage.
-
-    int64_t totalContigNumber = stSortedSet_size(contigsSet); //number of contigs
-    int64_t totalHaplotypePaths = stList_length(maximalHaplotypePaths); //number of haplotype paths
-    int64_t totalScaffoldPaths = stList_length(scaffoldPaths); //number of scaffold paths
-
-    int64_t totalErrors = totalErrorsHapToHapSameChromosome / 2 + totalErrorsInterJoin / 2
-            + totalErrorsHapToContamination + totalErrorsHapToInsertToContamination + totalErrorsInsertion / 2
-            + totalErrorsDeleteion / 2 + totalErrorsInsertionAndDeletion / 2 + totalErrorsHangingInsertion;
-
-    double errorsPerContig = ((double) totalErrors) / totalContigNumber; //number of errors / number of contigs
-    double errorsPerMappedBase = ((double) totalErrors) / totalPathLength; //number of errors / total path length
-    double coverage = ((double) totalPathLength) / averageHaplotypeLength; //totalPathLength/genotypeLength
-
-
-    assert(totalErrorsHapToHapSameChromosome % 2 == 0);
-    assert(totalErrorsInterJoin % 2 == 0);
-    assert(totalErrorsInsertion % 2 == 0);
-    assert(totalErrorsDeleteion % 2 == 0);
-    assert(totalErrorsInsertionAndDeletion % 2 == 0);
-    assert(totalScaffoldGaps % 2 == 0);
-    assert(totalAmbiguityGaps % 2 == 0);
-
-    char *insertionDistributionString = concatenateList(insertionDistribution);
-    char *deletionDistributionString = concatenateList(deletionDistribution);
-
-    fprintf(fileHandle, "<stats totalHaplotypeSwitches=\"%" PRIi64 "\" "
-        "totalScaffoldGaps=\"%" PRIi64 "\" "
-        "totalAmbiguityGaps=\"%" PRIi64 "\" "
-        "totalContigEnds=\"%" PRIi64 "\" "
-        "totalContigEndsWithNs=\"%" PRIi64 "\" "
-        "totalErrorsHaplotypeToHaplotypeSameChromosome=\"%" PRIi64 "\" "
-        "totalErrorsHaplotypeToHaplotypeDifferentChromosome=\"%" PRIi64 "\" "
-        "totalErrorsHaplotypeToContamination=\"%" PRIi64 "\" "
-        "totalErrorsHaplotypeToInsertionToContamination=\"%" PRIi64 "\" "
-        "totalErrorsHaplotypeToInsertion=\"%" PRIi64 "\" "
-        "totalErrorsHaplotypeToDeletion=\"%" PRIi64 "\" "
-        "totalErrorsHaplotypeToInsertionAndDeletion=\"%" PRIi64 "\" "
-        "totalErrorsContigEndsWithInsert=\"%" PRIi64 "\" "
-        "totalErrors=\"%" PRIi64 "\" totalPathLength=\"%" PRIi64 "\" genotypeLength=\"%" PRIi64 "\" "
-        "totalContigsLength=\"%" PRIi64 "\" coverage=\"%f\" blockNG50=\"%" PRIi64 "\" contigN50=\"%" PRIi64 "\" "
-        "contigNG50=\"%" PRIi64 "\" contigPathNG50=\"%" PRIi64 "\" scaffoldPathNG50=\"%" PRIi64 "\" totalBlockNumber=\"%" PRIi64 "\" "
-        "totalContigNumber=\"%" PRIi64 "\" totalHaplotypePaths=\"%" PRIi64 "\" totalScaffoldPaths=\"%" PRIi64 "\" "
-        "errorsPerContig=\"%f\" errorsPerMappedBase=\"%f\" "
-        "insertionErrorSizeDistribution=\"%s\" "
-        "deletionErrorSizeDistribution=\"%s\"/>", totalHapSwitches / 2,
-            totalScaffoldGaps / 2, totalAmbiguityGaps / 2, totalCleanEnds,
-            totalHangingEndWithsNs, totalErrorsHapToHapSameChromosome / 2, totalErrorsInterJoin / 2,
-            totalErrorsHapToContamination, totalErrorsHapToInsertToContamination, totalErrorsInsertion / 2,
-            totalErrorsDeleteion / 2, totalErrorsInsertionAndDeletion / 2, totalErrorsHangingInsertion,
-            totalErrors, totalPathLength, averageHaplotypeLength, totalSequencesLength, coverage, blockNG50, contigN50,
-            contigNG50, haplotypePathNG50, scaffoldPathNG50, totalBlockNumber, totalContigNumber, totalHaplotypePaths,
-            totalScaffoldPaths, errorsPerContig, errorsPerMappedBase,
-            insertionDistributionString, deletionDistributionString);
-
-    stList_destruct(maximalHaplotypePaths);
 }
 
 int main(int argc, char *argv[]) {
@@ -352,15 +225,55 @@ int main(int argc, char *argv[]) {
     ///////////////////////////////////////////////////////////////////////////
 
     int64_t startTime = time(NULL);
-    FILE *fileHandle = fopen(outputFile, "w");
 
-    assert(!(treatHaplotype1AsContamination && treatHaplotype2AsContamination));
+    AssemblaParameters parameters;
+    assemblaParameters_setFromArguments(&parameters);
+    AssemblaContext *context = assemblaContext_constructFromArguments();
 
-    stList *haplotypeEventStrings = getEventStrings(treatHaplotype1AsContamination ? NULL : hap1EventString, treatHaplotype2AsContamination ? NULL : hap2EventString);
-    stList *contaminationEventStrings = getEventStrings(contaminationEventString, treatHaplotype1AsContamination ? hap1EventString : (treatHaplotype2AsContamination ? hap2EventString : NULL));
+    CapSiteWriter capSiteWriter;
+    capSiteWriter.line = mafBuffer_construct();
+    if (capSitesFile != NULL || contigSummaryFile != NULL) {
+        parameters.capSiteFn = (void (*)(const CapSite *, void *)) writeCapSite;
+        parameters.capSiteExtraArg = &capSiteWriter;
+    }
 
-    reportSamplePathStats(flower, fileHandle, assemblyEventString, haplotypeEventStrings, contaminationEventStrings, capCodeParameters);
-    fclose(fileHandle);
+    //The flowers are loaded once, and the stats of each assembly are then calculated in turn.
+    for (int64_t i = 0; i < stList_length(assemblyEventStrings); i++) {
+        const char *eventString = stList_get(assemblyEventStrings, i);
+        char *assemblyOutputFile = getAssemblyFileName(outputFile, eventString);
+        char *assemblyMetricsRowFile = metricsRowFile != NULL ? getAssemblyFileName(metricsRowFile, eventString) : NULL;
+        capSiteWriter.fileHandle = NULL;
+        if (capSitesFile != NULL) {
+            char *assemblyCapSitesFile = getAssemblyFileName(capSitesFile, eventString);
+            capSiteWriter.fileHandle = fopen(assemblyCapSitesFile, "w");
+            if (capSiteWriter.fileHandle == NULL) {
+                st_errAbort("Could not open the cap sites file %s", assemblyCapSitesFile);
+            }
+            fprintf(capSiteWriter.fileHandle, "#contig\tstart\tend\tcapCode\tscore\tstrand\tpathEnd\tinsertLength"
+                    "\tdeleteLength\thaplotype\thaplotypePosition\n");
+            free(assemblyCapSitesFile);
+        }
+        capSiteWriter.contigSummaries = contigSummaryFile != NULL ? stHash_construct3(stHash_stringKey,
+                stHash_stringEqualKey, NULL, (void (*)(void *)) contigSummary_destruct) : NULL;
+        PathStats *pathStats = assemblaMetrics_getPathStats(context, &parameters, eventString);
+        if (capSiteWriter.fileHandle != NULL) {
+            fclose(capSiteWriter.fileHandle);
+        }
+        if (capSiteWriter.contigSummaries != NULL) {
+            char *assemblyContigSummaryFile = getAssemblyFileName(contigSummaryFile, eventString);
+            writeContigSummary(capSiteWriter.contigSummaries, assemblyContigSummaryFile);
+            free(assemblyContigSummaryFile);
+            stHash_destruct(capSiteWriter.contigSummaries);
+        }
+        FILE *fileHandle = fopen(assemblyOutputFile, "w");
+        reportSamplePathStats(pathStats, fileHandle, assemblyMetricsRowFile);
+        fclose(fileHandle);
+        pathStats_destruct(pathStats);
+        free(assemblyOutputFile);
+        free(assemblyMetricsRowFile);
+    }
+    mafBuffer_destruct(capSiteWriter.line);
+    assemblaContext_destruct(context);
     st_logInfo("Got the stats in %" PRIi64 " seconds/\n", time(NULL) - startTime);
 
     return 0;
@@ -5,6 +5,7 @@
  */
 
 #include <ctype.h>
+#include <math.h>
 
 #include "sonLib.h"
 #include "cactus.h"
@@ -12,45 +13,48 @@
 #include "adjacencyClassification.h"
 #include "scaffoldPaths.h"
 #include "assemblaCommon.h"
+#include "assemblaMetrics.h"
 #include "cactusMafs.h"
 
-int64_t totalSites = 0;
-double totalCorrect = 0;
-int64_t totalErrors = 0;
-int64_t totalCalls = 0;
-
-int64_t totalHeterozygous = 0;
-double totalCorrectInHeterozygous = 0;
-int64_t totalErrorsInHeterozygous = 0;
-int64_t totalCallsInHeterozygous = 0;
-
-int64_t totalCorrectHap1InHeterozygous = 0;
-int64_t totalCorrectHap2InHeterozygous = 0;
-
-int64_t totalInOneHaplotypeOnly = 0;
-double totalCorrectInOneHaplotype = 0;
-int64_t totalErrorsInOneHaplotype = 0;
-int64_t totalCallsInOneHaplotype = 0;
-
-stList *indelPositions = NULL;
-stList *hetPositions = NULL;
-
-typedef struct _segmentHolder {
-    Segment *segment;
-    int64_t offset;
-    char base1;
-    char base2;
-    char base3;
-} SegmentHolder;
+static void writeSubstitutionShard(SubstitutionStats *counts, const char *fileName) {
+    /*
+     * Writes the counts and sampled totals of the shard.
+     */
+    FILE *fileHandle = shardFile_construct(fileName, "snpStats");
+    double totals[SUBSTITUTION_TOTAL_NUMBER];
+    substitutionStats_getTotals(counts, totals);
+    for (int64_t i = 0; i < SUBSTITUTION_TOTAL_NUMBER; i++) {
+        fprintf(fileHandle, "total\t%" PRIi64 "\t%.17g\n", i, totals[i]);
+        if (counts->sampledTotals != NULL) {
+            fprintf(fileHandle, "sampledTotal\t%" PRIi64 "\t%.17g\t%.17g\n", i, counts->sampledTotals[i].sum,
+                    counts->sampledTotals[i].sumOfSquares);
+        }
+    }
+    fclose(fileHandle);
+}
 
-SegmentHolder *segmentHolder_construct(Segment *segment, int64_t offset, char base1, char base2, char base3) {
-    SegmentHolder *segmentHolder = st_malloc(sizeof(SegmentHolder));
-    segmentHolder->segment = segment;
-    segmentHolder->offset = offset;
-    segmentHolder->base1 = base1;
-    segmentHolder->base2 = base2;
-    segmentHolder->base3 = base3;
-    return segmentHolder;
+static void readSubstitutionShard(FILE *fileHandle, const char *fileName, SubstitutionStats *counts) {
+    /*
+     * Adds the counts of a shard file to those of the assembly.
+     */
+    double totals[SUBSTITUTION_TOTAL_NUMBER];
+    substitutionStats_getTotals(counts, totals);
+    char type[20];
+    while (fscanf(fileHandle, "%19s", type) == 1) {
+        int64_t i;
+        double total, sumOfSquares;
+        if (strcmp(type, "total") == 0 && fscanf(fileHandle, "%" PRIi64 " %lf", &i, &total) == 2 && i >= 0
+                && i < SUBSTITUTION_TOTAL_NUMBER) {
+            totals[i] += total;
+        } else if (strcmp(type, "sampledTotal") == 0 && counts->sampledTotals != NULL && fscanf(fileHandle,
+                "%" PRIi64 " %lf %lf", &i, &total, &sumOfSquares) == 3 && i >= 0 && i < SUBSTITUTION_TOTAL_NUMBER) {
+            counts->sampledTotals[i].sum += total;
+            counts->sampledTotals[i].sumOfSquares += sumOfSquares;
+        } else {
+            st_errAbort("The shard file %s is malformed", fileName);
+        }
+    }
+    substitutionStats_setTotals(counts, totals);
 }
 
 void printPositions(stList *positions, const char *substitutionType, FILE *fileHandle) {
@@ -80,159 +84,6 @@ void printPositions(stList *positions, const char *substitutionType, FILE *fileH
     }
 }
 
-static void getSnpStats(Block *block, FILE *fileHandle) {
-    if (block_getLength(block) >= minimumBlockLength) {
-        //Now get the column
-        Block_InstanceIterator *instanceIterator = block_getInstanceIterator(block);
-        Segment *segment;
-        char *hap1Seq = NULL;
-        char *hap2Seq = NULL;
-        char *assemblySeq = NULL;
-        Segment *hap1Segment = NULL;
-        Segment *hap2Segment = NULL;
-        while ((segment = block_getNext(instanceIterator)) != NULL) {
-            if (strcmp(event_getHeader(segment_getEvent(segment)), hap1EventString) == 0) {
-                if (hap1Seq != NULL) {
-                    goto end;
-                }
-                hap1Seq = segment_getString(segment);
-                hap1Segment = segment;
-            }
-            if (strcmp(event_getHeader(segment_getEvent(segment)), hap2EventString) == 0) {
-                if (hap2Seq != NULL) {
-                    goto end;
-                }
-                hap2Seq = segment_getString(segment);
-                hap2Segment = segment;
-            }
-            if (strcmp(event_getHeader(segment_getEvent(segment)), assemblyEventString) == 0) {
-                if (assemblySeq != NULL) {
-                    goto end;
-                }
-                assemblySeq = segment_getString(segment);
-            }
-        }
-
-        assert(minimumIndentity >= 0);
-        assert(minimumIndentity <= 100);
-        if (hap1Seq != NULL || hap2Seq != NULL) {
-            if (hap1Seq != NULL) {
-                assert(strlen(hap1Seq) == block_getLength(block));
-            }
-            if (hap2Seq != NULL) {
-                assert(strlen(hap2Seq) == block_getLength(block));
-            }
-            if (assemblySeq != NULL) {
-                assert(strlen(assemblySeq) == block_getLength(block));
-            }
-            double homoMatches = 0;
-            double matches = 0;
-            for (int64_t i = ignoreFirstNBasesOfBlock; i < block_getLength(block) - ignoreFirstNBasesOfBlock; i++) {
-                if (hap1Seq != NULL && hap2Seq != NULL) {
-                    if (toupper(hap1Seq[i]) == toupper(hap2Seq[i])) {
-                        homoMatches++;
-                    }
-                } else {
-                    homoMatches = INT64_MAX;
-                }
-                if (assemblySeq != NULL) {
-                    if (hap1Seq != NULL) {
-                        if (hap2Seq != NULL) {
-                            if (toupper(hap1Seq[i]) == toupper(hap2Seq[i]) && toupper(hap1Seq[i]) == toupper(
-                                    assemblySeq[i])) {
-                                matches++;
-                            }
-                        } else {
-                            if (toupper(hap1Seq[i]) == toupper(assemblySeq[i])) {
-                                matches++;
-                            }
-                        }
-                    } else {
-                        assert(hap2Seq != NULL);
-                        if (toupper(hap2Seq[i]) == toupper(assemblySeq[i])) {
-                            matches++;
-                        }
-                    }
-                } else {
-                    matches = INT64_MAX;
-                }
-            }
-            double homoIdentity = 100.0 * homoMatches / (block_getLength(block) - 2.0 * ignoreFirstNBasesOfBlock);
-            double identity = 100.0 * matches / (block_getLength(block) - 2.0 * ignoreFirstNBasesOfBlock);
-
-            if (homoIdentity >= minimumIndentity && identity >= minimumIndentity) {
-                //We're in gravy.
-                for (int64_t i = ignoreFirstNBasesOfBlock; i < block_getLength(block) - ignoreFirstNBasesOfBlock; i++) {
-
-                    if (hap1Seq != NULL) {
-                        if (hap2Seq != NULL) {
-                            if (toupper(hap1Seq[i]) == toupper(hap2Seq[i])) {
-                                totalSites++;
-                                if (assemblySeq != NULL) {
-                                    totalCorrect += bitsScoreFn(assemblySeq[i], hap1Seq[i]);
-                                    totalErrors += correctFn(assemblySeq[i], hap1Seq[i]) ? 0 : 1;
-                                    totalCalls++;
-                                }
-                            } else {
-                                totalHeterozygous++;
-                                if (assemblySeq != NULL) {
-                                    assert(toupper(hap1Seq[i]) != toupper(hap2Seq[i]));
-                                    totalCorrectInHeterozygous += bitsScoreFn(assemblySeq[i], hap1Seq[i]);
-                                    totalCorrectHap1InHeterozygous += bitsScoreFn(assemblySeq[i], hap1Seq[i]);
-                                    totalCorrectInHeterozygous += bitsScoreFn(assemblySeq[i], hap2Seq[i]);
-                                    totalCorrectHap2InHeterozygous += bitsScoreFn(assemblySeq[i], hap2Seq[i]);
-                                    totalErrorsInHeterozygous += (correctFn(assemblySeq[i], hap1Seq[i]) || correctFn(
-                                            assemblySeq[i], hap2Seq[i])) ? 0 : 1;
-                                    totalCallsInHeterozygous++;
-                                    if (!(correctFn(assemblySeq[i], hap1Seq[i])
-                                            || correctFn(assemblySeq[i], hap2Seq[i]))) {
-                                        stList_append(hetPositions, segmentHolder_construct(hap1Segment, i, assemblySeq[i], hap1Seq[i], hap2Seq[i]));
-                                    }
-                                }
-                            }
-                        } else {
-                            totalInOneHaplotypeOnly++;
-                            if (assemblySeq != NULL) {
-                                totalCorrectInOneHaplotype += bitsScoreFn(assemblySeq[i], hap1Seq[i]);
-                                totalErrorsInOneHaplotype += correctFn(assemblySeq[i], hap1Seq[i]) ? 0 : 1;
-                                totalCallsInOneHaplotype++;
-                                if (!correctFn(assemblySeq[i], hap1Seq[i])) {
-                                    stList_append(indelPositions, segmentHolder_construct(hap1Segment, i, assemblySeq[i], hap1Seq[i], 'N'));
-                                }
-                            }
-                        }
-                    } else {
-                        if (hap2Seq != NULL) {
-                            totalInOneHaplotypeOnly++;
-                            if (assemblySeq != NULL) {
-                                totalCorrectInOneHaplotype += bitsScoreFn(assemblySeq[i], hap2Seq[i]);
-                                totalErrorsInOneHaplotype += correctFn(assemblySeq[i], hap2Seq[i]) ? 0 : 1;
-                                totalCallsInOneHaplotype++;
-                                if (!correctFn(assemblySeq[i], hap2Seq[i])) {
-                                    stList_append(indelPositions, segmentHolder_construct(hap2Segment, i, assemblySeq[i], 'N', hap2Seq[i]));
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-
-        end:
-        //cleanup
-        if (hap1Seq != NULL) {
-            free(hap1Seq);
-        }
-        if (hap2Seq != NULL) {
-            free(hap2Seq);
-        }
-        if (assemblySeq != NULL) {
-            free(assemblySeq);
-        }
-        block_destructInstanceIterator(instanceIterator);
-    }
-}
-
 int main(int argc, char *argv[]) {
 
     assert(correctFn('Y', 'C'));
@@ -254,50 +105,104 @@ int main(int argc, char *argv[]) {
     //Parse the inputs
     //////////////////////////////////////////////
 
+    shardsSupported = 1;
     parseBasicArguments(argc, argv, "snpStats");
+    if ((shardNumber > 1 || shardFiles != NULL) && (printIndelPositions || printHetPositions)) {
+        st_errAbort("The positions can not be printed when run in shards");
+    }
 
     ///////////////////////////////////////////////////////////////////////////
     // Calculate and print to file a crap load of numbers.
     ///////////////////////////////////////////////////////////////////////////
 
-    indelPositions = stList_construct3(0, NULL);
-    hetPositions = stList_construct3(0, NULL);
-    FILE *fileHandle = fopen(outputFile, "w");
-    getMAFs(flower, fileHandle, getSnpStats);
+    AssemblaParameters parameters;
+    assemblaParameters_setFromArguments(&parameters);
+    int64_t assemblyNumber = stList_length(assemblyEventStrings);
+    stList *substitutionStats;
+    if (shardFiles != NULL) {
+        //Merge the counts of the shards.
+        substitutionStats = stList_construct3(0, (void (*)(void *)) substitutionStats_destruct);
+        for (int64_t i = 0; i < assemblyNumber; i++) {
+            SubstitutionStats *counts = substitutionStats_construct(sampleFraction);
+            mergeShardFiles(stList_get(assemblyEventStrings, i), "snpStats",
+                    (void (*)(FILE *, const char *, void *)) readSubstitutionShard, counts);
+            stList_append(substitutionStats, counts);
+        }
+    } else {
+        //One pass over the blocks, for all the assemblies.
+        //The context is only made here, as the cactus disk is not loaded when shards are merged.
+        AssemblaContext *context = assemblaContext_constructFromArguments();
+        substitutionStats = assemblaMetrics_getSubstitutionStats(context, &parameters, assemblyEventStrings);
+        assemblaContext_destruct(context);
+    }
 
     ///////////////////////////////////////////////////////////////////////////
     // Print outputs
     ///////////////////////////////////////////////////////////////////////////
 
-    fprintf(fileHandle, "<substitutionStats ");
-    fprintf(fileHandle, "totalHomozygous=\"%" PRIi64 "\" "
-        "totalCorrectInHomozygous=\"%f\" "
-        "totalErrorsInHomozygous=\"%" PRIi64 "\" "
-        "totalCallsInHomozygous=\"%" PRIi64 "\" "
-        "totalHeterozygous=\"%" PRIi64 "\" "
-        "totalCorrectInHeterozygous=\"%f\" "
-        "totalErrorsInHeterozygous=\"%" PRIi64 "\" "
-        "totalCallsInHeterozygous=\"%" PRIi64 "\" "
-        "totalCorrectHap1InHeterozygous=\"%" PRIi64 "\" "
-        "totalCorrectHap2InHeterozygous=\"%" PRIi64 "\" "
-        "totalInOneHaplotypeOnly=\"%" PRIi64 "\" "
-        "totalCorrectInOneHaplotypeOnly=\"%f\" "
-        "totalErrorsInOneHaplotypeOnly=\"%" PRIi64 "\" "
-        "totalCallsInOneHaplotypeOnly=\"%" PRIi64 "\" />", totalSites, totalCorrect, totalErrors, totalCalls, totalHeterozygous,
-            totalCorrectInHeterozygous, totalErrorsInHeterozygous, totalCallsInHeterozygous,
-            totalCorrectHap1InHeterozygous, totalCorrectHap2InHeterozygous, totalInOneHaplotypeOnly,
-            totalCorrectInOneHaplotype, totalErrorsInOneHaplotype, totalCallsInOneHaplotype);
+    for (int64_t i = 0; i < assemblyNumber; i++) {
+        SubstitutionStats *counts = stList_get(substitutionStats, i);
+        const char *eventString = stList_get(assemblyEventStrings, i);
+        char *assemblyOutputFile = getAssemblyFileName(outputFile, eventString);
+        if (shardNumber > 1) {
+            //The raw counts of the shard, to be merged.
+            writeSubstitutionShard(counts, assemblyOutputFile);
+            free(assemblyOutputFile);
+            if (metricsRowFile == NULL) {
+                arena_report(counts->arena, NULL);
+            }
+            continue;
+        }
+        FILE *fileHandle = fopen(assemblyOutputFile, "w");
+        substitutionStats_extrapolate(counts);
+        substitutionStats_writeXML(counts, fileHandle);
+
+        if (metricsRowFile != NULL) {
+            MetricsRow *metricsRow = metricsRow_construct();
+            metricsRow_addInt(metricsRow, "totalHomozygous", counts->totalSites);
+            metricsRow_addDouble(metricsRow, "totalCorrectInHomozygous", counts->totalCorrect);
+            metricsRow_addInt(metricsRow, "totalErrorsInHomozygous", counts->totalErrors);
+            metricsRow_addInt(metricsRow, "totalCallsInHomozygous", counts->totalCalls);
+            metricsRow_addInt(metricsRow, "totalHeterozygous", counts->totalHeterozygous);
+            metricsRow_addDouble(metricsRow, "totalCorrectInHeterozygous", counts->totalCorrectInHeterozygous);
+            metricsRow_addInt(metricsRow, "totalErrorsInHeterozygous", counts->totalErrorsInHeterozygous);
+            metricsRow_addInt(metricsRow, "totalCallsInHeterozygous", counts->totalCallsInHeterozygous);
+            metricsRow_addInt(metricsRow, "totalCorrectHap1InHeterozygous", counts->totalCorrectHap1InHeterozygous);
+            metricsRow_addInt(metricsRow, "totalCorrectHap2InHeterozygous", counts->totalCorrectHap2InHeterozygous);
+            metricsRow_addInt(metricsRow, "totalInOneHaplotypeOnly", counts->totalInOneHaplotypeOnly);
+            metricsRow_addDouble(metricsRow, "totalCorrectInOneHaplotypeOnly", counts->totalCorrectInOneHaplotype);
+            metricsRow_addInt(metricsRow, "totalErrorsInOneHaplotypeOnly", counts->totalErrorsInOneHaplotype);
+            metricsRow_addInt(metricsRow, "totalCallsInOneHaplotypeOnly", counts->totalCallsInOneHaplotype);
+            if (counts->sampledTotals != NULL) {
+                metricsRow_addDouble(metricsRow, "sampleFraction", sampleFraction);
+                for (int64_t j = 0; j < SUBSTITUTION_TOTAL_NUMBER; j++) {
+                    char *name = stString_print("%s.standardError", substitutionTotalNames[j]);
+                    metricsRow_addDouble(metricsRow, name, sampledTotal_getStandardError(&counts->sampledTotals[j]));
+                    free(name);
+                }
+            }
+            char *assemblyMetricsRowFile = getAssemblyFileName(metricsRowFile, eventString);
+            arena_report(counts->arena, metricsRow);
+            metricsRow_write(metricsRow, assemblyMetricsRowFile);
+            free(assemblyMetricsRowFile);
+            metricsRow_destruct(metricsRow);
+        } else {
+            arena_report(counts->arena, NULL);
+        }
 
-    if (printIndelPositions) {
-        printPositions(indelPositions, "INDEL_SUBSTITUTION", fileHandle);
-    }
+        if (printIndelPositions) {
+            printPositions(counts->indelPositions, "INDEL_SUBSTITUTION", fileHandle);
+        }
 
-    if (printHetPositions) {
-        printPositions(hetPositions, "HET_SUBSTITUTION", fileHandle);
+        if (printHetPositions) {
+            printPositions(counts->hetPositions, "HET_SUBSTITUTION", fileHandle);
+        }
+        fclose(fileHandle);
+        free(assemblyOutputFile);
     }
+    stList_destruct(substitutionStats);
 
     st_logInfo("Finished writing out the stats.\n");
-    fclose(fileHandle);
 
     return 0;
 }
@@ -0,0 +1,450 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten (at) gmail.com) and Dent Earl (dearl (at) soe.ucsc.edu)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <ctype.h>
+
+#include "sonLib.h"
+#include "cactus.h"
+#include "substitutions.h"
+#include "adjacencyClassification.h"
+#include "contigPathTable.h"
+#include "mafWriter.h"
+#include "assemblaCommon.h"
+
+/*
+ * Writes, for each assembly, tracks of statistics in fixed size windows along each haplotype
+ * sequence, in one pass over the blocks. The statistic of a window is the sum over the haplotype
+ * bases in the window of:
+ *
+ * bases : 1, for the haplotype bases in blocks.
+ * coveredBases : 1 if the block contains the assembly.
+ * substitutionCalls, substitutionErrors : the calls and errors counted by substitutionStats
+ * (with the same minimumBlockLength, ignoreFirstNBasesOfBlock and minimumIdentity filters),
+ * at the haplotype bases of the column.
+ * copyNumberDeficientBases, copyNumberExcessBases : the bases counted by copyNumberStats for the
+ * column of the base, so a column in both haplotypes is counted in the windows of both.
+ * adjacencyErrors : the assembly segment ends in the column of the base with an error cap code
+ * (see getCapCode), counted at the first or last column of the block in the windows of the first
+ * haplotype 1 segment of the block, else of the first haplotype 2 segment, so each end is counted
+ * once. An error between two paths is counted at the ends of both, so the sum over the windows is
+ * the sum of the pathStats error totals with those of the errors between paths doubled.
+ *
+ * The tracks are written in a binary format, all integers int64_t:
+ *
+ * magic (8 bytes), window size, zoom factor, metric number, track number,
+ * for each metric: name length, name padded to 8 bytes,
+ * for each track: name length, name padded to 8 bytes, sequence length, level number, data offset,
+ * then the data of each track, for each level: window number * metric number counts.
+ *
+ * Level 0 has the given window size, level i + 1 windows zoom factor times larger than level i,
+ * each the sum of the windows it contains, up to a level with a single window.
+ */
+
+static const char *windowTracksMagic = "ASMWIN01";
+
+static const int64_t zoomFactor = 4;
+
+enum WindowMetric {
+    WINDOW_BASES,
+    WINDOW_COVERED_BASES,
+    WINDOW_SUBSTITUTION_CALLS,
+    WINDOW_SUBSTITUTION_ERRORS,
+    WINDOW_COPY_NUMBER_DEFICIENT_BASES,
+    WINDOW_COPY_NUMBER_EXCESS_BASES,
+    WINDOW_ADJACENCY_ERRORS,
+    WINDOW_METRIC_NUMBER
+};
+
+static const char *windowMetricNames[WINDOW_METRIC_NUMBER] = { "bases", "coveredBases", "substitutionCalls",
+        "substitutionErrors", "copyNumberDeficientBases", "copyNumberExcessBases", "adjacencyErrors" };
+
+/*
+ * The windows of a haplotype sequence, for each assembly.
+ */
+typedef struct _track {
+    char *sequenceName;
+    int64_t sequenceLength;
+    int64_t windowNumber;
+    int64_t **counts; //for each assembly, windowNumber * WINDOW_METRIC_NUMBER counts
+} Track;
+
+static stHash *sequenceNamesToTracks;
+static MafBuffer *sequenceNameBuffer;
+static ContigPathTable *contigPathTable;
+
+static void track_destruct(Track *track) {
+    for (int64_t i = 0; i < stList_length(assemblyEventStrings); i++) {
+        free(track->counts[i]);
+    }
+    free(track->counts);
+    free(track->sequenceName);
+    free(track);
+}
+
+static Track *getTrack(Segment *segment) {
+    Sequence *sequence = segment_getSequence(segment);
+    mafBuffer_clear(sequenceNameBuffer);
+    mafBuffer_appendSequenceName(sequenceNameBuffer, sequence);
+    mafBuffer_appendChar(sequenceNameBuffer, '\0');
+    Track *track = stHash_search(sequenceNamesToTracks, sequenceNameBuffer->string);
+    if (track == NULL) {
+        track = st_malloc(sizeof(Track));
+        track->sequenceName = stString_copy(sequenceNameBuffer->string);
+        track->sequenceLength = sequence_getLength(sequence);
+        track->windowNumber = (track->sequenceLength + windowSize - 1) / windowSize;
+        track->counts = st_malloc(sizeof(int64_t *) * stList_length(assemblyEventStrings));
+        for (int64_t i = 0; i < stList_length(assemblyEventStrings); i++) {
+            track->counts[i] = st_calloc(track->windowNumber * WINDOW_METRIC_NUMBER + 1, sizeof(int64_t));
+        }
+        stHash_insert(sequenceNamesToTracks, track->sequenceName, track);
+    }
+    return track;
+}
+
+/*
+ * The positive strand coordinate, from the start of its sequence, of a column of the segment.
+ */
+static int64_t getPosition(Segment *segment, int64_t column) {
+    int64_t i = segment_getStrand(segment) ? segment_getStart(segment) + column : segment_getStart(segment) - column;
+    return i - sequence_getStart(segment_getSequence(segment));
+}
+
+static void addToWindow(Track *track, int64_t assembly, int64_t position, enum WindowMetric metric, int64_t count) {
+    assert(position >= 0 && position < track->sequenceLength);
+    track->counts[assembly][(position / windowSize) * WINDOW_METRIC_NUMBER + metric] += count;
+}
+
+/*
+ * Adds count for each base of the segment to the windows containing them.
+ */
+static void addSegmentToWindows(Track *track, Segment *segment, int64_t assembly, enum WindowMetric metric,
+        int64_t count) {
+    int64_t start = getPosition(segment, 0), end = getPosition(segment, segment_getLength(segment) - 1);
+    if (start > end) {
+        int64_t i = start;
+        start = end;
+        end = i;
+    }
+    end++;
+    for (int64_t i = start; i < end;) {
+        int64_t j = (i / windowSize + 1) * windowSize;
+        j = j < end ? j : end;
+        addToWindow(track, assembly, i, metric, count * (j - i));
+        i = j;
+    }
+}
+
+/*
+ * As in substitutionStats, the identities of the haplotypes to each other and to the assembly,
+ * which must both be at least minimumIdentity for the block's substitutions to be counted.
+ */
+static bool passesIdentityFilter(Block *block, const SequenceView *hap1Seq, const SequenceView *hap2Seq,
+        const SequenceView *assemblySeq) {
+    double homoMatches = 0;
+    double matches = 0;
+    for (int64_t i = ignoreFirstNBasesOfBlock; i < block_getLength(block) - ignoreFirstNBasesOfBlock; i++) {
+        char hap1Base = hap1Seq != NULL ? toupper(sequenceView_getBase(hap1Seq, i)) : 'N';
+        char hap2Base = hap2Seq != NULL ? toupper(sequenceView_getBase(hap2Seq, i)) : 'N';
+        char assemblyBase = assemblySeq != NULL ? toupper(sequenceView_getBase(assemblySeq, i)) : 'N';
+        if (hap1Seq != NULL && hap2Seq != NULL) {
+            homoMatches += hap1Base == hap2Base ? 1 : 0;
+        } else {
+            homoMatches = INT64_MAX;
+        }
+        if (assemblySeq != NULL) {
+            if (hap1Seq != NULL) {
+                matches += hap1Base == assemblyBase && (hap2Seq == NULL || hap1Base == hap2Base) ? 1 : 0;
+            } else {
+                matches += hap2Base == assemblyBase ? 1 : 0;
+            }
+        } else {
+            matches = INT64_MAX;
+        }
+    }
+    double homoIdentity = 100.0 * homoMatches / (block_getLength(block) - 2.0 * ignoreFirstNBasesOfBlock);
+    double identity = 100.0 * matches / (block_getLength(block) - 2.0 * ignoreFirstNBasesOfBlock);
+    return homoIdentity >= minimumIndentity && identity >= minimumIndentity;
+}
+
+static void addSubstitutions(Block *block, int64_t assembly, const SequenceView *hap1Seq,
+        const SequenceView *hap2Seq, const SequenceView *assemblySeq, Segment *hap1Segment, Segment *hap2Segment) {
+    if (assemblySeq == NULL || !passesIdentityFilter(block, hap1Seq, hap2Seq, assemblySeq)) {
+        return;
+    }
+    Track *hap1Track = hap1Seq != NULL ? getTrack(hap1Segment) : NULL;
+    Track *hap2Track = hap2Seq != NULL ? getTrack(hap2Segment) : NULL;
+    for (int64_t i = ignoreFirstNBasesOfBlock; i < block_getLength(block) - ignoreFirstNBasesOfBlock; i++) {
+        char assemblyBase = sequenceView_getBase(assemblySeq, i);
+        bool error;
+        if (hap1Seq != NULL && hap2Seq != NULL) {
+            char hap1Base = sequenceView_getBase(hap1Seq, i);
+            char hap2Base = sequenceView_getBase(hap2Seq, i);
+            error = toupper(hap1Base) == toupper(hap2Base) ? !correctFn(assemblyBase, hap1Base) :
+                    !(correctFn(assemblyBase, hap1Base) || correctFn(assemblyBase, hap2Base));
+        } else {
+            error = !correctFn(assemblyBase, sequenceView_getBase(hap1Seq != NULL ? hap1Seq : hap2Seq, i));
+        }
+        if (hap1Track != NULL) {
+            addToWindow(hap1Track, assembly, getPosition(hap1Segment, i), WINDOW_SUBSTITUTION_CALLS, 1);
+            addToWindow(hap1Track, assembly, getPosition(hap1Segment, i), WINDOW_SUBSTITUTION_ERRORS, error);
+        }
+        if (hap2Track != NULL) {
+            addToWindow(hap2Track, assembly, getPosition(hap2Segment, i), WINDOW_SUBSTITUTION_CALLS, 1);
+            addToWindow(hap2Track, assembly, getPosition(hap2Segment, i), WINDOW_SUBSTITUTION_ERRORS, error);
+        }
+    }
+}
+
+static bool isErrorCapCode(enum CapCode capCode) {
+    switch (capCode) {
+        case ERROR_HAP_TO_HAP_SAME_CHROMOSOME:
+        case ERROR_HAP_TO_HAP_DIFFERENT_CHROMOSOMES:
+        case ERROR_HAP_TO_CONTAMINATION:
+        case ERROR_HAP_TO_INSERT_TO_CONTAMINATION:
+        case ERROR_HAP_TO_INSERT:
+        case ERROR_HAP_TO_DELETION:
+        case ERROR_HAP_TO_INSERT_AND_DELETION:
+        case ERROR_CONTIG_END_WITH_INSERT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void addBlock(Block *block, FILE *fileHandle) {
+    int64_t assemblyNumber = stList_length(assemblyEventStrings);
+    stList *haplotypeSegments = stList_construct();
+    int64_t hap1Number = 0, hap2Number = 0;
+    SequenceView hap1View, hap2View;
+    SequenceView *hap1Seq = NULL, *hap2Seq = NULL;
+    Segment *hap1Segment = NULL, *hap2Segment = NULL;
+    int64_t *assemblyNumbers = st_calloc(assemblyNumber, sizeof(int64_t));
+    SequenceView *assemblyViews = st_malloc(assemblyNumber * sizeof(SequenceView));
+    bool *hasAssemblySeqs = st_calloc(assemblyNumber, sizeof(bool));
+    //The adjacency errors at the first and last columns of the block, for each assembly.
+    int64_t *adjacencyErrors = st_calloc(assemblyNumber * 2, sizeof(int64_t));
+
+    Block_InstanceIterator *instanceIt = block_getInstanceIterator(block);
+    Segment *segment;
+    while ((segment = block_getNext(instanceIt)) != NULL) {
+        const char *eventString = event_getHeader(segment_getEvent(segment));
+        int64_t assemblyIndex = getAssemblyIndex(eventString);
+        if (assemblyIndex != -1) {
+            if (assemblyNumbers[assemblyIndex]++ == 0) {
+                hasAssemblySeqs[assemblyIndex] = sequenceView_get(segment, &assemblyViews[assemblyIndex]);
+            }
+            enum CapCode _5CapCode, _3CapCode;
+            if (contigPathTable_getCapCodes(contigPathTable, segment, &_5CapCode, &_3CapCode)) {
+                adjacencyErrors[assemblyIndex * 2] += isErrorCapCode(_5CapCode);
+                adjacencyErrors[assemblyIndex * 2 + 1] += isErrorCapCode(_3CapCode);
+            }
+        } else if (segment_getSequence(segment) != NULL) {
+            if (strcmp(eventString, hap1EventString) == 0) {
+                stList_append(haplotypeSegments, segment);
+                if (hap1Number++ == 0) {
+                    hap1Seq = sequenceView_get(segment, &hap1View) ? &hap1View : NULL;
+                    hap1Segment = segment;
+                }
+            } else if (strcmp(eventString, hap2EventString) == 0) {
+                stList_append(haplotypeSegments, segment);
+                if (hap2Number++ == 0) {
+                    hap2Seq = sequenceView_get(segment, &hap2View) ? &hap2View : NULL;
+                    hap2Segment = segment;
+                }
+            }
+        }
+    }
+    block_destructInstanceIterator(instanceIt);
+
+    int64_t maxHapNumber = hap1Number > hap2Number ? hap1Number : hap2Number;
+    int64_t minHapNumber = hap1Number < hap2Number ? hap1Number : hap2Number;
+    for (int64_t i = 0; i < stList_length(haplotypeSegments); i++) {
+        Segment *haplotypeSegment = stList_get(haplotypeSegments, i);
+        Track *track = getTrack(haplotypeSegment);
+        for (int64_t j = 0; j < assemblyNumber; j++) {
+            addSegmentToWindows(track, haplotypeSegment, j, WINDOW_BASES, 1);
+            if (assemblyNumbers[j] > 0) {
+                addSegmentToWindows(track, haplotypeSegment, j, WINDOW_COVERED_BASES, 1);
+            }
+            if (block_getLength(block) >= minimumBlockLength) {
+                if (assemblyNumbers[j] < minHapNumber) {
+                    addSegmentToWindows(track, haplotypeSegment, j, WINDOW_COPY_NUMBER_DEFICIENT_BASES,
+                            minHapNumber - assemblyNumbers[j]);
+                } else if (assemblyNumbers[j] > maxHapNumber) {
+                    addSegmentToWindows(track, haplotypeSegment, j, WINDOW_COPY_NUMBER_EXCESS_BASES,
+                            assemblyNumbers[j] - maxHapNumber);
+                }
+            }
+            //The errors are of the assembly segments, so are only counted in the windows of one haplotype segment.
+            if (haplotypeSegment == (hap1Segment != NULL ? hap1Segment : hap2Segment)) {
+                addToWindow(track, j, getPosition(haplotypeSegment, 0), WINDOW_ADJACENCY_ERRORS,
+                        adjacencyErrors[j * 2]);
+                addToWindow(track, j, getPosition(haplotypeSegment, block_getLength(block) - 1),
+                        WINDOW_ADJACENCY_ERRORS, adjacencyErrors[j * 2 + 1]);
+            }
+        }
+    }
+
+    //As in substitutionStats, blocks with more than one segment of a haplotype are skipped, as are
+    //the assemblies with more than one segment in the block.
+    if (block_getLength(block) >= minimumBlockLength && hap1Number <= 1 && hap2Number <= 1
+            && (hap1Seq != NULL || hap2Seq != NULL)) {
+        for (int64_t j = 0; j < assemblyNumber; j++) {
+            if (assemblyNumbers[j] == 1) {
+                addSubstitutions(block, j, hap1Seq, hap2Seq, hasAssemblySeqs[j] ? &assemblyViews[j] : NULL,
+                        hap1Segment, hap2Segment);
+            }
+        }
+    }
+
+    sequenceView_clearCache();
+    stList_destruct(haplotypeSegments);
+    free(assemblyNumbers);
+    free(assemblyViews);
+    free(hasAssemblySeqs);
+    free(adjacencyErrors);
+}
+
+/*
+ * Writing.
+ */
+
+static void writeInt(FILE *fileHandle, int64_t i) {
+    if (fwrite(&i, sizeof(int64_t), 1, fileHandle) != 1) {
+        st_errAbort("Failed to write the window tracks");
+    }
+}
+
+static void writeString(FILE *fileHandle, const char *string) {
+    char padding[8] = { 0 };
+    int64_t length = strlen(string);
+    writeInt(fileHandle, length);
+    if (fwrite(string, 1, length, fileHandle) != length
+            || fwrite(padding, 1, (8 - length % 8) % 8, fileHandle) != (8 - length % 8) % 8) {
+        st_errAbort("Failed to write the window tracks");
+    }
+}
+
+static int64_t getStringLength(const char *string) {
+    return 8 + (strlen(string) + 7) / 8 * 8;
+}
+
+static int64_t getLevelNumber(int64_t windowNumber) {
+    int64_t levelNumber = 1;
+    while (windowNumber > 1) {
+        windowNumber = (windowNumber + zoomFactor - 1) / zoomFactor;
+        levelNumber++;
+    }
+    return levelNumber;
+}
+
+static void writeTrack(FILE *fileHandle, int64_t *counts, int64_t windowNumber) {
+    //Each level is written then summed, in place, into the next.
+    while (1) {
+        if (fwrite(counts, sizeof(int64_t), windowNumber * WINDOW_METRIC_NUMBER, fileHandle)
+                != windowNumber * WINDOW_METRIC_NUMBER) {
+            st_errAbort("Failed to write the window tracks");
+        }
+        if (windowNumber <= 1) {
+            break;
+        }
+        int64_t nextWindowNumber = (windowNumber + zoomFactor - 1) / zoomFactor;
+        for (int64_t i = 0; i < nextWindowNumber; i++) {
+            for (int64_t k = 0; k < WINDOW_METRIC_NUMBER; k++) {
+                int64_t j = 0;
+                for (int64_t l = i * zoomFactor; l < (i + 1) * zoomFactor && l < windowNumber; l++) {
+                    j += counts[l * WINDOW_METRIC_NUMBER + k];
+                }
+                counts[i * WINDOW_METRIC_NUMBER + k] = j;
+            }
+        }
+        windowNumber = nextWindowNumber;
+    }
+}
+
+static void writeTracks(stList *tracks, int64_t assembly, const char *fileName) {
+    FILE *fileHandle = fopen(fileName, "w");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the window tracks file %s for writing", fileName);
+    }
+    fwrite(windowTracksMagic, 1, 8, fileHandle);
+    writeInt(fileHandle, windowSize);
+    writeInt(fileHandle, zoomFactor);
+    writeInt(fileHandle, WINDOW_METRIC_NUMBER);
+    writeInt(fileHandle, stList_length(tracks));
+    int64_t offset = 40;
+    for (int64_t i = 0; i < WINDOW_METRIC_NUMBER; i++) {
+        writeString(fileHandle, windowMetricNames[i]);
+        offset += getStringLength(windowMetricNames[i]);
+    }
+    for (int64_t i = 0; i < stList_length(tracks); i++) {
+        offset += getStringLength(((Track *) stList_get(tracks, i))->sequenceName) + 24;
+    }
+    for (int64_t i = 0; i < stList_length(tracks); i++) {
+        Track *track = stList_get(tracks, i);
+        writeString(fileHandle, track->sequenceName);
+        writeInt(fileHandle, track->sequenceLength);
+        writeInt(fileHandle, getLevelNumber(track->windowNumber));
+        writeInt(fileHandle, offset);
+        for (int64_t windowNumber = track->windowNumber;; windowNumber = (windowNumber + zoomFactor - 1) / zoomFactor) {
+            offset += windowNumber * WINDOW_METRIC_NUMBER * sizeof(int64_t);
+            if (windowNumber <= 1) {
+                break;
+            }
+        }
+    }
+    for (int64_t i = 0; i < stList_length(tracks); i++) {
+        Track *track = stList_get(tracks, i);
+        writeTrack(fileHandle, track->counts[assembly], track->windowNumber);
+    }
+    if (fclose(fileHandle) != 0) {
+        st_errAbort("Failed to close the window tracks file %s", fileName);
+    }
+}
+
+static int compareTracks(const void *a, const void *b) {
+    return strcmp(((Track *) a)->sequenceName, ((Track *) b)->sequenceName);
+}
+
+int main(int argc, char *argv[]) {
+    //////////////////////////////////////////////
+    //Parse the inputs
+    //////////////////////////////////////////////
+
+    parseBasicArguments(argc, argv, "windowTracks");
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Sweep the blocks once, for all the assemblies and haplotype sequences.
+    ///////////////////////////////////////////////////////////////////////////
+
+    int64_t startTime = time(NULL);
+
+    stList *haplotypeEventStrings = getEventStrings(hap1EventString, hap2EventString);
+    stList *contaminationEventStrings = getEventStrings(contaminationEventString, NULL);
+    contigPathTable = getContigPathTable(assemblyEventStrings, haplotypeEventStrings, contaminationEventStrings);
+
+    sequenceNamesToTracks = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL,
+            (void (*)(void *)) track_destruct);
+    sequenceNameBuffer = mafBuffer_construct();
+    getMAFsBounded(flower, NULL, addBlock);
+
+    stList *tracks = stHash_getValues(sequenceNamesToTracks);
+    stList_sort(tracks, compareTracks);
+    for (int64_t i = 0; i < stList_length(assemblyEventStrings); i++) {
+        char *assemblyOutputFile = getAssemblyFileName(outputFile, stList_get(assemblyEventStrings, i));
+        writeTracks(tracks, i, assemblyOutputFile);
+        free(assemblyOutputFile);
+    }
+    st_logInfo("Wrote the window tracks of %" PRIi64 " haplotype sequences in %" PRIi64 " seconds\n",
+            stList_length(tracks), time(NULL) - startTime);
+
+    stList_destruct(tracks);
+    stHash_destruct(sequenceNamesToTracks);
+    mafBuffer_destruct(sequenceNameBuffer);
+    contigPathTable_destruct(contigPathTable);
+
+    return 0;
+}
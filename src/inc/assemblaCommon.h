@@ -10,6 +10,7 @@
 #include "cactus.h"
 #include "sonLib.h"
 #include "adjacencyClassification.h"
+#include "contigPathTable.h"
 
 /*
  * Global parameters shared by all the scripts.
@@ -18,8 +19,16 @@ extern CapCodeParameters *capCodeParameters;
 extern char *outputFile;
 extern Flower *flower;
 extern CactusDisk *cactusDisk;
+/*
+ * The directory of the cactus disk, or NULL if the database is not a file in a directory.
+ */
+extern char *cactusDiskDirectory;
 
 extern char *assemblyEventString;
+/*
+ * All the assembly event strings given, in order, assemblyEventString is the first.
+ */
+extern stList *assemblyEventStrings;
 extern char *hap1EventString;
 extern char *hap2EventString;
 extern char *contaminationEventString;
@@ -31,6 +40,16 @@ extern bool treatHaplotype2AsContamination;
  */
 extern int64_t minimumBlockLength;
 
+/*
+ * For the scripts that traverse the blocks with getMAFsBounded.
+ */
+extern int64_t maximumMemory;
+
+/*
+ * If not NULL, the scripts also write their summary metrics to this file as a MetricsRow.
+ */
+extern char *metricsRowFile;
+
 /*
  * Parameters for the substitution script.
  */
@@ -45,6 +64,123 @@ extern bool printHetPositions;
 extern int64_t bucketNumber;
 extern int64_t upperLinkageBound;
 extern int64_t sampleNumber;
+/*
+ * If the precision is not 0 the linkage is sampled in rounds, until the 95% interval of the ratio
+ * of each bucket is within the precision of it, the sample number is reached or, if it is not 0,
+ * the time budget (in seconds) runs out.
+ */
+extern double linkagePrecision;
+extern int64_t linkageTimeBudget;
+
+/*
+ * For the annotated MAF script.
+ */
+extern bool compressOutput;
+extern int64_t numberOfThreads;
+extern bool writeMafIndex;
+/*
+ * If non-zero every block formatted natively is checked against getMAFBlock (see
+ * mafBuffer_canFormatBlock), which is slow, for testing.
+ */
+extern bool verifyMaf;
+extern char *annotationTableFormat;
+
+/*
+ * For the window tracks script.
+ */
+extern int64_t windowSize;
+
+/*
+ * For the daemon, the Unix domain socket to serve requests on. If given, no output file is needed.
+ */
+extern char *socketPath;
+
+/*
+ * For the path stats script, if not NULL the files to write the cap sites (see CapSite) and the
+ * per contig summary of them to.
+ */
+extern char *capSitesFile;
+extern char *contigSummaryFile;
+
+/*
+ * For the coverage plots script. The bins go up to the maximum length, or if it is 0 to the longest
+ * length of each plot, with the given number per power of ten.
+ */
+extern int64_t coveragePlotMaximumLength;
+extern int64_t coveragePlotBinsPerDecade;
+extern bool compressCoveragePlotBins;
+extern bool coveragePlotIsBinary;
+
+/*
+ * Block sampling, for quick approximate runs. With a sample fraction f below 1 each block is kept
+ * with probability f, decided by a hash of its name and the sample seed, so every script and run
+ * with the same seed keeps the same blocks. Totals over the kept blocks are extrapolated with the
+ * Horvitz-Thompson estimator, sum / f, whose standard error is sqrt((1 - f) * sum of squares) / f,
+ * the sums being over the contributions of the kept blocks.
+ */
+extern double sampleFraction;
+extern int64_t sampleSeed;
+
+/*
+ * Non-zero if the block is in the sample (always, if not sampling). getMAFsBounded and
+ * getMAFsInRegions only visit the sampled blocks.
+ */
+bool isBlockSampled(Block *block);
+
+/*
+ * As isBlockSampled, for the given sample fraction and seed.
+ */
+bool isBlockInSample(Block *block, double sampleFraction, int64_t sampleSeed);
+
+typedef struct _sampledTotal {
+    double sum;
+    double sumOfSquares;
+} SampledTotal;
+
+/*
+ * Adds the contribution of a sampled block.
+ */
+static inline void sampledTotal_add(SampledTotal *sampledTotal, double contribution) {
+    sampledTotal->sum += contribution;
+    sampledTotal->sumOfSquares += contribution * contribution;
+}
+
+double sampledTotal_getEstimate(const SampledTotal *sampledTotal);
+
+double sampledTotal_getStandardError(const SampledTotal *sampledTotal);
+
+/*
+ * As sampledTotal_getEstimate and sampledTotal_getStandardError, for the given sample fraction.
+ */
+double sampledTotal_getEstimate2(const SampledTotal *sampledTotal, double sampleFraction);
+
+double sampledTotal_getStandardError2(const SampledTotal *sampledTotal, double sampleFraction);
+
+/*
+ * Sharding, to spread the evaluation of one alignment over processes. With --shard i/n
+ * getMAFsBounded and getMAFsInRegions visit only the nested flowers of the top level groups whose
+ * index (among those with nested flowers) is i modulo n, plus, for shard 0, the top level blocks.
+ * A script run in shards writes its raw counts to a shard file in place of its outputs, and a run
+ * given the shard files with --mergeShards (which does not load the cactus disk) merges them and
+ * writes the outputs. Scripts that can be run in shards set shardsSupported before
+ * parseBasicArguments, which otherwise rejects the options.
+ */
+extern bool shardsSupported;
+extern int64_t shardIndex;
+extern int64_t shardNumber;
+extern stList *shardFiles;
+
+/*
+ * Opens a shard file for writing, writing the header identifying the program and shard.
+ */
+FILE *shardFile_construct(const char *fileName, const char *programName);
+
+/*
+ * Calls readFn on each of the shard files of the assembly (past the header), checking they are of
+ * the program and sample fraction of this run and cover every shard of the split exactly once.
+ */
+void mergeShardFiles(const char *assemblyEventString, const char *programName,
+        void(*readFn)(FILE *fileHandle, const char *fileName, void *extraArg), void *extraArg);
 
 stList *getEventStrings(const char *hapA1EventString, const char *hapA2EventString);
 
@@ -52,4 +188,227 @@ void basicUsage(const char *programName);
 
 int parseBasicArguments(int argc, char *argv[], const char *programName);
 
+/*
+ * A read only view of the bases of a segment, in place of the copy made by segment_getString.
+ * The view points to the forward strand bases of the segment, read from the cactus disk. If
+ * strand is zero the bases of the segment are the reverse complement of the length characters at
+ * string, which sequenceView_getBase computes as the bases are read.
+ */
+typedef struct _sequenceView {
+    const char *string;
+    int64_t length;
+    bool strand;
+} SequenceView;
+
+/*
+ * Sets the view of the bases of the segment, returning the string it points to, which the
+ * caller must free, or NULL if the segment has no sequence.
+ */
+char *sequenceView_read(Segment *segment, SequenceView *sequenceView);
+
+/*
+ * Sets the view of the bases of the segment, returning zero if the segment has no sequence.
+ * Must only be called from one thread at a time, but the views themselves can be read from any
+ * thread. Views are valid until sequenceView_clearCache is called, which the callers do after
+ * each block, so only the bases of the blocks being processed are held.
+ */
+bool sequenceView_get(Segment *segment, SequenceView *sequenceView);
+
+/*
+ * Frees the strings of the views set by sequenceView_get.
+ */
+void sequenceView_clearCache(void);
+
+/*
+ * A cache of the strings of views of its own, for code that must not share the cache of
+ * sequenceView_get, such as runs of the metrics library (see assemblaMetrics.h). Views set by
+ * sequenceViewCache_get are valid until the cache is cleared or destructed.
+ */
+typedef struct _sequenceViewCache SequenceViewCache;
+
+SequenceViewCache *sequenceViewCache_construct(void);
+
+void sequenceViewCache_destruct(SequenceViewCache *sequenceViewCache);
+
+void sequenceViewCache_clear(SequenceViewCache *sequenceViewCache);
+
+bool sequenceViewCache_get(SequenceViewCache *sequenceViewCache, Segment *segment, SequenceView *sequenceView);
+
+/*
+ * The ith base of the segment, in the orientation of the segment.
+ */
+static inline char sequenceView_getBase(const SequenceView *sequenceView, int64_t i) {
+    return sequenceView->strand ? sequenceView->string[i] :
+            cactusMisc_reverseComplementChar(sequenceView->string[sequenceView->length - 1 - i]);
+}
+
+/*
+ * The contig path table of the assemblies, see contigPathTable.h. The first script to need the
+ * table for a set of event strings and cap code parameters writes it to a file in the cactus disk
+ * directory. Later calls, from any script, map that file instead of computing the contig paths
+ * again. The file is rebuilt if the cactus disk changes.
+ */
+ContigPathTable *getContigPathTable(stList *assemblyEventStrings, stList *haplotypeEventStrings,
+        stList *contaminationEventStrings);
+
+/*
+ * As getContigPathTable, for the given flower, cactus disk directory (which may be NULL) and
+ * cap code parameters.
+ */
+ContigPathTable *getContigPathTable2(Flower *flower, const char *cactusDiskDirectory,
+        CapCodeParameters *capCodeParameters, stList *assemblyEventStrings, stList *haplotypeEventStrings,
+        stList *contaminationEventStrings);
+
+/*
+ * Loads the flower and all the flowers nested in it, so that traversing them afterwards reads
+ * the flowers already in memory and does not change the cactus disk's cache of loaded flowers.
+ * Computing the contig paths has the same effect, but a contig path table mapped from its file
+ * does not.
+ */
+void loadFlowers(Flower *flower);
+
+/*
+ * The file an output for the given assembly is written to: the given file if there is only
+ * one assembly, else the file name followed by "." and the assembly event string.
+ */
+char *getAssemblyFileName(const char *fileName, const char *assemblyEventString);
+
+/*
+ * The index of the event string in assemblyEventStrings, or -1 if it is not an assembly.
+ */
+int64_t getAssemblyIndex(const char *eventString);
+
+/*
+ * A row of named summary metrics, written as a two line CSV file (the names, then the values).
+ * The names are those of the attributes in the script's XML output, with attributes of nested
+ * elements named element.attribute, so bin/aggregateStats.py can read either.
+ */
+typedef struct _metricsRow MetricsRow;
+
+MetricsRow *metricsRow_construct(void);
+
+void metricsRow_destruct(MetricsRow *metricsRow);
+
+void metricsRow_addInt(MetricsRow *metricsRow, const char *name, int64_t value);
+
+void metricsRow_addDouble(MetricsRow *metricsRow, const char *name, double value);
+
+void metricsRow_addString(MetricsRow *metricsRow, const char *name, const char *value);
+
+void metricsRow_write(MetricsRow *metricsRow, const char *fileName);
+
+/*
+ * An arena of memory for the many small objects a script keeps until it reports, such as the
+ * holders of blocks and error positions. Objects are allocated by bumping a pointer through
+ * chunks, which double in size up to 16MB, and are all freed at once with the arena.
+ */
+typedef struct _arena Arena;
+
+Arena *arena_construct(void);
+
+/*
+ * Frees the arena and everything allocated from it.
+ */
+void arena_destruct(Arena *arena);
+
+/*
+ * Allocates size bytes, aligned to 16 bytes, which are not initialised.
+ */
+void *arena_malloc(Arena *arena, size_t size);
+
+char *arena_copyString(Arena *arena, const char *string);
+
+/*
+ * Logs the number and bytes of the allocations and chunks of the arena and, if the metrics row
+ * is not NULL, adds them to it as allocator.allocations, allocator.bytesAllocated,
+ * allocator.chunks and allocator.bytesReserved.
+ */
+void arena_report(Arena *arena, MetricsRow *metricsRow);
+
+/*
+ * Calls blockFn on the blocks of the flower and its nested flowers, in the same order as
+ * getMAFs. Nested flower subtrees are processed one at a time and, once the process is using
+ * more than maximumMemory bytes, the nested flowers already processed are unloaded from the
+ * cactus disk. If maximumMemory is set, blockFn must not keep pointers to the blocks or segments.
+ * If regions were given the flower is ignored, and only the blocks overlapping them are visited,
+ * with getMAFsInRegions.
+ */
+void getMAFsBounded(Flower *flower, FILE *fileHandle, void(*blockFn)(Block *, FILE *));
+
+/*
+ * A region given with --region or --regionBed: zero based, half open coordinates on the positive
+ * strand of the sequence, which is named as it is in the MAFs. Normally a haplotype sequence, but
+ * any sequence can be given.
+ */
+typedef struct _region {
+    char *sequenceName;
+    int64_t start;
+    int64_t end;
+} Region;
+
+/*
+ * The regions the scripts are restricted to, or NULL if the whole alignment is evaluated.
+ */
+extern stList *regions;
+
+/*
+ * Non-zero if any segment of the block overlaps one of the regions.
+ */
+bool blockOverlapsRegions(Block *block);
+
+/*
+ * The number of bases of the sequence in the regions, which should not overlap.
+ */
+int64_t getSequenceRegionLength(Sequence *sequence);
+
+/*
+ * Calls blockFn on the blocks overlapping the regions, in the same order as getMAFs. The blocks
+ * are found with a region index of the cactus disk, which is built by the first script to need
+ * it and kept (as blocks.*.idx and blocks.*.rec) in the cactus disk directory, or in TMPDIR if
+ * that is not writable, so only the flowers containing those blocks are loaded. If the index
+ * can not be written every block is checked. The flowers are not unloaded.
+ */
+void getMAFsInRegions(FILE *fileHandle, void(*blockFn)(Block *, FILE *));
+
+/*
+ * A set of regions, looked up by sequence name, so blocks and sequences can be checked against
+ * them. The regions, which belong to the caller, must outlive the set.
+ */
+typedef struct _regionSet RegionSet;
+
+RegionSet *regionSet_construct(stList *regions);
+
+void regionSet_destruct(RegionSet *regionSet);
+
+/*
+ * As blockOverlapsRegions and getSequenceRegionLength, for the regions of the set.
+ */
+bool regionSet_overlapsBlock(RegionSet *regionSet, Block *block);
+
+int64_t regionSet_getSequenceLength(RegionSet *regionSet, Sequence *sequence);
+
+/*
+ * The blocks a traversal visits, with the parameters that getMAFsBounded and getMAFsInRegions
+ * take from the command line: all the blocks of the flower, or if regionSet is not NULL those
+ * overlapping its regions (found with the region index if cactusDiskDirectory is not NULL),
+ * restricted to a sample and shard, unloading nested flowers beyond maximumMemory.
+ */
+typedef struct _blockTraversal {
+    Flower *flower;
+    CactusDisk *cactusDisk;
+    const char *cactusDiskDirectory;
+    RegionSet *regionSet;
+    double sampleFraction;
+    int64_t sampleSeed;
+    int64_t shardIndex;
+    int64_t shardNumber;
+    int64_t maximumMemory;
+} BlockTraversal;
+
+/*
+ * Calls blockFn, with the extra argument, on each block of the traversal, in the same order as
+ * getMAFs. Uses no global state, so traversals of different cactus disks can run at once.
+ */
+void blockTraversal_run(const BlockTraversal *blockTraversal, void(*blockFn)(Block *, void *), void *extraArg);
+
 #endif /* COMMON_H_ */
@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten (at) gmail.com) and Dent Earl (dearl (at) soe.ucsc.edu)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef ASSEMBLA_METRICS_H_
+#define ASSEMBLA_METRICS_H_
+
+#include "cactus.h"
+#include "sonLib.h"
+#include "adjacencyClassification.h"
+#include "assemblaCommon.h"
+
+/*
+ * The metrics of pathStats, substitutionStats and copyNumberStats as a library, so a long running
+ * process can evaluate many assemblies and parameter sets without starting a script, and loading
+ * the cactus disk, for each. A run keeps its state in the context, parameters and results below,
+ * not in globals; the binaries fill the parameters from their command lines and print the results.
+ *
+ * A context holds a cactus disk and the sequences read from it. The cactus disk loads flowers as
+ * they are needed, so the runs of one context are serialised by a lock, while the runs of
+ * different contexts can go at once, in different threads.
+ */
+
+/*
+ * An end of a segment of a contig path whose cap code (see getCapCode) is not HAP_NOTHING, that is a
+ * haplotype switch, gap, contig end or error, as counted by the path stats. The positions are
+ * zero based, on the positive strand and from the start of their sequences.
+ */
+typedef struct _capSite {
+    Sequence *sequence; //The assembly contig.
+    int64_t position; //The first or last base of the segment, at the end.
+    bool strand; //The strand of the contig path on the contig.
+    bool _5End; //Which end of the segment, in the orientation of the path.
+    enum CapCode capCode;
+    int64_t insertLength;
+    int64_t deleteLength;
+    int64_t path; //The ordinal of the contig path.
+    //The haplotype base aligned to the assembly base, from the first haplotype segment of the block.
+    Sequence *haplotypeSequence; //NULL if the block has no haplotype segment.
+    int64_t haplotypePosition;
+} CapSite;
+
+/*
+ * The parameters of a run, as given to the scripts by the options of the same names.
+ */
+typedef struct _assemblaParameters {
+    CapCodeParameters *capCodeParameters;
+    const char *hap1EventString;
+    const char *hap2EventString;
+    const char *contaminationEventString;
+    bool treatHaplotype1AsContamination;
+    bool treatHaplotype2AsContamination;
+    int64_t minimumBlockLength;
+    /*
+     * For the path stats. If not NULL, called with each cap site of the assembly as the blocks are
+     * visited (in region mode, of the segments in blocks overlapping the regions). An adjacency
+     * between two paths is a site at the end of each.
+     */
+    void (*capSiteFn)(const CapSite *capSite, void *extraArg);
+    void *capSiteExtraArg;
+    /*
+     * For the substitution stats. If keepErrorPositions is non-zero the positions of the errors
+     * are kept in the results (and flowers are not unloaded).
+     */
+    int64_t ignoreFirstNBasesOfBlock;
+    int64_t minimumIdentity;
+    bool keepErrorPositions;
+    /*
+     * The blocks visited, as by a BlockTraversal: regions is a list of Region, or NULL for the
+     * whole alignment.
+     */
+    stList *regions;
+    double sampleFraction;
+    int64_t sampleSeed;
+    int64_t shardIndex;
+    int64_t shardNumber;
+    int64_t maximumMemory;
+} AssemblaParameters;
+
+/*
+ * Sets the parameters to those given on the command line, as parsed by parseBasicArguments.
+ */
+void assemblaParameters_setFromArguments(AssemblaParameters *parameters);
+
+typedef struct _assemblaContext AssemblaContext;
+
+/*
+ * Loads the cactus disk of the database string.
+ */
+AssemblaContext *assemblaContext_construct(const char *cactusDiskDatabaseString);
+
+/*
+ * A context of the cactus disk loaded by parseBasicArguments, which is not freed with the context.
+ */
+AssemblaContext *assemblaContext_constructFromArguments(void);
+
+void assemblaContext_destruct(AssemblaContext *context);
+
+/*
+ * If greater than zero, up to this many of the contig path tables built for the path stats are
+ * kept in the context, by assemblies and parameters, and reused by later runs (as by the daemon),
+ * rather than freed once the stats are got. The least recently used table is freed to make room
+ * for a new one. Zero, the default, keeps none.
+ */
+void assemblaContext_setMaximumContigPathTables(AssemblaContext *context, int64_t maximumContigPathTables);
+
+/*
+ * The path stats of an assembly, named as the attributes of the pathStats XML. The totals of
+ * errors counted at both ends of a path are halved, as they are printed.
+ */
+typedef struct _pathStats {
+    int64_t totalHaplotypeSwitches;
+    int64_t totalScaffoldGaps;
+    int64_t totalAmbiguityGaps;
+    int64_t totalContigEnds;
+    int64_t totalContigEndsWithNs;
+    int64_t totalErrorsHaplotypeToHaplotypeSameChromosome;
+    int64_t totalErrorsHaplotypeToHaplotypeDifferentChromosome;
+    int64_t totalErrorsHaplotypeToContamination;
+    int64_t totalErrorsHaplotypeToInsertionToContamination;
+    int64_t totalErrorsHaplotypeToInsertion;
+    int64_t totalErrorsHaplotypeToDeletion;
+    int64_t totalErrorsHaplotypeToInsertionAndDeletion;
+    int64_t totalErrorsContigEndsWithInsert;
+    int64_t totalErrors;
+    int64_t totalPathLength;
+    int64_t genotypeLength;
+    int64_t totalContigsLength;
+    double coverage;
+    int64_t blockNG50;
+    int64_t contigN50;
+    int64_t contigNG50;
+    int64_t contigPathNG50;
+    int64_t scaffoldPathNG50;
+    int64_t totalBlockNumber;
+    int64_t totalContigNumber;
+    int64_t totalHaplotypePaths;
+    int64_t totalScaffoldPaths;
+    double errorsPerContig;
+    double errorsPerMappedBase;
+    /*
+     * The sizes of the insertion and deletion errors, in ascending order.
+     */
+    int64_t *insertionErrorSizes;
+    int64_t insertionErrorSizeNumber;
+    int64_t *deletionErrorSizes;
+    int64_t deletionErrorSizeNumber;
+    /*
+     * If the sample fraction is below 1 the block totals are extrapolated, with these standard errors.
+     */
+    double sampleFraction;
+    double totalPathLengthStandardError;
+    double totalBlockNumberStandardError;
+    double coverageStandardError;
+    //The memory of the error sizes.
+    Arena *arena;
+} PathStats;
+
+/*
+ * The path stats of the assembly. Path stats can not be run in shards.
+ */
+PathStats *assemblaMetrics_getPathStats(AssemblaContext *context, const AssemblaParameters *parameters,
+        const char *assemblyEventString);
+
+void pathStats_destruct(PathStats *pathStats);
+
+/*
+ * Writes the path stats as the pathStats XML.
+ */
+void pathStats_writeXML(PathStats *pathStats, FILE *fileHandle);
+
+/*
+ * The error sizes as the space separated string of the XML.
+ */
+char *pathStats_getErrorSizeDistribution(const int64_t *errorSizes, int64_t errorSizeNumber);
+
+/*
+ * A position of a substitution error: the offset in a haplotype segment, with the assembly base
+ * (base1) and the bases of the haplotypes (base2 and base3, N if the haplotype is missing).
+ */
+typedef struct _segmentHolder {
+    Segment *segment;
+    int64_t offset;
+    char base1;
+    char base2;
+    char base3;
+} SegmentHolder;
+
+/*
+ * The substitution counts of an assembly. The counts are those of the sampled blocks, which
+ * substitutionStats_extrapolate replaces with their estimates for all the blocks.
+ */
+typedef struct _substitutionStats {
+    int64_t totalSites;
+    double totalCorrect;
+    int64_t totalErrors;
+    int64_t totalCalls;
+
+    int64_t totalHeterozygous;
+    double totalCorrectInHeterozygous;
+    int64_t totalErrorsInHeterozygous;
+    int64_t totalCallsInHeterozygous;
+
+    int64_t totalCorrectHap1InHeterozygous;
+    int64_t totalCorrectHap2InHeterozygous;
+
+    int64_t totalInOneHaplotypeOnly;
+    double totalCorrectInOneHaplotype;
+    int64_t totalErrorsInOneHaplotype;
+    int64_t totalCallsInOneHaplotype;
+
+    /*
+     * The SegmentHolders of the errors, if keepErrorPositions was given. The segments are those
+     * of the context, so must only be read while it runs nothing else.
+     */
+    stList *indelPositions;
+    stList *hetPositions;
+
+    //The totals of the sampled blocks, if sampling, in the order of substitutionTotalNames.
+    double sampleFraction;
+    SampledTotal *sampledTotals;
+    //The memory of the positions.
+    Arena *arena;
+} SubstitutionStats;
+
+#define SUBSTITUTION_TOTAL_NUMBER 14
+
+/*
+ * The names of the totals, as in the substitutionStats XML.
+ */
+extern const char *substitutionTotalNames[SUBSTITUTION_TOTAL_NUMBER];
+
+/*
+ * Empty counts, for the sample fraction, to be added to (as when merging shards).
+ */
+SubstitutionStats *substitutionStats_construct(double sampleFraction);
+
+void substitutionStats_destruct(SubstitutionStats *substitutionStats);
+
+/*
+ * Gets and sets the totals of the counts, in the order of substitutionTotalNames.
+ */
+void substitutionStats_getTotals(const SubstitutionStats *substitutionStats, double *totals);
+
+void substitutionStats_setTotals(SubstitutionStats *substitutionStats, const double *totals);
+
+void substitutionStats_extrapolate(SubstitutionStats *substitutionStats);
+
+/*
+ * Writes the (extrapolated) counts as the substitutionStats XML, without the error positions.
+ */
+void substitutionStats_writeXML(SubstitutionStats *substitutionStats, FILE *fileHandle);
+
+/*
+ * The substitution counts of the assemblies, in a list in the order of the event strings, from
+ * one pass over the blocks.
+ */
+stList *assemblaMetrics_getSubstitutionStats(AssemblaContext *context, const AssemblaParameters *parameters,
+        stList *assemblyEventStrings);
+
+/*
+ * A copy number category, with the number of columns in it.
+ */
+typedef struct _copyNumberCategory {
+    int64_t maxHapNumber;
+    int64_t minHapNumber;
+    int64_t assemblyNumber;
+    int64_t columnCount;
+} CopyNumberCategory;
+
+/*
+ * The totals reported, each summed over the copy number categories.
+ */
+enum CopyNumberTotal {
+    TOTAL_COLUMNS,
+    TOTAL_BASES,
+    DEFICIENT_COLUMNS,
+    DEFICIENT_BASES,
+    DEFICIENT_COLUMNS_GREATER_THAN_ZERO,
+    DEFICIENT_BASES_GREATER_THAN_ZERO,
+    EXCESS_COLUMNS,
+    EXCESS_BASES,
+    COPY_NUMBER_TOTAL_NUMBER
+};
+
+/*
+ * The names of the totals, as in the copyNumberStats XML.
+ */
+extern const char *copyNumberTotalNames[COPY_NUMBER_TOTAL_NUMBER];
+
+/*
+ * The copy number categories of an assembly, with the totals of the sampled blocks if sampling.
+ */
+typedef struct _copyNumberStats {
+    stHash *categories; //Each category is both key and value.
+    double sampleFraction;
+    SampledTotal sampledTotals[COPY_NUMBER_TOTAL_NUMBER];
+    //The memory of the categories.
+    Arena *arena;
+} CopyNumberStats;
+
+/*
+ * Empty categories, for the sample fraction, to be added to (as when merging shards).
+ */
+CopyNumberStats *copyNumberStats_construct(double sampleFraction);
+
+void copyNumberStats_destruct(CopyNumberStats *copyNumberStats);
+
+/*
+ * Adds to the columns of a copy number category.
+ */
+void copyNumberStats_addColumnCount(CopyNumberStats *copyNumberStats, int64_t maxHapNumber, int64_t minHapNumber,
+        int64_t assemblyNumber, int64_t columnCount);
+
+/*
+ * The categories, sorted by haplotype and assembly copy number. The list does not own them.
+ */
+stList *copyNumberStats_getCategories(CopyNumberStats *copyNumberStats);
+
+/*
+ * The totals of the categories, in the order of copyNumberTotalNames, extrapolated if sampling.
+ */
+void copyNumberStats_getTotals(CopyNumberStats *copyNumberStats, int64_t *totals);
+
+/*
+ * The column count of a category, extrapolated if sampling.
+ */
+int64_t copyNumberStats_getColumnCount(CopyNumberStats *copyNumberStats, CopyNumberCategory *category);
+
+/*
+ * Writes the categories and totals as the copyNumberStats XML, of a run with the minimum block length.
+ */
+void copyNumberStats_writeXML(CopyNumberStats *copyNumberStats, int64_t minimumBlockLength, FILE *fileHandle);
+
+/*
+ * The copy number categories of the assemblies, in a list in the order of the event strings,
+ * from one pass over the blocks.
+ */
+stList *assemblaMetrics_getCopyNumberStats(AssemblaContext *context, const AssemblaParameters *parameters,
+        stList *assemblyEventStrings);
+
+#endif /* ASSEMBLA_METRICS_H_ */
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten (at) gmail.com) and Dent Earl (dearl (at) soe.ucsc.edu)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef CONTIG_PATH_TABLE_H_
+#define CONTIG_PATH_TABLE_H_
+
+#include "cactus.h"
+#include "sonLib.h"
+#include "adjacencyClassification.h"
+
+/*
+ * Flat tables of the contig paths of a run, in place of the hashes built by
+ * buildSegmentToContigPathHash, buildContigPathToContigPathLengthHash and
+ * getContigPathToScaffoldPathLengthsHash. Each segment in a path is given a
+ * segment ordinal, which is the same for both orientations of the segment, and each
+ * path a path ordinal, in the order the paths are added. Lengths are kept in
+ * int64 arrays indexed by path ordinal. The table also holds the scaffold path of each
+ * contig path (built with a union-find over the path ordinals, in place of
+ * getScaffoldPaths) and the cap codes of the segments, so it can be written to a file
+ * and mapped back by scripts that would otherwise recompute the paths.
+ */
+typedef struct _contigPathTable ContigPathTable;
+
+ContigPathTable *contigPathTable_construct(void);
+
+void contigPathTable_destruct(ContigPathTable *contigPathTable);
+
+/*
+ * Adds the contig paths (as returned by getContigPaths) of an assembly, with their
+ * lengths, the scaffold paths containing them and the cap codes of their segments.
+ */
+void contigPathTable_addContigPaths(ContigPathTable *contigPathTable, stList *contigPaths,
+        stList *haplotypeEventStrings, stList *contaminationEventStrings, CapCodeParameters *capCodeParameters);
+
+int64_t contigPathTable_getSegmentNumber(ContigPathTable *contigPathTable);
+
+int64_t contigPathTable_getPathNumber(ContigPathTable *contigPathTable);
+
+int64_t contigPathTable_getScaffoldNumber(ContigPathTable *contigPathTable);
+
+/*
+ * The ordinal of the segment (in either orientation), or -1 if it is not in a contig path.
+ */
+int64_t contigPathTable_getSegmentOrdinal(ContigPathTable *contigPathTable, Segment *segment);
+
+/*
+ * The ordinal of the path containing the segment (in either orientation), or -1 if none does.
+ */
+int64_t contigPathTable_getPath(ContigPathTable *contigPathTable, Segment *segment);
+
+int64_t contigPathTable_getSegmentPath(ContigPathTable *contigPathTable, int64_t segmentOrdinal);
+
+int64_t contigPathTable_getPathLength(ContigPathTable *contigPathTable, int64_t path);
+
+int64_t contigPathTable_getScaffoldPathLength(ContigPathTable *contigPathTable, int64_t path);
+
+/*
+ * The ordinal (from 0 to the scaffold number) of the scaffold path containing the path.
+ */
+int64_t contigPathTable_getScaffold(ContigPathTable *contigPathTable, int64_t path);
+
+/*
+ * The lengths of the paths, indexed by path ordinal, and the summed lengths of the paths in
+ * each scaffold path, indexed by scaffold ordinal. The arrays belong to the table.
+ */
+const int64_t *contigPathTable_getPathLengths(ContigPathTable *contigPathTable);
+
+const int64_t *contigPathTable_getScaffoldLengths(ContigPathTable *contigPathTable);
+
+/*
+ * Gets the codes (see getCapCode) of the 5' and 3' caps of the segment, in the orientation given,
+ * returning zero if the segment is not in a contig path.
+ */
+bool contigPathTable_getCapCodes(ContigPathTable *contigPathTable, Segment *segment, enum CapCode *_5CapCode,
+        enum CapCode *_3CapCode);
+
+/*
+ * Non-zero if the segment, which must be in a contig path, is in the orientation it has in its path.
+ */
+bool contigPathTable_hasPathOrientation(ContigPathTable *contigPathTable, Segment *segment);
+
+/*
+ * The code of the 5' or 3' cap of the segment with the given ordinal, in the orientation of the
+ * segment in its path, with the insert and delete lengths given by getCapCode.
+ */
+enum CapCode contigPathTable_getPathCapCode(ContigPathTable *contigPathTable, int64_t segmentOrdinal, bool _5End,
+        int64_t *insertLength, int64_t *deleteLength);
+
+/*
+ * Writes the table to a file, returning zero if it could not be written. The key, which should
+ * identify the inputs the table was built from, is stored in the file.
+ */
+bool contigPathTable_write(ContigPathTable *contigPathTable, const char *fileName, const char *key);
+
+/*
+ * Maps a table written by contigPathTable_write into memory, returning NULL if the file does not
+ * exist, is malformed or was written with a different key. The table can not be added to.
+ */
+ContigPathTable *contigPathTable_load(const char *fileName, const char *key);
+
+#endif /* CONTIG_PATH_TABLE_H_ */
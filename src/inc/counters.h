@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten (at) gmail.com) and Dent Earl (dearl (at) soe.ucsc.edu)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef COUNTERS_H_
+#define COUNTERS_H_
+
+#include <stdint.h>
+
+/*
+ * Counters of how often the hot paths of the scripts run, to see which branches and loops
+ * matter without a profiler. They are only compiled in if ASSEMBLA_COUNTERS is defined (build
+ * with make counters=1), otherwise COUNT and COUNT_INDEX are empty statements.
+ *
+ * Each thread counts into its own block of counters, so a count is a plain increment. When the
+ * process exits the blocks are summed and written as a JSON object, of the counters by name, to
+ * the file named by the ASSEMBLA_COUNTERS_FILE environment variable, or else to stderr.
+ *
+ * Each entry of the list is a name and a number of counters, the counters of a name with more
+ * than one being indexed by COUNT_INDEX (an index out of range counts in the last).
+ */
+#define ASSEMBLA_COUNTER_LIST(X) \
+    X(blocksVisited, 1) \
+    X(blocksNotSampled, 1) \
+    X(capCodes, 32) \
+    X(contigPathTableLookups, 1) \
+    X(contigPathTableProbes, 1) \
+    X(substitutionBlocks, 1) \
+    X(substitutionBlocksBelowMinimumLength, 1) \
+    X(substitutionBlocksWithDuplicateHaplotypes, 1) \
+    X(substitutionDuplicateAssemblySegments, 1) \
+    X(substitutionBlocksBelowMinimumIdentity, 1) \
+    X(copyNumberBlocks, 1) \
+    X(copyNumberBlocksBelowMinimumLength, 1) \
+    X(copyNumberCategories, 1) \
+    X(coveragePlotBlocks, 1) \
+    X(coveragePlotSpeciesLookups, 1)
+
+#ifdef ASSEMBLA_COUNTERS
+
+enum AssemblaCounter {
+#define ASSEMBLA_COUNTER_ENUM(name, number) COUNTER_##name, COUNTER_##name##_LAST = COUNTER_##name + (number) - 1,
+    ASSEMBLA_COUNTER_LIST(ASSEMBLA_COUNTER_ENUM)
+#undef ASSEMBLA_COUNTER_ENUM
+    COUNTER_NUMBER
+};
+
+/*
+ * The counters of the thread, NULL until the thread first counts.
+ */
+extern __thread int64_t *assemblaCounters;
+
+/*
+ * Allocates and registers the counters of the thread.
+ */
+int64_t *assemblaCounters_construct(void);
+
+static inline void assemblaCounters_increment(int64_t first, int64_t last, int64_t i) {
+    int64_t *counters = assemblaCounters != NULL ? assemblaCounters : assemblaCounters_construct();
+    counters[i >= 0 && first + i <= last ? first + i : last]++;
+}
+
+#define COUNT_INDEX(name, i) assemblaCounters_increment(COUNTER_##name, COUNTER_##name##_LAST, (i))
+
+#else
+
+#define COUNT_INDEX(name, i) ((void) 0)
+
+#endif
+
+#define COUNT(name) COUNT_INDEX(name, 0)
+
+#endif /* COUNTERS_H_ */
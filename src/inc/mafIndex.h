@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten (at) gmail.com) and Dent Earl (dearl (at) soe.ucsc.edu)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef MAF_INDEX_H_
+#define MAF_INDEX_H_
+
+#include "cactus.h"
+#include "sonLib.h"
+#include "mafWriter.h"
+
+/*
+ * An index from (sequence, start, end) ranges to the offsets of the MAF records
+ * (annotation lines and MAF block) containing them. Coordinates are zero based,
+ * half open and on the positive strand of the sequence, sequence names are as they
+ * appear in the MAF. Offsets are file offsets, or BGZF virtual offsets if the
+ * MAF is compressed.
+ */
+typedef struct _mafIndex MafIndex;
+
+/*
+ * Constructs an empty index, to be filled in as a MAF is written.
+ */
+MafIndex *mafIndex_construct(void);
+
+void mafIndex_destruct(MafIndex *mafIndex);
+
+/*
+ * Adds an entry for each sequence in the block, for a record starting at the given
+ * (uncompressed, see mafWriter_getOffset) offset.
+ */
+void mafIndex_addBlock(MafIndex *mafIndex, Block *block, int64_t offset);
+
+/*
+ * Writes the index to a file, once the writer has been closed. If the writer is NULL the
+ * offsets are written as they were added, for an index of some other uncompressed file.
+ */
+void mafIndex_write(MafIndex *mafIndex, MafWriter *mafWriter, const char *fileName);
+
+/*
+ * Loads (maps) an index written by mafIndex_write.
+ */
+MafIndex *mafIndex_read(const char *fileName);
+
+bool mafIndex_isCompressed(MafIndex *mafIndex);
+
+/*
+ * Returns the offsets of the records overlapping the given range, as a sorted list
+ * of stIntTuples without duplicates.
+ */
+stList *mafIndex_getOverlappingOffsets(MafIndex *mafIndex, const char *sequenceName, int64_t start, int64_t end);
+
+/*
+ * Parses a region string of the form "sequence:start-end" (zero based, half open)
+ * or "sequence" for the whole sequence. Returns non-zero if the string is valid.
+ */
+bool mafIndex_parseRegion(const char *region, char **sequenceName, int64_t *start, int64_t *end);
+
+/*
+ * Reads lines from a MAF, uncompressed or BGZF, starting from an offset from the index.
+ */
+typedef struct _mafReader MafReader;
+
+MafReader *mafReader_construct(const char *fileName, bool compressed);
+
+void mafReader_destruct(MafReader *mafReader);
+
+void mafReader_seek(MafReader *mafReader, int64_t offset);
+
+/*
+ * Appends the next line, including the newline, to the buffer. Returns zero at the
+ * end of the file.
+ */
+bool mafReader_getLine(MafReader *mafReader, MafBuffer *line);
+
+/*
+ * Appends the record (annotation lines and MAF block) starting at the given offset.
+ */
+void mafReader_getRecord(MafReader *mafReader, int64_t offset, MafBuffer *record);
+
+#endif /* MAF_INDEX_H_ */
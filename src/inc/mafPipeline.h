@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten (at) gmail.com) and Dent Earl (dearl (at) soe.ucsc.edu)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef MAF_PIPELINE_H_
+#define MAF_PIPELINE_H_
+
+#include "cactus.h"
+#include "sonLib.h"
+#include "mafWriter.h"
+#include "mafIndex.h"
+
+/*
+ * Formats MAF records (annotation lines followed by a MAF block) on a pool of worker
+ * threads, while a writer thread passes the finished records to a MafWriter (and
+ * MafIndex) in the order the blocks were added, so the output is identical to
+ * formatting them one at a time.
+ *
+ * Blocks are added from the calling thread, which also reads their instance strings,
+ * so the workers never read sequences from the cactus disk. The annotation function
+ * is called on the worker threads, so must only read cactus objects that are already
+ * loaded and shared state that is not modified while the pipeline runs.
+ */
+typedef struct _mafPipeline MafPipeline;
+
+/*
+ * With threadNumber <= 1 records are formatted and written in the calling thread.
+ * mafIndex may be NULL.
+ */
+MafPipeline *mafPipeline_construct(MafWriter *mafWriter, MafIndex *mafIndex, int64_t threadNumber,
+        void (*annotateBlock)(Block *block, MafBuffer *mafBuffer));
+
+/*
+ * Adds the next block, as it is to be printed.
+ */
+void mafPipeline_addBlock(MafPipeline *mafPipeline, Block *block);
+
+/*
+ * Waits until all the added blocks have been passed to the writer, then cleans up.
+ */
+void mafPipeline_destruct(MafPipeline *mafPipeline);
+
+#endif /* MAF_PIPELINE_H_ */
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten (at) gmail.com) and Dent Earl (dearl (at) soe.ucsc.edu)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef MAF_WRITER_H_
+#define MAF_WRITER_H_
+
+#include "cactus.h"
+#include "sonLib.h"
+#include "assemblaCommon.h"
+
+/*
+ * A growable character buffer that MAF text is formatted into.
+ */
+typedef struct _mafBuffer {
+    char *string;
+    int64_t length;
+    int64_t maxLength;
+} MafBuffer;
+
+MafBuffer *mafBuffer_construct(void);
+
+void mafBuffer_destruct(MafBuffer *mafBuffer);
+
+void mafBuffer_clear(MafBuffer *mafBuffer);
+
+void mafBuffer_append(MafBuffer *mafBuffer, const char *string, int64_t length);
+
+void mafBuffer_appendString(MafBuffer *mafBuffer, const char *string);
+
+void mafBuffer_appendChar(MafBuffer *mafBuffer, char c);
+
+/*
+ * Appends the bases of the view, reverse complementing them as they are copied if needed.
+ */
+void mafBuffer_appendSequenceView(MafBuffer *mafBuffer, const SequenceView *sequenceView);
+
+/*
+ * Appends the decimal representation of the integer, without going through printf.
+ */
+void mafBuffer_appendInt(MafBuffer *mafBuffer, int64_t i);
+
+/*
+ * Appends the name of the sequence as it appears in MAF "s" lines.
+ */
+void mafBuffer_appendSequenceName(MafBuffer *mafBuffer, Sequence *sequence);
+
+/*
+ * Appends the contents of the given stream, starting from its beginning.
+ */
+void mafBuffer_appendFile(MafBuffer *mafBuffer, FILE *fileHandle);
+
+/*
+ * Appends the MAF representation of the block, in the same format as getMAFBlock.
+ */
+void mafBuffer_appendBlock(MafBuffer *mafBuffer, Block *block);
+
+/*
+ * Returns non-zero if the block can be formatted by mafBuffer_appendBlockWithViews,
+ * else it must be formatted by getMAFBlock. The first time it is called the formatter
+ * is checked against getMAFBlock, if the two differ getMAFBlock is used for all blocks.
+ * One block does not cover every shape of block, so with verifyMaf every block is checked,
+ * and a difference is an error.
+ */
+bool mafBuffer_canFormatBlock(Block *block);
+
+/*
+ * The views of the instances of the block, in instance iterator order, with a NULL string
+ * for instances without a sequence. Free with free(). Getting the views is the only part of
+ * formatting a block that reads sequence data from the cactus disk.
+ */
+SequenceView *mafBuffer_getInstanceViews(Block *block);
+
+/*
+ * Appends the MAF representation of the block using prefetched instance views.
+ */
+void mafBuffer_appendBlockWithViews(MafBuffer *mafBuffer, Block *block, const SequenceView *instanceViews);
+
+void mafBuffer_appendBlockUsingGetMAFBlock(MafBuffer *mafBuffer, Block *block);
+
+/*
+ * BGZF blocks, see the SAM specification.
+ */
+#define BGZF_BLOCK_SIZE 0xff00
+#define BGZF_MAX_BLOCK_SIZE 0x10000
+#define BGZF_HEADER_SIZE 18
+#define BGZF_FOOTER_SIZE 8
+
+/*
+ * Writes MAF text to a file, either uncompressed or as a series of independently
+ * decompressible BGZF blocks (readable with gunzip/bgzip). With more than one thread
+ * the BGZF blocks are compressed concurrently but written in order.
+ */
+typedef struct _mafWriter MafWriter;
+
+MafWriter *mafWriter_construct(const char *fileName, bool compress, int64_t threadNumber);
+
+/*
+ * Flushes any remaining output, writes the BGZF end of file marker if compressing
+ * and closes the file. Called by mafWriter_destruct if not called before.
+ */
+void mafWriter_close(MafWriter *mafWriter);
+
+void mafWriter_destruct(MafWriter *mafWriter);
+
+/*
+ * The buffer to append the next record to.
+ */
+MafBuffer *mafWriter_getBuffer(MafWriter *mafWriter);
+
+/*
+ * Marks the end of a record (e.g. a MAF block) in the buffer, writing the buffer
+ * out if it has grown large enough.
+ */
+void mafWriter_endRecord(MafWriter *mafWriter);
+
+/*
+ * The offset in the uncompressed output of the next character appended to the buffer.
+ */
+int64_t mafWriter_getOffset(MafWriter *mafWriter);
+
+bool mafWriter_isCompressed(MafWriter *mafWriter);
+
+/*
+ * Converts an uncompressed offset to a file offset, or for BGZF output to a virtual
+ * offset (offset of the BGZF block << 16 | offset within the block). Only valid
+ * once the writer is closed.
+ */
+int64_t mafWriter_getVirtualOffset(MafWriter *mafWriter, int64_t offset);
+
+#endif /* MAF_WRITER_H_ */